@@ -24,6 +24,32 @@
 #include <fstream>
 #include <unordered_map>
 #include <iterator>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define AUDIOFILE_SSE2
+    #include <emmintrin.h>
+#endif
+#if defined(AUDIOFILE_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+    #define AUDIOFILE_SSSE3
+    #include <tmmintrin.h>
+#endif
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif defined(__ORBIS__)
+    #include <kernel.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 namespace AudioFile
 {
@@ -53,54 +79,237 @@ std::unordered_map <uint32_t, std::vector<uint8_t>> aiffSampleRateTable = {
 };
 
 //=============================================================
+// Other sample types (e.g. AudioFile<short>) go through double buffers and are converted from there
+namespace PcmConversion
+{
+    template <class T>
+    void decode (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, T* const* channels)
+    {
+        std::vector<std::vector<double>> buffers (numChannels, std::vector<double> (numFrames));
+        std::vector<double*> bufferChannels;
+        for (auto& buffer : buffers)
+            bufferChannels.push_back (buffer.data());
+
+        decode (source, format, bitDepth, numChannels, numFrames, bufferChannels.data());
+
+        for (int channel = 0; channel < numChannels; channel++)
+            for (size_t i = 0; i < numFrames; i++)
+                channels[channel][i] = (T) buffers[channel][i];
+    }
+
+    template <class T>
+    void encode (const T* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination)
+    {
+        std::vector<std::vector<double>> buffers (numChannels);
+        std::vector<const double*> bufferChannels;
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            buffers[channel].assign (channels[channel], channels[channel] + numFrames);
+            bufferChannels.push_back (buffers[channel].data());
+        }
+
+        encode (bufferChannels.data(), numChannels, numFrames, format, bitDepth, destination);
+    }
+}
+
+//=============================================================
+template <class T>
+ContiguousAudioBuffer<T>::ContiguousAudioBuffer()
+    : samples (nullptr), stride (0), numReservedChannels (0), numChannels (0), numSamples (0)
+{
+}
+
+//=============================================================
+template <class T>
+ContiguousAudioBuffer<T>::ContiguousAudioBuffer (const ContiguousAudioBuffer& other)
+    : ContiguousAudioBuffer()
+{
+    *this = other;
+}
+
+//=============================================================
+template <class T>
+ContiguousAudioBuffer<T>::ContiguousAudioBuffer (ContiguousAudioBuffer&& other)
+    : ContiguousAudioBuffer()
+{
+    *this = std::move (other);
+}
+
+//=============================================================
+template <class T>
+ContiguousAudioBuffer<T>& ContiguousAudioBuffer<T>::operator= (const ContiguousAudioBuffer& other)
+{
+    if (this != &other)
+    {
+        clear();
+        resize (other.numChannels, other.numSamples);
+
+        for (size_t channel = 0; channel < numChannels; channel++)
+            std::copy (other[channel].begin(), other[channel].end(), (*this)[channel].begin());
+    }
+
+    return *this;
+}
+
+//=============================================================
+template <class T>
+ContiguousAudioBuffer<T>& ContiguousAudioBuffer<T>::operator= (ContiguousAudioBuffer&& other)
+{
+    if (this != &other)
+    {
+        memory = std::move (other.memory);
+        samples = other.samples;
+        stride = other.stride;
+        numReservedChannels = other.numReservedChannels;
+        numChannels = other.numChannels;
+        numSamples = other.numSamples;
+
+        other.samples = nullptr;
+        other.stride = other.numReservedChannels = other.numChannels = other.numSamples = 0;
+    }
+
+    return *this;
+}
+
+//=============================================================
+template <class T>
+void ContiguousAudioBuffer<T>::resize (size_t newNumChannels, size_t newNumSamples)
+{
+    if (newNumChannels > numReservedChannels || newNumSamples > stride)
+        reallocate (std::max (newNumChannels, numReservedChannels), std::max (newNumSamples, stride));
+
+    // set any new samples and channels to zero, everything else stays where it is
+    for (size_t channel = 0; channel < newNumChannels; channel++)
+    {
+        T* channelData = samples + channel * stride;
+        const size_t numValidSamples = channel < numChannels ? std::min (numSamples, newNumSamples) : 0;
+        std::fill (channelData + numValidSamples, channelData + newNumSamples, (T)0.);
+    }
+
+    numChannels = newNumChannels;
+    numSamples = newNumSamples;
+}
+
+//=============================================================
+template <class T>
+void ContiguousAudioBuffer<T>::reserve (size_t numChannelsToReserve, size_t numSamplesToReserve)
+{
+    if (numChannelsToReserve > numReservedChannels || numSamplesToReserve > stride)
+        reallocate (std::max (numChannelsToReserve, numReservedChannels), std::max (numSamplesToReserve, stride));
+}
+
+//=============================================================
+template <class T>
+void ContiguousAudioBuffer<T>::clear()
+{
+    numChannels = 0;
+    numSamples = 0;
+}
+
+//=============================================================
+template <class T>
+void ContiguousAudioBuffer<T>::reallocate (size_t newNumReservedChannels, size_t newStride)
+{
+    // round the capacity of each channel up, so that every channel starts on an aligned address
+    const size_t samplesPerAlignment = std::max<size_t> (1, alignment / sizeof (T));
+    newStride = (newStride + samplesPerAlignment - 1) / samplesPerAlignment * samplesPerAlignment;
+
+    std::unique_ptr<uint8_t[]> newMemory (new uint8_t[newNumReservedChannels * newStride * sizeof (T) + alignment]);
+    const uintptr_t address = reinterpret_cast<uintptr_t> (newMemory.get());
+    T* newSamples = reinterpret_cast<T*> ((address + alignment - 1) / alignment * alignment);
+
+    for (size_t channel = 0; channel < numChannels; channel++)
+        std::copy (samples + channel * stride, samples + channel * stride + numSamples, newSamples + channel * newStride);
+
+    memory = std::move (newMemory);
+    samples = newSamples;
+    stride = newStride;
+    numReservedChannels = newNumReservedChannels;
+}
+
+template class ContiguousAudioBuffer<float>;
+template class ContiguousAudioBuffer<double>;
+template class ContiguousAudioBuffer<short>;
+
+//=============================================================
+// The storage of an AudioFile is sized and reserved through these, so that it can be either of the buffer types
+template <class T>
+static void resizeStorage (std::vector<std::vector<T>>& buffer, int numChannels, int numSamples)
+{
+    // new channels and samples are value-initialised, i.e. set to zero
+    buffer.resize (numChannels);
+    for (auto& channel : buffer)
+        channel.resize (numSamples);
+}
+
+template <class T>
+static void resizeStorage (ContiguousAudioBuffer<T>& buffer, int numChannels, int numSamples)
+{
+    buffer.resize ((size_t) numChannels, (size_t) numSamples);
+}
+
+template <class T>
+static void reserveStorage (std::vector<std::vector<T>>& buffer, int numChannels, int numSamples)
+{
+    buffer.reserve (numChannels);
+    for (auto& channel : buffer)
+        channel.reserve (numSamples);
+}
+
 template <class T>
-AudioFile<T>::AudioFile()
+static void reserveStorage (ContiguousAudioBuffer<T>& buffer, int numChannels, int numSamples)
+{
+    buffer.reserve ((size_t) numChannels, (size_t) numSamples);
+}
+
+//=============================================================
+template <class T, class Storage>
+AudioFile<T, Storage>::AudioFile()
 {
     bitDepth = 16;
     sampleRate = 44100;
-    samples.resize (1);
-    samples[0].resize (0);
+    resizeStorage (samples, 1, 0);
     audioFileFormat = AudioFileFormat::NotLoaded;
 }
 
 //=============================================================
-template <class T>
-uint32_t AudioFile<T>::getSampleRate() const
+template <class T, class Storage>
+uint32_t AudioFile<T, Storage>::getSampleRate() const
 {
     return sampleRate;
 }
 
 //=============================================================
-template <class T>
-int AudioFile<T>::getNumChannels() const
+template <class T, class Storage>
+int AudioFile<T, Storage>::getNumChannels() const
 {
     return (int)samples.size();
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::isMono() const
+template <class T, class Storage>
+bool AudioFile<T, Storage>::isMono() const
 {
     return getNumChannels() == 1;
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::isStereo() const
+template <class T, class Storage>
+bool AudioFile<T, Storage>::isStereo() const
 {
     return getNumChannels() == 2;
 }
 
 //=============================================================
-template <class T>
-int AudioFile<T>::getBitDepth() const
+template <class T, class Storage>
+int AudioFile<T, Storage>::getBitDepth() const
 {
     return bitDepth;
 }
 
 //=============================================================
-template <class T>
-int AudioFile<T>::getNumSamplesPerChannel() const
+template <class T, class Storage>
+int AudioFile<T, Storage>::getNumSamplesPerChannel() const
 {
     if (samples.size() > 0)
         return (int) samples[0].size();
@@ -109,15 +318,15 @@ int AudioFile<T>::getNumSamplesPerChannel() const
 }
 
 //=============================================================
-template <class T>
-double AudioFile<T>::getLengthInSeconds() const
+template <class T, class Storage>
+double AudioFile<T, Storage>::getLengthInSeconds() const
 {
     return (double)getNumSamplesPerChannel() / (double)sampleRate;
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::printSummary() const
+template <class T, class Storage>
+void AudioFile<T, Storage>::printSummary() const
 {
     std::cout << "|======================================|" << std::endl;
     std::cout << "Num Channels: " << getNumChannels() << std::endl;
@@ -129,8 +338,8 @@ void AudioFile<T>::printSummary() const
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::setAudioBuffer (AudioBuffer& newBuffer)
 {
     int numChannels = (int)newBuffer.size();
     
@@ -142,15 +351,13 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
     
     int numSamples = (int)newBuffer[0].size();
     
-    // set the number of channels
-    samples.resize (newBuffer.size());
+    // set the number of channels and samples
+    resizeStorage (samples, numChannels, numSamples);
     
     for (int k = 0; k < getNumChannels(); k++)
     {
         assert (newBuffer[k].size() == numSamples);
         
-        samples[k].resize (numSamples);
-        
         for (int i = 0; i < numSamples; i++)
         {
             samples[k][i] = newBuffer[k][i];
@@ -161,67 +368,58 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::setAudioBufferSize (int numChannels, int numSamples)
+template <class T, class Storage>
+void AudioFile<T, Storage>::setAudioBufferSize (int numChannels, int numSamples)
 {
-    samples.resize (numChannels);
-    setNumSamplesPerChannel (numSamples);
+    resizeStorage (samples, numChannels, numSamples);
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::setNumSamplesPerChannel (int numSamples)
+template <class T, class Storage>
+void AudioFile<T, Storage>::setNumSamplesPerChannel (int numSamples)
 {
-    int originalSize = getNumSamplesPerChannel();
-    
-    for (int i = 0; i < getNumChannels();i++)
-    {
-        samples[i].resize (numSamples);
-        
-        // set any new samples to zero
-        if (numSamples > originalSize)
-            std::fill (samples[i].begin() + originalSize, samples[i].end(), (T)0.);
-    }
+    resizeStorage (samples, getNumChannels(), numSamples);
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::setNumChannels (int numChannels)
+template <class T, class Storage>
+void AudioFile<T, Storage>::setNumChannels (int numChannels)
 {
-    int originalNumChannels = getNumChannels();
-    int originalNumSamplesPerChannel = getNumSamplesPerChannel();
-    
-    samples.resize (numChannels);
-    
-    // make sure any new channels are set to the right size
-    // and filled with zeros
-    if (numChannels > originalNumChannels)
-    {
-        for (int i = originalNumChannels; i < numChannels; i++)
-        {
-            samples[i].resize (originalNumSamplesPerChannel);
-            std::fill (samples[i].begin(), samples[i].end(), (T)0.);
-        }
-    }
+    // any new channels are set to the right size and filled with zeros
+    resizeStorage (samples, numChannels, getNumSamplesPerChannel());
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::setBitDepth (int numBitsPerSample)
+template <class T, class Storage>
+void AudioFile<T, Storage>::setBitDepth (int numBitsPerSample)
 {
     bitDepth = numBitsPerSample;
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::setSampleRate (uint32_t newSampleRate)
+template <class T, class Storage>
+void AudioFile<T, Storage>::setSampleRate (uint32_t newSampleRate)
 {
     sampleRate = newSampleRate;
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::load (std::string filePath)
+template <class T, class Storage>
+void AudioFile<T, Storage>::reserve (int numChannels, int numSamplesPerChannel)
+{
+    reserveStorage (samples, numChannels, numSamplesPerChannel);
+}
+
+//=============================================================
+template <class T, class Storage>
+void AudioFile<T, Storage>::reserveLength (int numChannels, double lengthInSeconds)
+{
+    reserve (numChannels, (int) std::ceil (lengthInSeconds * sampleRate));
+}
+
+//=============================================================
+template <class T, class Storage>
+bool AudioFile<T, Storage>::load (std::string filePath)
 {
     std::ifstream file (filePath, std::ios::binary);
     
@@ -248,6 +446,10 @@ bool AudioFile<T>::load (std::string filePath)
     {
         return decodeAiffFile (fileData);
     }
+    else if (audioFileFormat == AudioFileFormat::Flac)
+    {
+        return decodeFlacFile (fileData);
+    }
     else
     {
         std::cout << "Audio File Type: " << "Error" << std::endl;
@@ -256,8 +458,8 @@ bool AudioFile<T>::load (std::string filePath)
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::decodeWaveFile (std::vector<uint8_t>& fileData)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
@@ -272,7 +474,7 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE")
+    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || (headerChunkID != "RIFF" && headerChunkID != "RF64") || format != "WAVE")
     {
         std::cout << "ERROR: this doesn't seem to be a valid .WAV file" << std::endl;
         return false;
@@ -324,57 +526,37 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     // DATA CHUNK
     int d = indexOfDataChunk;
     std::string dataChunkID (fileData.begin() + d, fileData.begin() + d + 4);
-    int32_t dataChunkSize = fourBytesToInt (fileData, d + 4);
+    uint64_t dataChunkSize = (uint32_t) fourBytesToInt (fileData, d + 4);
+    
+    // [Johannes] RF64 files store the actual size in the ds64 chunk
+    if (headerChunkID == "RF64")
+    {
+        int indexOfDs64Chunk = getIndexOfString (fileData, "ds64");
+        if (indexOfDs64Chunk != -1 && indexOfDs64Chunk + 24 <= (int) fileData.size())
+            dataChunkSize = (uint32_t) fourBytesToInt (fileData, indexOfDs64Chunk + 16) | ((uint64_t) (uint32_t) fourBytesToInt (fileData, indexOfDs64Chunk + 20) << 32);
+    }
     
-    int numSamples = dataChunkSize / (numChannels * bitDepth / 8);
     int samplesStartIndex = indexOfDataChunk + 8;
     
+    // never read beyond the end of the file, e.g. if the data chunk size was never patched
+    const size_t numAvailableBytes = fileData.size() > (size_t) samplesStartIndex ? fileData.size() - samplesStartIndex : 0;
+    int numSamples = (int) std::min<uint64_t> (dataChunkSize / numBytesPerBlock, numAvailableBytes / numBytesPerBlock);
+    
     clearAudioBuffer();
-    samples.resize (numChannels);
+    setAudioBufferSize (numChannels, numSamples);
     
-    for (int i = 0; i < numSamples; i++)
-    {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerBlock * i) + channel * numBytesPerSample;
-            
-            if (bitDepth == 8)
-            {
-                int32_t sampleAsInt = (int32_t) fileData[sampleIndex];
-                T sample = (T)(sampleAsInt - 128) / (T)128.;
-                
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex + 2] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex];
-                
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
-    }
+    // [Johannes] All channels are sized up front and decoded in bulk, see PcmConversion.
+    std::vector<T*> channels;
+    for (int channel = 0; channel < getNumChannels(); channel++)
+        channels.push_back (samples[channel].data());
+    PcmConversion::decode (fileData.data() + samplesStartIndex, AudioFileFormat::Wave, bitDepth, numChannels, (size_t) numSamples, channels.data());
 
     return true;
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::decodeAiffFile (std::vector<uint8_t>& fileData)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
@@ -447,50 +629,70 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
     }
     
     clearAudioBuffer();
-    samples.resize (numChannels);
+    setAudioBufferSize (numChannels, numSamplesPerChannel);
+    
+    std::vector<T*> channels;
+    for (int channel = 0; channel < getNumChannels(); channel++)
+        channels.push_back (samples[channel].data());
+    PcmConversion::decode (fileData.data() + samplesStartIndex, AudioFileFormat::Aiff, bitDepth, numChannels, (size_t) numSamplesPerChannel, channels.data());
+    
+    return true;
+}
+
+//=============================================================
+// [Johannes] FLAC files are decoded frame by frame, see FlacDecoder.
+// Streams that were not finalised don't know their length, so the buffer grows as frames come in.
+template <class T, class Storage>
+bool AudioFile<T, Storage>::decodeFlacFile (std::vector<uint8_t>& fileData)
+{
+    FlacDecoder decoder;
+    
+    if (! decoder.open (fileData.data(), fileData.size()))
+    {
+        std::cout << "ERROR: this FLAC file is damaged or has a bit depth of more than 24 bits" << std::endl;
+        return false;
+    }
+    
+    sampleRate = decoder.getSampleRate();
+    bitDepth = decoder.getBitDepth();
+    const int numChannels = decoder.getNumChannels();
+    const uint64_t numSamplesInHeader = decoder.getNumSamplesPerChannel();
+    const double scale = 1. / (double) (1 << (bitDepth - 1));
+    
+    clearAudioBuffer();
+    setAudioBufferSize (numChannels, (int) numSamplesInHeader);
     
-    for (int i = 0; i < numSamplesPerChannel; i++)
+    int numSamplesPerChannel = 0;
+    while (const int numFrameSamples = decoder.readFrame())
     {
+        if (numSamplesPerChannel + numFrameSamples > getNumSamplesPerChannel())
+            setAudioBufferSize (numChannels, std::max (numSamplesPerChannel + numFrameSamples, 2 * getNumSamplesPerChannel()));
+        
         for (int channel = 0; channel < numChannels; channel++)
         {
-            int sampleIndex = samplesStartIndex + (numBytesPerFrame * i) + channel * numBytesPerSample;
-            
-            if (bitDepth == 8)
-            {
-                int8_t sampleAsSigned8Bit = (int8_t)fileData[sampleIndex];
-                T sample = (T)sampleAsSigned8Bit / (T)128.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex + 2];
-                
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-                
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
+            const int32_t* frameSamples = decoder.getFrameSamples (channel);
+            for (int i = 0; i < numFrameSamples; i++)
+                samples[channel][numSamplesPerChannel + i] = (T) (frameSamples[i] * scale);
         }
+        
+        numSamplesPerChannel += numFrameSamples;
+    }
+    
+    setAudioBufferSize (numChannels, numSamplesPerChannel);
+    
+    // sanity check the data
+    if (numSamplesInHeader != 0 && (uint64_t) numSamplesPerChannel != numSamplesInHeader)
+    {
+        std::cout << "ERROR: the FLAC file ends early or has a damaged frame" << std::endl;
+        return false;
     }
     
     return true;
 }
 
 //=============================================================
-template <class T>
-uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex)
+template <class T, class Storage>
+uint32_t AudioFile<T, Storage>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex)
 {
     for (auto it : aiffSampleRateTable)
     {
@@ -502,8 +704,8 @@ uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sa
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2)
 {
     for (int i = 0; i < 10; i++)
     {
@@ -515,8 +717,8 @@ bool AudioFile<T>::tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std:
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint32_t sampleRate)
+template <class T, class Storage>
+void AudioFile<T, Storage>::addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint32_t sampleRate)
 {
     if (aiffSampleRateTable.count (sampleRate) > 0)
     {
@@ -526,8 +728,8 @@ void AudioFile<T>::addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::save (std::string filePath, AudioFileFormat format)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::save (std::string filePath, AudioFileFormat format)
 {
     if (format == AudioFileFormat::Wave)
     {
@@ -537,88 +739,40 @@ bool AudioFile<T>::save (std::string filePath, AudioFileFormat format)
     {
         return saveToAiffFile (filePath);
     }
+    else if (format == AudioFileFormat::Flac)
+    {
+        return saveToFlacFile (filePath);
+    }
     
     return false;
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::saveToWaveFile (std::string filePath)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::saveToWaveFile (std::string filePath)
 {
     std::vector<uint8_t> fileData;
     
-    int32_t dataChunkSize = getNumSamplesPerChannel() * (getNumChannels() * bitDepth / 8);
-    
-    // -----------------------------------------------------------
-    // HEADER CHUNK
-    addStringToFileData (fileData, "RIFF");
-    
-    // The file size in bytes is the header chunk size (4, not counting RIFF and WAVE) + the format
-    // chunk size (24) + the metadata part of the data chunk plus the actual data chunk size
-    int32_t fileSizeInBytes = 4 + 24 + 8 + dataChunkSize;
-    addInt32ToFileData (fileData, fileSizeInBytes);
-    
-    addStringToFileData (fileData, "WAVE");
-    
-    // -----------------------------------------------------------
-    // FORMAT CHUNK
-    addStringToFileData (fileData, "fmt ");
-    addInt32ToFileData (fileData, 16); // format chunk size (16 for PCM)
-    addInt16ToFileData (fileData, 1); // audio format = 1
-    addInt16ToFileData (fileData, (int16_t)getNumChannels()); // num channels
-    addInt32ToFileData (fileData, (int32_t)sampleRate); // sample rate
-    
-    int32_t numBytesPerSecond = (int32_t) ((getNumChannels() * sampleRate * bitDepth) / 8);
-    addInt32ToFileData (fileData, numBytesPerSecond);
-    
-    int16_t numBytesPerBlock = getNumChannels() * (bitDepth / 8);
-    addInt16ToFileData (fileData, numBytesPerBlock);
-    
-    addInt16ToFileData (fileData, (int16_t)bitDepth);
-    
-    // -----------------------------------------------------------
-    // DATA CHUNK
-    addStringToFileData (fileData, "data");
-    addInt32ToFileData (fileData, dataChunkSize);
+    // [Johannes] The size is computed in 64 bits, larger files are written as RF64, see addWaveHeader.
+    uint64_t dataChunkSize = (uint64_t) getNumSamplesPerChannel() * (uint64_t) (getNumChannels() * bitDepth / 8);
+    addWaveHeader (fileData, dataChunkSize);
     
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24)
     {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                int32_t sampleAsInt = ((samples[channel][i] * (T)128.) + 128.);
-                uint8_t byte = (uint8_t)sampleAsInt;
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = (int16_t) (samples[channel][i] * (T)32768.);
-                addInt16ToFileData (fileData, sampleAsInt);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-                
-                uint8_t bytes[3];
-                bytes[2] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[0] = (uint8_t) sampleAsIntAgain & 0xFF;
-                
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
+        assert (false && "Trying to write a file with unsupported bit depth");
+        return false;
     }
     
+    // [Johannes] The sample data is encoded in bulk right behind the header, see PcmConversion.
+    const size_t headerSize = fileData.size();
+    fileData.resize (headerSize + (size_t) dataChunkSize);
+    std::vector<const T*> channels;
+    for (int channel = 0; channel < getNumChannels(); channel++)
+        channels.push_back (samples[channel].data());
+    PcmConversion::encode (channels.data(), getNumChannels(), (size_t) getNumSamplesPerChannel(), AudioFileFormat::Wave, bitDepth, fileData.data() + headerSize);
+    
     // check that the various sizes we put in the metadata are correct
-    if (fileSizeInBytes != (fileData.size() - 8) || dataChunkSize != (getNumSamplesPerChannel() * getNumChannels() * (bitDepth / 8)))
+    if (fileData.size() != headerSize + dataChunkSize)
     {
         std::cout << "ERROR: couldn't save file to " << filePath << std::endl;
         return false;
@@ -639,47 +793,16 @@ bool AudioFile<short>::saveToWaveFile(std::string filePath)
 {
 	std::vector<uint8_t> headerData;
 
-	int32_t dataChunkSize = getNumSamplesPerChannel() * (getNumChannels() * bitDepth / 8);
-
-	// -----------------------------------------------------------
-	// HEADER CHUNK
-	addStringToFileData(headerData, "RIFF");
-
-	// The file size in bytes is the header chunk size (4, not counting RIFF and WAVE) + the format
-	// chunk size (24) + the metadata part of the data chunk plus the actual data chunk size
-	int32_t fileSizeInBytes = 4 + 24 + 8 + dataChunkSize;
-	addInt32ToFileData(headerData, fileSizeInBytes);
-
-	addStringToFileData(headerData, "WAVE");
-
-	// -----------------------------------------------------------
-	// FORMAT CHUNK
-	addStringToFileData(headerData, "fmt ");
-	addInt32ToFileData(headerData, 16); // format chunk size (16 for PCM)
-	addInt16ToFileData(headerData, 1); // audio format = 1
-	addInt16ToFileData(headerData, (int16_t)getNumChannels()); // num channels
-	addInt32ToFileData(headerData, (int32_t)sampleRate); // sample rate
-
-	int32_t numBytesPerSecond = (int32_t)((getNumChannels() * sampleRate * bitDepth) / 8);
-	addInt32ToFileData(headerData, numBytesPerSecond);
-
-	int16_t numBytesPerBlock = getNumChannels() * (bitDepth / 8);
-	addInt16ToFileData(headerData, numBytesPerBlock);
-
-	addInt16ToFileData(headerData, (int16_t)bitDepth);
-
-	// -----------------------------------------------------------
-	// DATA CHUNK
-	addStringToFileData(headerData, "data");
-	addInt32ToFileData(headerData, dataChunkSize);
+	uint64_t dataChunkSize = (uint64_t)getNumSamplesPerChannel() * (uint64_t)(getNumChannels() * bitDepth / 8);
+	addWaveHeader(headerData, dataChunkSize);
 
 	// check that the various sizes we put in the metadata are correct
-	uint32_t totalDataSize = 0;
+	uint64_t totalDataSize = 0;
 	for (auto& channel : samples)
 	{
 		totalDataSize += channel.size() * sizeof(short);
 	}
-	if (fileSizeInBytes != (headerData.size() + totalDataSize - 8) || dataChunkSize != (getNumSamplesPerChannel() * getNumChannels() * (bitDepth / 8)))
+	if (totalDataSize != dataChunkSize)
 	{
 		std::cout << "ERROR: couldn't save file to " << filePath << std::endl;
 		return false;
@@ -695,11 +818,71 @@ bool AudioFile<short>::saveToWaveFile(std::string filePath)
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::saveToAiffFile (std::string filePath)
+template <class T, class Storage>
+void AudioFile<T, Storage>::addWaveHeader (std::vector<uint8_t>& fileData, uint64_t dataChunkSize)
 {
-    std::vector<uint8_t> fileData;
-    
+    // The file size in bytes is the header chunk size (4, not counting RIFF and WAVE) + the format
+    // chunk size (24) + the metadata part of the data chunk plus the actual data chunk size
+    uint64_t fileSizeInBytes = 4 + 24 + 8 + dataChunkSize;
+    
+    // [Johannes] Sizes that don't fit into 32 bits are stored in a ds64 chunk of an RF64 file instead (EBU Tech 3306)
+    const bool isRF64 = fileSizeInBytes > 0xFFFFFFFF;
+    
+    // -----------------------------------------------------------
+    // HEADER CHUNK
+    if (isRF64)
+    {
+        fileSizeInBytes += 36; // ds64 chunk
+        addStringToFileData (fileData, "RF64");
+        addInt32ToFileData (fileData, -1);
+        addStringToFileData (fileData, "WAVE");
+        
+        addStringToFileData (fileData, "ds64");
+        addInt32ToFileData (fileData, 28);
+        addInt32ToFileData (fileData, (int32_t) (fileSizeInBytes & 0xFFFFFFFF));
+        addInt32ToFileData (fileData, (int32_t) (fileSizeInBytes >> 32));
+        addInt32ToFileData (fileData, (int32_t) (dataChunkSize & 0xFFFFFFFF));
+        addInt32ToFileData (fileData, (int32_t) (dataChunkSize >> 32));
+        const uint64_t numSampleFrames = (uint64_t) getNumSamplesPerChannel();
+        addInt32ToFileData (fileData, (int32_t) (numSampleFrames & 0xFFFFFFFF));
+        addInt32ToFileData (fileData, (int32_t) (numSampleFrames >> 32));
+        addInt32ToFileData (fileData, 0); // table length
+    }
+    else
+    {
+        addStringToFileData (fileData, "RIFF");
+        addInt32ToFileData (fileData, (int32_t) fileSizeInBytes);
+        addStringToFileData (fileData, "WAVE");
+    }
+    
+    // -----------------------------------------------------------
+    // FORMAT CHUNK
+    addStringToFileData (fileData, "fmt ");
+    addInt32ToFileData (fileData, 16); // format chunk size (16 for PCM)
+    addInt16ToFileData (fileData, 1); // audio format = 1
+    addInt16ToFileData (fileData, (int16_t)getNumChannels()); // num channels
+    addInt32ToFileData (fileData, (int32_t)sampleRate); // sample rate
+    
+    int32_t numBytesPerSecond = (int32_t) ((getNumChannels() * sampleRate * bitDepth) / 8);
+    addInt32ToFileData (fileData, numBytesPerSecond);
+    
+    int16_t numBytesPerBlock = getNumChannels() * (bitDepth / 8);
+    addInt16ToFileData (fileData, numBytesPerBlock);
+    
+    addInt16ToFileData (fileData, (int16_t)bitDepth);
+    
+    // -----------------------------------------------------------
+    // DATA CHUNK
+    addStringToFileData (fileData, "data");
+    addInt32ToFileData (fileData, isRF64 ? -1 : (int32_t) dataChunkSize);
+}
+
+//=============================================================
+template <class T, class Storage>
+bool AudioFile<T, Storage>::saveToAiffFile (std::string filePath)
+{
+    std::vector<uint8_t> fileData;
+    
     int32_t numBytesPerSample = bitDepth / 8;
     int32_t numBytesPerFrame = numBytesPerSample * getNumChannels();
     int32_t totalNumAudioSampleBytes = getNumSamplesPerChannel() * numBytesPerFrame;
@@ -732,42 +915,19 @@ bool AudioFile<T>::saveToAiffFile (std::string filePath)
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // offset
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // block size
     
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24)
     {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                int32_t sampleAsInt = (int32_t)(samples[channel][i] * (T)128.);
-                uint8_t byte = (uint8_t)sampleAsInt;
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = (int16_t) (samples[channel][i] * (T)32768.);
-                addInt16ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-                
-                uint8_t bytes[3];
-                bytes[0] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[2] = (uint8_t) sampleAsIntAgain & 0xFF;
-                
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
+        assert (false && "Trying to write a file with unsupported bit depth");
+        return false;
     }
     
+    const size_t headerSize = fileData.size();
+    fileData.resize (headerSize + (size_t) totalNumAudioSampleBytes);
+    std::vector<const T*> channels;
+    for (int channel = 0; channel < getNumChannels(); channel++)
+        channels.push_back (samples[channel].data());
+    PcmConversion::encode (channels.data(), getNumChannels(), (size_t) getNumSamplesPerChannel(), AudioFileFormat::Aiff, bitDepth, fileData.data() + headerSize);
+    
     // check that the various sizes we put in the metadata are correct
     if (fileSizeInBytes != (fileData.size() - 8) || soundDataChunkSize != getNumSamplesPerChannel() *  numBytesPerFrame + 8)
     {
@@ -780,19 +940,63 @@ bool AudioFile<T>::saveToAiffFile (std::string filePath)
 }
 
 //=============================================================
-template <class T>
-bool AudioFile<T>::writeDataToFile (std::vector<uint8_t>& fileData, std::string filePath)
+template <class T, class Storage>
+bool AudioFile<T, Storage>::saveToFlacFile (std::string filePath)
+{
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24)
+    {
+        assert (false && "Trying to write a file with unsupported bit depth");
+        return false;
+    }
+    
+    FlacEncoder encoder;
+    if (! encoder.setup (getNumChannels(), sampleRate, bitDepth))
+    {
+        std::cout << "ERROR: couldn't save file to " << filePath << std::endl;
+        return false;
+    }
+    
+    // [Johannes] The samples are encoded to wave data one block at a time and compressed from there.
+    // The header is added last, when the number of samples and the frame sizes are known.
+    const size_t numFramesPerBlock = FlacEncoder::defaultBlockSize;
+    const size_t numSamplesPerChannel = (size_t) getNumSamplesPerChannel();
+    std::vector<uint8_t> waveData (numFramesPerBlock * getNumChannels() * bitDepth / 8);
+    std::vector<uint8_t> frameData;
+    std::vector<const T*> channels (getNumChannels());
+    
+    for (size_t start = 0; start < numSamplesPerChannel; start += numFramesPerBlock)
+    {
+        const size_t numFrames = std::min (numFramesPerBlock, numSamplesPerChannel - start);
+        for (int channel = 0; channel < getNumChannels(); channel++)
+            channels[channel] = samples[channel].data() + start;
+        
+        PcmConversion::encode (channels.data(), getNumChannels(), numFrames, AudioFileFormat::Wave, bitDepth, waveData.data());
+        encoder.process (waveData.data(), numFrames, frameData);
+    }
+    encoder.flush (frameData);
+    
+    std::vector<uint8_t> fileData;
+    encoder.createHeader (fileData);
+    fileData.insert (fileData.end(), frameData.begin(), frameData.end());
+    
+    // [Johannes] Written directly, as writeDataToFile appends the raw samples for AudioFile<short>.
+    std::ofstream outputFile (filePath, std::ios::binary);
+    if (! outputFile.is_open())
+        return false;
+    
+    outputFile.write (reinterpret_cast<const char*> (fileData.data()), fileData.size());
+    return outputFile.good();
+}
+
+//=============================================================
+template <class T, class Storage>
+bool AudioFile<T, Storage>::writeDataToFile (std::vector<uint8_t>& fileData, std::string filePath)
 {
     std::ofstream outputFile (filePath, std::ios::binary);
     
     if (outputFile.is_open())
     {
-        for (int i = 0; i < fileData.size(); i++)
-        {
-            char value = (char) fileData[i];
-            outputFile.write (&value, sizeof (char));
-        }
-        
+        outputFile.write (reinterpret_cast<const char*> (fileData.data()), fileData.size());
         outputFile.close();
         
         return true;
@@ -808,18 +1012,16 @@ bool AudioFile<short>::writeDataToFile(std::vector<uint8_t>& headerData, std::st
 
 	if (outputFile.is_open())
 	{
-		for (int i = 0; i < headerData.size(); i++)
-		{
-			char value = (char)headerData[i];
-			outputFile.write(&value, sizeof(char));
-		}
-		for (int i = 0; i < getNumSamplesPerChannel(); i++)
+		// [Johannes] Interleave all channels into one buffer, so the data is written at once instead of sample by sample.
+		std::vector<const int16_t*> channels;
+		for (auto& channel : samples)
 		{
-			for (int channel = 0; channel < getNumChannels(); channel++)
-			{
-				outputFile.write(reinterpret_cast<char*>(&samples[channel][i]), sizeof(short));
-			}
+			channels.push_back(channel.data());
 		}
+		std::vector<int16_t> interleaved((size_t)getNumSamplesPerChannel() * getNumChannels());
+		PcmConversion::interleave(channels.data(), getNumChannels(), (size_t)getNumSamplesPerChannel(), interleaved.data());
+		outputFile.write(reinterpret_cast<const char*>(headerData.data()), headerData.size());
+		outputFile.write(reinterpret_cast<const char*>(interleaved.data()), interleaved.size() * sizeof(int16_t));
 		outputFile.close();
 
 		return true;
@@ -829,16 +1031,16 @@ bool AudioFile<short>::writeDataToFile(std::vector<uint8_t>& headerData, std::st
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::addStringToFileData (std::vector<uint8_t>& fileData, std::string s)
+template <class T, class Storage>
+void AudioFile<T, Storage>::addStringToFileData (std::vector<uint8_t>& fileData, std::string s)
 {
     for (int i = 0; i < s.length();i++)
         fileData.push_back ((uint8_t) s[i]);
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::addInt32ToFileData (std::vector<uint8_t>& fileData, int32_t i, Endianness endianness)
+template <class T, class Storage>
+void AudioFile<T, Storage>::addInt32ToFileData (std::vector<uint8_t>& fileData, int32_t i, Endianness endianness)
 {
     uint8_t bytes[4];
     
@@ -862,8 +1064,8 @@ void AudioFile<T>::addInt32ToFileData (std::vector<uint8_t>& fileData, int32_t i
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i, Endianness endianness)
+template <class T, class Storage>
+void AudioFile<T, Storage>::addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i, Endianness endianness)
 {
     uint8_t bytes[2];
     
@@ -883,34 +1085,31 @@ void AudioFile<T>::addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i
 }
 
 //=============================================================
-template <class T>
-void AudioFile<T>::clearAudioBuffer()
+template <class T, class Storage>
+void AudioFile<T, Storage>::clearAudioBuffer()
 {
-    for (int i = 0; i < samples.size();i++)
-    {
-        samples[i].clear();
-    }
-    
-    samples.clear();
+    resizeStorage (samples, 0, 0);
 }
 
 //=============================================================
-template <class T>
-AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fileData)
+template <class T, class Storage>
+AudioFileFormat AudioFile<T, Storage>::determineAudioFileFormat (std::vector<uint8_t>& fileData)
 {
     std::string header (fileData.begin(), fileData.begin() + 4);
     
-    if (header == "RIFF")
+    if (header == "RIFF" || header == "RF64")
         return AudioFileFormat::Wave;
     else if (header == "FORM")
         return AudioFileFormat::Aiff;
+    else if (header == "fLaC")
+        return AudioFileFormat::Flac;
     else
         return AudioFileFormat::Error;
 }
 
 //=============================================================
-template <class T>
-int32_t AudioFile<T>::fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+template <class T, class Storage>
+int32_t AudioFile<T, Storage>::fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
 {
     int32_t result;
     
@@ -923,8 +1122,8 @@ int32_t AudioFile<T>::fourBytesToInt (std::vector<uint8_t>& source, int startInd
 }
 
 //=============================================================
-template <class T>
-int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+template <class T, class Storage>
+int16_t AudioFile<T, Storage>::twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
 {
     int16_t result;
     
@@ -937,8 +1136,8 @@ int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startInde
 }
 
 //=============================================================
-template <class T>
-int AudioFile<T>::getIndexOfString (std::vector<uint8_t>& source, std::string stringToSearchFor)
+template <class T, class Storage>
+int AudioFile<T, Storage>::getIndexOfString (std::vector<uint8_t>& source, std::string stringToSearchFor)
 {
     int index = -1;
     int stringLength = (int)stringToSearchFor.length();
@@ -958,8 +1157,8 @@ int AudioFile<T>::getIndexOfString (std::vector<uint8_t>& source, std::string st
 }
 
 //=============================================================
-template <class T>
-T AudioFile<T>::sixteenBitIntToSample (int16_t sample)
+template <class T, class Storage>
+T AudioFile<T, Storage>::sixteenBitIntToSample (int16_t sample)
 {
     return (T)sample / (T)32768.;
 }
@@ -967,5 +1166,3002 @@ T AudioFile<T>::sixteenBitIntToSample (int16_t sample)
 //===========================================================
 template class AudioFile<float>;
 template class AudioFile<double>;
+template class AudioFile<float, ContiguousAudioBuffer<float>>;
+template class AudioFile<double, ContiguousAudioBuffer<double>>;
+
+//=============================================================
+namespace WaveStream
+{
+    //=============================================================
+    static void addUInt32 (std::vector<uint8_t>& fileData, uint32_t i)
+    {
+        for (int b = 0; b < 4; b++)
+            fileData.push_back ((uint8_t) ((i >> (b * 8)) & 0xFF));
+    }
+    
+    //=============================================================
+    static void addUInt16 (std::vector<uint8_t>& fileData, uint16_t i)
+    {
+        fileData.push_back ((uint8_t) (i & 0xFF));
+        fileData.push_back ((uint8_t) ((i >> 8) & 0xFF));
+    }
+    
+    //=============================================================
+    static void addUInt64 (std::vector<uint8_t>& fileData, uint64_t i)
+    {
+        addUInt32 (fileData, (uint32_t) (i & 0xFFFFFFFF));
+        addUInt32 (fileData, (uint32_t) (i >> 32));
+    }
+    
+    //=============================================================
+    // The body of a ds64 chunk: RIFF size, data size and sample count with 64 bits each plus the length of an empty table
+    static const uint32_t ds64ChunkSize = 28;
+    
+    //=============================================================
+    size_t createHeader (std::vector<uint8_t>& fileData, int numChannels, uint32_t sampleRate, int bitDepth)
+    {
+        const size_t headerStart = fileData.size();
+        const uint16_t numBytesPerBlock = (uint16_t) (numChannels * (bitDepth / 8));
+        
+        // -----------------------------------------------------------
+        // HEADER CHUNK (the size is patched in finalise)
+        fileData.insert (fileData.end(), { 'R', 'I', 'F', 'F' });
+        addUInt32 (fileData, 0);
+        fileData.insert (fileData.end(), { 'W', 'A', 'V', 'E' });
+        
+        // -----------------------------------------------------------
+        // JUNK CHUNK (reserves room for a ds64 chunk, which finalise writes in its place if the file turns out to be too large for RIFF)
+        fileData.insert (fileData.end(), { 'J', 'U', 'N', 'K' });
+        addUInt32 (fileData, ds64ChunkSize);
+        fileData.insert (fileData.end(), ds64ChunkSize, 0);
+        
+        // -----------------------------------------------------------
+        // FORMAT CHUNK
+        fileData.insert (fileData.end(), { 'f', 'm', 't', ' ' });
+        addUInt32 (fileData, 16); // format chunk size (16 for PCM)
+        addUInt16 (fileData, 1); // audio format = 1
+        addUInt16 (fileData, (uint16_t) numChannels);
+        addUInt32 (fileData, sampleRate);
+        addUInt32 (fileData, sampleRate * numBytesPerBlock);
+        addUInt16 (fileData, numBytesPerBlock);
+        addUInt16 (fileData, (uint16_t) bitDepth);
+        
+        // -----------------------------------------------------------
+        // DATA CHUNK (the size is patched in finalise)
+        fileData.insert (fileData.end(), { 'd', 'a', 't', 'a' });
+        addUInt32 (fileData, 0);
+        
+        return fileData.size() - headerStart;
+    }
+    
+    //=============================================================
+    bool finalise (std::string filePath)
+    {
+        std::fstream file (filePath, std::ios::in | std::ios::out | std::ios::binary);
+        if (! file.is_open())
+            return false;
+        
+        file.seekg (0, std::ios::end);
+        const uint64_t fileLength = (uint64_t) file.tellg();
+        
+        // Only look at the beginning of the file, the data chunk follows the format chunk
+        std::vector<uint8_t> header ((size_t) std::min<uint64_t> (fileLength, 256));
+        file.seekg (0, std::ios::beg);
+        file.read (reinterpret_cast<char*> (header.data()), header.size());
+        
+        if (header.size() < 12 || (std::memcmp (header.data(), "RIFF", 4) != 0 && std::memcmp (header.data(), "RF64", 4) != 0))
+            return false;
+        
+        // Walk the chunks up to the data chunk, remembering the one reserved for ds64 and the block size
+        size_t reservedChunkIndex = 0;
+        size_t dataChunkIndex = 0;
+        uint64_t numBytesPerBlock = 0;
+        for (size_t i = 12; i + 8 <= header.size(); )
+        {
+            const uint8_t* chunk = header.data() + i;
+            const uint32_t chunkSize = (uint32_t) chunk[4] | ((uint32_t) chunk[5] << 8) | ((uint32_t) chunk[6] << 16) | ((uint32_t) chunk[7] << 24);
+            
+            if ((std::memcmp (chunk, "JUNK", 4) == 0 || std::memcmp (chunk, "ds64", 4) == 0) && chunkSize >= ds64ChunkSize)
+                reservedChunkIndex = i;
+            else if (std::memcmp (chunk, "fmt ", 4) == 0 && i + 22 <= header.size())
+                numBytesPerBlock = (uint64_t) chunk[20] | ((uint64_t) chunk[21] << 8);
+            else if (std::memcmp (chunk, "data", 4) == 0)
+            {
+                dataChunkIndex = i;
+                break;
+            }
+            
+            i += 8 + (size_t) chunkSize + (chunkSize & 1);
+        }
+        if (dataChunkIndex == 0)
+            return false;
+        
+        const uint64_t dataStart = dataChunkIndex + 8;
+        const uint64_t dataSize = fileLength - dataStart;
+        const uint64_t riffSize = fileLength - 8;
+        
+        // Only the size fields (and the IDs of the header and reserved chunk) are rewritten, never any data
+        std::vector<uint8_t> headerPatch;
+        std::vector<uint8_t> reservedChunkPatch;
+        uint32_t dataSizeField = 0;
+        
+        if (riffSize > 0xFFFFFFFF && reservedChunkIndex != 0)
+        {
+            // Too large for RIFF, so this becomes an RF64 file with the sizes in the ds64 chunk
+            headerPatch = { 'R', 'F', '6', '4' };
+            addUInt32 (headerPatch, 0xFFFFFFFF);
+            reservedChunkPatch = { 'd', 's', '6', '4' };
+            addUInt32 (reservedChunkPatch, ds64ChunkSize);
+            addUInt64 (reservedChunkPatch, riffSize);
+            addUInt64 (reservedChunkPatch, dataSize);
+            addUInt64 (reservedChunkPatch, numBytesPerBlock > 0 ? dataSize / numBytesPerBlock : 0);
+            addUInt32 (reservedChunkPatch, 0); // table length
+            dataSizeField = 0xFFFFFFFF;
+        }
+        else
+        {
+            // Files without a reserved chunk can't switch to RF64, so their sizes are clamped
+            headerPatch = { 'R', 'I', 'F', 'F' };
+            addUInt32 (headerPatch, (uint32_t) std::min<uint64_t> (riffSize, 0xFFFFFFFF));
+            if (reservedChunkIndex != 0)
+            {
+                reservedChunkPatch = { 'J', 'U', 'N', 'K' };
+                addUInt32 (reservedChunkPatch, ds64ChunkSize);
+                reservedChunkPatch.insert (reservedChunkPatch.end(), ds64ChunkSize, 0);
+            }
+            dataSizeField = (uint32_t) std::min<uint64_t> (dataSize, 0xFFFFFFFF);
+        }
+        
+        std::vector<uint8_t> dataSizePatch;
+        addUInt32 (dataSizePatch, dataSizeField);
+        
+        file.seekp (0, std::ios::beg);
+        file.write (reinterpret_cast<const char*> (headerPatch.data()), headerPatch.size());
+        if (! reservedChunkPatch.empty())
+        {
+            file.seekp ((std::streamoff) reservedChunkIndex, std::ios::beg);
+            file.write (reinterpret_cast<const char*> (reservedChunkPatch.data()), reservedChunkPatch.size());
+        }
+        file.seekp ((std::streamoff) dataChunkIndex + 4, std::ios::beg);
+        file.write (reinterpret_cast<const char*> (dataSizePatch.data()), dataSizePatch.size());
+        
+        return file.good();
+    }
+}
+
+//=============================================================
+namespace PcmConversion
+{
+    //=============================================================
+    // Frames are converted in blocks of interleaved samples that stay in the cache,
+    // then (de-)interleaved, so the conversions themselves don't depend on the channel count
+    static const size_t blockSize = 1024;
+    
+    //=============================================================
+    // The value range of each bit depth, samples are clipped to it when encoding
+    template <class T>
+    static T clip (T value, T minimum, T maximum)
+    {
+        // NaN ends up at the minimum, just like with the SIMD min and max instructions
+        if (! (value > minimum))
+            return minimum;
+        return value < maximum ? value : maximum;
+    }
+    
+    //=============================================================
+    template <class T>
+    static void decodeSamples (const uint8_t* source, bool isWave, int bitDepth, size_t numSamples, T* destination)
+    {
+        if (bitDepth == 8)
+        {
+            if (isWave)
+            {
+                for (size_t i = 0; i < numSamples; i++)
+                    destination[i] = (T)((int32_t) source[i] - 128) / (T)128.;
+            }
+            else
+            {
+                for (size_t i = 0; i < numSamples; i++)
+                    destination[i] = (T)(int8_t) source[i] / (T)128.;
+            }
+        }
+        else if (bitDepth == 16)
+        {
+            const int high = isWave ? 1 : 0;
+            for (size_t i = 0; i < numSamples; i++, source += 2)
+                destination[i] = (T)(int16_t) ((source[high] << 8) | source[1 - high]) / (T)32768.;
+        }
+        else if (bitDepth == 24)
+        {
+            const int high = isWave ? 2 : 0;
+            for (size_t i = 0; i < numSamples; i++, source += 3)
+            {
+                int32_t sampleAsInt = (source[high] << 16) | (source[1] << 8) | source[2 - high];
+                
+                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
+                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
+                
+                destination[i] = (T)sampleAsInt / (T)8388608.;
+            }
+        }
+        else
+        {
+            assert (false);
+        }
+    }
+    
+    //=============================================================
+    template <class T>
+    static void encodeSamples (const T* source, bool isWave, int bitDepth, size_t numSamples, uint8_t* destination)
+    {
+        if (bitDepth == 8)
+        {
+            if (isWave)
+            {
+                // The original code truncated (sample * 128 + 128), which is the same as flooring the scaled sample
+                for (size_t i = 0; i < numSamples; i++)
+                    destination[i] = (uint8_t) ((int32_t) std::floor (clip (source[i] * (T)128., (T)-128., (T)127.)) + 128);
+            }
+            else
+            {
+                for (size_t i = 0; i < numSamples; i++)
+                    destination[i] = (uint8_t) (int32_t) clip (source[i] * (T)128., (T)-128., (T)127.);
+            }
+        }
+        else if (bitDepth == 16)
+        {
+            const int high = isWave ? 1 : 0;
+            for (size_t i = 0; i < numSamples; i++, destination += 2)
+            {
+                const int32_t sampleAsInt = (int32_t) clip (source[i] * (T)32768., (T)-32768., (T)32767.);
+                destination[high] = (uint8_t) (sampleAsInt >> 8);
+                destination[1 - high] = (uint8_t) sampleAsInt;
+            }
+        }
+        else if (bitDepth == 24)
+        {
+            const int high = isWave ? 2 : 0;
+            for (size_t i = 0; i < numSamples; i++, destination += 3)
+            {
+                const int32_t sampleAsInt = (int32_t) clip (source[i] * (T)8388608., (T)-8388608., (T)8388607.);
+                destination[high] = (uint8_t) (sampleAsInt >> 16);
+                destination[1] = (uint8_t) (sampleAsInt >> 8);
+                destination[2 - high] = (uint8_t) sampleAsInt;
+            }
+        }
+        else
+        {
+            assert (false && "Trying to write a file with unsupported bit depth");
+        }
+    }
+    
+    //=============================================================
+    template <class T>
+    static void deinterleave (const T* source, int numChannels, size_t numFrames, T* const* channels, size_t firstFrame)
+    {
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            T* destination = channels[channel] + firstFrame;
+            for (size_t i = 0; i < numFrames; i++)
+                destination[i] = source[i * numChannels + channel];
+        }
+    }
+    
+    //=============================================================
+    template <class T>
+    static void interleaveSamples (const T* const* channels, int numChannels, size_t numFrames, size_t firstFrame, T* destination)
+    {
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            const T* source = channels[channel] + firstFrame;
+            for (size_t i = 0; i < numFrames; i++)
+                destination[i * numChannels + channel] = source[i];
+        }
+    }
+    
+#if defined(AUDIOFILE_SSE2)
+    //=============================================================
+    // Sign extends eight 16 bit integers and converts them to scaled floats
+    static inline void storeScaled16 (__m128i value, __m128 scale, float* destination)
+    {
+        const __m128i low = _mm_srai_epi32 (_mm_unpacklo_epi16 (value, value), 16);
+        const __m128i high = _mm_srai_epi32 (_mm_unpackhi_epi16 (value, value), 16);
+        _mm_storeu_ps (destination, _mm_mul_ps (_mm_cvtepi32_ps (low), scale));
+        _mm_storeu_ps (destination + 4, _mm_mul_ps (_mm_cvtepi32_ps (high), scale));
+    }
+    
+    //=============================================================
+    // Scales and clips four floats and truncates them to integers
+    static inline __m128i scaledToInt (const float* source, __m128 scale, __m128 minimum, __m128 maximum)
+    {
+        const __m128 scaled = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (source), scale), minimum), maximum);
+        return _mm_cvttps_epi32 (scaled);
+    }
+    
+    //=============================================================
+    // Scales and clips four floats and rounds them down to integers, which SSE2 can't do directly
+    static inline __m128i scaledToIntFloor (const float* source, __m128 scale, __m128 minimum, __m128 maximum)
+    {
+        const __m128 scaled = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (source), scale), minimum), maximum);
+        const __m128i truncated = _mm_cvttps_epi32 (scaled);
+        // truncation rounds negative values up, subtract one wherever that happened
+        return _mm_add_epi32 (truncated, _mm_castps_si128 (_mm_cmpgt_ps (_mm_cvtepi32_ps (truncated), scaled)));
+    }
+    
+    //=============================================================
+    static inline __m128i swapBytes16 (__m128i value)
+    {
+        return _mm_or_si128 (_mm_slli_epi16 (value, 8), _mm_srli_epi16 (value, 8));
+    }
+#endif
+    
+    //=============================================================
+    static void decodeSamples (const uint8_t* source, bool isWave, int bitDepth, size_t numSamples, float* destination)
+    {
+        size_t i = 0;
+        
+#if defined(AUDIOFILE_SSE2)
+        if (bitDepth == 8)
+        {
+            const __m128 scale = _mm_set1_ps (1.f / 128.f);
+            for (; i + 16 <= numSamples; i += 16)
+            {
+                const __m128i bytes = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i));
+                __m128i low, high;
+                if (isWave)
+                {
+                    const __m128i offset = _mm_set1_epi16 (128);
+                    low = _mm_sub_epi16 (_mm_unpacklo_epi8 (bytes, _mm_setzero_si128()), offset);
+                    high = _mm_sub_epi16 (_mm_unpackhi_epi8 (bytes, _mm_setzero_si128()), offset);
+                }
+                else
+                {
+                    low = _mm_srai_epi16 (_mm_unpacklo_epi8 (bytes, bytes), 8);
+                    high = _mm_srai_epi16 (_mm_unpackhi_epi8 (bytes, bytes), 8);
+                }
+                storeScaled16 (low, scale, destination + i);
+                storeScaled16 (high, scale, destination + i + 8);
+            }
+        }
+        else if (bitDepth == 16)
+        {
+            const __m128 scale = _mm_set1_ps (1.f / 32768.f);
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m128i value = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i * 2));
+                if (! isWave)
+                    value = swapBytes16 (value);
+                storeScaled16 (value, scale, destination + i);
+            }
+        }
+#if defined(AUDIOFILE_SSSE3)
+        else if (bitDepth == 24)
+        {
+            // Move the three bytes of each sample to the top of a 32 bit lane, then shift them back down with sign extension.
+            // Each step reads 16 bytes for 12 bytes of samples, so the last samples are left to the scalar loop.
+            const __m128 scale = _mm_set1_ps (1.f / 8388608.f);
+            const __m128i order = isWave ? _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11)
+                                         : _mm_setr_epi8 (-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9);
+            for (; (i + 4) * 3 + 4 <= numSamples * 3; i += 4)
+            {
+                const __m128i bytes = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i * 3));
+                const __m128i value = _mm_srai_epi32 (_mm_shuffle_epi8 (bytes, order), 8);
+                _mm_storeu_ps (destination + i, _mm_mul_ps (_mm_cvtepi32_ps (value), scale));
+            }
+        }
+#endif
+#endif
+        
+        decodeSamples<float> (source + i * (bitDepth / 8), isWave, bitDepth, numSamples - i, destination + i);
+    }
+    
+    //=============================================================
+    static void encodeSamples (const float* source, bool isWave, int bitDepth, size_t numSamples, uint8_t* destination)
+    {
+        size_t i = 0;
+        
+#if defined(AUDIOFILE_SSE2)
+        if (bitDepth == 8)
+        {
+            const __m128 scale = _mm_set1_ps (128.f);
+            const __m128 minimum = _mm_set1_ps (-128.f);
+            const __m128 maximum = _mm_set1_ps (127.f);
+            for (; i + 16 <= numSamples; i += 16)
+            {
+                __m128i low, high;
+                if (isWave)
+                {
+                    const __m128i offset = _mm_set1_epi16 (128);
+                    low = _mm_add_epi16 (_mm_packs_epi32 (scaledToIntFloor (source + i, scale, minimum, maximum), scaledToIntFloor (source + i + 4, scale, minimum, maximum)), offset);
+                    high = _mm_add_epi16 (_mm_packs_epi32 (scaledToIntFloor (source + i + 8, scale, minimum, maximum), scaledToIntFloor (source + i + 12, scale, minimum, maximum)), offset);
+                    _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i), _mm_packus_epi16 (low, high));
+                }
+                else
+                {
+                    low = _mm_packs_epi32 (scaledToInt (source + i, scale, minimum, maximum), scaledToInt (source + i + 4, scale, minimum, maximum));
+                    high = _mm_packs_epi32 (scaledToInt (source + i + 8, scale, minimum, maximum), scaledToInt (source + i + 12, scale, minimum, maximum));
+                    _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i), _mm_packs_epi16 (low, high));
+                }
+            }
+        }
+        else if (bitDepth == 16)
+        {
+            const __m128 scale = _mm_set1_ps (32768.f);
+            const __m128 minimum = _mm_set1_ps (-32768.f);
+            const __m128 maximum = _mm_set1_ps (32767.f);
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m128i value = _mm_packs_epi32 (scaledToInt (source + i, scale, minimum, maximum), scaledToInt (source + i + 4, scale, minimum, maximum));
+                if (! isWave)
+                    value = swapBytes16 (value);
+                _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i * 2), value);
+            }
+        }
+#if defined(AUDIOFILE_SSSE3)
+        else if (bitDepth == 24)
+        {
+            // Drop the top byte of each 32 bit lane and store the remaining twelve bytes
+            const __m128 scale = _mm_set1_ps (8388608.f);
+            const __m128 minimum = _mm_set1_ps (-8388608.f);
+            const __m128 maximum = _mm_set1_ps (8388607.f);
+            const __m128i order = isWave ? _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1)
+                                         : _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const __m128i value = _mm_shuffle_epi8 (scaledToInt (source + i, scale, minimum, maximum), order);
+                _mm_storel_epi64 (reinterpret_cast<__m128i*> (destination + i * 3), value);
+                const int32_t last = _mm_cvtsi128_si32 (_mm_srli_si128 (value, 8));
+                std::memcpy (destination + i * 3 + 8, &last, 4);
+            }
+        }
+#endif
+#endif
+        
+        encodeSamples<float> (source + i, isWave, bitDepth, numSamples - i, destination + i * (bitDepth / 8));
+    }
+    
+    //=============================================================
+    static void deinterleave (const float* source, int numChannels, size_t numFrames, float* const* channels, size_t firstFrame)
+    {
+#if defined(AUDIOFILE_SSE2)
+        if (numChannels == 2)
+        {
+            float* left = channels[0] + firstFrame;
+            float* right = channels[1] + firstFrame;
+            size_t i = 0;
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                const __m128 first = _mm_loadu_ps (source + i * 2);
+                const __m128 second = _mm_loadu_ps (source + i * 2 + 4);
+                _mm_storeu_ps (left + i, _mm_shuffle_ps (first, second, _MM_SHUFFLE (2, 0, 2, 0)));
+                _mm_storeu_ps (right + i, _mm_shuffle_ps (first, second, _MM_SHUFFLE (3, 1, 3, 1)));
+            }
+            deinterleave<float> (source + i * 2, numChannels, numFrames - i, channels, firstFrame + i);
+            return;
+        }
+#endif
+        deinterleave<float> (source, numChannels, numFrames, channels, firstFrame);
+    }
+    
+    //=============================================================
+    static void interleaveSamples (const float* const* channels, int numChannels, size_t numFrames, size_t firstFrame, float* destination)
+    {
+#if defined(AUDIOFILE_SSE2)
+        if (numChannels == 2)
+        {
+            const float* left = channels[0] + firstFrame;
+            const float* right = channels[1] + firstFrame;
+            size_t i = 0;
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                const __m128 l = _mm_loadu_ps (left + i);
+                const __m128 r = _mm_loadu_ps (right + i);
+                _mm_storeu_ps (destination + i * 2, _mm_unpacklo_ps (l, r));
+                _mm_storeu_ps (destination + i * 2 + 4, _mm_unpackhi_ps (l, r));
+            }
+            interleaveSamples<float> (channels, numChannels, numFrames - i, firstFrame + i, destination + i * 2);
+            return;
+        }
+#endif
+        interleaveSamples<float> (channels, numChannels, numFrames, firstFrame, destination);
+    }
+    
+    //=============================================================
+    template <class T>
+    static void decodeFrames (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, T* const* channels)
+    {
+        const bool isWave = format != AudioFileFormat::Aiff;
+        
+        // mono data doesn't need to be de-interleaved
+        if (numChannels == 1)
+        {
+            decodeSamples (source, isWave, bitDepth, numFrames, channels[0]);
+            return;
+        }
+        
+        assert (numChannels > 0 && (size_t) numChannels <= blockSize);
+        const size_t numBytesPerFrame = (size_t) numChannels * (bitDepth / 8);
+        const size_t numFramesPerBlock = blockSize / numChannels;
+        T block[blockSize];
+        
+        for (size_t frame = 0; frame < numFrames; frame += numFramesPerBlock)
+        {
+            const size_t numBlockFrames = std::min (numFramesPerBlock, numFrames - frame);
+            decodeSamples (source + frame * numBytesPerFrame, isWave, bitDepth, numBlockFrames * numChannels, block);
+            deinterleave (block, numChannels, numBlockFrames, channels, frame);
+        }
+    }
+    
+    //=============================================================
+    template <class T>
+    static void encodeFrames (const T* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination)
+    {
+        const bool isWave = format != AudioFileFormat::Aiff;
+        
+        // mono data doesn't need to be interleaved
+        if (numChannels == 1)
+        {
+            encodeSamples (channels[0], isWave, bitDepth, numFrames, destination);
+            return;
+        }
+        
+        assert (numChannels > 0 && (size_t) numChannels <= blockSize);
+        const size_t numBytesPerFrame = (size_t) numChannels * (bitDepth / 8);
+        const size_t numFramesPerBlock = blockSize / numChannels;
+        T block[blockSize];
+        
+        for (size_t frame = 0; frame < numFrames; frame += numFramesPerBlock)
+        {
+            const size_t numBlockFrames = std::min (numFramesPerBlock, numFrames - frame);
+            interleaveSamples (channels, numChannels, numBlockFrames, frame, block);
+            encodeSamples (block, isWave, bitDepth, numBlockFrames * numChannels, destination + frame * numBytesPerFrame);
+        }
+    }
+    
+    //=============================================================
+    void decode (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, float* const* channels)
+    {
+        decodeFrames (source, format, bitDepth, numChannels, numFrames, channels);
+    }
+    
+    //=============================================================
+    void decode (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, double* const* channels)
+    {
+        decodeFrames (source, format, bitDepth, numChannels, numFrames, channels);
+    }
+    
+    //=============================================================
+    void encode (const float* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination)
+    {
+        encodeFrames (channels, numChannels, numFrames, format, bitDepth, destination);
+    }
+    
+    //=============================================================
+    void encode (const double* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination)
+    {
+        encodeFrames (channels, numChannels, numFrames, format, bitDepth, destination);
+    }
+    
+    //=============================================================
+    void interleave (const int16_t* const* channels, int numChannels, size_t numFrames, int16_t* destination)
+    {
+        size_t i = 0;
+        
+#if defined(AUDIOFILE_SSE2)
+        if (numChannels == 2)
+        {
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                const __m128i left = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (channels[0] + i));
+                const __m128i right = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (channels[1] + i));
+                _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i * 2), _mm_unpacklo_epi16 (left, right));
+                _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i * 2 + 8), _mm_unpackhi_epi16 (left, right));
+            }
+        }
+#endif
+        
+        interleaveSamples<int16_t> (channels, numChannels, numFrames - i, i, destination + i * numChannels);
+    }
+}
+
+//=============================================================
+static uint32_t greatestCommonDivisor (uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        const uint32_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+//=============================================================
+// The zeroth order modified Bessel function of the first kind, which shapes the Kaiser window
+static double besselI0 (double x)
+{
+    double sum = 1.;
+    double term = 1.;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+        const double factor = x / (2. * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+//=============================================================
+// Multiplies the input samples with the coefficients of one phase, numTaps is a multiple of 8
+static float dotProduct (const float* samples, const float* coefficients, size_t numTaps)
+{
+#if defined(AUDIOFILE_SSE2)
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (size_t i = 0; i < numTaps; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_loadu_ps (samples + i), _mm_loadu_ps (coefficients + i)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_loadu_ps (samples + i + 4), _mm_loadu_ps (coefficients + i + 4)));
+    }
+    __m128 sum = _mm_add_ps (sum0, sum1);
+    sum = _mm_add_ps (sum, _mm_movehl_ps (sum, sum));
+    sum = _mm_add_ss (sum, _mm_shuffle_ps (sum, sum, 1));
+    return _mm_cvtss_f32 (sum);
+#else
+    float sum0 = 0.f, sum1 = 0.f, sum2 = 0.f, sum3 = 0.f;
+    for (size_t i = 0; i < numTaps; i += 4)
+    {
+        sum0 += samples[i] * coefficients[i];
+        sum1 += samples[i + 1] * coefficients[i + 1];
+        sum2 += samples[i + 2] * coefficients[i + 2];
+        sum3 += samples[i + 3] * coefficients[i + 3];
+    }
+    return (sum0 + sum1) + (sum2 + sum3);
+#endif
+}
+
+//=============================================================
+Resampler::Resampler()
+    : interpolation (1), decimation (1), numChannels (0), numTaps (0), latency (0.), phase (0), inputPosition (0)
+{
+}
+
+//=============================================================
+bool Resampler::setup (uint32_t inputSampleRate, uint32_t outputSampleRate, int newNumChannels, int numZeroCrossings)
+{
+    if (inputSampleRate == 0 || outputSampleRate == 0 || newNumChannels < 1 || numZeroCrossings < 1)
+        return false;
+    
+    // Upsample by L, filter and downsample by M, where L / M is the ratio of the rates in lowest terms
+    const uint32_t divisor = greatestCommonDivisor (inputSampleRate, outputSampleRate);
+    interpolation = outputSampleRate / divisor;
+    decimation = inputSampleRate / divisor;
+    
+    if (interpolation > maxNumPhases)
+        return false;
+    
+    // When downsampling, the filter has to become longer in input samples, as its cutoff moves down
+    const double stretch = std::max (1., (double) decimation / (double) interpolation);
+    const size_t numPhaseTaps = (size_t) std::ceil (2. * numZeroCrossings * stretch);
+    numTaps = (numPhaseTaps + 7) / 8 * 8;
+    numChannels = newNumChannels;
+    
+    // -----------------------------------------------------------
+    // The prototype filter runs at L times the input rate, with its cutoff slightly below the lower of both Nyquist frequencies.
+    // A Kaiser window with beta = 8 keeps the stopband about 80 dB down.
+    const size_t prototypeLength = numPhaseTaps * interpolation;
+    const double center = (prototypeLength - 1) / 2.;
+    const double cutoff = 0.91 * 0.5 / std::max (interpolation, decimation);
+    const double beta = 8.;
+    const double pi = 3.14159265358979323846;
+    
+    // the prototype runs at L times the input rate and the output rate is L / M times the input rate
+    latency = center / decimation;
+    
+    filterBank.assign (interpolation * numTaps, 0.f);
+    
+    for (size_t n = 0; n < prototypeLength; n++)
+    {
+        const double x = (double) n - center;
+        const double sinc = x == 0. ? 1. : std::sin (2. * pi * cutoff * x) / (2. * pi * cutoff * x);
+        const double ratio = x / (center > 0. ? center : 1.);
+        const double window = besselI0 (beta * std::sqrt (std::max (0., 1. - ratio * ratio))) / besselI0 (beta);
+        
+        // interpolation inserts L - 1 zeros between input samples, which the gain of L makes up for
+        const double coefficient = 2. * cutoff * sinc * window * interpolation;
+        
+        // tap j of phase p multiplies the input sample j samples before the newest one, the phases are stored reversed
+        const size_t phaseIndex = n % interpolation;
+        const size_t tap = n / interpolation;
+        filterBank[phaseIndex * numTaps + numTaps - 1 - tap] = (float) coefficient;
+    }
+    
+    history.assign (numChannels, std::vector<float>());
+    reset();
+    return true;
+}
+
+//=============================================================
+void Resampler::reset()
+{
+    for (auto& channelHistory : history)
+    {
+        channelHistory.resize (numTaps > 0 ? numTaps - 1 : 0);
+        std::fill (channelHistory.begin(), channelHistory.end(), 0.f);
+    }
+    
+    phase = 0;
+    inputPosition = 0;
+}
+
+//=============================================================
+size_t Resampler::getMaxOutputFrames (size_t numInputFrames) const
+{
+    return (size_t) (((uint64_t) numInputFrames * interpolation) / decimation) + 2;
+}
+
+//=============================================================
+double Resampler::getLatency() const
+{
+    return latency;
+}
+
+//=============================================================
+size_t Resampler::process (const float* const* input, size_t numInputFrames, float* const* output)
+{
+    if (numTaps == 0)
+        return 0;
+    
+    const size_t numHistorySamples = numTaps - 1;
+    uint32_t channelPhase = phase;
+    size_t position = inputPosition;
+    size_t numOutputFrames = 0;
+    
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+        // the new block follows the history, so every window of numTaps samples is contiguous
+        std::vector<float>& samples = history[channel];
+        samples.resize (numHistorySamples + numInputFrames);
+        std::copy (input[channel], input[channel] + numInputFrames, samples.begin() + numHistorySamples);
+        
+        channelPhase = phase;
+        position = inputPosition;
+        numOutputFrames = 0;
+        float* channelOutput = output[channel];
+        
+        while (position < numInputFrames)
+        {
+            channelOutput[numOutputFrames++] = dotProduct (samples.data() + position, filterBank.data() + channelPhase * numTaps, numTaps);
+            
+            channelPhase += decimation;
+            position += channelPhase / interpolation;
+            channelPhase %= interpolation;
+        }
+        
+        // keep the newest samples for the next block
+        std::copy (samples.end() - numHistorySamples, samples.end(), samples.begin());
+        samples.resize (numHistorySamples);
+    }
+    
+    phase = channelPhase;
+    inputPosition = position - numInputFrames;
+    return numOutputFrames;
+}
+
+//=============================================================
+// Sums the squares of 16 bit samples and counts the sign changes between neighbours, samples[-1] has to be valid
+static void measureFrame (const int16_t* samples, size_t numSamples, uint64_t& energy, uint32_t& numZeroCrossings)
+{
+    uint64_t sum = 0;
+    uint32_t crossings = 0;
+    size_t i = 0;
+    
+#if defined(AUDIOFILE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum64 = zero;
+    __m128i crossings16 = zero;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m128i current = _mm_loadu_si128 ((const __m128i*) (samples + i));
+        const __m128i previous = _mm_loadu_si128 ((const __m128i*) (samples + i - 1));
+        
+        // a pair of squares fits into 32 unsigned bits, even for -32768
+        const __m128i squares = _mm_madd_epi16 (current, current);
+        sum64 = _mm_add_epi64 (sum64, _mm_unpacklo_epi32 (squares, zero));
+        sum64 = _mm_add_epi64 (sum64, _mm_unpackhi_epi32 (squares, zero));
+        
+        // the sign masks differ where the signal crossed zero, which subtracts -1 from the count
+        const __m128i differs = _mm_xor_si128 (_mm_srai_epi16 (current, 15), _mm_srai_epi16 (previous, 15));
+        crossings16 = _mm_sub_epi16 (crossings16, differs);
+    }
+    
+    uint64_t sums[2];
+    _mm_storeu_si128 ((__m128i*) sums, sum64);
+    sum = sums[0] + sums[1];
+    
+    uint32_t counts[4];
+    _mm_storeu_si128 ((__m128i*) counts, _mm_madd_epi16 (crossings16, _mm_set1_epi16 (1)));
+    crossings = counts[0] + counts[1] + counts[2] + counts[3];
+#endif
+    
+    for (; i < numSamples; i++)
+    {
+        sum += (uint64_t) ((int32_t) samples[i] * samples[i]);
+        crossings += (samples[i] < 0) != (samples[i - 1] < 0) ? 1 : 0;
+    }
+    
+    energy = sum;
+    numZeroCrossings = crossings;
+}
+
+//=============================================================
+VoiceActivityDetector::Settings::Settings()
+    : frameSeconds (0.01f), onsetDecibels (12.f), releaseDecibels (6.f), minLevelDecibels (-55.f), maxZeroCrossingRate (0.45f),
+      onsetFrames (3), hangoverFrames (25), noiseFloorRiseDecibels (1.5f)
+{
+}
+
+//=============================================================
+VoiceActivityDetector::VoiceActivityDetector()
+    : frameSize (0), noiseFloorRise (0.f), numFrameSamples (0), frameIndex (0), hasNoiseFloor (false), noiseFloor (0.f),
+      voiceActive (false), numCandidateFrames (0), numQuietFrames (0), firstCandidateIndex (0), firstQuietIndex (0)
+{
+}
+
+//=============================================================
+bool VoiceActivityDetector::setup (uint32_t sampleRate, const Settings& newSettings)
+{
+    const double numSamples = std::floor ((double) sampleRate * newSettings.frameSeconds + 0.5);
+    if (sampleRate == 0 || numSamples < 8. || numSamples > 65536.)
+        return false;
+    
+    settings = newSettings;
+    frameSize = (size_t) numSamples;
+    noiseFloorRise = settings.noiseFloorRiseDecibels * (float) frameSize / (float) sampleRate;
+    frameSamples.assign (frameSize + 1, 0);
+    reset();
+    return true;
+}
+
+//=============================================================
+void VoiceActivityDetector::reset()
+{
+    std::fill (frameSamples.begin(), frameSamples.end(), (int16_t) 0);
+    numFrameSamples = 0;
+    frameIndex = 0;
+    hasNoiseFloor = false;
+    noiseFloor = 0.f;
+    voiceActive = false;
+    numCandidateFrames = 0;
+    numQuietFrames = 0;
+    firstCandidateIndex = 0;
+    firstQuietIndex = 0;
+}
+
+//=============================================================
+size_t VoiceActivityDetector::process (const int16_t* samples, size_t numSamples, std::vector<Frame>& frames)
+{
+    if (frameSize == 0)
+        return 0;
+    
+    size_t numFrames = 0;
+    
+    while (numSamples > 0)
+    {
+        const size_t numCopied = std::min (numSamples, frameSize - numFrameSamples);
+        std::copy (samples, samples + numCopied, frameSamples.begin() + 1 + numFrameSamples);
+        samples += numCopied;
+        numSamples -= numCopied;
+        numFrameSamples += numCopied;
+        
+        if (numFrameSamples == frameSize)
+        {
+            analyseFrame (frames);
+            numFrames++;
+            
+            // the last sample stays in front of the next frame for its first zero crossing
+            frameSamples[0] = frameSamples[frameSize];
+            numFrameSamples = 0;
+            frameIndex += frameSize;
+        }
+    }
+    
+    return numFrames;
+}
+
+//=============================================================
+void VoiceActivityDetector::analyseFrame (std::vector<Frame>& frames)
+{
+    uint64_t energy;
+    uint32_t numZeroCrossings;
+    measureFrame (frameSamples.data() + 1, frameSize, energy, numZeroCrossings);
+    
+    const double meanSquare = (double) energy / (double) frameSize;
+    const float level = meanSquare > 0. ? (float) (10. * std::log10 (meanSquare / (32768. * 32768.))) : -120.f;
+    const float zeroCrossingRate = (float) numZeroCrossings / (float) frameSize;
+    
+    // the noise floor follows quieter frames right away and louder ones slowly, so speech hardly lifts it
+    if (! hasNoiseFloor || level < noiseFloor)
+        noiseFloor = level;
+    else
+        noiseFloor = std::min (level, noiseFloor + noiseFloorRise);
+    
+    hasNoiseFloor = true;
+    
+    Frame frame;
+    frame.sampleIndex = frameIndex;
+    frame.levelDecibels = level;
+    frame.zeroCrossingRate = zeroCrossingRate;
+    frame.changed = false;
+    frame.changeSampleIndex = 0;
+    
+    if (! voiceActive)
+    {
+        const bool isCandidate = level >= noiseFloor + settings.onsetDecibels && level >= settings.minLevelDecibels
+                                 && zeroCrossingRate <= settings.maxZeroCrossingRate;
+        
+        if (! isCandidate)
+        {
+            numCandidateFrames = 0;
+        }
+        else
+        {
+            if (numCandidateFrames++ == 0)
+                firstCandidateIndex = frameIndex;
+            
+            if (numCandidateFrames >= settings.onsetFrames)
+            {
+                voiceActive = true;
+                frame.changed = true;
+                frame.changeSampleIndex = firstCandidateIndex;
+                numQuietFrames = 0;
+            }
+        }
+    }
+    else
+    {
+        const bool isSustained = level >= noiseFloor + settings.releaseDecibels && level >= settings.minLevelDecibels;
+        
+        if (isSustained)
+        {
+            numQuietFrames = 0;
+        }
+        else
+        {
+            if (numQuietFrames++ == 0)
+                firstQuietIndex = frameIndex;
+            
+            if (numQuietFrames >= settings.hangoverFrames)
+            {
+                voiceActive = false;
+                frame.changed = true;
+                frame.changeSampleIndex = firstQuietIndex;
+                numCandidateFrames = 0;
+            }
+        }
+    }
+    
+    frame.voiceActive = voiceActive;
+    frames.push_back (frame);
+}
+
+//=============================================================
+size_t VoiceActivityDetector::getFrameSize() const
+{
+    return frameSize;
+}
+
+//=============================================================
+bool VoiceActivityDetector::isVoiceActive() const
+{
+    return voiceActive;
+}
+
+//=============================================================
+// Writes the big endian bit fields of FLAC frames into a byte vector
+class FlacBitWriter
+{
+public:
+    FlacBitWriter (std::vector<uint8_t>& output)
+        : data (output), accumulator (0), numBits (0)
+    {
+    }
+    
+    /** Writes the lowest bits of the value, at most 32 */
+    void write (uint32_t value, int bits)
+    {
+        if (bits == 0)
+            return;
+    
+        accumulator = (accumulator << bits) | (bits < 32 ? value & ((1u << bits) - 1) : value);
+        numBits += bits;
+    
+        while (numBits >= 8)
+        {
+            numBits -= 8;
+            data.push_back ((uint8_t) (accumulator >> numBits));
+        }
+    }
+    
+    /** Writes the value in unary (as zeros terminated by a one) for the quotient, followed by the lowest bits */
+    void writeRice (uint32_t value, int parameter)
+    {
+        uint32_t quotient = value >> parameter;
+        const uint32_t remainder = parameter > 0 ? value & ((1u << parameter) - 1) : 0;
+    
+        if (quotient + 1 + parameter <= 32)
+        {
+            // the leading zeros are implied by the width
+            write ((1u << parameter) | remainder, (int) quotient + 1 + parameter);
+            return;
+        }
+    
+        for (; quotient >= 32; quotient -= 32)
+            write (0, 32);
+    
+        write (1, (int) quotient + 1);
+        write (remainder, parameter);
+    }
+    
+    void alignToByte()
+    {
+        if (numBits > 0)
+            write (0, 8 - numBits);
+    }
+
+private:
+    std::vector<uint8_t>& data;
+    uint64_t accumulator;
+    int numBits;
+};
+
+//=============================================================
+static int countLeadingZeros (uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll (value);
+#else
+    int zeros = 0;
+    for (; (value & 0xFF00000000000000ull) == 0; value <<= 8)
+        zeros += 8;
+    for (; (value & 0x8000000000000000ull) == 0; value <<= 1)
+        zeros++;
+    return zeros;
+#endif
+}
+
+//=============================================================
+// Reads the big endian bit fields of FLAC frames. Reading past the end of the data fails and returns zeros.
+class FlacBitReader
+{
+public:
+    FlacBitReader (const uint8_t* data_, size_t size_)
+        : data (data_), size (size_), nextByte (0), cache (0), numCachedBits (0), numBitsRead (0), failed (false)
+    {
+    }
+    
+    /** Reads an unsigned value of at most 32 bits */
+    uint32_t read (int bits)
+    {
+        if (bits == 0)
+            return 0;
+    
+        if (numBitsRead + bits > (uint64_t) size * 8)
+        {
+            failed = true;
+            return 0;
+        }
+    
+        if (numCachedBits < bits)
+            refill();
+    
+        const uint32_t value = (uint32_t) (cache >> (64 - bits));
+        cache <<= bits;
+        numCachedBits -= bits;
+        numBitsRead += bits;
+        return value;
+    }
+    
+    /** Reads a two's complement value of at most 32 bits */
+    int32_t readSigned (int bits)
+    {
+        if (bits == 0)
+            return 0;
+    
+        const uint32_t value = read (bits);
+        return bits < 32 ? (int32_t) (value << (32 - bits)) >> (32 - bits) : (int32_t) value;
+    }
+    
+    /** Reads the number of zeros up to the next one */
+    uint32_t readUnary()
+    {
+        uint32_t count = 0;
+    
+        while (! failed)
+        {
+            if (numCachedBits < 8)
+                refill();
+    
+            if (cache == 0)
+            {
+                // all cached bits are zeros
+                count += numCachedBits;
+                numBitsRead += numCachedBits;
+                numCachedBits = 0;
+    
+                if (numBitsRead > (uint64_t) size * 8)
+                    failed = true;
+    
+                continue;
+            }
+    
+            const int zeros = countLeadingZeros (cache);
+            cache = zeros < 63 ? cache << (zeros + 1) : 0;
+            numCachedBits -= zeros + 1;
+            numBitsRead += zeros + 1;
+    
+            if (numBitsRead > (uint64_t) size * 8)
+                failed = true;
+    
+            return count + zeros;
+        }
+    
+        return 0;
+    }
+    
+    void alignToByte()
+    {
+        read ((int) ((8 - numBitsRead % 8) % 8));
+    }
+    
+    /** @Returns the number of whole bytes that were read */
+    size_t getBytePosition() const
+    {
+        return (size_t) (numBitsRead / 8);
+    }
+    
+    bool hasFailed() const
+    {
+        return failed;
+    }
+
+private:
+    void refill()
+    {
+        // the cached bits are kept at the top, bytes past the end of the data are read as zeros
+        while (numCachedBits <= 56)
+        {
+            const uint64_t byte = nextByte < size ? data[nextByte] : 0;
+            cache |= byte << (56 - numCachedBits);
+            numCachedBits += 8;
+            nextByte++;
+        }
+    }
+    
+    const uint8_t* data;
+    size_t size;
+    size_t nextByte;
+    uint64_t cache;
+    int numCachedBits;
+    uint64_t numBitsRead;
+    bool failed;
+};
+
+//=============================================================
+// The CRC-8 of FLAC frame headers (polynomial x^8 + x^2 + x + 1)
+static uint8_t flacCrc8 (const uint8_t* data, size_t size)
+{
+    uint8_t crc = 0;
+    
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (uint8_t) ((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+    }
+    
+    return crc;
+}
+
+//=============================================================
+// The CRC-16 of whole FLAC frames (polynomial x^16 + x^15 + x^2 + 1)
+static uint16_t flacCrc16 (const uint8_t* data, size_t size)
+{
+    static const std::vector<uint16_t> table = []
+    {
+        std::vector<uint16_t> entries (256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint16_t crc = (uint16_t) (i << 8);
+            for (int bit = 0; bit < 8; bit++)
+                crc = (uint16_t) ((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+    
+    uint16_t crc = 0;
+    
+    for (size_t i = 0; i < size; i++)
+        crc = (uint16_t) ((crc << 8) ^ table[(crc >> 8) ^ data[i]]);
+    
+    return crc;
+}
+
+//=============================================================
+static uint32_t zigZagEncode (int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+//=============================================================
+// Chooses the partition order and the Rice parameter of each partition with the fewest bits for the residual
+// of a subframe, whose first predictorOrder samples are warm-up samples. The sums of the partitions are computed
+// at the finest order and merged pairwise for each coarser one. Returns the estimated size of the residual in bits.
+static uint64_t chooseRiceParameters (const int32_t* residual, int numSamples, int predictorOrder, uint64_t* partitionSums, int& partitionOrder, uint8_t* parameters)
+{
+    // FLAC allows up to 15 partition orders, 8 is the limit of the subset most decoders are tuned for
+    int maxPartitionOrder = 0;
+    while (maxPartitionOrder < 8 && numSamples % (2 << maxPartitionOrder) == 0 && (numSamples >> (maxPartitionOrder + 1)) > predictorOrder)
+        maxPartitionOrder++;
+    
+    const int partitionLength = numSamples >> maxPartitionOrder;
+    for (int partition = 0; partition < (1 << maxPartitionOrder); partition++)
+    {
+        uint64_t sum = 0;
+        for (int i = partition == 0 ? predictorOrder : partition * partitionLength; i < (partition + 1) * partitionLength; i++)
+            sum += zigZagEncode (residual[i]);
+        partitionSums[partition] = sum;
+    }
+    
+    uint64_t bestBits = UINT64_MAX;
+    
+    for (int order = maxPartitionOrder; order >= 0; order--)
+    {
+        const int numPartitions = 1 << order;
+        uint64_t bits = 2 + 4;
+        uint8_t orderParameters[256];
+        int largestParameter = 0;
+    
+        for (int partition = 0; partition < numPartitions; partition++)
+        {
+            const uint64_t sum = partitionSums[partition];
+            const uint64_t count = (uint64_t) (numSamples >> order) - (partition == 0 ? predictorOrder : 0);
+    
+            // the parameter is about the logarithm of the mean, the unary parts of all samples add up to about sum >> parameter
+            int parameter = 0;
+            while (parameter < 30 && (count << (parameter + 1)) < sum)
+                parameter++;
+    
+            orderParameters[partition] = (uint8_t) parameter;
+            largestParameter = std::max (largestParameter, parameter);
+            bits += count * (parameter + 1) + (sum >> parameter);
+        }
+    
+        bits += (uint64_t) numPartitions * (largestParameter > 14 ? 5 : 4);
+    
+        if (bits < bestBits)
+        {
+            bestBits = bits;
+            partitionOrder = order;
+            std::copy (orderParameters, orderParameters + numPartitions, parameters);
+        }
+    
+        for (int partition = 0; partition < numPartitions / 2; partition++)
+            partitionSums[partition] = partitionSums[2 * partition] + partitionSums[2 * partition + 1];
+    }
+    
+    return bestBits;
+}
+
+//=============================================================
+static void writeResidual (FlacBitWriter& writer, const int32_t* residual, int numSamples, int predictorOrder, uint64_t* partitionSums)
+{
+    int partitionOrder = 0;
+    uint8_t parameters[256];
+    chooseRiceParameters (residual, numSamples, predictorOrder, partitionSums, partitionOrder, parameters);
+    
+    const int numPartitions = 1 << partitionOrder;
+    const bool useLongParameters = *std::max_element (parameters, parameters + numPartitions) > 14;
+    
+    writer.write (useLongParameters ? 1 : 0, 2);
+    writer.write ((uint32_t) partitionOrder, 4);
+    
+    const int partitionLength = numSamples >> partitionOrder;
+    for (int partition = 0; partition < numPartitions; partition++)
+    {
+        const int parameter = parameters[partition];
+        writer.write ((uint32_t) parameter, useLongParameters ? 5 : 4);
+    
+        for (int i = partition == 0 ? predictorOrder : partition * partitionLength; i < (partition + 1) * partitionLength; i++)
+            writer.writeRice (zigZagEncode (residual[i]), parameter);
+    }
+}
+
+//=============================================================
+// Computes the residual of one of the fixed polynomial predictors of FLAC
+static void computeFixedResidual (const int32_t* signal, int numSamples, int order, int32_t* residual)
+{
+    for (int i = order; i < numSamples; i++)
+    {
+        const int64_t x = signal[i];
+        int64_t prediction = 0;
+    
+        switch (order)
+        {
+            case 1: prediction = signal[i - 1]; break;
+            case 2: prediction = 2 * (int64_t) signal[i - 1] - signal[i - 2]; break;
+            case 3: prediction = 3 * ((int64_t) signal[i - 1] - signal[i - 2]) + signal[i - 3]; break;
+            case 4: prediction = 4 * ((int64_t) signal[i - 1] + signal[i - 3]) - 6 * (int64_t) signal[i - 2] - signal[i - 4]; break;
+            default: break;
+        }
+    
+        residual[i] = (int32_t) (x - prediction);
+    }
+}
+
+//=============================================================
+// Computes the residual of a quantised LPC filter. Returns false if the residual doesn't fit the Rice coding.
+static bool computeLpcResidual (const int32_t* signal, int numSamples, const int32_t* coefficients, int order, int shift, int32_t* residual)
+{
+    for (int i = order; i < numSamples; i++)
+    {
+        int64_t sum = 0;
+        for (int j = 0; j < order; j++)
+            sum += (int64_t) coefficients[j] * signal[i - j - 1];
+    
+        const int64_t value = signal[i] - (sum >> shift);
+        if (value >= (1 << 30) || value <= -(1 << 30))
+            return false;
+    
+        residual[i] = (int32_t) value;
+    }
+    
+    return true;
+}
+
+//=============================================================
+// A cheap estimate of how well a signal compresses: the sum of its second differences
+static uint64_t estimateSignalBits (const int32_t* signal, int numSamples)
+{
+    uint64_t sum = 0;
+    
+    for (int i = 2; i < numSamples; i++)
+    {
+        const int64_t difference = (int64_t) signal[i] - 2 * (int64_t) signal[i - 1] + signal[i - 2];
+        sum += (uint64_t) (difference < 0 ? -difference : difference);
+    }
+    
+    return sum;
+}
+
+//=============================================================
+FlacEncoder::FlacEncoder()
+    : numChannels (0), sampleRate (0), bitDepth (0), blockSize (0), maxLpcOrder (0), lpcPrecision (0), numBufferedSamples (0),
+      frameNumber (0), numEncodedSamples (0), minFrameSize (0), maxFrameSize (0)
+{
+}
+
+//=============================================================
+bool FlacEncoder::setup (int newNumChannels, uint32_t newSampleRate, int newBitDepth, int newBlockSize, int newMaxLpcOrder)
+{
+    if (newNumChannels < 1 || newNumChannels > 8 || newSampleRate == 0 || newSampleRate >= (1 << 20))
+        return false;
+    
+    if ((newBitDepth != 8 && newBitDepth != 16 && newBitDepth != 24) || newBlockSize < 16 || newBlockSize > 65535)
+        return false;
+    
+    numChannels = newNumChannels;
+    sampleRate = newSampleRate;
+    bitDepth = newBitDepth;
+    blockSize = newBlockSize;
+    maxLpcOrder = std::max (0, std::min (newMaxLpcOrder, 32));
+    
+    // shorter blocks can't afford as many bits for their coefficients, these are the steps of the reference encoder
+    lpcPrecision = blockSize <= 192 ? 7 : blockSize <= 384 ? 8 : blockSize <= 576 ? 9 : blockSize <= 1152 ? 10 : blockSize <= 2304 ? 11 : blockSize <= 4608 ? 12 : 13;
+    
+    // stereo blocks also keep the side and mid signal
+    blockSamples.assign (numChannels == 2 ? 4 : numChannels, std::vector<int32_t> (blockSize));
+    numBufferedSamples = 0;
+    
+    window.clear();
+    windowedSignal.resize (blockSize);
+    residual.resize (blockSize);
+    bestResidual.resize (blockSize);
+    partitionSums.resize (256);
+    
+    frameNumber = 0;
+    numEncodedSamples = 0;
+    minFrameSize = 0;
+    maxFrameSize = 0;
+    return true;
+}
+
+//=============================================================
+size_t FlacEncoder::createHeader (std::vector<uint8_t>& fileData) const
+{
+    const size_t startSize = fileData.size();
+    FlacBitWriter writer (fileData);
+    
+    writer.write ('f', 8);
+    writer.write ('L', 8);
+    writer.write ('a', 8);
+    writer.write ('C', 8);
+    
+    // the STREAMINFO block is the last and only metadata block
+    writer.write (0x80, 8);
+    writer.write (34, 24);
+    
+    writer.write ((uint32_t) blockSize, 16);
+    writer.write ((uint32_t) blockSize, 16);
+    writer.write (minFrameSize, 24);
+    writer.write (maxFrameSize, 24);
+    writer.write (sampleRate, 20);
+    writer.write ((uint32_t) numChannels - 1, 3);
+    writer.write ((uint32_t) bitDepth - 1, 5);
+    writer.write ((uint32_t) (numEncodedSamples >> 32), 4);
+    writer.write ((uint32_t) numEncodedSamples, 32);
+    
+    // the MD5 signature of the samples is left unset, which means it is unknown
+    for (int i = 0; i < 4; i++)
+        writer.write (0, 32);
+    
+    return fileData.size() - startSize;
+}
+
+//=============================================================
+size_t FlacEncoder::process (const uint8_t* waveData, size_t numFrames, std::vector<uint8_t>& output)
+{
+    const size_t startSize = output.size();
+    const int numBytesPerSample = bitDepth / 8;
+    
+    while (numFrames > 0)
+    {
+        const int numSamples = (int) std::min<size_t> (numFrames, (size_t) (blockSize - numBufferedSamples));
+    
+        for (int i = numBufferedSamples; i < numBufferedSamples + numSamples; i++)
+        {
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                if (numBytesPerSample == 1)
+                    blockSamples[channel][i] = (int32_t) waveData[0] - 128;
+                else if (numBytesPerSample == 2)
+                    blockSamples[channel][i] = (int16_t) (waveData[0] | (waveData[1] << 8));
+                else
+                    blockSamples[channel][i] = (int32_t) (((uint32_t) waveData[0] << 8) | ((uint32_t) waveData[1] << 16) | ((uint32_t) waveData[2] << 24)) >> 8;
+    
+                waveData += numBytesPerSample;
+            }
+        }
+    
+        numBufferedSamples += numSamples;
+        numFrames -= numSamples;
+    
+        if (numBufferedSamples == blockSize)
+        {
+            encodeFrame (blockSize, output);
+            numBufferedSamples = 0;
+        }
+    }
+    
+    return output.size() - startSize;
+}
+
+//=============================================================
+size_t FlacEncoder::flush (std::vector<uint8_t>& output)
+{
+    const size_t startSize = output.size();
+    
+    if (numBufferedSamples > 0)
+    {
+        encodeFrame (numBufferedSamples, output);
+        numBufferedSamples = 0;
+    }
+    
+    return output.size() - startSize;
+}
+
+//=============================================================
+uint64_t FlacEncoder::getNumSamplesPerChannel() const
+{
+    return numEncodedSamples;
+}
+
+//=============================================================
+void FlacEncoder::encodeFrame (int numSamples, std::vector<uint8_t>& output)
+{
+    const size_t frameStart = output.size();
+    FlacBitWriter writer (output);
+    
+    // -----------------------------------------------------------
+    // Stereo blocks are coded as the pair of the left, right, side and mid signal that is estimated to be the smallest
+    int channelAssignment = numChannels - 1;
+    
+    if (numChannels == 2)
+    {
+        std::vector<int32_t>& left = blockSamples[0];
+        std::vector<int32_t>& right = blockSamples[1];
+        std::vector<int32_t>& side = blockSamples[2];
+        std::vector<int32_t>& mid = blockSamples[3];
+    
+        for (int i = 0; i < numSamples; i++)
+        {
+            side[i] = left[i] - right[i];
+            mid[i] = (left[i] + right[i]) >> 1;
+        }
+    
+        const uint64_t leftBits = estimateSignalBits (left.data(), numSamples);
+        const uint64_t rightBits = estimateSignalBits (right.data(), numSamples);
+        const uint64_t sideBits = estimateSignalBits (side.data(), numSamples);
+        const uint64_t midBits = estimateSignalBits (mid.data(), numSamples);
+    
+        uint64_t bestBits = leftBits + rightBits;
+        if (leftBits + sideBits < bestBits)
+        {
+            bestBits = leftBits + sideBits;
+            channelAssignment = 8;
+        }
+        if (rightBits + sideBits < bestBits)
+        {
+            bestBits = rightBits + sideBits;
+            channelAssignment = 9;
+        }
+        if (midBits + sideBits < bestBits)
+            channelAssignment = 10;
+    }
+    
+    // -----------------------------------------------------------
+    // Frame header
+    writer.write (0x3FFE, 14);
+    writer.write (0, 1);
+    writer.write (0, 1);
+    
+    int blockSizeCode = numSamples <= 256 ? 6 : 7;
+    if (numSamples == 192)
+        blockSizeCode = 1;
+    for (int code = 2; code <= 5; code++)
+        if (numSamples == 576 << (code - 2))
+            blockSizeCode = code;
+    for (int code = 8; code <= 15; code++)
+        if (numSamples == 256 << (code - 8))
+            blockSizeCode = code;
+    
+    static const uint32_t sampleRateCodes[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+    int sampleRateCode = sampleRate % 1000 == 0 && sampleRate / 1000 <= 255 ? 12 : sampleRate <= 65535 ? 13 : sampleRate % 10 == 0 && sampleRate / 10 <= 65535 ? 14 : 0;
+    for (int code = 1; code < 12; code++)
+        if (sampleRate == sampleRateCodes[code])
+            sampleRateCode = code;
+    
+    writer.write ((uint32_t) blockSizeCode, 4);
+    writer.write ((uint32_t) sampleRateCode, 4);
+    writer.write ((uint32_t) channelAssignment, 4);
+    writer.write (bitDepth == 8 ? 1 : bitDepth == 16 ? 4 : 6, 3);
+    writer.write (0, 1);
+    
+    // the frame number is coded like a UTF-8 character
+    if (frameNumber < 0x80)
+    {
+        writer.write (frameNumber, 8);
+    }
+    else
+    {
+        int numExtraBytes = 1;
+        while (numExtraBytes < 6 && frameNumber >= (1u << (5 * numExtraBytes + 6)))
+            numExtraBytes++;
+    
+        writer.write (((0xFF00u >> (numExtraBytes + 1)) & 0xFF) | (frameNumber >> (6 * numExtraBytes)), 8);
+        for (int i = numExtraBytes - 1; i >= 0; i--)
+            writer.write (0x80 | ((frameNumber >> (6 * i)) & 0x3F), 8);
+    }
+    
+    if (blockSizeCode == 6)
+        writer.write ((uint32_t) numSamples - 1, 8);
+    else if (blockSizeCode == 7)
+        writer.write ((uint32_t) numSamples - 1, 16);
+    
+    if (sampleRateCode == 12)
+        writer.write (sampleRate / 1000, 8);
+    else if (sampleRateCode == 13)
+        writer.write (sampleRate, 16);
+    else if (sampleRateCode == 14)
+        writer.write (sampleRate / 10, 16);
+    
+    writer.write (flacCrc8 (output.data() + frameStart, output.size() - frameStart), 8);
+    
+    // -----------------------------------------------------------
+    // Subframes, the side signal needs one more bit
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+        const bool isSide = (channelAssignment == 8 && channel == 1) || (channelAssignment == 9 && channel == 0) || (channelAssignment == 10 && channel == 1);
+        const int source = isSide ? 2 : channelAssignment == 10 ? 3 : channel;
+        
+        encodeSubframe (writer, blockSamples[source].data(), numSamples, isSide ? bitDepth + 1 : bitDepth);
+    }
+    
+    writer.alignToByte();
+    writer.write (flacCrc16 (output.data() + frameStart, output.size() - frameStart), 16);
+    
+    const uint32_t frameSize = (uint32_t) (output.size() - frameStart);
+    minFrameSize = minFrameSize == 0 ? frameSize : std::min (minFrameSize, frameSize);
+    maxFrameSize = std::max (maxFrameSize, frameSize);
+    numEncodedSamples += numSamples;
+    frameNumber++;
+}
+
+//=============================================================
+void FlacEncoder::encodeSubframe (FlacBitWriter& writer, const int32_t* signal, int numSamples, int subframeBitDepth)
+{
+    // -----------------------------------------------------------
+    // Silence and other constant signals only need one sample
+    if (std::all_of (signal + 1, signal + numSamples, [signal] (int32_t sample) { return sample == signal[0]; }))
+    {
+        writer.write (0x00, 8);
+        writer.write ((uint32_t) signal[0], subframeBitDepth);
+        return;
+    }
+    
+    enum class Predictor { Verbatim, Fixed, Lpc };
+    Predictor bestPredictor = Predictor::Verbatim;
+    uint64_t bestBits = (uint64_t) numSamples * subframeBitDepth;
+    int bestOrder = 0;
+    int32_t bestCoefficients[32];
+    int bestShift = 0;
+    
+    // -----------------------------------------------------------
+    // The fixed predictor of the order with the smallest absolute residual
+    if (numSamples > 4)
+    {
+        uint64_t sums[5] = { 0, 0, 0, 0, 0 };
+    
+        for (int i = 4; i < numSamples; i++)
+        {
+            const int64_t e0 = signal[i];
+            const int64_t e1 = e0 - signal[i - 1];
+            const int64_t e2 = e1 - ((int64_t) signal[i - 1] - signal[i - 2]);
+            const int64_t e3 = e2 - ((int64_t) signal[i - 1] - 2 * (int64_t) signal[i - 2] + signal[i - 3]);
+            const int64_t e4 = e3 - ((int64_t) signal[i - 1] - 3 * (int64_t) signal[i - 2] + 3 * (int64_t) signal[i - 3] - signal[i - 4]);
+            sums[0] += (uint64_t) (e0 < 0 ? -e0 : e0);
+            sums[1] += (uint64_t) (e1 < 0 ? -e1 : e1);
+            sums[2] += (uint64_t) (e2 < 0 ? -e2 : e2);
+            sums[3] += (uint64_t) (e3 < 0 ? -e3 : e3);
+            sums[4] += (uint64_t) (e4 < 0 ? -e4 : e4);
+        }
+    
+        const int order = (int) (std::min_element (sums, sums + 5) - sums);
+        computeFixedResidual (signal, numSamples, order, residual.data());
+        int partitionOrder;
+        uint8_t parameters[256];
+        const uint64_t bits = (uint64_t) order * subframeBitDepth + chooseRiceParameters (residual.data(), numSamples, order, partitionSums.data(), partitionOrder, parameters);
+    
+        if (bits < bestBits)
+        {
+            bestBits = bits;
+            bestPredictor = Predictor::Fixed;
+            bestOrder = order;
+            residual.swap (bestResidual);
+        }
+    }
+    
+    // -----------------------------------------------------------
+    // The LPC filter from the autocorrelation of the signal in a Tukey window
+    if (maxLpcOrder > 0 && numSamples > 2 * maxLpcOrder)
+    {
+        if ((int) window.size() != numSamples)
+        {
+            const double pi = 3.14159265358979323846;
+            const int taperLength = numSamples / 4;
+            window.assign (numSamples, 1.);
+            for (int i = 0; i < taperLength; i++)
+            {
+                window[i] = 0.5 - 0.5 * std::cos (pi * i / taperLength);
+                window[numSamples - 1 - i] = window[i];
+            }
+        }
+    
+        for (int i = 0; i < numSamples; i++)
+            windowedSignal[i] = signal[i] * window[i];
+    
+        double autocorrelation[33];
+        for (int lag = 0; lag <= maxLpcOrder; lag++)
+        {
+            double sum = 0.;
+            for (int i = lag; i < numSamples; i++)
+                sum += windowedSignal[i] * windowedSignal[i - lag];
+            autocorrelation[lag] = sum;
+        }
+    
+        if (autocorrelation[0] > 0.)
+        {
+            // Levinson-Durbin recursion, keeping the coefficients and the prediction error of every order
+            double coefficients[32][32];
+            double errors[32];
+            double lpc[32];
+            double error = autocorrelation[0];
+            int maxOrder = maxLpcOrder;
+    
+            for (int i = 0; i < maxOrder; i++)
+            {
+                double reflection = -autocorrelation[i + 1];
+                for (int j = 0; j < i; j++)
+                    reflection -= lpc[j] * autocorrelation[i - j];
+                reflection /= error;
+    
+                lpc[i] = reflection;
+                for (int j = 0; j < i / 2; j++)
+                {
+                    const double temp = lpc[j];
+                    lpc[j] += reflection * lpc[i - 1 - j];
+                    lpc[i - 1 - j] += reflection * temp;
+                }
+                if (i & 1)
+                    lpc[i / 2] += lpc[i / 2] * reflection;
+    
+                error *= 1. - reflection * reflection;
+    
+                for (int j = 0; j <= i; j++)
+                    coefficients[i][j] = -lpc[j];
+                errors[i] = error;
+    
+                if (error <= 0.)
+                {
+                    maxOrder = i + 1;
+                    break;
+                }
+            }
+    
+            // the order with the fewest expected bits, based on the prediction error
+            int order = 1;
+            double fewestBits = 1e300;
+            for (int i = 1; i <= maxOrder; i++)
+            {
+                const double bitsPerSample = errors[i - 1] > 0. ? std::max (0., 0.5 * std::log2 (errors[i - 1] * 0.5 / numSamples)) : 0.;
+                const double bits = bitsPerSample * (numSamples - i) + i * (subframeBitDepth + lpcPrecision);
+                if (bits < fewestBits)
+                {
+                    fewestBits = bits;
+                    order = i;
+                }
+            }
+    
+            // quantise the coefficients to lpcPrecision bits with a shift of up to 15, carrying the rounding error along
+            const double* lp = coefficients[order - 1];
+            double largest = 0.;
+            for (int i = 0; i < order; i++)
+                largest = std::max (largest, std::fabs (lp[i]));
+    
+            int exponent;
+            std::frexp (largest, &exponent);
+            const int shift = std::min (15, (lpcPrecision - 1) - (exponent - 1) - 1);
+    
+            if (largest > 0. && shift >= 0)
+            {
+                const int32_t largestCoefficient = (1 << (lpcPrecision - 1)) - 1;
+                int32_t quantised[32];
+                double carry = 0.;
+    
+                for (int i = 0; i < order; i++)
+                {
+                    carry += lp[i] * (1 << shift);
+                    const int32_t value = (int32_t) std::max<double> (-largestCoefficient - 1, std::min<double> (largestCoefficient, std::round (carry)));
+                    carry -= value;
+                    quantised[i] = value;
+                }
+    
+                if (computeLpcResidual (signal, numSamples, quantised, order, shift, residual.data()))
+                {
+                    int partitionOrder;
+                    uint8_t parameters[256];
+                    const uint64_t bits = (uint64_t) order * (subframeBitDepth + lpcPrecision) + 4 + 5 + chooseRiceParameters (residual.data(), numSamples, order, partitionSums.data(), partitionOrder, parameters);
+    
+                    if (bits < bestBits)
+                    {
+                        bestBits = bits;
+                        bestPredictor = Predictor::Lpc;
+                        bestOrder = order;
+                        bestShift = shift;
+                        std::copy (quantised, quantised + order, bestCoefficients);
+                        residual.swap (bestResidual);
+                    }
+                }
+            }
+        }
+    }
+    
+    // -----------------------------------------------------------
+    // Subframe header: a zero bit, the type and no wasted bits
+    if (bestPredictor == Predictor::Verbatim)
+    {
+        writer.write (0x01 << 1, 8);
+        for (int i = 0; i < numSamples; i++)
+            writer.write ((uint32_t) signal[i], subframeBitDepth);
+        return;
+    }
+    
+    if (bestPredictor == Predictor::Fixed)
+        writer.write ((uint32_t) (0x08 | bestOrder) << 1, 8);
+    else
+        writer.write ((uint32_t) (0x20 | (bestOrder - 1)) << 1, 8);
+    
+    for (int i = 0; i < bestOrder; i++)
+        writer.write ((uint32_t) signal[i], subframeBitDepth);
+    
+    if (bestPredictor == Predictor::Lpc)
+    {
+        writer.write ((uint32_t) lpcPrecision - 1, 4);
+        writer.write ((uint32_t) bestShift, 5);
+        for (int i = 0; i < bestOrder; i++)
+            writer.write ((uint32_t) bestCoefficients[i], lpcPrecision);
+    }
+    
+    writeResidual (writer, bestResidual.data(), numSamples, bestOrder, partitionSums.data());
+}
+
+//=============================================================
+FlacDecoder::FlacDecoder()
+    : data (nullptr), size (0), position (0), numChannels (0), sampleRate (0), bitDepth (0), numSamplesPerChannel (0)
+{
+}
+
+//=============================================================
+bool FlacDecoder::open (const uint8_t* newData, size_t newSize)
+{
+    data = newData;
+    size = newSize;
+    position = 0;
+    
+    // the STREAMINFO block always comes first
+    if (size < 42 || std::memcmp (data, "fLaC", 4) != 0 || (data[4] & 0x7F) != 0)
+        return false;
+    
+    const uint8_t* streamInfo = data + 8;
+    sampleRate = ((uint32_t) streamInfo[10] << 12) | ((uint32_t) streamInfo[11] << 4) | (streamInfo[12] >> 4);
+    numChannels = ((streamInfo[12] >> 1) & 0x07) + 1;
+    bitDepth = (((streamInfo[12] & 0x01) << 4) | (streamInfo[13] >> 4)) + 1;
+    numSamplesPerChannel = ((uint64_t) (streamInfo[13] & 0x0F) << 32) | ((uint64_t) streamInfo[14] << 24) | ((uint64_t) streamInfo[15] << 16) | ((uint64_t) streamInfo[16] << 8) | streamInfo[17];
+    
+    if (bitDepth < 4 || bitDepth > 24)
+        return false;
+    
+    // skip all metadata blocks up to the last one
+    size_t offset = 4;
+    while (true)
+    {
+        if (offset + 4 > size)
+            return false;
+    
+        const bool isLastBlock = (data[offset] & 0x80) != 0;
+        offset += 4 + (((size_t) data[offset + 1] << 16) | ((size_t) data[offset + 2] << 8) | data[offset + 3]);
+    
+        if (isLastBlock)
+            break;
+    }
+    
+    if (offset > size)
+        return false;
+    
+    position = offset;
+    frameSamples.resize (numChannels);
+    return true;
+}
+
+//=============================================================
+int FlacDecoder::getNumChannels() const
+{
+    return numChannels;
+}
+
+//=============================================================
+uint32_t FlacDecoder::getSampleRate() const
+{
+    return sampleRate;
+}
+
+//=============================================================
+int FlacDecoder::getBitDepth() const
+{
+    return bitDepth;
+}
+
+//=============================================================
+uint64_t FlacDecoder::getNumSamplesPerChannel() const
+{
+    return numSamplesPerChannel;
+}
+
+//=============================================================
+const int32_t* FlacDecoder::getFrameSamples (int channel) const
+{
+    return frameSamples[channel].data();
+}
+
+//=============================================================
+size_t FlacDecoder::getPosition() const
+{
+    return position;
+}
+
+//=============================================================
+int FlacDecoder::readFrame()
+{
+    if (data == nullptr || position + 2 > size)
+        return 0;
+    
+    FlacBitReader reader (data + position, size - position);
+    
+    // -----------------------------------------------------------
+    // Frame header
+    if (reader.read (14) != 0x3FFE || reader.read (1) != 0)
+        return 0;
+    
+    reader.read (1);
+    const uint32_t blockSizeCode = reader.read (4);
+    const uint32_t sampleRateCode = reader.read (4);
+    const uint32_t channelAssignment = reader.read (4);
+    const uint32_t sampleSizeCode = reader.read (3);
+    
+    if (reader.read (1) != 0 || blockSizeCode == 0 || sampleRateCode == 15 || channelAssignment > 10 || sampleSizeCode == 3 || sampleSizeCode == 7)
+        return 0;
+    
+    // the frame or sample number is coded like a UTF-8 character
+    const uint32_t firstByte = reader.read (8);
+    int numBytes = 0;
+    while (numBytes < 8 && (firstByte & (0x80 >> numBytes)) != 0)
+        numBytes++;
+    
+    if (numBytes == 1 || numBytes == 8)
+        return 0;
+    
+    for (int i = 1; i < numBytes; i++)
+    {
+        if ((reader.read (8) & 0xC0) != 0x80)
+            return 0;
+    }
+    
+    int numSamples = 0;
+    if (blockSizeCode == 1)
+        numSamples = 192;
+    else if (blockSizeCode <= 5)
+        numSamples = 576 << (blockSizeCode - 2);
+    else if (blockSizeCode == 6)
+        numSamples = (int) reader.read (8) + 1;
+    else if (blockSizeCode == 7)
+        numSamples = (int) reader.read (16) + 1;
+    else
+        numSamples = 256 << (blockSizeCode - 8);
+    
+    if (sampleRateCode == 12)
+        reader.read (8);
+    else if (sampleRateCode == 13 || sampleRateCode == 14)
+        reader.read (16);
+    
+    const size_t headerSize = reader.getBytePosition();
+    if (reader.read (8) != flacCrc8 (data + position, headerSize) || reader.hasFailed())
+        return 0;
+    
+    const int frameChannels = channelAssignment < 8 ? (int) channelAssignment + 1 : 2;
+    static const int sampleSizes[] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+    const int frameBitDepth = sampleSizeCode == 0 ? bitDepth : sampleSizes[sampleSizeCode];
+    
+    if (frameChannels != numChannels)
+        return 0;
+    
+    // -----------------------------------------------------------
+    // Subframes, the side signal has one more bit
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+        const bool isSide = (channelAssignment == 8 && channel == 1) || (channelAssignment == 9 && channel == 0) || (channelAssignment == 10 && channel == 1);
+        frameSamples[channel].resize (numSamples);
+    
+        if (! decodeSubframe (reader, frameSamples[channel].data(), numSamples, isSide ? frameBitDepth + 1 : frameBitDepth))
+            return 0;
+    }
+    
+    reader.alignToByte();
+    const size_t frameSize = reader.getBytePosition();
+    if (reader.read (16) != flacCrc16 (data + position, frameSize) || reader.hasFailed())
+        return 0;
+    
+    // -----------------------------------------------------------
+    // Undo the stereo decorrelation
+    if (channelAssignment >= 8)
+    {
+        int32_t* first = frameSamples[0].data();
+        int32_t* second = frameSamples[1].data();
+    
+        for (int i = 0; i < numSamples; i++)
+        {
+            if (channelAssignment == 8)
+            {
+                second[i] = first[i] - second[i];
+            }
+            else if (channelAssignment == 9)
+            {
+                first[i] += second[i];
+            }
+            else
+            {
+                const int32_t side = second[i];
+                const int32_t mid = (int32_t) ((uint32_t) first[i] << 1) | (side & 1);
+                first[i] = (mid + side) >> 1;
+                second[i] = (mid - side) >> 1;
+            }
+        }
+    }
+    
+    position += frameSize + 2;
+    return numSamples;
+}
+
+//=============================================================
+bool FlacDecoder::decodeSubframe (FlacBitReader& reader, int32_t* samples, int numSamples, int subframeBitDepth)
+{
+    if (reader.read (1) != 0)
+        return false;
+    
+    const uint32_t type = reader.read (6);
+    
+    int numWastedBits = 0;
+    if (reader.read (1) != 0)
+        numWastedBits = (int) reader.readUnary() + 1;
+    
+    subframeBitDepth -= numWastedBits;
+    if (subframeBitDepth <= 0 || reader.hasFailed())
+        return false;
+    
+    if (type == 0)
+    {
+        std::fill (samples, samples + numSamples, reader.readSigned (subframeBitDepth));
+    }
+    else if (type == 1)
+    {
+        for (int i = 0; i < numSamples; i++)
+            samples[i] = reader.readSigned (subframeBitDepth);
+    }
+    else if ((type >= 8 && type <= 12) || type >= 32)
+    {
+        const bool isLpc = type >= 32;
+        const int order = isLpc ? (int) (type & 0x1F) + 1 : (int) type - 8;
+    
+        if (order > numSamples)
+            return false;
+    
+        for (int i = 0; i < order; i++)
+            samples[i] = reader.readSigned (subframeBitDepth);
+    
+        int32_t coefficients[32];
+        int precision = 0;
+        int shift = 0;
+    
+        if (isLpc)
+        {
+            precision = (int) reader.read (4) + 1;
+            shift = reader.readSigned (5);
+    
+            if (precision == 16 || shift < 0)
+                return false;
+    
+            for (int i = 0; i < order; i++)
+                coefficients[i] = reader.readSigned (precision);
+        }
+    
+        // -----------------------------------------------------------
+        // Residual, Rice coded in partitions, each with its own parameter or escaped to plain values
+        const uint32_t method = reader.read (2);
+        const int partitionOrder = (int) reader.read (4);
+        const int numPartitions = 1 << partitionOrder;
+    
+        if (method > 1 || numSamples % numPartitions != 0 || (numSamples >> partitionOrder) < order)
+            return false;
+    
+        const int parameterBits = method == 1 ? 5 : 4;
+        const uint32_t escapeParameter = method == 1 ? 31 : 15;
+        int i = order;
+    
+        for (int partition = 0; partition < numPartitions; partition++)
+        {
+            const uint32_t parameter = reader.read (parameterBits);
+            const int end = (partition + 1) * (numSamples >> partitionOrder);
+    
+            if (parameter == escapeParameter)
+            {
+                const int numBits = (int) reader.read (5);
+                for (; i < end; i++)
+                    samples[i] = reader.readSigned (numBits);
+            }
+            else
+            {
+                for (; i < end; i++)
+                {
+                    const uint32_t value = (reader.readUnary() << parameter) | reader.read ((int) parameter);
+                    samples[i] = (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+                }
+            }
+    
+            if (reader.hasFailed())
+                return false;
+        }
+    
+        // -----------------------------------------------------------
+        // Add the prediction to the residual
+        for (i = order; i < numSamples; i++)
+        {
+            int64_t prediction = 0;
+    
+            if (isLpc)
+            {
+                for (int j = 0; j < order; j++)
+                    prediction += (int64_t) coefficients[j] * samples[i - j - 1];
+                prediction >>= shift;
+            }
+            else if (order == 1)
+                prediction = samples[i - 1];
+            else if (order == 2)
+                prediction = 2 * (int64_t) samples[i - 1] - samples[i - 2];
+            else if (order == 3)
+                prediction = 3 * ((int64_t) samples[i - 1] - samples[i - 2]) + samples[i - 3];
+            else if (order == 4)
+                prediction = 4 * ((int64_t) samples[i - 1] + samples[i - 3]) - 6 * (int64_t) samples[i - 2] - samples[i - 4];
+    
+            samples[i] = (int32_t) (samples[i] + prediction);
+        }
+    }
+    else
+    {
+        return false;
+    }
+    
+    if (numWastedBits > 0)
+    {
+        for (int i = 0; i < numSamples; i++)
+            samples[i] = (int32_t) ((uint32_t) samples[i] << numWastedBits);
+    }
+    
+    return ! reader.hasFailed();
+}
+
+//=============================================================
+namespace FlacStream
+{
+    bool finalise (std::string filePath)
+    {
+        std::fstream file (filePath, std::ios::in | std::ios::out | std::ios::binary);
+        if (! file.is_open())
+            return false;
+    
+        file.seekg (0, std::ios::end);
+        std::vector<uint8_t> fileData ((size_t) file.tellg());
+        file.seekg (0, std::ios::beg);
+        file.read (reinterpret_cast<char*> (fileData.data()), fileData.size());
+    
+        // Frames have no size field, so the whole stream is decoded to find them
+        FlacDecoder decoder;
+        if (! decoder.open (fileData.data(), fileData.size()))
+            return false;
+    
+        uint64_t numSamplesPerChannel = 0;
+        uint32_t minFrameSize = 0;
+        uint32_t maxFrameSize = 0;
+        size_t frameStart = decoder.getPosition();
+    
+        while (const int numSamples = decoder.readFrame())
+        {
+            const uint32_t frameSize = (uint32_t) (decoder.getPosition() - frameStart);
+            minFrameSize = minFrameSize == 0 ? frameSize : std::min (minFrameSize, frameSize);
+            maxFrameSize = std::max (maxFrameSize, frameSize);
+            numSamplesPerChannel += numSamples;
+            frameStart = decoder.getPosition();
+        }
+    
+        // Patch the frame sizes (bytes 12 to 17) and the number of samples (the lower nibble of byte 21 and bytes 22 to 25)
+        uint8_t* streamInfo = fileData.data() + 8;
+        streamInfo[4] = (uint8_t) (minFrameSize >> 16);
+        streamInfo[5] = (uint8_t) (minFrameSize >> 8);
+        streamInfo[6] = (uint8_t) minFrameSize;
+        streamInfo[7] = (uint8_t) (maxFrameSize >> 16);
+        streamInfo[8] = (uint8_t) (maxFrameSize >> 8);
+        streamInfo[9] = (uint8_t) maxFrameSize;
+        streamInfo[13] = (uint8_t) ((streamInfo[13] & 0xF0) | ((numSamplesPerChannel >> 32) & 0x0F));
+        streamInfo[14] = (uint8_t) (numSamplesPerChannel >> 24);
+        streamInfo[15] = (uint8_t) (numSamplesPerChannel >> 16);
+        streamInfo[16] = (uint8_t) (numSamplesPerChannel >> 8);
+        streamInfo[17] = (uint8_t) numSamplesPerChannel;
+    
+        file.seekp (12, std::ios::beg);
+        file.write (reinterpret_cast<const char*> (streamInfo + 4), 14);
+    
+        return file.good();
+    }
+}
+
+//=============================================================
+static uint32_t readUInt32 (const uint8_t* data)
+{
+    return (uint32_t) data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+//=============================================================
+static uint16_t readUInt16 (const uint8_t* data)
+{
+    return (uint16_t) (data[0] | (data[1] << 8));
+}
+
+//=============================================================
+static uint64_t readUInt64 (const uint8_t* data)
+{
+    return (uint64_t) readUInt32 (data) | ((uint64_t) readUInt32 (data + 4) << 32);
+}
+
+//=============================================================
+static uint32_t readUInt32BigEndian (const uint8_t* data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+//=============================================================
+static uint16_t readUInt16BigEndian (const uint8_t* data)
+{
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+//=============================================================
+AudioFileView::AudioFileView()
+    : mapping (nullptr), mappingSize (0), sampleData (nullptr), numSamplesPerChannel (0), sampleRate (0), numChannels (0), bitDepth (0)
+#if defined(_WIN32)
+    , fileHandle (nullptr), mappingHandle (nullptr)
+#else
+    , fileDescriptor (-1)
+#endif
+{
+}
+
+//=============================================================
+AudioFileView::~AudioFileView()
+{
+    close();
+}
+
+//=============================================================
+bool AudioFileView::open (const std::string& filePath)
+{
+    close();
+    
+#if defined(_WIN32)
+    HANDLE file = CreateFileA (filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    fileHandle = file;
+    
+    LARGE_INTEGER length;
+    if (! GetFileSizeEx (file, &length) || length.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    mappingSize = (uint64_t) length.QuadPart;
+    
+    HANDLE fileMapping = CreateFileMappingA (file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (fileMapping == nullptr)
+    {
+        close();
+        return false;
+    }
+    mappingHandle = fileMapping;
+    mapping = static_cast<const uint8_t*> (MapViewOfFile (fileMapping, FILE_MAP_READ, 0, 0, 0));
+#elif defined(__ORBIS__)
+    fileDescriptor = sceKernelOpen (filePath.c_str(), SCE_KERNEL_O_RDONLY, 0);
+    if (fileDescriptor < 0)
+        return false;
+    
+    SceKernelStat status;
+    if (sceKernelFstat (fileDescriptor, &status) != SCE_OK || status.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+    mappingSize = (uint64_t) status.st_size;
+    
+    void* fileMapping = nullptr;
+    if (sceKernelMmap (nullptr, (size_t) mappingSize, SCE_KERNEL_PROT_CPU_READ, SCE_KERNEL_MAP_SHARED, fileDescriptor, 0, &fileMapping) == SCE_OK)
+        mapping = static_cast<const uint8_t*> (fileMapping);
+#else
+    fileDescriptor = ::open (filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0)
+        return false;
+    
+    struct stat status;
+    if (fstat (fileDescriptor, &status) != 0 || status.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+    mappingSize = (uint64_t) status.st_size;
+    
+    void* fileMapping = mmap (nullptr, (size_t) mappingSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if (fileMapping != MAP_FAILED)
+    {
+        // Analysis tools mostly read recordings from front to back
+        madvise (fileMapping, (size_t) mappingSize, MADV_SEQUENTIAL);
+        mapping = static_cast<const uint8_t*> (fileMapping);
+    }
+#endif
+    
+    if (mapping == nullptr || ! parseChunks())
+    {
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+//=============================================================
+void AudioFileView::close()
+{
+#if defined(_WIN32)
+    if (mapping != nullptr)
+        UnmapViewOfFile (mapping);
+    if (mappingHandle != nullptr)
+        CloseHandle (static_cast<HANDLE> (mappingHandle));
+    if (fileHandle != nullptr)
+        CloseHandle (static_cast<HANDLE> (fileHandle));
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#elif defined(__ORBIS__)
+    if (mapping != nullptr)
+        sceKernelMunmap (const_cast<uint8_t*> (mapping), (size_t) mappingSize);
+    if (fileDescriptor >= 0)
+        sceKernelClose (fileDescriptor);
+    fileDescriptor = -1;
+#else
+    if (mapping != nullptr)
+        munmap (const_cast<uint8_t*> (mapping), (size_t) mappingSize);
+    if (fileDescriptor >= 0)
+        ::close (fileDescriptor);
+    fileDescriptor = -1;
+#endif
+    
+    mapping = nullptr;
+    mappingSize = 0;
+    sampleData = nullptr;
+    numSamplesPerChannel = 0;
+    sampleRate = 0;
+    numChannels = 0;
+    bitDepth = 0;
+}
+
+//=============================================================
+bool AudioFileView::isOpen() const
+{
+    return mapping != nullptr;
+}
+
+//=============================================================
+bool AudioFileView::parseChunks()
+{
+    const bool isRF64 = mappingSize >= 4 && std::memcmp (mapping, "RF64", 4) == 0;
+    
+    if (mappingSize < 12 || (std::memcmp (mapping, "RIFF", 4) != 0 && ! isRF64) || std::memcmp (mapping + 8, "WAVE", 4) != 0)
+    {
+        std::cout << "ERROR: this doesn't seem to be a valid .WAV file" << std::endl;
+        return false;
+    }
+    
+    // -----------------------------------------------------------
+    // walk the chunks instead of searching for their names, so sample data is never mistaken for a chunk
+    const uint8_t* formatChunk = nullptr;
+    uint64_t dataStart = 0;
+    uint64_t dataSize = 0;
+    uint64_t position = 12;
+    uint64_t ds64DataSize = 0;
+    
+    while (position + 8 <= mappingSize)
+    {
+        const uint8_t* chunk = mapping + position;
+        const uint64_t chunkSize = readUInt32 (chunk + 4);
+        
+        if (std::memcmp (chunk, "fmt ", 4) == 0 && chunkSize >= 16 && position + 8 + 16 <= mappingSize)
+        {
+            formatChunk = chunk + 8;
+        }
+        else if (isRF64 && std::memcmp (chunk, "ds64", 4) == 0 && chunkSize >= 16 && position + 8 + 16 <= mappingSize)
+        {
+            // the 64 bit RIFF size is followed by the 64 bit data size
+            ds64DataSize = readUInt64 (chunk + 16);
+        }
+        else if (std::memcmp (chunk, "data", 4) == 0)
+        {
+            dataStart = position + 8;
+            
+            // recordings that were never finalised still have placeholder sizes, so they are read up to the end
+            const uint64_t available = mappingSize - dataStart;
+            const uint64_t size = (chunkSize == 0xFFFFFFFF && ds64DataSize > 0) ? ds64DataSize : chunkSize;
+            dataSize = (size == 0 || size == 0xFFFFFFFF || size > available) ? available : size;
+            break;
+        }
+        
+        // chunks are padded to an even size
+        position += 8 + chunkSize + (chunkSize & 1);
+    }
+    
+    if (formatChunk == nullptr || dataStart == 0)
+    {
+        std::cout << "ERROR: this doesn't seem to be a valid .WAV file" << std::endl;
+        return false;
+    }
+    
+    // -----------------------------------------------------------
+    // FORMAT CHUNK
+    const uint16_t audioFormat = readUInt16 (formatChunk);
+    numChannels = readUInt16 (formatChunk + 2);
+    sampleRate = readUInt32 (formatChunk + 4);
+    bitDepth = readUInt16 (formatChunk + 14);
+    
+    // check that the audio format is PCM, possibly in the extensible format
+    if (audioFormat != 1 && audioFormat != 0xFFFE)
+    {
+        std::cout << "ERROR: this is a compressed .WAV file and this library does not support decoding them at present" << std::endl;
+        return false;
+    }
+    
+    if (numChannels < 1 || (bitDepth != 8 && bitDepth != 16 && bitDepth != 24))
+    {
+        std::cout << "ERROR: this file has no channels or a bit depth that is not 8, 16 or 24 bits" << std::endl;
+        return false;
+    }
+    
+    // -----------------------------------------------------------
+    // DATA CHUNK
+    sampleData = mapping + dataStart;
+    numSamplesPerChannel = dataSize / (uint64_t) (numChannels * (bitDepth / 8));
+    
+    return true;
+}
+
+//=============================================================
+uint32_t AudioFileView::getSampleRate() const
+{
+    return sampleRate;
+}
+
+//=============================================================
+int AudioFileView::getNumChannels() const
+{
+    return numChannels;
+}
+
+//=============================================================
+int AudioFileView::getBitDepth() const
+{
+    return bitDepth;
+}
+
+//=============================================================
+uint64_t AudioFileView::getNumSamplesPerChannel() const
+{
+    return numSamplesPerChannel;
+}
+
+//=============================================================
+double AudioFileView::getLengthInSeconds() const
+{
+    return sampleRate > 0 ? (double) numSamplesPerChannel / (double) sampleRate : 0.;
+}
+
+//=============================================================
+SampleSpan<uint8_t> AudioFileView::getData() const
+{
+    SampleSpan<uint8_t> span;
+    span.data = sampleData;
+    span.size = (size_t) (numSamplesPerChannel * numChannels * (bitDepth / 8));
+    return span;
+}
+
+//=============================================================
+SampleSpan<uint8_t> AudioFileView::getData (uint64_t startSample, uint64_t endSample) const
+{
+    startSample = std::min (startSample, numSamplesPerChannel);
+    endSample = std::min (std::max (endSample, startSample), numSamplesPerChannel);
+    
+    const uint64_t numBytesPerFrame = (uint64_t) (numChannels * (bitDepth / 8));
+    SampleSpan<uint8_t> span;
+    span.data = sampleData != nullptr ? sampleData + startSample * numBytesPerFrame : nullptr;
+    span.size = (size_t) ((endSample - startSample) * numBytesPerFrame);
+    return span;
+}
+
+//=============================================================
+SampleSpan<uint8_t> AudioFileView::getSlice (double startSeconds, double endSeconds) const
+{
+    return getData (getSampleIndex (startSeconds), getSampleIndex (endSeconds));
+}
+
+//=============================================================
+uint64_t AudioFileView::getSampleIndex (double seconds) const
+{
+    // sample i starts at i / sampleRate, so a half-open range of times covers the samples from the first index at or after its start
+    const double sampleIndex = std::ceil (seconds * (double) sampleRate);
+    
+    if (! (sampleIndex > 0.))
+        return 0;
+    
+    return sampleIndex < (double) numSamplesPerChannel ? (uint64_t) sampleIndex : numSamplesPerChannel;
+}
+
+//=============================================================
+float AudioFileView::getSample (int channel, uint64_t sampleIndex) const
+{
+    assert (channel >= 0 && channel < numChannels && sampleIndex < numSamplesPerChannel);
+    
+    const int numBytesPerSample = bitDepth / 8;
+    const uint8_t* sample = sampleData + (sampleIndex * numChannels + channel) * numBytesPerSample;
+    
+    if (bitDepth == 8)
+    {
+        return (float) ((int32_t) sample[0] - 128) / 128.f;
+    }
+    else if (bitDepth == 16)
+    {
+        return (float) (int16_t) readUInt16 (sample) / 32768.f;
+    }
+    else
+    {
+        int32_t sampleAsInt = (sample[2] << 16) | (sample[1] << 8) | sample[0];
+        
+        if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
+            sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
+        
+        return (float) sampleAsInt / 8388608.f;
+    }
+}
+
+//=============================================================
+AudioFileReader::AudioFileReader (size_t chunkSizeInBytes)
+    : audioFileFormat (AudioFileFormat::NotLoaded),
+      dataStart (0),
+      numSamplesPerChannel (0),
+      sampleRate (0),
+      numChannels (0),
+      bitDepth (0),
+      numFramesPerChunk (0),
+      requestedChunkSize (chunkSizeInBytes),
+      position (0),
+      currentChunk (0),
+      requestedFrame (0),
+      isLoading (false),
+      stopThread (false)
+{
+}
+
+//=============================================================
+AudioFileReader::~AudioFileReader()
+{
+    close();
+}
+
+//=============================================================
+bool AudioFileReader::open (const std::string& filePath)
+{
+    close();
+    
+    file.open (filePath, std::ios::binary);
+    
+    if (! file.is_open())
+    {
+        std::cout << "ERROR: File doesn't exist or otherwise can't load file" << std::endl;
+        std::cout << filePath << std::endl;
+        return false;
+    }
+    
+    file.seekg (0, std::ios::end);
+    const uint64_t fileSize = (uint64_t) file.tellg();
+    
+    uint8_t header[12];
+    bool parsed = false;
+    
+    if (readAt (0, header, sizeof (header)) == sizeof (header))
+    {
+        if ((std::memcmp (header, "RIFF", 4) == 0 || std::memcmp (header, "RF64", 4) == 0) && std::memcmp (header + 8, "WAVE", 4) == 0)
+        {
+            audioFileFormat = AudioFileFormat::Wave;
+            parsed = parseWaveChunks (fileSize);
+        }
+        else if (std::memcmp (header, "FORM", 4) == 0 && std::memcmp (header + 8, "AIFF", 4) == 0)
+        {
+            audioFileFormat = AudioFileFormat::Aiff;
+            parsed = parseAiffChunks (fileSize);
+        }
+        else
+        {
+            std::cout << "Audio File Type: " << "Error" << std::endl;
+        }
+    }
+    
+    if (! parsed)
+    {
+        file.close();
+        audioFileFormat = AudioFileFormat::Error;
+        return false;
+    }
+    
+    // both chunks are allocated once here, reading never allocates afterwards
+    const size_t numBytesPerFrame = (size_t) (numChannels * (bitDepth / 8));
+    numFramesPerChunk = std::max<size_t> (1, requestedChunkSize / numBytesPerFrame);
+    
+    for (auto& chunk : chunks)
+    {
+        chunk.data.resize (numFramesPerChunk * numBytesPerFrame);
+        chunk.firstFrame = 0;
+        chunk.numFrames = 0;
+    }
+    
+    position = 0;
+    currentChunk = 0;
+    isLoading = false;
+    stopThread = false;
+    thread = std::thread (&AudioFileReader::readChunks, this);
+    
+    // start reading the first chunk right away
+    std::lock_guard<std::mutex> lock (mutex);
+    requestChunk (0);
+    
+    return true;
+}
+
+//=============================================================
+void AudioFileReader::close()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            stopThread = true;
+        }
+        
+        condition.notify_all();
+        thread.join();
+    }
+    
+    if (file.is_open())
+        file.close();
+    
+    for (auto& chunk : chunks)
+    {
+        std::vector<uint8_t>().swap (chunk.data);
+        chunk.firstFrame = 0;
+        chunk.numFrames = 0;
+    }
+    
+    audioFileFormat = AudioFileFormat::NotLoaded;
+    dataStart = 0;
+    numSamplesPerChannel = 0;
+    sampleRate = 0;
+    numChannels = 0;
+    bitDepth = 0;
+    position = 0;
+    isLoading = false;
+}
+
+//=============================================================
+bool AudioFileReader::isOpen() const
+{
+    // the file itself belongs to the helper thread while it is running
+    return thread.joinable();
+}
+
+//=============================================================
+size_t AudioFileReader::readAt (uint64_t offset, uint8_t* buffer, size_t size)
+{
+    file.clear();
+    file.seekg ((std::streamoff) offset);
+    file.read (reinterpret_cast<char*> (buffer), (std::streamsize) size);
+    return (size_t) file.gcount();
+}
+
+//=============================================================
+bool AudioFileReader::parseWaveChunks (uint64_t fileSize)
+{
+    // walk the chunks like AudioFileView, but read each chunk header from the file
+    uint8_t formatChunk[16];
+    bool hasFormatChunk = false;
+    uint64_t dataSize = 0;
+    uint64_t ds64DataSize = 0;
+    uint64_t chunkPosition = 12;
+    dataStart = 0;
+    
+    while (chunkPosition + 8 <= fileSize)
+    {
+        uint8_t chunkHeader[8];
+        if (readAt (chunkPosition, chunkHeader, sizeof (chunkHeader)) != sizeof (chunkHeader))
+            break;
+        
+        const uint64_t chunkSize = readUInt32 (chunkHeader + 4);
+        
+        if (std::memcmp (chunkHeader, "fmt ", 4) == 0 && chunkSize >= 16)
+        {
+            hasFormatChunk = readAt (chunkPosition + 8, formatChunk, sizeof (formatChunk)) == sizeof (formatChunk);
+        }
+        else if (std::memcmp (chunkHeader, "ds64", 4) == 0 && chunkSize >= 16)
+        {
+            // RF64 files keep their sizes here, the 64 bit RIFF size is followed by the 64 bit data size
+            uint8_t sizes[16];
+            if (readAt (chunkPosition + 8, sizes, sizeof (sizes)) == sizeof (sizes))
+                ds64DataSize = readUInt64 (sizes + 8);
+        }
+        else if (std::memcmp (chunkHeader, "data", 4) == 0)
+        {
+            dataStart = chunkPosition + 8;
+            
+            // recordings that were never finalised still have placeholder sizes, so they are read up to the end
+            const uint64_t available = fileSize - dataStart;
+            const uint64_t size = (chunkSize == 0xFFFFFFFF && ds64DataSize > 0) ? ds64DataSize : chunkSize;
+            dataSize = (size == 0 || size == 0xFFFFFFFF || size > available) ? available : size;
+            break;
+        }
+        
+        // chunks are padded to an even size
+        chunkPosition += 8 + chunkSize + (chunkSize & 1);
+    }
+    
+    if (! hasFormatChunk || dataStart == 0)
+    {
+        std::cout << "ERROR: this doesn't seem to be a valid .WAV file" << std::endl;
+        return false;
+    }
+    
+    // -----------------------------------------------------------
+    // FORMAT CHUNK
+    const uint16_t audioFormat = readUInt16 (formatChunk);
+    numChannels = readUInt16 (formatChunk + 2);
+    sampleRate = readUInt32 (formatChunk + 4);
+    bitDepth = readUInt16 (formatChunk + 14);
+    
+    // check that the audio format is PCM, possibly in the extensible format
+    if (audioFormat != 1 && audioFormat != 0xFFFE)
+    {
+        std::cout << "ERROR: this is a compressed .WAV file and this library does not support decoding them at present" << std::endl;
+        return false;
+    }
+    
+    if (numChannels < 1 || (bitDepth != 8 && bitDepth != 16 && bitDepth != 24))
+    {
+        std::cout << "ERROR: this file has no channels or a bit depth that is not 8, 16 or 24 bits" << std::endl;
+        return false;
+    }
+    
+    numSamplesPerChannel = dataSize / (uint64_t) (numChannels * (bitDepth / 8));
+    return true;
+}
+
+//=============================================================
+bool AudioFileReader::parseAiffChunks (uint64_t fileSize)
+{
+    // the common chunk may come before or after the sound data chunk, so all chunks are walked
+    uint8_t commonChunk[18];
+    bool hasCommonChunk = false;
+    uint64_t chunkPosition = 12;
+    dataStart = 0;
+    
+    while (chunkPosition + 8 <= fileSize)
+    {
+        uint8_t chunkHeader[8];
+        if (readAt (chunkPosition, chunkHeader, sizeof (chunkHeader)) != sizeof (chunkHeader))
+            break;
+        
+        const uint64_t chunkSize = readUInt32BigEndian (chunkHeader + 4);
+        
+        if (std::memcmp (chunkHeader, "COMM", 4) == 0 && chunkSize >= 18)
+        {
+            hasCommonChunk = readAt (chunkPosition + 8, commonChunk, sizeof (commonChunk)) == sizeof (commonChunk);
+        }
+        else if (std::memcmp (chunkHeader, "SSND", 4) == 0)
+        {
+            uint8_t offset[4];
+            if (readAt (chunkPosition + 8, offset, sizeof (offset)) == sizeof (offset))
+                dataStart = chunkPosition + 16 + readUInt32BigEndian (offset);
+        }
+        
+        chunkPosition += 8 + chunkSize + (chunkSize & 1);
+    }
+    
+    if (! hasCommonChunk || dataStart == 0 || dataStart > fileSize)
+    {
+        std::cout << "ERROR: this doesn't seem to be a valid AIFF file" << std::endl;
+        return false;
+    }
+    
+    // -----------------------------------------------------------
+    // COMM CHUNK
+    numChannels = readUInt16BigEndian (commonChunk);
+    const uint64_t numSampleFrames = readUInt32BigEndian (commonChunk + 2);
+    bitDepth = readUInt16BigEndian (commonChunk + 6);
+    
+    // the sample rate is an 80 bit extended precision number: sign, 15 bit exponent and 64 bit mantissa
+    const uint8_t* rate = commonChunk + 8;
+    const int exponent = ((rate[0] & 0x7F) << 8 | rate[1]) - 16383;
+    const uint64_t mantissa = ((uint64_t) readUInt32BigEndian (rate + 2) << 32) | readUInt32BigEndian (rate + 6);
+    sampleRate = (uint32_t) std::ldexp ((double) mantissa, exponent - 63);
+    
+    if (numChannels < 1 || (bitDepth != 8 && bitDepth != 16 && bitDepth != 24))
+    {
+        std::cout << "ERROR: this file has no channels or a bit depth that is not 8, 16 or 24 bits" << std::endl;
+        return false;
+    }
+    
+    numSamplesPerChannel = std::min (numSampleFrames, (fileSize - dataStart) / (uint64_t) (numChannels * (bitDepth / 8)));
+    return true;
+}
+
+//=============================================================
+AudioFileFormat AudioFileReader::getAudioFileFormat() const
+{
+    return audioFileFormat;
+}
+
+//=============================================================
+uint32_t AudioFileReader::getSampleRate() const
+{
+    return sampleRate;
+}
+
+//=============================================================
+int AudioFileReader::getNumChannels() const
+{
+    return numChannels;
+}
+
+//=============================================================
+int AudioFileReader::getBitDepth() const
+{
+    return bitDepth;
+}
+
+//=============================================================
+uint64_t AudioFileReader::getNumSamplesPerChannel() const
+{
+    return numSamplesPerChannel;
+}
+
+//=============================================================
+double AudioFileReader::getLengthInSeconds() const
+{
+    return sampleRate > 0 ? (double) numSamplesPerChannel / (double) sampleRate : 0.;
+}
+
+//=============================================================
+uint64_t AudioFileReader::getPosition() const
+{
+    return position;
+}
+
+//=============================================================
+bool AudioFileReader::seek (uint64_t sampleIndex)
+{
+    if (! isOpen() || sampleIndex > numSamplesPerChannel)
+        return false;
+    
+    position = sampleIndex;
+    
+    // start reading the chunk early if neither chunk has it and the helper thread is idle
+    if (position < numSamplesPerChannel && ! chunks[currentChunk].contains (position))
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (! isLoading && ! chunks[1 - currentChunk].contains (position))
+            requestChunk (position);
+    }
+    
+    return true;
+}
+
+//=============================================================
+size_t AudioFileReader::read (float* const* channels, size_t numFrames)
+{
+    return readFrames (channels, numFrames);
+}
+
+//=============================================================
+size_t AudioFileReader::read (double* const* channels, size_t numFrames)
+{
+    return readFrames (channels, numFrames);
+}
+
+//=============================================================
+template <class T>
+size_t AudioFileReader::readFrames (T* const* channels, size_t numFrames)
+{
+    if (! isOpen())
+        return 0;
+    
+    const size_t numBytesPerFrame = (size_t) (numChannels * (bitDepth / 8));
+    std::vector<T*> channelsAtFrame (channels, channels + numChannels);
+    size_t numFramesRead = 0;
+    
+    while (numFramesRead < numFrames && position < numSamplesPerChannel)
+    {
+        if (! makeCurrent (position))
+            break;
+        
+        const Chunk& chunk = chunks[currentChunk];
+        const size_t offset = (size_t) (position - chunk.firstFrame);
+        const size_t numFramesToDecode = std::min (numFrames - numFramesRead, chunk.numFrames - offset);
+        
+        for (int channel = 0; channel < numChannels; channel++)
+            channelsAtFrame[channel] = channels[channel] + numFramesRead;
+        
+        PcmConversion::decode (chunk.data.data() + offset * numBytesPerFrame, audioFileFormat, bitDepth, numChannels, numFramesToDecode, channelsAtFrame.data());
+        
+        numFramesRead += numFramesToDecode;
+        position += numFramesToDecode;
+    }
+    
+    return numFramesRead;
+}
+
+//=============================================================
+bool AudioFileReader::makeCurrent (uint64_t frame)
+{
+    if (chunks[currentChunk].contains (frame))
+        return true;
+    
+    std::unique_lock<std::mutex> lock (mutex);
+    condition.wait (lock, [this] { return ! isLoading; });
+    
+    // usually the prefetched chunk is the right one, otherwise (e.g. after seeking) it is read now
+    Chunk& otherChunk = chunks[1 - currentChunk];
+    
+    if (! otherChunk.contains (frame))
+    {
+        requestChunk (frame);
+        condition.wait (lock, [this] { return ! isLoading; });
+        
+        if (! otherChunk.contains (frame))
+            return false;
+    }
+    
+    currentChunk = 1 - currentChunk;
+    
+    // the previous chunk is free now, so the helper thread can read ahead into it
+    const uint64_t nextFrame = otherChunk.firstFrame + otherChunk.numFrames;
+    if (nextFrame < numSamplesPerChannel)
+        requestChunk (nextFrame);
+    
+    return true;
+}
+
+//=============================================================
+void AudioFileReader::requestChunk (uint64_t frame)
+{
+    requestedFrame = frame;
+    isLoading = true;
+    condition.notify_all();
+}
+
+//=============================================================
+void AudioFileReader::readChunks()
+{
+    const size_t numBytesPerFrame = (size_t) (numChannels * (bitDepth / 8));
+    std::unique_lock<std::mutex> lock (mutex);
+    
+    while (true)
+    {
+        condition.wait (lock, [this] { return isLoading || stopThread; });
+        
+        if (stopThread)
+            return;
+        
+        // the current chunk only changes while nothing is loading, so the other one belongs to this thread now
+        Chunk& chunk = chunks[1 - currentChunk];
+        const uint64_t frame = requestedFrame;
+        lock.unlock();
+        
+        const size_t numFramesToRead = (size_t) std::min<uint64_t> (numFramesPerChunk, numSamplesPerChannel - frame);
+        const size_t numBytesRead = readAt (dataStart + frame * numBytesPerFrame, chunk.data.data(), numFramesToRead * numBytesPerFrame);
+        chunk.firstFrame = frame;
+        chunk.numFrames = numBytesRead / numBytesPerFrame;
+        
+        lock.lock();
+        isLoading = false;
+        condition.notify_all();
+    }
+}
 
 }
@@ -28,6 +28,11 @@
 #include <assert.h>
 #include <string>
 #include <stdint.h>
+#include <memory>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace AudioFile
 {
@@ -42,11 +47,100 @@ enum class AudioFileFormat
     Error,
     NotLoaded,
     Wave,
-    Aiff
+    Aiff,
+    Flac
 };
 
 //=============================================================
+/** A mutable range of samples of one channel that points into memory owned by someone else.
+ * It offers the parts of the std::vector interface needed to read and write samples in place.
+ */
+template <class T>
+class ChannelSpan
+{
+public:
+    ChannelSpan (T* channelData, size_t channelSize) : samples (channelData), numSamples (channelSize) {}
+    
+    T* data() const { return samples; }
+    size_t size() const { return numSamples; }
+    bool empty() const { return numSamples == 0; }
+    T* begin() const { return samples; }
+    T* end() const { return samples + numSamples; }
+    T& operator[] (size_t index) const { return samples[index]; }
+    
+private:
+    T* samples;
+    size_t numSamples;
+};
+
+//=============================================================
+/** Planar sample storage backed by a single aligned allocation instead of one vector per channel.
+ * Every channel starts on a cache line and all channels share the same capacity, so growing
+ * within the reserved capacity never moves or reallocates anything. Channels are accessed
+ * like before through samples[channel][sampleIndex], all channels always have the same length.
+ */
 template <class T>
+class ContiguousAudioBuffer
+{
+public:
+    
+    //=============================================================
+    /** The alignment of each channel in bytes */
+    static const size_t alignment = 64;
+    
+    //=============================================================
+    ContiguousAudioBuffer();
+    ContiguousAudioBuffer (const ContiguousAudioBuffer& other);
+    ContiguousAudioBuffer (ContiguousAudioBuffer&& other);
+    ContiguousAudioBuffer& operator= (const ContiguousAudioBuffer& other);
+    ContiguousAudioBuffer& operator= (ContiguousAudioBuffer&& other);
+    
+    //=============================================================
+    /** @Returns the number of channels */
+    size_t size() const { return numChannels; }
+    
+    /** @Returns true if there are no channels */
+    bool empty() const { return numChannels == 0; }
+    
+    /** @Returns the samples of a channel */
+    ChannelSpan<T> operator[] (size_t channel) { return ChannelSpan<T> (samples + channel * stride, numSamples); }
+    ChannelSpan<const T> operator[] (size_t channel) const { return ChannelSpan<const T> (samples + channel * stride, numSamples); }
+    
+    /** @Returns the number of samples per channel that fit without reallocating */
+    size_t capacity() const { return stride; }
+    
+    //=============================================================
+    /** Sets the number of channels and samples per channel. Existing samples are preserved
+     * and new ones are set to zero. This only reallocates if the reserved capacity is exceeded.
+     */
+    void resize (size_t newNumChannels, size_t newNumSamples);
+    
+    /** Makes sure that the given number of channels and samples per channel fit without reallocating */
+    void reserve (size_t numChannelsToReserve, size_t numSamplesToReserve);
+    
+    /** Removes all channels, but keeps the allocation */
+    void clear();
+    
+private:
+    
+    //=============================================================
+    /** Moves the samples into a new allocation with the given capacity */
+    void reallocate (size_t newNumReservedChannels, size_t newStride);
+    
+    //=============================================================
+    std::unique_ptr<uint8_t[]> memory;
+    T* samples;
+    size_t stride;
+    size_t numReservedChannels;
+    size_t numChannels;
+    size_t numSamples;
+};
+
+//=============================================================
+/** The sample storage is the default vector of vectors, which can be used and resized like any vector,
+ * or a ContiguousAudioBuffer (see ContiguousAudioFile below), which is a single allocation.
+ */
+template <class T, class Storage = std::vector<std::vector<T> > >
 class AudioFile
 {
 public:
@@ -120,13 +214,22 @@ public:
     /** Sets the sample rate for the audio file. If you use the save() function, this sample rate will be used */
     void setSampleRate (uint32_t newSampleRate);
     
+    /** Reserves memory for the given number of channels and samples per channel, so that growing the
+     * buffer up to that size doesn't reallocate. With the default storage, only channels that exist
+     * already have their samples reserved.
+     */
+    void reserve (int numChannels, int numSamplesPerChannel);
+    
+    /** Reserves memory for the given length in seconds at the current sample rate, see reserve() */
+    void reserveLength (int numChannels, double lengthInSeconds);
+    
     //=============================================================
-    /** A vector of vectors holding the audio samples for the AudioFile. You can 
+    /** The storage holding the audio samples for the AudioFile. You can 
      * access the samples by channel and then by sample index, i.e:
      *
      *      samples[channel][sampleIndex]
      */
-    AudioBuffer samples;
+    Storage samples;
     
 private:
     
@@ -141,10 +244,13 @@ private:
     AudioFileFormat determineAudioFileFormat (std::vector<uint8_t>& fileData);
     bool decodeWaveFile (std::vector<uint8_t>& fileData);
     bool decodeAiffFile (std::vector<uint8_t>& fileData);
+    bool decodeFlacFile (std::vector<uint8_t>& fileData);
     
     //=============================================================
     bool saveToWaveFile (std::string filePath);
+    void addWaveHeader (std::vector<uint8_t>& fileData, uint64_t dataChunkSize);
     bool saveToAiffFile (std::string filePath);
+    bool saveToFlacFile (std::string filePath);
     
     //=============================================================
     void clearAudioBuffer();
@@ -172,6 +278,639 @@ private:
     int bitDepth;
 };
 
+//=============================================================
+/** An AudioFile whose samples are kept in a single aligned allocation, see ContiguousAudioBuffer */
+template <class T>
+using ContiguousAudioFile = AudioFile<T, ContiguousAudioBuffer<T> >;
+
+//=============================================================
+/** Helpers for writing PCM wave files incrementally, e.g. while recording.
+ * The header is written up front with placeholder sizes and
+ * patched once all sample data has been appended to the file.
+ * Files that grow beyond 4 GB are turned into RF64 files when they are patched.
+ */
+namespace WaveStream
+{
+    /** Appends a PCM wave header with placeholder sizes to the given data.
+     * The header reserves room for a ds64 chunk in a JUNK chunk, so the file can become an RF64 file later on.
+     * @Returns the size of the header in bytes
+     */
+    size_t createHeader (std::vector<uint8_t>& fileData, int numChannels, uint32_t sampleRate, int bitDepth);
+    
+    /** Patches the size fields of an incrementally written wave file based on its current length.
+     * If the file is too large for RIFF and has a reserved chunk, it is switched to RF64 with the sizes in a ds64 chunk,
+     * otherwise the sizes are clamped. The sample data is never touched.
+     * @Returns true if the file could be patched
+     */
+    bool finalise (std::string filePath);
+}
+
+//=============================================================
+/** Bulk conversion between the PCM data of wave and AIFF files and separate channel buffers.
+ * The float versions use SSE2 (and SSSE3 for 24 bit samples) where available, everything else
+ * is converted in plain loops. Both produce exactly the same results as the original per-sample code.
+ * 8 bit samples are unsigned in wave files and signed in AIFF files, larger samples are little endian
+ * in wave files and big endian in AIFF files. When encoding, samples outside of [-1, 1) are clipped.
+ */
+namespace PcmConversion
+{
+    /** Decodes interleaved frames into the channel buffers, which must each have room for numFrames samples */
+    void decode (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, float* const* channels);
+    void decode (const uint8_t* source, AudioFileFormat format, int bitDepth, int numChannels, size_t numFrames, double* const* channels);
+    
+    /** Encodes the channel buffers into interleaved frames.
+     * The destination must have room for numFrames * numChannels * bitDepth / 8 bytes.
+     */
+    void encode (const float* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination);
+    void encode (const double* const* channels, int numChannels, size_t numFrames, AudioFileFormat format, int bitDepth, uint8_t* destination);
+    
+    /** Interleaves 16 bit channels without any conversion, the destination must have room for numFrames * numChannels samples */
+    void interleave (const int16_t* const* channels, int numChannels, size_t numFrames, int16_t* destination);
+}
+
+//=============================================================
+/** A streaming polyphase resampler for any rational ratio of two sample rates.
+ * The Kaiser-windowed sinc filter is split into one set of coefficients per phase when it is set up,
+ * so each output sample is a single dot product (with SSE2 where available) of one phase and the newest input samples.
+ * Blocks of any size can be passed in, the filter state is kept between calls, so the output doesn't depend on the block size.
+ */
+class Resampler
+{
+public:
+    
+    //=============================================================
+    /** The default number of zero crossings of the sinc on each side, which determines the steepness of the filter */
+    static const int defaultNumZeroCrossings = 24;
+    
+    /** The largest number of phases, i.e. the output rate divided by the greatest common divisor of both rates */
+    static const uint32_t maxNumPhases = 4096;
+    
+    //=============================================================
+    Resampler();
+    
+    //=============================================================
+    /** Computes the filter bank for the given rates and resets the state of all channels.
+     * @Returns false if a rate is zero or the ratio of the rates needs more than maxNumPhases phases
+     */
+    bool setup (uint32_t inputSampleRate, uint32_t outputSampleRate, int numChannels, int numZeroCrossings = defaultNumZeroCrossings);
+    
+    /** Clears the filter state, as if no samples had been processed since setup() */
+    void reset();
+    
+    //=============================================================
+    /** @Returns the largest number of frames process() can produce for the given number of input frames */
+    size_t getMaxOutputFrames (size_t numInputFrames) const;
+    
+    /** @Returns the delay of the filter in output frames, which is constant for all samples */
+    double getLatency() const;
+    
+    /** Resamples the next block of frames. The output channels must each have room for getMaxOutputFrames() samples.
+     * @Returns the number of frames written to the output channels
+     */
+    size_t process (const float* const* input, size_t numInputFrames, float* const* output);
+    
+private:
+    
+    //=============================================================
+    uint32_t interpolation;
+    uint32_t decimation;
+    int numChannels;
+    size_t numTaps;
+    double latency;
+    
+    /** The coefficients of all phases, each phase is numTaps long and in reverse order, so it lines up with the input */
+    std::vector<float> filterBank;
+    
+    /** The last numTaps - 1 input samples of each channel followed by room for the next block */
+    std::vector<std::vector<float>> history;
+    
+    /** The phase and input sample of the next output sample, relative to the start of the next block */
+    uint32_t phase;
+    size_t inputPosition;
+};
+
+//=============================================================
+/** Detects voice in a mono stream of 16 bit samples, frame by frame as blocks come in.
+ * Each frame of about 10 ms is described by its energy and zero-crossing rate, both computed with SSE2 where available.
+ * A frame is a candidate for voice if its level is clearly above the noise floor, which is tracked continuously,
+ * and if it doesn't cross zero as often as hiss does. Hysteresis turns the candidates into a stable decision:
+ * voice starts after a few candidates in a row and ends after a hangover of quieter frames,
+ * and each change is dated back to the first frame that caused it.
+ */
+class VoiceActivityDetector
+{
+public:
+    
+    //=============================================================
+    /** The parameters of the decision, they default to values that suit speech recorded with a headset */
+    struct Settings
+    {
+        Settings();
+        
+        /** The length of the frames the decision is made for */
+        float frameSeconds;
+        
+        /** How far above the noise floor a frame has to be to start voice, and to keep it going */
+        float onsetDecibels;
+        float releaseDecibels;
+        
+        /** Frames below this level never count as voice, however quiet the noise floor is */
+        float minLevelDecibels;
+        
+        /** Frames that cross zero more often than this fraction of their samples are treated as noise */
+        float maxZeroCrossingRate;
+        
+        /** The number of candidate frames in a row that start voice and of quiet frames in a row that end it */
+        int onsetFrames;
+        int hangoverFrames;
+        
+        /** How fast the noise floor may rise in dB per second, it falls immediately */
+        float noiseFloorRiseDecibels;
+    };
+    
+    /** The analysis of one frame */
+    struct Frame
+    {
+        /** The index of the first sample of the frame, counted from setup() or reset() */
+        uint64_t sampleIndex;
+        
+        /** The RMS level of the frame in dB relative to full scale and the fraction of its samples that crossed zero */
+        float levelDecibels;
+        float zeroCrossingRate;
+        
+        /** Whether voice is active after this frame */
+        bool voiceActive;
+        
+        /** Whether this frame changed the decision, the voice then started or ended at changeSampleIndex */
+        bool changed;
+        uint64_t changeSampleIndex;
+    };
+    
+    //=============================================================
+    VoiceActivityDetector();
+    
+    //=============================================================
+    /** Prepares the detector for the given rate and resets it.
+     * @Returns false if the rate is zero or a frame would be shorter than 8 or longer than 65536 samples
+     */
+    bool setup (uint32_t sampleRate, const Settings& newSettings = Settings());
+    
+    /** Forgets the noise floor and the decision, as if no samples had been processed since setup() */
+    void reset();
+    
+    //=============================================================
+    /** Analyses the next block of samples and appends one Frame for every frame that was completed.
+     * The rest of the block is kept for the next call, so the result doesn't depend on the block size.
+     * @Returns the number of frames that were appended
+     */
+    size_t process (const int16_t* samples, size_t numSamples, std::vector<Frame>& frames);
+    
+    /** @Returns the number of samples in each frame */
+    size_t getFrameSize() const;
+    
+    /** @Returns whether voice was active after the last frame */
+    bool isVoiceActive() const;
+    
+private:
+    
+    //=============================================================
+    void analyseFrame (std::vector<Frame>& frames);
+    
+    //=============================================================
+    Settings settings;
+    size_t frameSize;
+    float noiseFloorRise;
+    
+    /** The last sample of the previous frame followed by room for the current one, which the zero crossings need */
+    std::vector<int16_t> frameSamples;
+    size_t numFrameSamples;
+    uint64_t frameIndex;
+    
+    bool hasNoiseFloor;
+    float noiseFloor;
+    bool voiceActive;
+    int numCandidateFrames;
+    int numQuietFrames;
+    uint64_t firstCandidateIndex;
+    uint64_t firstQuietIndex;
+};
+
+//=============================================================
+class FlacBitWriter;
+class FlacBitReader;
+
+//=============================================================
+/** Encodes PCM data losslessly into a FLAC stream, block by block as it comes in.
+ * Each block is predicted with the best of the fixed polynomial predictors and a quantised LPC filter
+ * computed from its windowed autocorrelation, stereo blocks also try left/side, right/side and mid/side,
+ * and the prediction residual is Rice coded in partitions. The result can be read by any FLAC decoder.
+ * Once set up, nothing is allocated while encoding, apart from growing the output.
+ */
+class FlacEncoder
+{
+public:
+    
+    //=============================================================
+    /** The default number of samples per channel in each frame */
+    static const int defaultBlockSize = 4096;
+    
+    /** The default highest order of the LPC filters, higher orders compress a little better but take longer */
+    static const int defaultMaxLpcOrder = 8;
+    
+    //=============================================================
+    FlacEncoder();
+    
+    //=============================================================
+    /** Prepares the encoder for a new stream.
+     * @Returns false unless there are 1 to 8 channels of 8, 16 or 24 bit samples and the block size is 16 to 65535
+     */
+    bool setup (int numChannels, uint32_t sampleRate, int bitDepth, int blockSize = defaultBlockSize, int maxLpcOrder = defaultMaxLpcOrder);
+    
+    /** Appends the stream marker and the STREAMINFO block with what is known so far.
+     * While encoding, the number of samples and the smallest and largest frame are unknown and left at zero,
+     * see FlacStream::finalise(). After flush(), the header is complete and can replace the first one.
+     * @Returns the size of the header in bytes
+     */
+    size_t createHeader (std::vector<uint8_t>& fileData) const;
+    
+    /** Takes interleaved frames in the sample format of wave files and appends one FLAC frame
+     * to the output for every block that was filled up, the rest is kept for the next call.
+     * @Returns the number of bytes that were appended
+     */
+    size_t process (const uint8_t* waveData, size_t numFrames, std::vector<uint8_t>& output);
+    
+    /** Encodes the samples that are left as a shorter last frame.
+     * @Returns the number of bytes that were appended
+     */
+    size_t flush (std::vector<uint8_t>& output);
+    
+    /** @Returns the number of samples per channel that were encoded into frames */
+    uint64_t getNumSamplesPerChannel() const;
+    
+private:
+    
+    //=============================================================
+    void encodeFrame (int numSamples, std::vector<uint8_t>& output);
+    void encodeSubframe (FlacBitWriter& writer, const int32_t* signal, int numSamples, int subframeBitDepth);
+    
+    //=============================================================
+    int numChannels;
+    uint32_t sampleRate;
+    int bitDepth;
+    int blockSize;
+    int maxLpcOrder;
+    int lpcPrecision;
+    
+    /** The samples of the current block per channel, plus the side and mid signal for stereo streams */
+    std::vector<std::vector<int32_t>> blockSamples;
+    int numBufferedSamples;
+    
+    /** Scratch space for choosing the predictor of a subframe */
+    std::vector<double> window;
+    std::vector<double> windowedSignal;
+    std::vector<int32_t> residual;
+    std::vector<int32_t> bestResidual;
+    std::vector<uint64_t> partitionSums;
+    
+    uint32_t frameNumber;
+    uint64_t numEncodedSamples;
+    uint32_t minFrameSize;
+    uint32_t maxFrameSize;
+};
+
+//=============================================================
+/** Decodes a FLAC stream frame by frame. It reads the streams written by FlacEncoder and
+ * those of other encoders with up to 24 bits per sample. Every frame is checked with its CRC.
+ */
+class FlacDecoder
+{
+public:
+    
+    //=============================================================
+    FlacDecoder();
+    
+    //=============================================================
+    /** Reads the stream marker and skips all metadata blocks after the STREAMINFO block.
+     * The data is not copied and has to stay valid while frames are read.
+     * @Returns false if the data doesn't start with a FLAC stream this decoder supports
+     */
+    bool open (const uint8_t* data, size_t size);
+    
+    //=============================================================
+    int getNumChannels() const;
+    uint32_t getSampleRate() const;
+    int getBitDepth() const;
+    
+    /** @Returns the number of samples per channel in the STREAMINFO block, which is 0 while a stream is being written */
+    uint64_t getNumSamplesPerChannel() const;
+    
+    //=============================================================
+    /** Decodes the next frame.
+     * @Returns the number of samples per channel in the frame, 0 at the end of the stream or at the first damaged frame
+     */
+    int readFrame();
+    
+    /** @Returns the signed samples of one channel of the frame that was read last */
+    const int32_t* getFrameSamples (int channel) const;
+    
+    /** @Returns the offset of the next frame in the data, i.e. the end of the last valid frame */
+    size_t getPosition() const;
+    
+private:
+    
+    //=============================================================
+    bool decodeSubframe (FlacBitReader& reader, int32_t* samples, int numSamples, int subframeBitDepth);
+    
+    //=============================================================
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    
+    int numChannels;
+    uint32_t sampleRate;
+    int bitDepth;
+    uint64_t numSamplesPerChannel;
+    
+    std::vector<std::vector<int32_t>> frameSamples;
+};
+
+//=============================================================
+/** Helpers for FLAC files that were written incrementally with FlacEncoder, e.g. while recording */
+namespace FlacStream
+{
+    /** Fills in the number of samples and the smallest and largest frame in the STREAMINFO block
+     * by reading all valid frames of the file. Frames after the first damaged one are ignored.
+     * @Returns true if the file could be patched
+     */
+    bool finalise (std::string filePath);
+}
+
+//=============================================================
+/** A read-only range of samples or bytes that points into memory owned by someone else */
+template <class T>
+struct SampleSpan
+{
+    const T* data = nullptr;
+    size_t size = 0;
+    
+    const T* begin() const { return data; }
+    const T* end() const { return data + size; }
+    const T& operator[] (size_t index) const { return data[index]; }
+    bool empty() const { return size == 0; }
+};
+
+//=============================================================
+/** A read-only view of a PCM wave file that maps the file into memory instead of loading it.
+ * The chunks are parsed in place and the sample data is exposed as it is stored in the file,
+ * i.e. interleaved and little endian, so opening even hour-long recordings doesn't copy anything.
+ * Recordings whose header sizes were never patched are read up to the end of the file,
+ * files larger than 4 GB are read through the sizes in their ds64 chunk (RF64).
+ */
+class AudioFileView
+{
+public:
+    
+    //=============================================================
+    AudioFileView();
+    ~AudioFileView();
+    
+    AudioFileView (const AudioFileView&) = delete;
+    AudioFileView& operator= (const AudioFileView&) = delete;
+    
+    //=============================================================
+    /** Maps a wave file and parses its chunks.
+     * @Returns true if the file is a PCM wave file with a bit depth of 8, 16 or 24 bits
+     */
+    bool open (const std::string& filePath);
+    
+    /** Unmaps the file, all spans obtained from this view become invalid */
+    void close();
+    
+    /** @Returns true if a file is currently mapped */
+    bool isOpen() const;
+    
+    //=============================================================
+    /** @Returns the sample rate */
+    uint32_t getSampleRate() const;
+    
+    /** @Returns the number of audio channels */
+    int getNumChannels() const;
+    
+    /** @Returns the bit depth of each sample */
+    int getBitDepth() const;
+    
+    /** @Returns the number of samples per channel */
+    uint64_t getNumSamplesPerChannel() const;
+    
+    /** @Returns the length in seconds based on the number of samples and sample rate */
+    double getLengthInSeconds() const;
+    
+    //=============================================================
+    /** @Returns the bytes of the data chunk, limited to whole sample frames */
+    SampleSpan<uint8_t> getData() const;
+    
+    /** @Returns the bytes of the sample frames [startSample, endSample), limited to the length of the file.
+     * Like the whole data chunk, a slice points into the mapping, so cutting a clip from a long recording costs the same as from a short one.
+     */
+    SampleSpan<uint8_t> getData (uint64_t startSample, uint64_t endSample) const;
+    
+    /** @Returns the bytes of the sample frames that start within [startSeconds, endSeconds), see getSampleIndex() */
+    SampleSpan<uint8_t> getSlice (double startSeconds, double endSeconds) const;
+    
+    /** @Returns the index of the first sample that starts at or after the given time, limited to the length of the file */
+    uint64_t getSampleIndex (double seconds) const;
+    
+    /** @Returns the interleaved samples if the sample type matches the bit depth,
+     * i.e. uint8_t for 8 bit and int16_t for 16 bit files, and an empty span otherwise.
+     * 24 bit samples have no native type, use getData() or getSample() for those.
+     */
+    template <class T>
+    SampleSpan<T> getInterleavedSamples() const;
+    
+    /** @Returns the interleaved samples of the sample frames [startSample, endSample) with the same restrictions as above */
+    template <class T>
+    SampleSpan<T> getInterleavedSamples (uint64_t startSample, uint64_t endSample) const;
+    
+    /** @Returns a single sample normalised to [-1, 1), decoded the same way AudioFile does */
+    float getSample (int channel, uint64_t sampleIndex) const;
+    
+private:
+    
+    //=============================================================
+    /** Finds the format and data chunks in the mapped file */
+    bool parseChunks();
+    
+    //=============================================================
+    const uint8_t* mapping;
+    uint64_t mappingSize;
+    const uint8_t* sampleData;
+    uint64_t numSamplesPerChannel;
+    uint32_t sampleRate;
+    int numChannels;
+    int bitDepth;
+#if defined(_WIN32)
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
+
+//=============================================================
+template <class T>
+SampleSpan<T> AudioFileView::getInterleavedSamples() const
+{
+    return getInterleavedSamples<T> (0, numSamplesPerChannel);
+}
+
+//=============================================================
+template <class T>
+SampleSpan<T> AudioFileView::getInterleavedSamples (uint64_t startSample, uint64_t endSample) const
+{
+    SampleSpan<T> span;
+    const bool typeMatches = sizeof (T) * 8 == (size_t) bitDepth && (bitDepth == 8 || bitDepth == 16);
+    
+    // Chunks start at even offsets, but check anyway as the samples are accessed in place
+    if (typeMatches && sampleData != nullptr && reinterpret_cast<uintptr_t> (sampleData) % alignof (T) == 0)
+    {
+        const SampleSpan<uint8_t> bytes = getData (startSample, endSample);
+        span.data = reinterpret_cast<const T*> (bytes.data);
+        span.size = bytes.size / sizeof (T);
+    }
+    
+    return span;
+}
+
+//=============================================================
+/** A pull-based reader for PCM wave and AIFF files of any length that never holds more than two chunks in memory.
+ * Frames are decoded into caller buffers through PcmConversion, while a helper thread already reads the
+ * chunk following the current one, so sequential reads mostly wait for the disk only once.
+ * Seeking by sample index is cheap within the current chunk and otherwise costs one synchronous chunk read.
+ */
+class AudioFileReader
+{
+public:
+    
+    //=============================================================
+    /** The default size of a chunk in bytes */
+    static const size_t defaultChunkSize = 1 << 20;
+    
+    //=============================================================
+    AudioFileReader (size_t chunkSizeInBytes = defaultChunkSize);
+    ~AudioFileReader();
+    
+    AudioFileReader (const AudioFileReader&) = delete;
+    AudioFileReader& operator= (const AudioFileReader&) = delete;
+    
+    //=============================================================
+    /** Opens a wave or AIFF file, parses its chunks and starts prefetching from the first sample.
+     * @Returns true if the file is a PCM file with a bit depth of 8, 16 or 24 bits
+     */
+    bool open (const std::string& filePath);
+    
+    /** Stops the helper thread and closes the file */
+    void close();
+    
+    /** @Returns true if a file is currently open */
+    bool isOpen() const;
+    
+    //=============================================================
+    /** @Returns the format of the open file */
+    AudioFileFormat getAudioFileFormat() const;
+    
+    /** @Returns the sample rate */
+    uint32_t getSampleRate() const;
+    
+    /** @Returns the number of audio channels */
+    int getNumChannels() const;
+    
+    /** @Returns the bit depth of each sample */
+    int getBitDepth() const;
+    
+    /** @Returns the number of samples per channel */
+    uint64_t getNumSamplesPerChannel() const;
+    
+    /** @Returns the length in seconds based on the number of samples and sample rate */
+    double getLengthInSeconds() const;
+    
+    //=============================================================
+    /** @Returns the index of the next sample that will be read */
+    uint64_t getPosition() const;
+    
+    /** Moves the read position to the given sample index
+     * @Returns false if the index lies beyond the end of the file
+     */
+    bool seek (uint64_t sampleIndex);
+    
+    /** Decodes up to numFrames frames from the read position into the channel buffers,
+     * which must each have room for numFrames samples, and advances the read position.
+     * @Returns the number of frames that were read, which is only less than numFrames at the end of the file or on errors
+     */
+    size_t read (float* const* channels, size_t numFrames);
+    size_t read (double* const* channels, size_t numFrames);
+    
+private:
+    
+    //=============================================================
+    /** Raw sample data of consecutive frames */
+    struct Chunk
+    {
+        std::vector<uint8_t> data;
+        uint64_t firstFrame = 0;
+        size_t numFrames = 0;
+        
+        bool contains (uint64_t frame) const { return frame >= firstFrame && frame < firstFrame + numFrames; }
+    };
+    
+    //=============================================================
+    /** Finds the format and sample data chunks, reading only the chunk headers */
+    bool parseWaveChunks (uint64_t fileSize);
+    bool parseAiffChunks (uint64_t fileSize);
+    
+    /** Reads bytes from the given offset in the file
+     * @Returns the number of bytes that were read
+     */
+    size_t readAt (uint64_t offset, uint8_t* buffer, size_t size);
+    
+    /** Makes the chunk containing the given frame the current one and requests the following chunk
+     * @Returns false if the chunk couldn't be read
+     */
+    bool makeCurrent (uint64_t frame);
+    
+    /** Requests the helper thread to read the chunk starting at the given frame into the chunk that isn't current,
+     * the lock has to be held
+     */
+    void requestChunk (uint64_t frame);
+    
+    /** The helper thread: reads requested chunks until the reader is closed */
+    void readChunks();
+    
+    template <class T>
+    size_t readFrames (T* const* channels, size_t numFrames);
+    
+    //=============================================================
+    std::ifstream file;
+    AudioFileFormat audioFileFormat;
+    uint64_t dataStart;
+    uint64_t numSamplesPerChannel;
+    uint32_t sampleRate;
+    int numChannels;
+    int bitDepth;
+    size_t numFramesPerChunk;
+    size_t requestedChunkSize;
+    uint64_t position;
+    
+    //=============================================================
+    Chunk chunks[2];
+    int currentChunk;
+    uint64_t requestedFrame;
+    bool isLoading;
+    bool stopThread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+};
+
 }
 
 #endif /* AudioFile_h */
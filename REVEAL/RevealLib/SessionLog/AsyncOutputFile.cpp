@@ -0,0 +1,656 @@
+#include "AsyncOutputFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+	// Positioned writes are not implemented for Windows, create_output_file maps the file instead.
+#elif defined(__ORBIS__)
+	#include <kernel.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+	#include <linux/io_uring.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+#endif
+
+namespace SessionLog
+{
+
+	// Buffers are page aligned, which the kernel prefers for registered buffers.
+	static constexpr size_t kBufferAlignment = 4096;
+
+#if defined(__linux__)
+	// The mapped submission and completion queues of the io_uring instance.
+	struct AsyncWriteQueue::Ring
+	{
+		int fileDescriptor = -1;
+		void* pSubmissionMapping = nullptr;
+		size_t submissionMappingSize = 0;
+		void* pCompletionMapping = nullptr;
+		size_t completionMappingSize = 0;
+		io_uring_sqe* pEntries = nullptr;
+		size_t entriesSize = 0;
+		unsigned* pSubmissionHead = nullptr;
+		unsigned* pSubmissionTail = nullptr;
+		unsigned* pSubmissionArray = nullptr;
+		unsigned submissionMask = 0;
+		unsigned submissionEntries = 0;
+		unsigned* pCompletionHead = nullptr;
+		unsigned* pCompletionTail = nullptr;
+		io_uring_cqe* pCompletions = nullptr;
+		unsigned completionMask = 0;
+		unsigned completionEntries = 0;
+		// Entries that were placed in the submission queue but not consumed by the kernel yet.
+		unsigned unsubmitted = 0;
+	};
+#endif
+
+	std::shared_ptr<AsyncWriteQueue> AsyncWriteQueue::acquire()
+	{
+		static std::mutex s_mutex;
+		static std::weak_ptr<AsyncWriteQueue> s_pQueue;
+		std::lock_guard<std::mutex> lock(s_mutex);
+		std::shared_ptr<AsyncWriteQueue> pQueue = s_pQueue.lock();
+		if (!pQueue)
+		{
+			pQueue.reset(new AsyncWriteQueue());
+			s_pQueue = pQueue;
+		}
+		return pQueue;
+	}
+
+	AsyncWriteQueue::AsyncWriteQueue()
+		: m_pBufferMemory(new uint8_t[kBufferCount * kBufferSize + kBufferAlignment])
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(m_pBufferMemory.get());
+		m_pBuffers = m_pBufferMemory.get() + (kBufferAlignment - address % kBufferAlignment) % kBufferAlignment;
+		m_freeBuffers.reserve(kBufferCount);
+		for (uint32_t buffer = 0; buffer < kBufferCount; ++buffer)
+		{
+			m_freeBuffers.push_back(kBufferCount - 1 - buffer);
+			m_bufferOperations.emplace_back();
+			m_bufferOperations.back().buffer = buffer;
+			m_bufferOperations.back().pData = m_pBuffers + static_cast<size_t>(buffer) * kBufferSize;
+		}
+
+#if defined(__linux__)
+		if (setup_ring())
+		{
+			m_threads.emplace_back(&AsyncWriteQueue::run_ring, this);
+			return;
+		}
+#endif
+		for (uint32_t thread = 0; thread < kPoolThreadCount; ++thread)
+		{
+			m_threads.emplace_back(&AsyncWriteQueue::run_pool, this);
+		}
+	}
+
+	AsyncWriteQueue::~AsyncWriteQueue()
+	{
+		// All files are closed by now, so the workers only have to notice that they can stop.
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_workSignal.notify_all();
+		for (auto& thread : m_threads)
+		{
+			thread.join();
+		}
+#if defined(__linux__)
+		destroy_ring();
+#endif
+	}
+
+	uint32_t AsyncWriteQueue::acquire_buffer(uint8_t*& rpData)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_freeBuffers.empty())
+			{
+				const uint32_t buffer = m_freeBuffers.back();
+				m_freeBuffers.pop_back();
+				rpData = m_bufferOperations[buffer].pData;
+				return buffer;
+			}
+		}
+
+		// [NOTE] Waiting for a write to complete could block for good: the caller may hold a lock that is needed to submit
+		// the buffers other files are holding. The buffer is allocated outside of the lock and stays with the queue for later writes.
+		std::unique_ptr<uint8_t[]> pBuffer(new uint8_t[kBufferSize]);
+		rpData = pBuffer.get();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint32_t buffer = static_cast<uint32_t>(m_bufferOperations.size());
+		m_extraBuffers.push_back(std::move(pBuffer));
+		m_bufferOperations.emplace_back();
+		m_bufferOperations.back().buffer = buffer;
+		m_bufferOperations.back().pData = rpData;
+		m_freeBuffers.reserve(m_bufferOperations.size());
+		return buffer;
+	}
+
+	void AsyncWriteQueue::release_buffer(uint32_t buffer)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_freeBuffers.push_back(buffer);
+		}
+		m_completionSignal.notify_all();
+	}
+
+	void AsyncWriteQueue::submit_write(FileState& rFile, uint32_t buffer, uint32_t size, uint64_t offset)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Operation& rOperation = m_bufferOperations[buffer];
+		rOperation.pFile = &rFile;
+		rOperation.offset = offset;
+		rOperation.size = size;
+		rOperation.written = 0;
+		rOperation.sequence = ++rFile.submittedWrites;
+		rOperation.isSync = false;
+		rFile.pendingOperations++;
+		push_operation(rOperation);
+	}
+
+	void AsyncWriteQueue::submit_sync(FileState& rFile)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		rFile.syncTarget = rFile.submittedWrites;
+		start_sync(rFile);
+	}
+
+	bool AsyncWriteQueue::wait_for_sync(FileState& rFile)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const uint64_t target = rFile.syncTarget;
+		m_completionSignal.wait(lock, [&rFile, target]() { return rFile.syncedWrites >= target; });
+		return !rFile.failed;
+	}
+
+	void AsyncWriteQueue::wait(FileState& rFile)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_completionSignal.wait(lock, [&rFile]() { return rFile.pendingOperations == 0; });
+	}
+
+	bool AsyncWriteQueue::uses_io_uring() const
+	{
+#if defined(__linux__)
+		return m_pRing != nullptr;
+#else
+		return false;
+#endif
+	}
+
+	void AsyncWriteQueue::push_operation(Operation& rOperation)
+	{
+		rOperation.pNext = nullptr;
+		if (m_pQueueTail != nullptr)
+		{
+			m_pQueueTail->pNext = &rOperation;
+		}
+		else
+		{
+			m_pQueueHead = &rOperation;
+		}
+		m_pQueueTail = &rOperation;
+		m_workSignal.notify_one();
+	}
+
+	void AsyncWriteQueue::complete_operation(Operation& rOperation, int64_t result)
+	{
+		if (result == -EINTR || result == -EAGAIN)
+		{
+			push_operation(rOperation);
+			return;
+		}
+		if (!rOperation.isSync && result > 0 && rOperation.written + result < rOperation.size)
+		{
+			rOperation.written += static_cast<uint32_t>(result);
+			push_operation(rOperation);
+			return;
+		}
+		if (result < 0 || (!rOperation.isSync && result == 0))
+		{
+			// [NOTE] The data is lost, but the journal only trusts blocks whose checksum matches after a crash.
+			rOperation.pFile->failed = true;
+		}
+		FileState& rFile = *rOperation.pFile;
+		if (rOperation.isSync)
+		{
+			rFile.syncedWrites = rOperation.sequence;
+			rFile.isSyncing = false;
+		}
+		else
+		{
+			m_freeBuffers.push_back(rOperation.buffer);
+			rOperation.pFile = nullptr;
+		}
+		rFile.pendingOperations--;
+		// Either a write the requested sync waited for or the previous sync completed.
+		start_sync(rFile);
+		m_completionSignal.notify_all();
+	}
+
+	void AsyncWriteQueue::start_sync(FileState& rFile)
+	{
+		if (rFile.isSyncing || rFile.syncTarget <= rFile.syncedWrites)
+		{
+			return;
+		}
+		// Writes may complete in any order, so the sync may only start once all writes it covers did.
+		for (const Operation& rWrite : m_bufferOperations)
+		{
+			if (rWrite.pFile == &rFile && rWrite.sequence <= rFile.syncTarget)
+			{
+				return;
+			}
+		}
+		Operation& rOperation = rFile.syncOperation;
+		rOperation.pFile = &rFile;
+		rOperation.sequence = rFile.syncTarget;
+		rOperation.isSync = true;
+		rFile.isSyncing = true;
+		rFile.pendingOperations++;
+		push_operation(rOperation);
+	}
+
+	void AsyncWriteQueue::run_pool()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_workSignal.wait(lock, [this]() { return m_pQueueHead != nullptr || m_stop; });
+			if (m_pQueueHead == nullptr)
+			{
+				break;
+			}
+			Operation& rOperation = *m_pQueueHead;
+			m_pQueueHead = rOperation.pNext;
+			if (m_pQueueHead == nullptr)
+			{
+				m_pQueueTail = nullptr;
+			}
+			m_inFlight++;
+			lock.unlock();
+
+			const int fileDescriptor = rOperation.pFile->fileDescriptor;
+			int64_t result = 0;
+#if defined(_WIN32)
+			result = -EINVAL;
+#elif defined(__ORBIS__)
+			if (rOperation.isSync)
+			{
+				result = sceKernelFsync(fileDescriptor);
+			}
+			else
+			{
+				result = sceKernelPwrite(fileDescriptor, rOperation.pData + rOperation.written, rOperation.size - rOperation.written, static_cast<off_t>(rOperation.offset + rOperation.written));
+			}
+#else
+			if (rOperation.isSync)
+			{
+#if defined(__linux__)
+				result = fdatasync(fileDescriptor);
+#else
+				result = fsync(fileDescriptor);
+#endif
+			}
+			else
+			{
+				result = pwrite(fileDescriptor, rOperation.pData + rOperation.written, rOperation.size - rOperation.written, static_cast<off_t>(rOperation.offset + rOperation.written));
+			}
+			if (result < 0)
+			{
+				result = -errno;
+			}
+#endif
+
+			lock.lock();
+			m_inFlight--;
+			complete_operation(rOperation, result);
+		}
+	}
+
+#if defined(__linux__)
+	bool AsyncWriteQueue::setup_ring()
+	{
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+		// Every preallocated buffer can be in flight at once, and a sync per file on top of that.
+		// More operations just wait in the queue until entries are free again.
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		const int fileDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, kBufferCount * 2, &params));
+		if (fileDescriptor < 0)
+		{
+			return false;
+		}
+#ifdef IORING_FEAT_RW_CUR_POS
+		// Allocated buffers are written with IORING_OP_WRITE, which came with the same kernel version as this feature.
+		const bool hasWrite = (params.features & IORING_FEAT_RW_CUR_POS) != 0;
+#else
+		const bool hasWrite = false;
+#endif
+		if (!hasWrite)
+		{
+			::close(fileDescriptor);
+			return false;
+		}
+		m_pRing.reset(new Ring());
+		Ring& rRing = *m_pRing;
+		rRing.fileDescriptor = fileDescriptor;
+
+		rRing.submissionMappingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		rRing.completionMappingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+		const bool isSingleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+		const bool isSingleMapping = false;
+#endif
+		if (isSingleMapping)
+		{
+			rRing.submissionMappingSize = rRing.completionMappingSize = std::max(rRing.submissionMappingSize, rRing.completionMappingSize);
+		}
+		void* pMapping = mmap(nullptr, rRing.submissionMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fileDescriptor, IORING_OFF_SQ_RING);
+		if (pMapping == MAP_FAILED)
+		{
+			destroy_ring();
+			return false;
+		}
+		rRing.pSubmissionMapping = pMapping;
+		if (!isSingleMapping)
+		{
+			pMapping = mmap(nullptr, rRing.completionMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fileDescriptor, IORING_OFF_CQ_RING);
+			if (pMapping == MAP_FAILED)
+			{
+				destroy_ring();
+				return false;
+			}
+			rRing.pCompletionMapping = pMapping;
+		}
+		rRing.entriesSize = params.sq_entries * sizeof(io_uring_sqe);
+		pMapping = mmap(nullptr, rRing.entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fileDescriptor, IORING_OFF_SQES);
+		if (pMapping == MAP_FAILED)
+		{
+			destroy_ring();
+			return false;
+		}
+		rRing.pEntries = static_cast<io_uring_sqe*>(pMapping);
+
+		uint8_t* pSubmission = static_cast<uint8_t*>(rRing.pSubmissionMapping);
+		uint8_t* pCompletion = static_cast<uint8_t*>(isSingleMapping ? rRing.pSubmissionMapping : rRing.pCompletionMapping);
+		rRing.pSubmissionHead = reinterpret_cast<unsigned*>(pSubmission + params.sq_off.head);
+		rRing.pSubmissionTail = reinterpret_cast<unsigned*>(pSubmission + params.sq_off.tail);
+		rRing.pSubmissionArray = reinterpret_cast<unsigned*>(pSubmission + params.sq_off.array);
+		rRing.submissionMask = *reinterpret_cast<unsigned*>(pSubmission + params.sq_off.ring_mask);
+		rRing.submissionEntries = params.sq_entries;
+		rRing.pCompletionHead = reinterpret_cast<unsigned*>(pCompletion + params.cq_off.head);
+		rRing.pCompletionTail = reinterpret_cast<unsigned*>(pCompletion + params.cq_off.tail);
+		rRing.pCompletions = reinterpret_cast<io_uring_cqe*>(pCompletion + params.cq_off.cqes);
+		rRing.completionMask = *reinterpret_cast<unsigned*>(pCompletion + params.cq_off.ring_mask);
+		rRing.completionEntries = params.cq_entries;
+
+		// Registered buffers are pinned once, so the kernel does not have to map them for every write.
+		// This fails if the locked memory limit is too low, in which case the thread pool is used instead.
+		iovec buffers[kBufferCount];
+		for (uint32_t buffer = 0; buffer < kBufferCount; ++buffer)
+		{
+			buffers[buffer].iov_base = m_pBuffers + static_cast<size_t>(buffer) * kBufferSize;
+			buffers[buffer].iov_len = kBufferSize;
+		}
+		if (syscall(__NR_io_uring_register, fileDescriptor, IORING_REGISTER_BUFFERS, buffers, kBufferCount) < 0)
+		{
+			destroy_ring();
+			return false;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void AsyncWriteQueue::destroy_ring()
+	{
+		if (!m_pRing)
+		{
+			return;
+		}
+		Ring& rRing = *m_pRing;
+		if (rRing.pEntries != nullptr)
+		{
+			munmap(rRing.pEntries, rRing.entriesSize);
+		}
+		if (rRing.pCompletionMapping != nullptr)
+		{
+			munmap(rRing.pCompletionMapping, rRing.completionMappingSize);
+		}
+		if (rRing.pSubmissionMapping != nullptr)
+		{
+			munmap(rRing.pSubmissionMapping, rRing.submissionMappingSize);
+		}
+		// Closing the ring also unregisters the buffers.
+		::close(rRing.fileDescriptor);
+		m_pRing.reset();
+	}
+
+	void AsyncWriteQueue::run_ring()
+	{
+#if defined(__NR_io_uring_enter)
+		Ring& rRing = *m_pRing;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_workSignal.wait(lock, [this]() { return m_pQueueHead != nullptr || m_inFlight > 0 || m_stop; });
+			if (m_pQueueHead == nullptr && m_inFlight == 0)
+			{
+				break;
+			}
+
+			// Move queued operations into free submission entries. Only this thread ever writes the tail.
+			// Operations in flight are limited to the completion entries, so no completion can be dropped.
+			unsigned tail = *rRing.pSubmissionTail;
+			const unsigned head = __atomic_load_n(rRing.pSubmissionHead, __ATOMIC_ACQUIRE);
+			while (m_pQueueHead != nullptr && tail - head < rRing.submissionEntries && m_inFlight < rRing.completionEntries)
+			{
+				Operation& rOperation = *m_pQueueHead;
+				m_pQueueHead = rOperation.pNext;
+				if (m_pQueueHead == nullptr)
+				{
+					m_pQueueTail = nullptr;
+				}
+
+				const unsigned index = tail & rRing.submissionMask;
+				io_uring_sqe& rEntry = rRing.pEntries[index];
+				std::memset(&rEntry, 0, sizeof(rEntry));
+				rEntry.fd = rOperation.pFile->fileDescriptor;
+				rEntry.user_data = reinterpret_cast<uintptr_t>(&rOperation);
+				if (rOperation.isSync)
+				{
+					rEntry.opcode = IORING_OP_FSYNC;
+					rEntry.fsync_flags = IORING_FSYNC_DATASYNC;
+				}
+				else
+				{
+					// Only the preallocated buffers are registered.
+					const bool isRegistered = rOperation.buffer < kBufferCount;
+					rEntry.opcode = isRegistered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+					rEntry.addr = reinterpret_cast<uintptr_t>(rOperation.pData + rOperation.written);
+					rEntry.len = rOperation.size - rOperation.written;
+					rEntry.off = rOperation.offset + rOperation.written;
+					rEntry.buf_index = isRegistered ? static_cast<uint16_t>(rOperation.buffer) : 0;
+				}
+				rRing.pSubmissionArray[index] = index;
+				tail++;
+				rRing.unsubmitted++;
+				m_inFlight++;
+			}
+			__atomic_store_n(rRing.pSubmissionTail, tail, __ATOMIC_RELEASE);
+			const unsigned submitCount = rRing.unsubmitted;
+			lock.unlock();
+
+			// Submit everything and wait for at least one completion. Operations queued meanwhile are picked up after it.
+			const long submitted = syscall(__NR_io_uring_enter, rRing.fileDescriptor, submitCount, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+			lock.lock();
+			if (submitted > 0)
+			{
+				rRing.unsubmitted -= std::min(static_cast<unsigned>(submitted), rRing.unsubmitted);
+			}
+
+			// Reap all completions, which also returns their buffers.
+			unsigned completionHead = *rRing.pCompletionHead;
+			const unsigned completionTail = __atomic_load_n(rRing.pCompletionTail, __ATOMIC_ACQUIRE);
+			while (completionHead != completionTail)
+			{
+				const io_uring_cqe& rCompletion = rRing.pCompletions[completionHead & rRing.completionMask];
+				Operation& rOperation = *reinterpret_cast<Operation*>(static_cast<uintptr_t>(rCompletion.user_data));
+				m_inFlight--;
+				complete_operation(rOperation, rCompletion.res);
+				completionHead++;
+			}
+			__atomic_store_n(rRing.pCompletionHead, completionHead, __ATOMIC_RELEASE);
+		}
+#endif
+	}
+#endif
+
+	AsyncOutputFile::~AsyncOutputFile()
+	{
+		close();
+	}
+
+	bool AsyncOutputFile::open(const std::string& filePath)
+	{
+		if (m_isOpen)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		(void)filePath;
+		return false;
+#else
+#if defined(__ORBIS__)
+		const int fileDescriptor = sceKernelOpen(filePath.c_str(), SCE_KERNEL_O_WRONLY | SCE_KERNEL_O_CREAT | SCE_KERNEL_O_TRUNC, SCE_KERNEL_S_IRWU);
+#else
+		const int fileDescriptor = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+		if (fileDescriptor < 0)
+		{
+			return false;
+		}
+		m_state.fileDescriptor = fileDescriptor;
+		m_state.pendingOperations = 0;
+		m_state.submittedWrites = 0;
+		m_state.syncTarget = 0;
+		m_state.syncedWrites = 0;
+		m_state.isSyncing = false;
+		m_state.failed = false;
+		m_pQueue = AsyncWriteQueue::acquire();
+		m_buffer = kNoBuffer;
+		m_bufferFill = 0;
+		m_bufferOffset = 0;
+		m_length = 0;
+		m_isOpen = true;
+		return true;
+#endif
+	}
+
+	void AsyncOutputFile::write(const void* pData, size_t size)
+	{
+		if (!m_isOpen)
+		{
+			return;
+		}
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+		while (size > 0)
+		{
+			if (m_buffer == kNoBuffer)
+			{
+				m_buffer = m_pQueue->acquire_buffer(m_pBufferData);
+				m_bufferFill = 0;
+				m_bufferOffset = m_length;
+			}
+			const size_t chunkSize = std::min(size, AsyncWriteQueue::kBufferSize - m_bufferFill);
+			std::memcpy(m_pBufferData + m_bufferFill, pBytes, chunkSize);
+			m_bufferFill += static_cast<uint32_t>(chunkSize);
+			m_length += chunkSize;
+			pBytes += chunkSize;
+			size -= chunkSize;
+			if (m_bufferFill == AsyncWriteQueue::kBufferSize)
+			{
+				submit_buffer();
+			}
+		}
+	}
+
+	void AsyncOutputFile::submit_sync()
+	{
+		if (!m_isOpen)
+		{
+			return;
+		}
+		// The partially filled buffer is written as well, the next write starts a new one behind it.
+		submit_buffer();
+		m_pQueue->submit_sync(m_state);
+	}
+
+	bool AsyncOutputFile::wait_for_sync()
+	{
+		return m_isOpen && m_pQueue->wait_for_sync(m_state);
+	}
+
+	void AsyncOutputFile::close()
+	{
+		if (!m_isOpen)
+		{
+			return;
+		}
+		sync();
+		m_pQueue->wait(m_state);
+#if defined(__ORBIS__)
+		sceKernelClose(m_state.fileDescriptor);
+#elif !defined(_WIN32)
+		::close(m_state.fileDescriptor);
+#endif
+		m_state.fileDescriptor = -1;
+		m_pQueue.reset();
+		m_isOpen = false;
+	}
+
+	bool AsyncOutputFile::is_open() const
+	{
+		return m_isOpen;
+	}
+
+	uint64_t AsyncOutputFile::get_length() const
+	{
+		return m_length;
+	}
+
+	void AsyncOutputFile::submit_buffer()
+	{
+		if (m_buffer == kNoBuffer)
+		{
+			return;
+		}
+		if (m_bufferFill > 0)
+		{
+			m_pQueue->submit_write(m_state, m_buffer, m_bufferFill, m_bufferOffset);
+		}
+		else
+		{
+			m_pQueue->release_buffer(m_buffer);
+		}
+		m_buffer = kNoBuffer;
+	}
+
+} // namespace SessionLog
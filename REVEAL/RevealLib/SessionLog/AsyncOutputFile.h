@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OutputFile.h"
+
+namespace SessionLog
+{
+
+	// Writes the buffers of all asynchronous output files on dedicated threads.
+	// A single queue is shared by all open files, so all streams of a session use the same buffers and submission ring.
+	// On Linux, writes are submitted through io_uring with the buffers registered once, elsewhere or if io_uring is
+	// not available, a small pool of threads performs positioned writes. Nothing is allocated per write either way.
+	// Acquiring a buffer never waits: if all buffers are in use, e.g. by many open files or a slow disk, another one is
+	// allocated and kept for later writes. Callers may hold their own locks, and the game and audio threads never wait for the disk.
+	class AsyncWriteQueue
+	{
+	public:
+
+		static constexpr size_t kBufferSize = 256 * 1024;
+		// The buffers that are preallocated and registered with io_uring, buffers allocated later are written unregistered.
+		static constexpr uint32_t kBufferCount = 16;
+		static constexpr uint32_t kPoolThreadCount = 2;
+
+		// The completion state of one file, which has to stay alive until all of its operations completed.
+		struct FileState;
+
+		// A write of one buffer or a sync of one file, linked into the queue while it waits for submission.
+		struct Operation
+		{
+			FileState* pFile = nullptr;
+			Operation* pNext = nullptr;
+			uint8_t* pData = nullptr;
+			uint64_t offset = 0;
+			// Writes are numbered per file, a sync covers all writes up to its number.
+			uint64_t sequence = 0;
+			uint32_t buffer = 0;
+			uint32_t size = 0;
+			uint32_t written = 0;
+			bool isSync = false;
+		};
+
+		struct FileState
+		{
+			int fileDescriptor = -1;
+			uint32_t pendingOperations = 0;
+			uint64_t submittedWrites = 0;
+			// The writes the last requested sync has to cover, and those covered by the last completed one.
+			uint64_t syncTarget = 0;
+			uint64_t syncedWrites = 0;
+			bool isSyncing = false;
+			bool failed = false;
+			Operation syncOperation;
+		};
+
+		// Returns the queue shared by all open files and creates it if there is none.
+		// The queue is destroyed with the last reference, after all of its operations completed.
+		static std::shared_ptr<AsyncWriteQueue> acquire();
+
+		~AsyncWriteQueue();
+
+		// Returns the index and the data of a free buffer. If there is none, another buffer is allocated instead of waiting.
+		uint32_t acquire_buffer(uint8_t*& rpData);
+
+		// Returns a buffer that was never submitted.
+		void release_buffer(uint32_t buffer);
+
+		// Queues the given buffer to be written to the file at the given offset. The buffer is released once it was written.
+		void submit_write(FileState& rFile, uint32_t buffer, uint32_t size, uint64_t offset);
+
+		// Requests the data of all writes queued so far to reach the disk, without waiting for it.
+		// The sync is queued as soon as those writes completed, later writes don't hold it back.
+		void submit_sync(FileState& rFile);
+
+		// Waits until the last requested sync of the file completed. Returns false if any write or sync failed.
+		bool wait_for_sync(FileState& rFile);
+
+		// Waits until all operations of the file completed.
+		void wait(FileState& rFile);
+
+		// Returns true if writes are submitted through io_uring instead of the thread pool.
+		bool uses_io_uring() const;
+
+	private:
+
+		AsyncWriteQueue();
+
+		// Queues an operation for the worker threads, the lock has to be held.
+		void push_operation(Operation& rOperation);
+
+		// Accounts for the result of a write or sync. Partial writes are queued again for their remainder.
+		// The lock has to be held.
+		void complete_operation(Operation& rOperation, int64_t result);
+
+		// Queues the requested sync of the file once no write it covers is pending anymore, the lock has to be held.
+		void start_sync(FileState& rFile);
+
+		// A worker of the thread pool: performs queued operations one by one with positioned writes.
+		void run_pool();
+
+#if defined(__linux__)
+		// Sets up the submission ring and registers the buffers with it. Returns false if io_uring can not be used.
+		bool setup_ring();
+
+		// Unmaps and closes the submission ring.
+		void destroy_ring();
+
+		// The ring thread: moves queued operations into the submission ring and reaps their completions.
+		void run_ring();
+#endif
+
+		std::unique_ptr<uint8_t[]> m_pBufferMemory;
+		uint8_t* m_pBuffers = nullptr;
+		// Buffers allocated once the preallocated ones were all in use.
+		std::vector<std::unique_ptr<uint8_t[]>> m_extraBuffers;
+		std::vector<uint32_t> m_freeBuffers;
+		// One operation per buffer, the deque keeps them in place while more buffers are added.
+		std::deque<Operation> m_bufferOperations;
+		Operation* m_pQueueHead = nullptr;
+		Operation* m_pQueueTail = nullptr;
+		uint32_t m_inFlight = 0;
+		bool m_stop = false;
+		std::mutex m_mutex;
+		std::condition_variable m_workSignal;
+		std::condition_variable m_completionSignal;
+		std::vector<std::thread> m_threads;
+
+#if defined(__linux__)
+		struct Ring;
+		std::unique_ptr<Ring> m_pRing;
+#endif
+	};
+
+	// Collects appended data in the buffers of the shared write queue and hands each full buffer to it.
+	// Appending only copies and never waits. A submitted sync is performed by the queue as well, so only waiting for it blocks.
+	class AsyncOutputFile : public OutputFile
+	{
+	public:
+
+		~AsyncOutputFile() override;
+
+		bool open(const std::string& filePath) override;
+		void write(const void* pData, size_t size) override;
+		void submit_sync() override;
+		bool wait_for_sync() override;
+		void close() override;
+		bool is_open() const override;
+		uint64_t get_length() const override;
+
+	private:
+
+		// Hands the current buffer to the queue, even if it is not full yet.
+		void submit_buffer();
+
+		static constexpr uint32_t kNoBuffer = 0xFFFFffff;
+
+		std::shared_ptr<AsyncWriteQueue> m_pQueue;
+		AsyncWriteQueue::FileState m_state;
+		uint32_t m_buffer = kNoBuffer;
+		uint8_t* m_pBufferData = nullptr;
+		uint32_t m_bufferFill = 0;
+		uint64_t m_bufferOffset = 0;
+		uint64_t m_length = 0;
+		bool m_isOpen = false;
+	};
+
+} // namespace SessionLog
@@ -0,0 +1,669 @@
+#include "BinaryLog.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace SessionLog
+{
+
+	void put_varint(std::vector<uint8_t>& rOut, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			rOut.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		rOut.push_back(static_cast<uint8_t>(value));
+	}
+
+	bool get_varint(const uint8_t*& rpData, const uint8_t* pEnd, uint64_t& rValue)
+	{
+		rValue = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (rpData >= pEnd)
+			{
+				return false;
+			}
+			const uint8_t byte = *rpData++;
+			rValue |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void put_string(std::vector<uint8_t>& rOut, const char* pText, size_t length)
+	{
+		put_varint(rOut, length);
+		rOut.insert(rOut.end(), pText, pText + length);
+	}
+
+	static bool get_string(const uint8_t*& rpData, const uint8_t* pEnd, std::string& rText)
+	{
+		uint64_t length;
+		if (!get_varint(rpData, pEnd, length) || static_cast<uint64_t>(pEnd - rpData) < length)
+		{
+			return false;
+		}
+		rText.assign(reinterpret_cast<const char*>(rpData), static_cast<size_t>(length));
+		rpData += length;
+		return true;
+	}
+
+	static void put_record(std::vector<uint8_t>& rOut, LogRecordType type, const std::vector<uint8_t>& payload)
+	{
+		rOut.push_back(static_cast<uint8_t>(type));
+		put_varint(rOut, payload.size());
+		rOut.insert(rOut.end(), payload.begin(), payload.end());
+	}
+
+	void BinaryLogWriter::begin_session(uint32_t participant, const char* undefinedValue, std::vector<uint8_t>& rOut)
+	{
+		m_dictionary.clear();
+		m_dictionaryRecords.clear();
+		m_lastDictionarySize = 0;
+		m_persistent.clear();
+		m_tracked.clear();
+
+		for (uint32_t value : { kBinaryLogMagic, kBinaryLogVersion })
+		{
+			for (int b = 0; b < 4; ++b)
+			{
+				rOut.push_back(static_cast<uint8_t>(value >> (b * 8)));
+			}
+		}
+
+		std::vector<uint8_t> payload;
+		put_varint(payload, participant);
+		put_string(payload, undefinedValue, std::strlen(undefinedValue));
+		put_record(rOut, LogRecordType::kSession, payload);
+	}
+
+	void BinaryLogWriter::write_columns(const std::vector<const char*>& columnNames, std::vector<uint8_t>& rOut)
+	{
+		std::vector<uint8_t> payload;
+		put_varint(payload, columnNames.size());
+		for (const char* pName : columnNames)
+		{
+			put_string(payload, pName, std::strlen(pName));
+		}
+		put_record(rOut, LogRecordType::kColumns, payload);
+	}
+
+	static void put_time(std::vector<uint8_t>& rOut, float elapsedTime)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &elapsedTime, sizeof(bits));
+		for (int b = 0; b < 4; ++b)
+		{
+			rOut.push_back(static_cast<uint8_t>(bits >> (b * 8)));
+		}
+	}
+
+	void BinaryLogWriter::write_columns(const std::vector<const char*>& columnNames, const std::vector<uint8_t>& persistent, std::vector<uint8_t>& rOut)
+	{
+		write_columns(columnNames, rOut);
+		m_persistent = persistent;
+		m_persistent.resize(columnNames.size(), 0);
+		m_tracked.assign(columnNames.size(), TrackedCell());
+		put_record(rOut, LogRecordType::kColumnKinds, m_persistent);
+	}
+
+	void BinaryLogWriter::begin_row(float elapsedTime)
+	{
+		m_row.clear();
+		put_time(m_row, elapsedTime);
+	}
+
+	void BinaryLogWriter::add_undefined()
+	{
+		m_row.push_back(static_cast<uint8_t>(CellType::kUndefined));
+	}
+
+	void BinaryLogWriter::add_text(const char* pText, size_t length)
+	{
+		put_text_cell(m_row, pText, length);
+	}
+
+	void BinaryLogWriter::add_integer(int32_t value)
+	{
+		put_integer_cell(m_row, value);
+	}
+
+	void BinaryLogWriter::add_name(uint32_t hash, const char* pValue)
+	{
+		put_name_cell(m_row, hash, pValue);
+	}
+
+	void BinaryLogWriter::end_row(std::vector<uint8_t>& rOut)
+	{
+		// New dictionary entries have to precede the first row referring to them.
+		rOut.insert(rOut.end(), m_dictionaryRecords.begin(), m_dictionaryRecords.end());
+		m_lastDictionarySize = m_dictionaryRecords.size();
+		m_dictionaryRecords.clear();
+		put_record(rOut, LogRecordType::kRow, m_row);
+	}
+
+	void BinaryLogWriter::begin_changes(float elapsedTime)
+	{
+		// The row buffer collects the changes, the count is only known at the end.
+		m_row.clear();
+		m_changeCount = 0;
+		put_time(m_row, elapsedTime);
+	}
+
+	void BinaryLogWriter::change_undefined(uint32_t column)
+	{
+		// Only persistent columns have to be told explicitly that their value is gone.
+		TrackedCell& rCell = m_tracked[column];
+		if (m_persistent[column] && rCell.type != CellType::kUndefined)
+		{
+			rCell = TrackedCell();
+			put_varint(m_row, column);
+			m_row.push_back(static_cast<uint8_t>(CellType::kUndefined));
+			++m_changeCount;
+		}
+	}
+
+	void BinaryLogWriter::change_text(uint32_t column, const char* pText, size_t length, bool force)
+	{
+		TrackedCell& rCell = m_tracked[column];
+		if (!force && rCell.type == CellType::kText && rCell.text.size() == length && std::memcmp(rCell.text.data(), pText, length) == 0)
+		{
+			return;
+		}
+		if (m_persistent[column])
+		{
+			rCell.type = CellType::kText;
+			rCell.text.assign(pText, length);
+		}
+		put_varint(m_row, column);
+		put_text_cell(m_row, pText, length);
+		++m_changeCount;
+	}
+
+	void BinaryLogWriter::change_integer(uint32_t column, int32_t value, bool force)
+	{
+		TrackedCell& rCell = m_tracked[column];
+		if (!force && rCell.type == CellType::kInteger && rCell.value == static_cast<uint32_t>(value))
+		{
+			return;
+		}
+		if (m_persistent[column])
+		{
+			rCell.type = CellType::kInteger;
+			rCell.value = static_cast<uint32_t>(value);
+		}
+		put_varint(m_row, column);
+		put_integer_cell(m_row, value);
+		++m_changeCount;
+	}
+
+	void BinaryLogWriter::change_name(uint32_t column, uint32_t hash, const char* pValue, bool force)
+	{
+		TrackedCell& rCell = m_tracked[column];
+		if (!force && rCell.type == CellType::kName && rCell.value == hash)
+		{
+			return;
+		}
+		if (m_persistent[column])
+		{
+			rCell.type = CellType::kName;
+			rCell.value = hash;
+		}
+		put_varint(m_row, column);
+		put_name_cell(m_row, hash, pValue);
+		++m_changeCount;
+	}
+
+	void BinaryLogWriter::end_changes(std::vector<uint8_t>& rOut)
+	{
+		// Even records without changes are written, so rebuilding the wide table yields every line.
+		std::vector<uint8_t> payload(m_row.begin(), m_row.begin() + 4);
+		put_varint(payload, m_changeCount);
+		payload.insert(payload.end(), m_row.begin() + 4, m_row.end());
+		rOut.insert(rOut.end(), m_dictionaryRecords.begin(), m_dictionaryRecords.end());
+		m_lastDictionarySize = m_dictionaryRecords.size();
+		m_dictionaryRecords.clear();
+		put_record(rOut, LogRecordType::kChanges, payload);
+	}
+
+	void BinaryLogWriter::write_keyframe(float elapsedTime, std::vector<uint8_t>& rOut)
+	{
+		std::vector<uint8_t> cells;
+		uint32_t count = 0;
+		for (uint32_t column = 0; column < m_tracked.size(); ++column)
+		{
+			if (m_persistent[column])
+			{
+				put_varint(cells, column);
+				put_tracked_cell(cells, m_tracked[column]);
+				++count;
+			}
+		}
+		std::vector<uint8_t> payload;
+		put_time(payload, elapsedTime);
+		put_varint(payload, count);
+		payload.insert(payload.end(), cells.begin(), cells.end());
+		put_record(rOut, LogRecordType::kKeyframe, payload);
+	}
+
+	void BinaryLogWriter::put_text_cell(std::vector<uint8_t>& rOut, const char* pText, size_t length)
+	{
+		rOut.push_back(static_cast<uint8_t>(CellType::kText));
+		put_string(rOut, pText, length);
+	}
+
+	void BinaryLogWriter::put_integer_cell(std::vector<uint8_t>& rOut, int32_t value)
+	{
+		// Zigzag encoding keeps small negative numbers small as well.
+		rOut.push_back(static_cast<uint8_t>(CellType::kInteger));
+		put_varint(rOut, (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+	}
+
+	void BinaryLogWriter::put_name_cell(std::vector<uint8_t>& rOut, uint32_t hash, const char* pValue)
+	{
+		auto itEntry = m_dictionary.find(hash);
+		if (itEntry == m_dictionary.end())
+		{
+			// The first occurrence of a value defines its id.
+			const uint32_t id = static_cast<uint32_t>(m_dictionary.size());
+			itEntry = m_dictionary.insert(std::make_pair(hash, id)).first;
+			std::vector<uint8_t> payload;
+			put_varint(payload, id);
+			put_string(payload, pValue, std::strlen(pValue));
+			put_record(m_dictionaryRecords, LogRecordType::kDictionary, payload);
+		}
+		rOut.push_back(static_cast<uint8_t>(CellType::kName));
+		put_varint(rOut, itEntry->second);
+	}
+
+	void BinaryLogWriter::put_tracked_cell(std::vector<uint8_t>& rOut, const TrackedCell& cell)
+	{
+		switch (cell.type)
+		{
+		case CellType::kText:
+			put_text_cell(rOut, cell.text.data(), cell.text.size());
+			break;
+		case CellType::kInteger:
+			put_integer_cell(rOut, static_cast<int32_t>(cell.value));
+			break;
+		case CellType::kName:
+			// The name was written before, so its dictionary entry exists already.
+			rOut.push_back(static_cast<uint8_t>(CellType::kName));
+			put_varint(rOut, m_dictionary[cell.value]);
+			break;
+		default:
+			rOut.push_back(static_cast<uint8_t>(CellType::kUndefined));
+			break;
+		}
+	}
+
+	std::vector<uint8_t> BinaryLogWriter::create_abort_record()
+	{
+		std::vector<uint8_t> record;
+		put_record(record, LogRecordType::kAborted, std::vector<uint8_t>());
+		return record;
+	}
+
+	BinaryLogReader::BinaryLogReader(const uint8_t* pData, size_t size)
+		: m_pData(pData), m_size(size)
+	{
+	}
+
+	// Returns true if the data starts with the file header of a binary log.
+	static bool is_log_header(const uint8_t* pData, size_t size)
+	{
+		if (size < 8)
+		{
+			return false;
+		}
+		uint32_t header[2] = { 0, 0 };
+		for (int i = 0; i < 8; ++i)
+		{
+			header[i / 4] |= static_cast<uint32_t>(pData[i]) << ((i % 4) * 8);
+		}
+		return header[0] == kBinaryLogMagic && header[1] == kBinaryLogVersion;
+	}
+
+	bool BinaryLogReader::read_header()
+	{
+		if (m_size < 8)
+		{
+			return false;
+		}
+		m_position = 8;
+		return is_log_header(m_pData, m_size);
+	}
+
+	bool BinaryLogReader::read_record(LogRecordType& rType, const uint8_t*& rpPayload, size_t& rPayloadSize)
+	{
+		const uint8_t* pData = m_pData + m_position;
+		const uint8_t* pEnd = m_pData + m_size;
+		if (pData >= pEnd)
+		{
+			return false;
+		}
+		rType = static_cast<LogRecordType>(*pData++);
+		uint64_t payloadSize;
+		if (!get_varint(pData, pEnd, payloadSize) || static_cast<uint64_t>(pEnd - pData) < payloadSize)
+		{
+			return false;
+		}
+		rpPayload = pData;
+		rPayloadSize = static_cast<size_t>(payloadSize);
+		m_position = static_cast<size_t>(pData - m_pData) + rPayloadSize;
+		return true;
+	}
+
+	bool BinaryLogReader::read_cell(const uint8_t*& rpData, const uint8_t* pEnd, LogCell& rCell) const
+	{
+		if (rpData >= pEnd)
+		{
+			return false;
+		}
+		uint64_t value;
+		rCell.type = static_cast<CellType>(*rpData++);
+		switch (rCell.type)
+		{
+		case CellType::kUndefined:
+			return true;
+		case CellType::kText:
+			return get_string(rpData, pEnd, rCell.text);
+		case CellType::kName:
+			if (!get_varint(rpData, pEnd, value) || value >= m_dictionary.size())
+			{
+				return false;
+			}
+			rCell.id = static_cast<uint32_t>(value);
+			return true;
+		case CellType::kInteger:
+			if (!get_varint(rpData, pEnd, value))
+			{
+				return false;
+			}
+			rCell.integer = static_cast<int32_t>((static_cast<uint32_t>(value) >> 1) ^ (0u - (static_cast<uint32_t>(value) & 1)));
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool BinaryLogReader::read_changes(const uint8_t*& rpData, const uint8_t* pEnd)
+	{
+		uint64_t count;
+		if (!get_varint(rpData, pEnd, count))
+		{
+			return false;
+		}
+		m_changes.clear();
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			uint64_t column;
+			LogCell cell;
+			if (!get_varint(rpData, pEnd, column) || column >= m_columns.size() || !read_cell(rpData, pEnd, cell))
+			{
+				return false;
+			}
+			m_changes.push_back(std::make_pair(static_cast<uint32_t>(column), cell));
+		}
+		return true;
+	}
+
+	static bool get_time(const uint8_t*& rpData, const uint8_t* pEnd, float& rTime)
+	{
+		if (pEnd - rpData < 4)
+		{
+			return false;
+		}
+		uint32_t bits = 0;
+		for (int b = 0; b < 4; ++b)
+		{
+			bits |= static_cast<uint32_t>(rpData[b]) << (b * 8);
+		}
+		std::memcpy(&rTime, &bits, sizeof(bits));
+		rpData += 4;
+		return true;
+	}
+
+	bool BinaryLogReader::read_definition(LogRecordType type, const uint8_t* pData, const uint8_t* pEnd)
+	{
+		bool isValid = true;
+		uint64_t value;
+		switch (type)
+		{
+		case LogRecordType::kSession:
+			isValid = get_varint(pData, pEnd, value) && get_string(pData, pEnd, m_undefinedValue);
+			m_participant = static_cast<uint32_t>(value);
+			break;
+		case LogRecordType::kColumns:
+			isValid = get_varint(pData, pEnd, value);
+			m_columns.resize(isValid ? static_cast<size_t>(value) : 0);
+			for (auto& column : m_columns)
+			{
+				isValid = isValid && get_string(pData, pEnd, column);
+			}
+			break;
+		case LogRecordType::kColumnKinds:
+			m_isLongFormat = true;
+			m_persistent.assign(pData, pEnd);
+			m_persistent.resize(m_columns.size(), 0);
+			m_persistentCells.assign(m_columns.size(), LogCell());
+			break;
+		case LogRecordType::kDictionary:
+		{
+			std::string entry;
+			isValid = get_varint(pData, pEnd, value) && get_string(pData, pEnd, entry) && value <= m_dictionary.size();
+			if (isValid)
+			{
+				if (value == m_dictionary.size())
+				{
+					m_dictionary.push_back(entry);
+				}
+				else
+				{
+					m_dictionary[static_cast<size_t>(value)] = entry;
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return isValid;
+	}
+
+	bool BinaryLogReader::seek(size_t offset)
+	{
+		// The records start right after the file header, which is where an offset of zero leads.
+		offset = std::max<size_t>(offset, 8);
+		// Seeking backwards has to read the definitions from the start again.
+		if (offset < m_position || m_position < 8)
+		{
+			if (!read_header())
+			{
+				return false;
+			}
+			m_dictionary.clear();
+		}
+		LogRecordType type;
+		const uint8_t* pPayload;
+		size_t payloadSize;
+		while (m_position < offset)
+		{
+			const size_t recordStart = m_position;
+			if (!read_record(type, pPayload, payloadSize))
+			{
+				return false;
+			}
+			if (type == LogRecordType::kAborted)
+			{
+				m_isAborted = true;
+			}
+			else if (!read_definition(type, pPayload, pPayload + payloadSize))
+			{
+				m_position = recordStart;
+				return false;
+			}
+		}
+		m_persistentCells.assign(m_columns.size(), LogCell());
+		return m_position == offset;
+	}
+
+	bool BinaryLogReader::read_definitions(const uint8_t* pData, size_t size)
+	{
+		const uint8_t* pEnd = pData + size;
+		if (is_log_header(pData, size))
+		{
+			pData += 8;
+		}
+		while (pData < pEnd)
+		{
+			const LogRecordType type = static_cast<LogRecordType>(*pData++);
+			uint64_t payloadSize;
+			if (!get_varint(pData, pEnd, payloadSize) || static_cast<uint64_t>(pEnd - pData) < payloadSize)
+			{
+				return false;
+			}
+			const bool isDefinition = type == LogRecordType::kSession || type == LogRecordType::kColumns || type == LogRecordType::kColumnKinds || type == LogRecordType::kDictionary;
+			if (!isDefinition || !read_definition(type, pData, pData + payloadSize))
+			{
+				return false;
+			}
+			pData += payloadSize;
+		}
+		return true;
+	}
+
+	void BinaryLogReader::resume(const uint8_t* pData, size_t size, size_t offset)
+	{
+		m_pData = pData;
+		m_size = size;
+		m_baseOffset = offset;
+		// The start of the log is only reached through the file header.
+		m_position = offset == 0 && is_log_header(pData, size) ? 8 : 0;
+		m_persistentCells.assign(m_columns.size(), LogCell());
+	}
+
+	bool BinaryLogReader::next_row()
+	{
+		LogRecordType type;
+		const uint8_t* pPayload;
+		size_t payloadSize;
+		while (true)
+		{
+			const size_t recordStart = m_position;
+			if (!read_record(type, pPayload, payloadSize))
+			{
+				return false;
+			}
+			const uint8_t* pData = pPayload;
+			const uint8_t* pEnd = pPayload + payloadSize;
+			bool isValid = true;
+
+			switch (type)
+			{
+			case LogRecordType::kSession:
+			case LogRecordType::kColumns:
+			case LogRecordType::kColumnKinds:
+			case LogRecordType::kDictionary:
+				isValid = read_definition(type, pData, pEnd);
+				break;
+			case LogRecordType::kRow:
+			{
+				isValid = get_time(pData, pEnd, m_rowTime);
+				m_rowOffset = recordStart;
+				m_row.resize(m_columns.size());
+				m_changes.clear();
+				for (uint32_t column = 0; isValid && column < m_row.size(); ++column)
+				{
+					isValid = read_cell(pData, pEnd, m_row[column]);
+					if (isValid && m_row[column].type != CellType::kUndefined)
+					{
+						m_changes.push_back(std::make_pair(column, m_row[column]));
+					}
+				}
+				if (isValid)
+				{
+					return true;
+				}
+				break;
+			}
+			case LogRecordType::kChanges:
+			{
+				isValid = m_isLongFormat && get_time(pData, pEnd, m_rowTime) && read_changes(pData, pEnd);
+				if (!isValid)
+				{
+					break;
+				}
+				m_rowOffset = recordStart;
+				// Persistent columns keep their values, all others are only defined where they were set.
+				for (auto& change : m_changes)
+				{
+					if (m_persistent[change.first])
+					{
+						m_persistentCells[change.first] = change.second;
+					}
+				}
+				m_row.resize(m_columns.size());
+				for (uint32_t column = 0; column < m_row.size(); ++column)
+				{
+					m_row[column] = m_persistent[column] ? m_persistentCells[column] : LogCell();
+				}
+				for (auto& change : m_changes)
+				{
+					m_row[change.first] = change.second;
+				}
+				return true;
+			}
+			case LogRecordType::kKeyframe:
+			{
+				// Keyframes repeat the persistent values, which only matters when starting in the middle of a log.
+				float keyframeTime;
+				isValid = m_isLongFormat && get_time(pData, pEnd, keyframeTime) && read_changes(pData, pEnd);
+				if (isValid)
+				{
+					for (auto& change : m_changes)
+					{
+						m_persistentCells[change.first] = change.second;
+					}
+					m_changes.clear();
+				}
+				break;
+			}
+			case LogRecordType::kAborted:
+				m_isAborted = true;
+				break;
+			default:
+				// Unknown records are skipped, so older readers can still read newer logs.
+				break;
+			}
+
+			if (!isValid)
+			{
+				m_position = recordStart;
+				return false;
+			}
+		}
+	}
+
+	const std::string& BinaryLogReader::get_cell_string(const LogCell& cell, std::string& rBuffer) const
+	{
+		switch (cell.type)
+		{
+		case CellType::kText:
+			return cell.text;
+		case CellType::kName:
+			return m_dictionary[cell.id];
+		case CellType::kInteger:
+			rBuffer = std::to_string(cell.integer);
+			return rBuffer;
+		default:
+			return m_undefinedValue;
+		}
+	}
+
+} // namespace SessionLog
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SessionLog
+{
+
+	// The binary log is a compact alternative to the tab separated text output.
+	// It starts with its magic and version, followed by records of the form: type (u8), payload size (varint), payload.
+	// Integers are stored as variable length integers, strings as their size followed by their characters.
+	// Strings that repeat, like names and flags, are dictionary encoded: each distinct value is written once,
+	// right before the first row using it, and rows only refer to its small id afterwards.
+	// Logs in the long format contain change records instead of rows, which only hold the cells that changed.
+	// Persistent columns (conditions and "always up to date" fields) keep their last value until it changes,
+	// all other columns only have a value in the change record that set it.
+	// Keyframes with the values of all persistent columns are written periodically, so readers can start anywhere.
+	static constexpr uint32_t kBinaryLogMagic = 0x4C315652; // "RV1L"
+	static constexpr uint32_t kBinaryLogVersion = 1;
+	static constexpr const char* kBinaryLogFileExtension = ".rvl";
+
+	enum class LogRecordType : uint8_t
+	{
+		// The participant number and the string representing undefined values.
+		kSession = 1,
+		// The names of all columns after the participant and the time.
+		kColumns = 2,
+		// A new dictionary entry: id, string.
+		kDictionary = 3,
+		// One line of the output: elapsed time (f32), then one cell per column.
+		kRow = 4,
+		// Marks the output of an aborted session.
+		kAborted = 5,
+		// Long format: elapsed time (f32), number of changes, then pairs of column index and cell.
+		kChanges = 6,
+		// Long format: the values of all persistent columns, with the same layout as a change record.
+		kKeyframe = 7,
+		// Long format: one byte per column, 1 for persistent columns.
+		kColumnKinds = 8
+	};
+
+	enum class CellType : uint8_t
+	{
+		kUndefined = 0,
+		// Followed by a string.
+		kText = 1,
+		// Followed by a dictionary id.
+		kName = 2,
+		// Followed by a zigzag encoded integer.
+		kInteger = 3
+	};
+
+	// Encodes the records of a binary log.
+	// Rows are built cell by cell, and ending a row emits any new dictionary entries before the row itself.
+	class BinaryLogWriter
+	{
+	public:
+
+		// Starts a new log with its file header and the session record.
+		void begin_session(uint32_t participant, const char* undefinedValue, std::vector<uint8_t>& rOut);
+
+		// Writes the column record with the given column names.
+		void write_columns(const std::vector<const char*>& columnNames, std::vector<uint8_t>& rOut);
+
+		// Writes the column records of a log in the long format.
+		// Persistent columns are tracked, so only changes of their values are written.
+		void write_columns(const std::vector<const char*>& columnNames, const std::vector<uint8_t>& persistent, std::vector<uint8_t>& rOut);
+
+		void begin_row(float elapsedTime);
+		void add_undefined();
+		void add_text(const char* pText, size_t length);
+		void add_integer(int32_t value);
+		// Adds a dictionary encoded value, identified by its hash. The string is only read the first time a hash is seen.
+		void add_name(uint32_t hash, const char* pValue);
+		void end_row(std::vector<uint8_t>& rOut);
+
+		// Returns the size of the dictionary records that were written right before the last row or change record.
+		size_t get_last_dictionary_size() const { return m_lastDictionarySize; }
+
+		// Long format: changes are collected like the cells of a row, but each one names its column.
+		// Values of persistent columns are skipped if they did not change, unless forced.
+		// Values of other columns are always forced, as they represent an event at this point in time.
+		void begin_changes(float elapsedTime);
+		void change_undefined(uint32_t column);
+		void change_text(uint32_t column, const char* pText, size_t length, bool force);
+		void change_integer(uint32_t column, int32_t value, bool force);
+		void change_name(uint32_t column, uint32_t hash, const char* pValue, bool force);
+		void end_changes(std::vector<uint8_t>& rOut);
+
+		// Long format: writes a keyframe with the last values of all persistent columns.
+		void write_keyframe(float elapsedTime, std::vector<uint8_t>& rOut);
+
+		// Returns the record that marks an aborted session.
+		static std::vector<uint8_t> create_abort_record();
+
+	private:
+
+		// The last value written for a persistent column.
+		struct TrackedCell
+		{
+			CellType type = CellType::kUndefined;
+			uint32_t value = 0;
+			std::string text;
+		};
+
+		void put_text_cell(std::vector<uint8_t>& rOut, const char* pText, size_t length);
+		void put_integer_cell(std::vector<uint8_t>& rOut, int32_t value);
+		void put_name_cell(std::vector<uint8_t>& rOut, uint32_t hash, const char* pValue);
+		void put_tracked_cell(std::vector<uint8_t>& rOut, const TrackedCell& cell);
+
+		std::unordered_map<uint32_t, uint32_t> m_dictionary;
+		std::vector<uint8_t> m_dictionaryRecords;
+		std::vector<uint8_t> m_row;
+		std::vector<uint8_t> m_persistent;
+		std::vector<TrackedCell> m_tracked;
+		uint32_t m_changeCount = 0;
+		size_t m_lastDictionarySize = 0;
+	};
+
+	// A decoded cell of a row.
+	struct LogCell
+	{
+		CellType type = CellType::kUndefined;
+		int32_t integer = 0;
+		uint32_t id = 0;
+		std::string text;
+	};
+
+	// Decodes a binary log row by row.
+	class BinaryLogReader
+	{
+	public:
+
+		BinaryLogReader(const uint8_t* pData, size_t size);
+
+		// Reads the file header. Returns false if the data is no binary log.
+		bool read_header();
+
+		// Reads the next row, processing all other records on the way.
+		// Rows of logs in the long format are rebuilt from the change records and the persistent column values.
+		// Returns false at the end of the log, or if a record is damaged or incomplete.
+		bool next_row();
+
+		// Moves to the record at the given offset, e.g. the resume offset of a session index entry.
+		// Records in between are skipped by their size, only column and dictionary records are read on the way.
+		// The values of persistent columns are reset, so the offset has to be a keyframe in logs of the long format.
+		// Returns false if the offset could not be reached.
+		bool seek(size_t offset);
+
+		// Reads the session, column and dictionary records in a part of the log, e.g. the one a definition entry of a session index points at.
+		// The part may start with the file header. Returns false if it is damaged or contains any other record.
+		bool read_definitions(const uint8_t* pData, size_t size);
+
+		// Continues reading in another part of the same log, which holds the log from the given offset on.
+		// At offset 0, the part starts with the file header, which is skipped.
+		// Definitions read so far are kept, so together with read_definitions, only the parts of the log that are needed have to be loaded.
+		// As with seek, the values of persistent columns are reset, so the offset has to be a keyframe in logs of the long format.
+		void resume(const uint8_t* pData, size_t size, size_t offset);
+
+		// Returns the string representation of a cell of the current row.
+		const std::string& get_cell_string(const LogCell& cell, std::string& rBuffer) const;
+
+		uint32_t get_participant() const { return m_participant; }
+		const std::string& get_undefined_value() const { return m_undefinedValue; }
+		const std::vector<std::string>& get_columns() const { return m_columns; }
+		float get_row_time() const { return m_rowTime; }
+		// Returns the offset of the current row's record in the whole log, which matches the offsets of a session index.
+		size_t get_row_offset() const { return m_baseOffset + m_rowOffset; }
+		const std::vector<LogCell>& get_row() const { return m_row; }
+		// Returns the cells that were set by the current row, as column index and cell.
+		// For rows of the wide format, these are all defined cells.
+		const std::vector<std::pair<uint32_t, LogCell>>& get_changes() const { return m_changes; }
+		bool is_long_format() const { return m_isLongFormat; }
+		bool is_aborted() const { return m_isAborted; }
+		// Returns true if reading stopped before the end of the data.
+		bool is_truncated() const { return m_position < m_size; }
+
+	private:
+
+		bool read_record(LogRecordType& rType, const uint8_t*& rpPayload, size_t& rPayloadSize);
+		bool read_cell(const uint8_t*& rpData, const uint8_t* pEnd, LogCell& rCell) const;
+		bool read_changes(const uint8_t*& rpData, const uint8_t* pEnd);
+		// Reads the session, column and dictionary records, which every other record depends on.
+		bool read_definition(LogRecordType type, const uint8_t* pData, const uint8_t* pEnd);
+
+		const uint8_t* m_pData;
+		size_t m_size;
+		// The offset of the data in the whole log, see resume.
+		size_t m_baseOffset = 0;
+		size_t m_position = 0;
+		uint32_t m_participant = 0;
+		std::string m_undefinedValue;
+		std::vector<std::string> m_columns;
+		std::vector<std::string> m_dictionary;
+		float m_rowTime = 0.0f;
+		size_t m_rowOffset = 0;
+		std::vector<LogCell> m_row;
+		std::vector<std::pair<uint32_t, LogCell>> m_changes;
+		std::vector<uint8_t> m_persistent;
+		std::vector<LogCell> m_persistentCells;
+		bool m_isLongFormat = false;
+		bool m_isAborted = false;
+	};
+
+	// Variable length integer helpers shared by all binary formats.
+	void put_varint(std::vector<uint8_t>& rOut, uint64_t value);
+	bool get_varint(const uint8_t*& rpData, const uint8_t* pEnd, uint64_t& rValue);
+
+} // namespace SessionLog
@@ -0,0 +1,314 @@
+#include "BlockCodec.h"
+#include "SessionJournal.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace SessionLog
+{
+
+	static constexpr size_t kMinimumMatch = 4;
+	static constexpr size_t kMaximumOffset = 65535;
+	// The end of a block always consists of literals, which keeps the decoder simple and fast.
+	static constexpr size_t kLastLiterals = 5;
+	static constexpr size_t kMatchSearchLimit = 12;
+	static constexpr uint32_t kHashBits = 12;
+
+	static uint32_t read_u32(const uint8_t* pData)
+	{
+		uint32_t value;
+		std::memcpy(&value, pData, sizeof(value));
+		return value;
+	}
+
+	static uint32_t hash_sequence(uint32_t sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - kHashBits);
+	}
+
+	// Writes a length that did not fit into its token nibble.
+	static bool write_length(size_t length, uint8_t*& rpOut, const uint8_t* pOutEnd)
+	{
+		while (length >= 255)
+		{
+			if (rpOut >= pOutEnd)
+			{
+				return false;
+			}
+			*rpOut++ = 255;
+			length -= 255;
+		}
+		if (rpOut >= pOutEnd)
+		{
+			return false;
+		}
+		*rpOut++ = static_cast<uint8_t>(length);
+		return true;
+	}
+
+	// Writes one sequence of literals, optionally followed by a match.
+	static bool write_sequence(const uint8_t* pLiterals, size_t literalLength, size_t offset, size_t matchLength, uint8_t*& rpOut, const uint8_t* pOutEnd)
+	{
+		if (rpOut >= pOutEnd)
+		{
+			return false;
+		}
+		uint8_t* pToken = rpOut++;
+		*pToken = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4);
+		if (literalLength >= 15 && !write_length(literalLength - 15, rpOut, pOutEnd))
+		{
+			return false;
+		}
+		if (static_cast<size_t>(pOutEnd - rpOut) < literalLength)
+		{
+			return false;
+		}
+		if (literalLength > 0)
+		{
+			std::memcpy(rpOut, pLiterals, literalLength);
+			rpOut += literalLength;
+		}
+
+		if (matchLength == 0)
+		{
+			return true;
+		}
+		if (pOutEnd - rpOut < 2)
+		{
+			return false;
+		}
+		*rpOut++ = static_cast<uint8_t>(offset);
+		*rpOut++ = static_cast<uint8_t>(offset >> 8);
+		const size_t extraLength = matchLength - kMinimumMatch;
+		*pToken |= static_cast<uint8_t>(extraLength < 15 ? extraLength : 15);
+		return extraLength < 15 || write_length(extraLength - 15, rpOut, pOutEnd);
+	}
+
+	size_t compress_bound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	size_t compress_block(const uint8_t* pSource, size_t sourceSize, uint8_t* pDestination, size_t destinationCapacity)
+	{
+		uint8_t* pOut = pDestination;
+		const uint8_t* pOutEnd = pDestination + destinationCapacity;
+		size_t anchor = 0;
+
+		if (sourceSize > kMatchSearchLimit)
+		{
+			// Positions are stored with an offset of one, so zero means empty.
+			uint32_t table[1 << kHashBits] = { 0 };
+			const size_t searchEnd = sourceSize - kMatchSearchLimit;
+			const size_t matchEnd = sourceSize - kLastLiterals;
+			size_t position = 0;
+			while (position < searchEnd)
+			{
+				const uint32_t sequence = read_u32(pSource + position);
+				const uint32_t hash = hash_sequence(sequence);
+				const size_t candidate = table[hash];
+				table[hash] = static_cast<uint32_t>(position + 1);
+
+				if (candidate == 0 || position - (candidate - 1) > kMaximumOffset || read_u32(pSource + candidate - 1) != sequence)
+				{
+					// Skip ahead faster the longer no match was found, incompressible data is passed over quickly.
+					position += 1 + ((position - anchor) >> 6);
+					continue;
+				}
+
+				const size_t reference = candidate - 1;
+				size_t matchLength = kMinimumMatch;
+				while (position + matchLength < matchEnd && pSource[reference + matchLength] == pSource[position + matchLength])
+				{
+					++matchLength;
+				}
+				if (!write_sequence(pSource + anchor, position - anchor, position - reference, matchLength, pOut, pOutEnd))
+				{
+					return 0;
+				}
+				position += matchLength;
+				anchor = position;
+			}
+		}
+
+		if (!write_sequence(pSource + anchor, sourceSize - anchor, 0, 0, pOut, pOutEnd))
+		{
+			return 0;
+		}
+		return static_cast<size_t>(pOut - pDestination);
+	}
+
+	bool decompress_block(const uint8_t* pSource, size_t sourceSize, uint8_t* pDestination, size_t destinationSize)
+	{
+		const uint8_t* pIn = pSource;
+		const uint8_t* pInEnd = pSource + sourceSize;
+		size_t position = 0;
+
+		while (pIn < pInEnd)
+		{
+			const uint8_t token = *pIn++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15)
+			{
+				uint8_t extra;
+				do
+				{
+					if (pIn >= pInEnd)
+					{
+						return false;
+					}
+					extra = *pIn++;
+					literalLength += extra;
+				} while (extra == 255);
+			}
+			if (static_cast<size_t>(pInEnd - pIn) < literalLength || destinationSize - position < literalLength)
+			{
+				return false;
+			}
+			std::memcpy(pDestination + position, pIn, literalLength);
+			pIn += literalLength;
+			position += literalLength;
+
+			// The last sequence consists of literals only.
+			if (pIn == pInEnd)
+			{
+				break;
+			}
+
+			if (pInEnd - pIn < 2)
+			{
+				return false;
+			}
+			const size_t offset = static_cast<size_t>(pIn[0]) | (static_cast<size_t>(pIn[1]) << 8);
+			pIn += 2;
+			if (offset == 0 || offset > position)
+			{
+				return false;
+			}
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15)
+			{
+				uint8_t extra;
+				do
+				{
+					if (pIn >= pInEnd)
+					{
+						return false;
+					}
+					extra = *pIn++;
+					matchLength += extra;
+				} while (extra == 255);
+			}
+			matchLength += kMinimumMatch;
+			if (destinationSize - position < matchLength)
+			{
+				return false;
+			}
+
+			// Matches may overlap their own output, so they are copied byte by byte.
+			const uint8_t* pMatch = pDestination + position - offset;
+			uint8_t* pOut = pDestination + position;
+			for (size_t i = 0; i < matchLength; ++i)
+			{
+				pOut[i] = pMatch[i];
+			}
+			position += matchLength;
+		}
+
+		return position == destinationSize;
+	}
+
+	static void put_frame_u32(uint8_t* pOut, uint32_t value)
+	{
+		for (int b = 0; b < 4; ++b)
+		{
+			pOut[b] = static_cast<uint8_t>(value >> (b * 8));
+		}
+	}
+
+	static uint32_t get_frame_u32(const uint8_t* pData)
+	{
+		return static_cast<uint32_t>(pData[0]) | (static_cast<uint32_t>(pData[1]) << 8) | (static_cast<uint32_t>(pData[2]) << 16) | (static_cast<uint32_t>(pData[3]) << 24);
+	}
+
+	void encode_frame(const uint8_t* pData, size_t size, std::vector<uint8_t>& rOut)
+	{
+		while (size > kMaximumFrameSize)
+		{
+			encode_frame(pData, kMaximumFrameSize, rOut);
+			pData += kMaximumFrameSize;
+			size -= kMaximumFrameSize;
+		}
+
+		const size_t frameStart = rOut.size();
+		rOut.resize(frameStart + kFrameHeaderSize + compress_bound(size));
+		uint8_t* pFrame = rOut.data() + frameStart;
+
+		// Only keep the compressed data if it actually saves space.
+		size_t storedSize = compress_block(pData, size, pFrame + kFrameHeaderSize, compress_bound(size));
+		uint32_t storedField = static_cast<uint32_t>(storedSize);
+		if (storedSize == 0 || storedSize >= size)
+		{
+			if (size > 0)
+			{
+				std::memcpy(pFrame + kFrameHeaderSize, pData, size);
+			}
+			storedSize = size;
+			storedField = static_cast<uint32_t>(size) | kFrameStoredFlag;
+		}
+
+		put_frame_u32(pFrame, kFrameMagic);
+		put_frame_u32(pFrame + 4, static_cast<uint32_t>(size));
+		put_frame_u32(pFrame + 8, storedField);
+		put_frame_u32(pFrame + 12, crc32(pData, size));
+		rOut.resize(frameStart + kFrameHeaderSize + storedSize);
+	}
+
+	bool decode_frame(std::istream& input, std::vector<uint8_t>& rOut)
+	{
+		uint8_t header[kFrameHeaderSize];
+		input.read(reinterpret_cast<char*>(header), kFrameHeaderSize);
+		if (input.gcount() != kFrameHeaderSize || get_frame_u32(header) != kFrameMagic)
+		{
+			return false;
+		}
+		const uint32_t rawSize = get_frame_u32(header + 4);
+		const uint32_t storedField = get_frame_u32(header + 8);
+		const bool isStored = (storedField & kFrameStoredFlag) != 0;
+		const uint32_t storedSize = storedField & ~kFrameStoredFlag;
+		// Stored frames keep their raw size, compressed ones are only kept if they are smaller.
+		// Anything else is a damaged header, which is rejected before its sizes are allocated.
+		if (rawSize > kMaximumFrameSize || (isStored ? storedSize != rawSize : (storedSize == 0 || storedSize >= rawSize)))
+		{
+			return false;
+		}
+
+		std::vector<uint8_t> stored(storedSize);
+		input.read(reinterpret_cast<char*>(stored.data()), storedSize);
+		if (static_cast<uint32_t>(input.gcount()) != storedSize)
+		{
+			return false;
+		}
+
+		const size_t outputStart = rOut.size();
+		rOut.resize(outputStart + rawSize);
+		bool isValid = true;
+		if (isStored)
+		{
+			std::copy(stored.begin(), stored.end(), rOut.begin() + outputStart);
+		}
+		else
+		{
+			isValid = decompress_block(stored.data(), storedSize, rOut.data() + outputStart, rawSize);
+		}
+		if (!isValid || crc32(rOut.data() + outputStart, rawSize) != get_frame_u32(header + 12))
+		{
+			rOut.resize(outputStart);
+			return false;
+		}
+		return true;
+	}
+
+} // namespace SessionLog
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+namespace SessionLog
+{
+
+	// A small LZ77 codec in the spirit of LZ4, which trades compression ratio for speed.
+	// Every block is compressed on its own, so each one can be decoded without any other.
+
+	// Returns the worst case size of a compressed block for the given input size.
+	size_t compress_bound(size_t size);
+
+	// Compresses a block of data into the given buffer.
+	// Returns the compressed size, or 0 if the buffer was too small.
+	size_t compress_block(const uint8_t* pSource, size_t sourceSize, uint8_t* pDestination, size_t destinationCapacity);
+
+	// Decompresses a block of data that decodes to exactly the given size.
+	// Returns false if the data is damaged.
+	bool decompress_block(const uint8_t* pSource, size_t sourceSize, uint8_t* pDestination, size_t destinationSize);
+
+	// Compressed output files consist of self-describing frames, one per block.
+	// Each frame starts with its magic, the raw size, the stored size and the checksum of the raw data.
+	// If compressing a block would not make it smaller, it is stored as is and flagged in the stored size.
+	// A damaged or truncated frame only affects itself, all frames before it remain readable.
+	static constexpr uint32_t kFrameMagic = 0x425A5652; // "RVZB"
+	static constexpr uint32_t kFrameHeaderSize = 16;
+	static constexpr uint32_t kFrameStoredFlag = 0x80000000;
+	// The largest raw size of a single frame, larger data is split into several frames.
+	// Readers reject larger sizes before allocating anything, so a damaged header can not request gigabytes of memory.
+	static constexpr uint32_t kMaximumFrameSize = 16 * 1024 * 1024;
+	static constexpr const char* kCompressedFileExtension = ".rvz";
+
+	// Appends a frame for the given raw data, or several if it is larger than kMaximumFrameSize.
+	void encode_frame(const uint8_t* pData, size_t size, std::vector<uint8_t>& rOut);
+
+	// Reads the next frame from the given input and appends its raw data.
+	// Returns false at the end of the input or if the frame is damaged, the output is not modified in that case.
+	bool decode_frame(std::istream& input, std::vector<uint8_t>& rOut);
+
+} // namespace SessionLog
@@ -0,0 +1,387 @@
+#include "OutputFile.h"
+
+#include "AsyncOutputFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+	#include <io.h>
+	#include <fcntl.h>
+	#include <sys/stat.h>
+#elif defined(__ORBIS__)
+	#include <kernel.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace SessionLog
+{
+
+	// Syncs start at multiples of this, which is a multiple of the page size on all supported platforms.
+	static constexpr uint64_t kSyncAlignment = 64 * 1024;
+
+	std::unique_ptr<OutputFile> create_output_file(FileBackend backend, const std::string& filePath)
+	{
+		if (backend == FileBackend::kAsync)
+		{
+			std::unique_ptr<OutputFile> pFile(new AsyncOutputFile());
+			if (pFile->open(filePath))
+			{
+				return pFile;
+			}
+			// Positioned writes are not available on this platform, map the file instead.
+			backend = FileBackend::kMapped;
+		}
+		if (backend == FileBackend::kMapped)
+		{
+			std::unique_ptr<OutputFile> pFile(new MappedOutputFile());
+			if (pFile->open(filePath))
+			{
+				return pFile;
+			}
+			// The file system might not support mappings, use the stream backend instead.
+		}
+		std::unique_ptr<OutputFile> pFile(new StreamOutputFile());
+		if (pFile->open(filePath))
+		{
+			return pFile;
+		}
+		return nullptr;
+	}
+
+	bool truncate_file(const std::string& filePath, uint64_t length)
+	{
+#if defined(_WIN32)
+		int fileDescriptor = -1;
+		if (_sopen_s(&fileDescriptor, filePath.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+		{
+			return false;
+		}
+		const bool success = _chsize_s(fileDescriptor, static_cast<__int64>(length)) == 0;
+		_close(fileDescriptor);
+		return success;
+#elif defined(__ORBIS__)
+		return sceKernelTruncate(filePath.c_str(), static_cast<off_t>(length)) == SCE_OK;
+#else
+		return ::truncate(filePath.c_str(), static_cast<off_t>(length)) == 0;
+#endif
+	}
+
+	bool StreamOutputFile::open(const std::string& filePath)
+	{
+		m_file.open(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
+		m_length = 0;
+		return m_file.good();
+	}
+
+	void StreamOutputFile::write(const void* pData, size_t size)
+	{
+		m_file.write(static_cast<const char*>(pData), size);
+		m_length += size;
+	}
+
+	void StreamOutputFile::submit_sync()
+	{
+		// The stream can only hand its buffer to the operating system, there is nothing to wait for.
+		m_file.flush();
+		m_isSyncFailed = !m_file.good();
+	}
+
+	bool StreamOutputFile::wait_for_sync()
+	{
+		return !m_isSyncFailed;
+	}
+
+	void StreamOutputFile::close()
+	{
+		m_file.close();
+	}
+
+	bool StreamOutputFile::is_open() const
+	{
+		return m_file.is_open();
+	}
+
+	uint64_t StreamOutputFile::get_length() const
+	{
+		return m_length;
+	}
+
+	MappedOutputFile::MappedOutputFile(uint64_t extentSize)
+		: m_extentSize(extentSize > 0 ? extentSize : kDefaultExtentSize)
+	{
+	}
+
+	MappedOutputFile::~MappedOutputFile()
+	{
+		close();
+	}
+
+	bool MappedOutputFile::open(const std::string& filePath)
+	{
+		if (m_isOpen)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		HANDLE fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		m_fileHandle = fileHandle;
+#elif defined(__ORBIS__)
+		m_fileDescriptor = sceKernelOpen(filePath.c_str(), SCE_KERNEL_O_RDWR | SCE_KERNEL_O_CREAT | SCE_KERNEL_O_TRUNC, SCE_KERNEL_S_IRWU);
+		if (m_fileDescriptor < 0)
+		{
+			return false;
+		}
+#else
+		m_fileDescriptor = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (m_fileDescriptor < 0)
+		{
+			return false;
+		}
+#endif
+		m_isOpen = true;
+		m_length = 0;
+		m_syncedLength = 0;
+		m_capacity = 0;
+
+		// Map the first extent right away, so a failure can still fall back to another backend.
+		if (!map_capacity(m_extentSize))
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedOutputFile::write(const void* pData, size_t size)
+	{
+		if (!m_isOpen)
+		{
+			return;
+		}
+		if (m_pMapping != nullptr && m_length + size > m_capacity)
+		{
+			// Grow by whole extents, so this only happens once in a while.
+			uint64_t capacity = m_capacity;
+			while (m_length + size > capacity)
+			{
+				capacity += m_extentSize;
+			}
+			if (!map_capacity(capacity))
+			{
+				// The disk is most likely full. Writing through the file instead reports that as an error,
+				// while everything before stays intact and can still be recovered.
+				unmap();
+				m_capacity = 0;
+				cut_to_length();
+			}
+		}
+		if (m_pMapping == nullptr)
+		{
+			write_at_end(pData, size);
+			return;
+		}
+		std::memcpy(m_pMapping + m_length, pData, size);
+		m_length += size;
+	}
+
+	void MappedOutputFile::submit_sync()
+	{
+		m_isSyncPending = m_isOpen && m_length != m_syncedLength;
+		m_isSyncFailed = false;
+		if (!m_isSyncPending)
+		{
+			return;
+		}
+
+		// Only the range written since the last sync is dirty. Its pages are scheduled to be written, the file is flushed when waiting.
+		// Data written through the file is already in its cache.
+		if (m_pMapping != nullptr)
+		{
+			const uint64_t syncStart = m_syncedLength - (m_syncedLength % kSyncAlignment);
+			const size_t syncSize = static_cast<size_t>(m_length - syncStart);
+#if defined(_WIN32)
+			m_isSyncFailed = !FlushViewOfFile(m_pMapping + syncStart, syncSize);
+#elif defined(__ORBIS__)
+			m_isSyncFailed = sceKernelMsync(m_pMapping + syncStart, syncSize, SCE_KERNEL_MS_ASYNC) != SCE_OK;
+#else
+			m_isSyncFailed = msync(m_pMapping + syncStart, syncSize, MS_ASYNC) != 0;
+#endif
+		}
+		m_syncedLength = m_length;
+	}
+
+	bool MappedOutputFile::wait_for_sync()
+	{
+		if (!m_isSyncPending)
+		{
+			return m_isOpen;
+		}
+		m_isSyncPending = false;
+
+		// The handle stays the same while the mapping grows, so this doesn't get in the way of appending.
+#if defined(_WIN32)
+		const bool success = FlushFileBuffers(static_cast<HANDLE>(m_fileHandle)) != FALSE;
+#elif defined(__ORBIS__)
+		const bool success = sceKernelFsync(m_fileDescriptor) == SCE_OK;
+#else
+		const bool success = fsync(m_fileDescriptor) == 0;
+#endif
+		return success && !m_isSyncFailed;
+	}
+
+	void MappedOutputFile::close()
+	{
+		if (!m_isOpen)
+		{
+			return;
+		}
+		sync();
+		unmap();
+
+		// Cut off the preallocated tail, so the file is exactly as long as its data.
+		cut_to_length();
+#if defined(_WIN32)
+		CloseHandle(static_cast<HANDLE>(m_fileHandle));
+		m_fileHandle = nullptr;
+#elif defined(__ORBIS__)
+		sceKernelClose(m_fileDescriptor);
+		m_fileDescriptor = -1;
+#else
+		::close(m_fileDescriptor);
+		m_fileDescriptor = -1;
+#endif
+		m_isOpen = false;
+		m_capacity = 0;
+	}
+
+	bool MappedOutputFile::is_open() const
+	{
+		return m_isOpen;
+	}
+
+	uint64_t MappedOutputFile::get_length() const
+	{
+		return m_length;
+	}
+
+	bool MappedOutputFile::map_capacity(uint64_t capacity)
+	{
+		unmap();
+
+#if defined(_WIN32)
+		// Creating the mapping with the new maximum size extends the file as well.
+		HANDLE mappingHandle = CreateFileMappingA(static_cast<HANDLE>(m_fileHandle), nullptr, PAGE_READWRITE, static_cast<DWORD>(capacity >> 32), static_cast<DWORD>(capacity), nullptr);
+		if (mappingHandle == nullptr)
+		{
+			return false;
+		}
+		void* pMapping = MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(capacity));
+		if (pMapping == nullptr)
+		{
+			CloseHandle(mappingHandle);
+			return false;
+		}
+		m_mappingHandle = mappingHandle;
+#elif defined(__ORBIS__)
+		// Output is written to exFAT formatted USB drives, which have no sparse files, so extending the file allocates its clusters.
+		// A full drive therefore fails here instead of when the mapping is written to.
+		if (sceKernelFtruncate(m_fileDescriptor, static_cast<off_t>(capacity)) != SCE_OK)
+		{
+			return false;
+		}
+		void* pMapping = nullptr;
+		if (sceKernelMmap(nullptr, static_cast<size_t>(capacity), SCE_KERNEL_PROT_CPU_READ | SCE_KERNEL_PROT_CPU_WRITE, SCE_KERNEL_MAP_SHARED, m_fileDescriptor, 0, &pMapping) != SCE_OK)
+		{
+			return false;
+		}
+#else
+		// Extending the file with ftruncate would leave it sparse, and writing to the mapping on a full disk would raise SIGBUS.
+		// Reserving the extent fails with ENOSPC here instead.
+		if (capacity > m_capacity && posix_fallocate(m_fileDescriptor, static_cast<off_t>(m_capacity), static_cast<off_t>(capacity - m_capacity)) != 0)
+		{
+			return false;
+		}
+		void* pMapping = mmap(nullptr, static_cast<size_t>(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, m_fileDescriptor, 0);
+		if (pMapping == MAP_FAILED)
+		{
+			return false;
+		}
+#endif
+		m_pMapping = static_cast<uint8_t*>(pMapping);
+		m_capacity = capacity;
+		return true;
+	}
+
+	void MappedOutputFile::write_at_end(const void* pData, size_t size)
+	{
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+		while (size > 0)
+		{
+#if defined(_WIN32)
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(m_length);
+			overlapped.OffsetHigh = static_cast<DWORD>(m_length >> 32);
+			DWORD written = 0;
+			const int64_t result = WriteFile(static_cast<HANDLE>(m_fileHandle), pBytes, static_cast<DWORD>(std::min<size_t>(size, 0x40000000)), &written, &overlapped) ? static_cast<int64_t>(written) : -1;
+#elif defined(__ORBIS__)
+			const int64_t result = sceKernelPwrite(m_fileDescriptor, pBytes, size, static_cast<off_t>(m_length));
+#else
+			const int64_t result = pwrite(m_fileDescriptor, pBytes, size, static_cast<off_t>(m_length));
+#endif
+			if (result <= 0)
+			{
+				// [NOTE] The data is lost, but everything before it stays intact and can still be recovered.
+				return;
+			}
+			pBytes += result;
+			size -= static_cast<size_t>(result);
+			m_length += static_cast<uint64_t>(result);
+		}
+	}
+
+	void MappedOutputFile::cut_to_length()
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER length;
+		length.QuadPart = static_cast<LONGLONG>(m_length);
+		SetFilePointerEx(static_cast<HANDLE>(m_fileHandle), length, nullptr, FILE_BEGIN);
+		SetEndOfFile(static_cast<HANDLE>(m_fileHandle));
+#elif defined(__ORBIS__)
+		sceKernelFtruncate(m_fileDescriptor, static_cast<off_t>(m_length));
+#else
+		ftruncate(m_fileDescriptor, static_cast<off_t>(m_length));
+#endif
+	}
+
+	void MappedOutputFile::unmap()
+	{
+		if (m_pMapping == nullptr)
+		{
+			return;
+		}
+#if defined(_WIN32)
+		UnmapViewOfFile(m_pMapping);
+		CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+		m_mappingHandle = nullptr;
+#elif defined(__ORBIS__)
+		sceKernelMunmap(m_pMapping, static_cast<size_t>(m_capacity));
+#else
+		munmap(m_pMapping, static_cast<size_t>(m_capacity));
+#endif
+		m_pMapping = nullptr;
+	}
+
+} // namespace SessionLog
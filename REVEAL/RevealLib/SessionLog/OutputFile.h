@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace SessionLog
+{
+
+	// The ways output files can be written.
+	enum class FileBackend : uint32_t
+	{
+		// Appends through a buffered std::ofstream.
+		kStream = 0,
+		// Preallocates the file in large extents and copies data into a mapping of it.
+		// Falls back to kStream if the file can not be mapped.
+		kMapped = 1,
+		// Copies data into preallocated buffers that are written on dedicated threads, see AsyncOutputFile.h.
+		// Uses io_uring on Linux and positioned writes on a small thread pool elsewhere.
+		// Falls back to kMapped where positioned writes are not available.
+		kAsync = 2
+	};
+
+	// An output file that only ever grows at its end.
+	class OutputFile
+	{
+	public:
+
+		virtual ~OutputFile() {}
+
+		// Creates the file at the given path, replacing any existing file.
+		virtual bool open(const std::string& filePath) = 0;
+
+		// Appends data to the end of the file.
+		virtual void write(const void* pData, size_t size) = 0;
+
+		// Hands everything written so far to the operating system and waits until it reached the disk where possible.
+		bool sync()
+		{
+			submit_sync();
+			return wait_for_sync();
+		}
+
+		// Hands everything written so far to the operating system and starts writing it to the disk, without waiting for that.
+		virtual void submit_sync() = 0;
+
+		// Waits until the data of the last submit_sync reached the disk where possible. Returns false if it could not be written.
+		// Unlike everything else, this may be called while another thread appends to the file, as long as nothing submits or closes meanwhile.
+		virtual bool wait_for_sync() = 0;
+
+		// Closes the file. Afterwards, the file on disk is exactly as long as the data written to it.
+		virtual void close() = 0;
+
+		virtual bool is_open() const = 0;
+
+		// Returns the number of bytes written to the file so far.
+		virtual uint64_t get_length() const = 0;
+	};
+
+	// Creates an output file with the given backend and opens it.
+	// Returns nullptr if neither the requested backend nor the fallback could open the file.
+	std::unique_ptr<OutputFile> create_output_file(FileBackend backend, const std::string& filePath);
+
+	// Cuts the given file off at the given length.
+	bool truncate_file(const std::string& filePath, uint64_t length);
+
+	// Appends through a buffered std::ofstream.
+	class StreamOutputFile : public OutputFile
+	{
+	public:
+
+		bool open(const std::string& filePath) override;
+		void write(const void* pData, size_t size) override;
+		void submit_sync() override;
+		bool wait_for_sync() override;
+		void close() override;
+		bool is_open() const override;
+		uint64_t get_length() const override;
+
+	private:
+
+		std::ofstream m_file;
+		uint64_t m_length = 0;
+		bool m_isSyncFailed = false;
+	};
+
+	// Preallocates the file in large extents and maps it, so appending is a plain copy without any system calls.
+	// The mapping only grows once per extent, which also keeps the file from fragmenting on FAT formatted drives.
+	// Data is synchronised to the disk only when requested and the unused tail of the last extent is cut off on close.
+	// Submitting a sync only schedules the dirty pages to be written, waiting for them flushes the file without touching the mapping.
+	// Extents are reserved on the disk before they are mapped. If that fails once the disk is full, later data is written through the file,
+	// which fails with an error instead of a crash.
+	class MappedOutputFile : public OutputFile
+	{
+	public:
+
+		static constexpr uint64_t kDefaultExtentSize = 8 * 1024 * 1024;
+
+		explicit MappedOutputFile(uint64_t extentSize = kDefaultExtentSize);
+		~MappedOutputFile() override;
+
+		bool open(const std::string& filePath) override;
+		void write(const void* pData, size_t size) override;
+		void submit_sync() override;
+		bool wait_for_sync() override;
+		void close() override;
+		bool is_open() const override;
+		uint64_t get_length() const override;
+
+	private:
+
+		// Reserves the file up to the given capacity and maps all of it.
+		// Returns false if the space could not be reserved, e.g. because the disk is full.
+		bool map_capacity(uint64_t capacity);
+
+		// Appends data through the file instead of the mapping.
+		void write_at_end(const void* pData, size_t size);
+
+		// Cuts the file off after the data written so far.
+		void cut_to_length();
+
+		// Removes the current mapping, if there is one.
+		void unmap();
+
+		uint64_t m_extentSize;
+		uint64_t m_length = 0;
+		uint64_t m_syncedLength = 0;
+		uint64_t m_capacity = 0;
+		uint8_t* m_pMapping = nullptr;
+		bool m_isOpen = false;
+		bool m_isSyncPending = false;
+		bool m_isSyncFailed = false;
+#if defined(_WIN32)
+		void* m_fileHandle = nullptr;
+		void* m_mappingHandle = nullptr;
+#else
+		int m_fileDescriptor = -1;
+#endif
+	};
+
+} // namespace SessionLog
@@ -0,0 +1,128 @@
+#include "OutputSink.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace SessionLog
+{
+
+	OutputSink::OutputSink(size_t capacity)
+		: m_pBuffer(new char[capacity]), m_capacity(capacity), m_allocated(capacity)
+	{
+	}
+
+	char* OutputSink::reserve(size_t size)
+	{
+		if (m_size + size > m_allocated)
+		{
+			const size_t allocated = std::max(m_allocated * 2, m_size + size);
+			std::unique_ptr<char[]> pBuffer(new char[allocated]);
+			if (m_size > 0)
+			{
+				std::memcpy(pBuffer.get(), m_pBuffer.get(), m_size);
+			}
+			m_pBuffer.swap(pBuffer);
+			m_allocated = allocated;
+		}
+		return m_pBuffer.get() + m_size;
+	}
+
+	void OutputSink::append(const void* pData, size_t size)
+	{
+		if (size > 0)
+		{
+			std::memcpy(reserve(size), pData, size);
+			m_size += size;
+		}
+	}
+
+	void OutputSink::append(const char* pText)
+	{
+		append(pText, std::strlen(pText));
+	}
+
+	void OutputSink::append(const std::string& text)
+	{
+		append(text.data(), text.size());
+	}
+
+	void OutputSink::append(char character)
+	{
+		*reserve(1) = character;
+		m_size++;
+	}
+
+	void OutputSink::append_integer(int64_t value)
+	{
+		if (value < 0)
+		{
+			append('-');
+			// Negate in unsigned arithmetic, which also works for the smallest value.
+			append_unsigned(0 - static_cast<uint64_t>(value));
+		}
+		else
+		{
+			append_unsigned(static_cast<uint64_t>(value));
+		}
+	}
+
+	void OutputSink::append_unsigned(uint64_t value)
+	{
+		// Digits are produced from the back, 20 are enough for any 64 bit integer.
+		char digits[20];
+		char* pDigit = digits + sizeof(digits);
+		do
+		{
+			*--pDigit = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value > 0);
+		append(pDigit, static_cast<size_t>(digits + sizeof(digits) - pDigit));
+	}
+
+	void OutputSink::append_fixed(float value, uint32_t decimals)
+	{
+		static const uint32_t kScales[] = { 1, 10, 100, 1000, 10000 };
+		decimals = std::min<uint32_t>(decimals, 4);
+		const uint32_t scale = kScales[decimals];
+
+		// A float has 24 significant bits and the scale at most 14, so the scaled value is exact in a double.
+		// This allows rounding exactly like printf, which rounds the exact binary value half to even.
+		const double scaled = std::fabs(static_cast<double>(value)) * scale;
+		if (!(scaled < 9.0e18))
+		{
+			// Infinity, NaN and huge values are left to printf.
+			char text[64];
+			const int length = std::snprintf(text, sizeof(text), "%.*f", static_cast<int>(decimals), static_cast<double>(value));
+			append(text, length > 0 ? std::min(static_cast<size_t>(length), sizeof(text) - 1) : 0);
+			return;
+		}
+		const double whole = std::floor(scaled);
+		const double fraction = scaled - whole;
+		uint64_t units = static_cast<uint64_t>(whole);
+		if (fraction > 0.5 || (fraction == 0.5 && (units & 1) != 0))
+		{
+			units++;
+		}
+
+		if (std::signbit(value))
+		{
+			append('-');
+		}
+		append_unsigned(units / scale);
+		if (decimals > 0)
+		{
+			char* pDecimals = reserve(decimals + 1);
+			pDecimals[0] = '.';
+			uint32_t remainder = static_cast<uint32_t>(units % scale);
+			for (uint32_t digit = decimals; digit > 0; --digit)
+			{
+				pDecimals[digit] = static_cast<char>('0' + remainder % 10);
+				remainder /= 10;
+			}
+			m_size += decimals + 1;
+		}
+	}
+
+} // namespace SessionLog
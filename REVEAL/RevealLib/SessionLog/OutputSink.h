@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace SessionLog
+{
+
+	// A preallocated byte buffer that output is formatted into without any stream state, locale or sentry objects.
+	// Numbers are converted directly into the buffer, fractional numbers as fixed point exactly like printf's "%.Nf".
+	// The owner hands the contents to its file once the sink is full or a durability event occurs, and clears it afterwards.
+	// Appending never splits data, the buffer grows beyond its capacity if a single append does not fit.
+	class OutputSink
+	{
+	public:
+
+		static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+		explicit OutputSink(size_t capacity = kDefaultCapacity);
+
+		void append(const void* pData, size_t size);
+		void append(const char* pText);
+		void append(const std::string& text);
+		void append(char character);
+		void append_integer(int64_t value);
+		void append_unsigned(uint64_t value);
+
+		// Appends a float with the given number of decimals (at most 4), rounded exactly like printf.
+		void append_fixed(float value, uint32_t decimals);
+
+		const char* data() const { return m_pBuffer.get(); }
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+		// Returns true once the contents reached the capacity and should be written out.
+		bool is_full() const { return m_size >= m_capacity; }
+		void clear() { m_size = 0; }
+
+	private:
+
+		// Makes sure that the given number of bytes can be appended and returns where to write them.
+		char* reserve(size_t size);
+
+		std::unique_ptr<char[]> m_pBuffer;
+		size_t m_size = 0;
+		size_t m_capacity;
+		size_t m_allocated;
+	};
+
+} // namespace SessionLog
@@ -0,0 +1,220 @@
+#include "SessionIndex.h"
+
+#include "BinaryLog.h"
+#include "BlockCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace SessionLog
+{
+
+	static void put_index_u32(std::vector<uint8_t>& rOut, uint32_t value)
+	{
+		for (int b = 0; b < 4; ++b)
+		{
+			rOut.push_back(static_cast<uint8_t>(value >> (b * 8)));
+		}
+	}
+
+	static bool get_index_u32(const uint8_t*& rpData, const uint8_t* pEnd, uint32_t& rValue)
+	{
+		if (pEnd - rpData < 4)
+		{
+			return false;
+		}
+		rValue = 0;
+		for (int b = 0; b < 4; ++b)
+		{
+			rValue |= static_cast<uint32_t>(rpData[b]) << (b * 8);
+		}
+		rpData += 4;
+		return true;
+	}
+
+	void SessionIndexWriter::begin_index(std::vector<uint8_t>& rOut)
+	{
+		put_index_u32(rOut, kSessionIndexMagic);
+		put_index_u32(rOut, kSessionIndexVersion);
+	}
+
+	void SessionIndexWriter::add_entry(std::vector<uint8_t>& rOut, IndexEntryType type, float time, uint64_t offset, uint64_t size, uint64_t resumeOffset, const char* pName, size_t nameLength)
+	{
+		uint32_t timeBits;
+		std::memcpy(&timeBits, &time, sizeof(timeBits));
+		rOut.push_back(static_cast<uint8_t>(type));
+		put_index_u32(rOut, timeBits);
+		put_varint(rOut, offset);
+		put_varint(rOut, size);
+		put_varint(rOut, offset - std::min(resumeOffset, offset));
+		put_varint(rOut, nameLength);
+		rOut.insert(rOut.end(), pName, pName + nameLength);
+	}
+
+	void SessionIndexWriter::add_frame(std::vector<uint8_t>& rOut, uint64_t offset, uint64_t size, uint64_t fileOffset)
+	{
+		rOut.push_back(static_cast<uint8_t>(IndexEntryType::kFrame));
+		put_index_u32(rOut, 0);
+		put_varint(rOut, offset);
+		put_varint(rOut, size);
+		put_varint(rOut, fileOffset);
+		put_varint(rOut, 0);
+	}
+
+	bool SessionIndex::load(const uint8_t* pData, size_t size)
+	{
+		m_entries.clear();
+		m_definitions.clear();
+		m_frames.clear();
+		m_version = 0;
+		const uint8_t* pEnd = pData + size;
+		uint32_t magic, version;
+		if (!get_index_u32(pData, pEnd, magic) || !get_index_u32(pData, pEnd, version) || magic != kSessionIndexMagic || version < kMinSessionIndexVersion || version > kSessionIndexVersion)
+		{
+			build_lookup();
+			return false;
+		}
+		m_version = version;
+		while (pData < pEnd)
+		{
+			IndexEntry entry;
+			uint32_t timeBits;
+			uint64_t resumeDistance, nameLength;
+			entry.type = static_cast<IndexEntryType>(*pData++);
+			if (!get_index_u32(pData, pEnd, timeBits) || !get_varint(pData, pEnd, entry.offset) || !get_varint(pData, pEnd, entry.size)
+				|| !get_varint(pData, pEnd, resumeDistance) || !get_varint(pData, pEnd, nameLength) || static_cast<uint64_t>(pEnd - pData) < nameLength)
+			{
+				break;
+			}
+			std::memcpy(&entry.time, &timeBits, sizeof(timeBits));
+			entry.resumeOffset = entry.offset - std::min(resumeDistance, entry.offset);
+			entry.name.assign(reinterpret_cast<const char*>(pData), static_cast<size_t>(nameLength));
+			pData += nameLength;
+			if (entry.type == IndexEntryType::kFrame)
+			{
+				IndexFrame frame;
+				frame.offset = entry.offset;
+				frame.size = entry.size;
+				frame.fileOffset = resumeDistance;
+				m_frames.push_back(frame);
+			}
+			else if (entry.type == IndexEntryType::kDefinitions)
+			{
+				m_definitions.push_back(std::move(entry));
+			}
+			else
+			{
+				m_entries.push_back(std::move(entry));
+			}
+		}
+		build_lookup();
+		return true;
+	}
+
+	bool SessionIndex::load_file(const std::string& filePath)
+	{
+		std::ifstream file(filePath, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+		{
+			m_entries.clear();
+			build_lookup();
+			return false;
+		}
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return load(data.data(), data.size());
+	}
+
+	void SessionIndex::limit(uint64_t dataLength)
+	{
+		// Entries are sorted by their offset, so everything from the first incomplete row on is dropped.
+		auto isIncomplete = [dataLength](const IndexEntry& entry) { return entry.offset + entry.size > dataLength; };
+		m_entries.erase(std::find_if(m_entries.begin(), m_entries.end(), isIncomplete), m_entries.end());
+		m_definitions.erase(std::find_if(m_definitions.begin(), m_definitions.end(), isIncomplete), m_definitions.end());
+		build_lookup();
+	}
+
+	uint64_t SessionIndex::limit_frames(uint64_t fileLength)
+	{
+		// Recovery only keeps whole frames, so every frame that starts inside the file is complete.
+		auto itEnd = std::find_if(m_frames.begin(), m_frames.end(), [fileLength](const IndexFrame& frame) { return frame.fileOffset >= fileLength; });
+		m_frames.erase(itEnd, m_frames.end());
+		return m_frames.empty() ? 0 : m_frames.back().offset + m_frames.back().size;
+	}
+
+	const IndexFrame* SessionIndex::find_frame(uint64_t offset) const
+	{
+		auto itFrame = std::upper_bound(m_frames.begin(), m_frames.end(), offset, [](uint64_t value, const IndexFrame& frame) { return value < frame.offset; });
+		if (itFrame == m_frames.begin() || offset >= (itFrame - 1)->offset + (itFrame - 1)->size)
+		{
+			return nullptr;
+		}
+		return &*(itFrame - 1);
+	}
+
+	const IndexEntry* SessionIndex::find_time(float time) const
+	{
+		if (m_entries.empty())
+		{
+			return nullptr;
+		}
+		auto itEntry = std::upper_bound(m_entries.begin(), m_entries.end(), time, [](float value, const IndexEntry& entry) { return value < entry.time; });
+		return itEntry == m_entries.begin() ? &m_entries.front() : &*(itEntry - 1);
+	}
+
+	const IndexEntry* SessionIndex::find_marker(const std::string& name, size_t occurrence) const
+	{
+		auto itMarker = m_markersByName.find(name);
+		if (itMarker == m_markersByName.end() || occurrence >= itMarker->second.size())
+		{
+			return nullptr;
+		}
+		return &m_entries[itMarker->second[occurrence]];
+	}
+
+	void SessionIndex::get_marker_segment(const IndexEntry& marker, uint64_t& rBegin, uint64_t& rEnd, uint64_t& rResume) const
+	{
+		// Find the marker before the given one, the segment starts right after its row.
+		const size_t entryIndex = static_cast<size_t>(&marker - m_entries.data());
+		auto itMarker = std::lower_bound(m_markers.begin(), m_markers.end(), entryIndex);
+		if (itMarker == m_markers.begin())
+		{
+			rBegin = 0;
+			rResume = 0;
+		}
+		else
+		{
+			const IndexEntry& previous = m_entries[*(itMarker - 1)];
+			rBegin = previous.offset + previous.size;
+			rResume = previous.resumeOffset;
+		}
+		rEnd = marker.offset + marker.size;
+	}
+
+	void SessionIndex::build_lookup()
+	{
+		m_markers.clear();
+		m_markersByName.clear();
+		for (size_t index = 0; index < m_entries.size(); ++index)
+		{
+			if (m_entries[index].type == IndexEntryType::kMarker)
+			{
+				m_markers.push_back(index);
+				m_markersByName[m_entries[index].name].push_back(index);
+			}
+		}
+	}
+
+	std::string get_index_path(const std::string& outputPath)
+	{
+		std::string basePath(outputPath);
+		const size_t extensionLength = std::strlen(kCompressedFileExtension);
+		if (basePath.size() > extensionLength && basePath.compare(basePath.size() - extensionLength, extensionLength, kCompressedFileExtension) == 0)
+		{
+			basePath.resize(basePath.size() - extensionLength);
+		}
+		return basePath + kSessionIndexFileExtension;
+	}
+
+} // namespace SessionLog
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SessionLog
+{
+
+	// The session index is a small sidecar file that maps times and named events to byte offsets in an output file.
+	// It starts with its magic and version, followed by entries of the form:
+	// type (u8), time (f32), offset (varint), size (varint), distance back to the resume offset (varint), name (varint size, characters).
+	// Offsets count the uncompressed bytes of the output file, including its header.
+	// Rows can only be decoded from their resume offset on: for text and wide binary logs this is the row itself,
+	// for logs in the long format it is the last keyframe before the row, which restores all persistent values.
+	// Entries are written in the order of their rows, so their times never decrease.
+	// Definition and frame entries are no rows and are kept apart, they are ordered by their offsets among themselves.
+	static constexpr uint32_t kSessionIndexMagic = 0x31585652; // "RVX1"
+	static constexpr uint32_t kSessionIndexVersion = 2;
+	// Indices of older versions have no definition and frame entries, readers have to decode their output files from the start.
+	static constexpr uint32_t kMinSessionIndexVersion = 1;
+	static constexpr const char* kSessionIndexFileExtension = ".rvi";
+
+	enum class IndexEntryType : uint8_t
+	{
+		// A regular entry written after a number of rows or seconds.
+		kTime = 1,
+		// A row in which an indexed column got a new value, named by that value.
+		// Activity markers name the activity since the previous marker, see get_marker_segment.
+		kMarker = 2,
+		// A row in which a condition changed, named by the condition.
+		kCondition = 3,
+		// Records of a binary log that later rows depend on: the session and column records at its start,
+		// and the dictionary records written right before a row. Reading them restores everything a resume offset needs.
+		kDefinitions = 4,
+		// A frame of a compressed output file: the offset and size of its decoded data,
+		// with the position of the frame in the file instead of the resume distance. Written as the frames are.
+		kFrame = 5
+	};
+
+	struct IndexEntry
+	{
+		IndexEntryType type = IndexEntryType::kTime;
+		float time = 0.0f;
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint64_t resumeOffset = 0;
+		std::string name;
+	};
+
+	struct IndexFrame
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint64_t fileOffset = 0;
+	};
+
+	// Encodes the entries of a session index.
+	class SessionIndexWriter
+	{
+	public:
+
+		// Writes the file header of a new index.
+		static void begin_index(std::vector<uint8_t>& rOut);
+
+		// Writes an entry for the row at the given offset and with the given size.
+		static void add_entry(std::vector<uint8_t>& rOut, IndexEntryType type, float time, uint64_t offset, uint64_t size, uint64_t resumeOffset, const char* pName = "", size_t nameLength = 0);
+
+		// Writes an entry for a compressed frame that holds the decoded data at the given offset and with the given size.
+		static void add_frame(std::vector<uint8_t>& rOut, uint64_t offset, uint64_t size, uint64_t fileOffset);
+	};
+
+	// Loads a session index and looks up entries by time or marker name in logarithmic or constant time.
+	// Frames are looked up by offset in logarithmic time as well.
+	class SessionIndex
+	{
+	public:
+
+		// Decodes an index. Entries after a damaged or incomplete one are dropped.
+		// Returns false if the data is no session index.
+		bool load(const uint8_t* pData, size_t size);
+		bool load_file(const std::string& filePath);
+
+		// Drops all entries with rows that are not completely inside an output file of the given length.
+		// This is necessary if the output file was cut off during the recovery of a crashed session.
+		void limit(uint64_t dataLength);
+
+		// Drops all frames that do not start inside a compressed file of the given length, see limit.
+		// Returns the length of the data the remaining frames decode to.
+		uint64_t limit_frames(uint64_t fileLength);
+
+		// Returns the last entry at or before the given time, or the first entry if there is none.
+		// Returns nullptr if the index is empty.
+		const IndexEntry* find_time(float time) const;
+
+		// Returns the given occurrence of the marker with the given name, or nullptr if there is none.
+		const IndexEntry* find_marker(const std::string& name, size_t occurrence = 0) const;
+
+		// Returns the byte range of the rows a marker names: from the end of the previous marker row to the end of its own row.
+		// Decoding has to start at the returned resume offset, rows before the begin offset are skipped.
+		void get_marker_segment(const IndexEntry& marker, uint64_t& rBegin, uint64_t& rEnd, uint64_t& rResume) const;
+
+		// Returns the frame that holds the decoded data at the given offset, or nullptr if there is none.
+		const IndexFrame* find_frame(uint64_t offset) const;
+
+		const std::vector<IndexEntry>& get_entries() const { return m_entries; }
+		const std::vector<IndexEntry>& get_definitions() const { return m_definitions; }
+		const std::vector<IndexFrame>& get_frames() const { return m_frames; }
+		// Returns true if the index describes the definitions of its binary log, which older versions don't.
+		bool has_definitions() const { return m_version >= 2; }
+
+	private:
+
+		void build_lookup();
+
+		uint32_t m_version = 0;
+		std::vector<IndexEntry> m_entries;
+		std::vector<IndexEntry> m_definitions;
+		std::vector<IndexFrame> m_frames;
+		std::vector<size_t> m_markers;
+		std::unordered_map<std::string, std::vector<size_t>> m_markersByName;
+	};
+
+	// Returns the path of the index that belongs to the given output file, with or without its compressed file extension.
+	std::string get_index_path(const std::string& outputPath);
+
+} // namespace SessionLog
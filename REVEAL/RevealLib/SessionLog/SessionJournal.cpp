@@ -0,0 +1,667 @@
+#include "SessionJournal.h"
+
+#include "BinaryLog.h"
+#include "BlockCodec.h"
+#include "SessionIndex.h"
+
+#include <AudioFile/AudioFile.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace SessionLog
+{
+
+	// Little endian encoding helpers for the journal payloads.
+	static void put_u32(std::vector<uint8_t>& rOut, uint32_t value)
+	{
+		for (int b = 0; b < 4; ++b)
+		{
+			rOut.push_back(static_cast<uint8_t>(value >> (b * 8)));
+		}
+	}
+
+	static void put_u64(std::vector<uint8_t>& rOut, uint64_t value)
+	{
+		put_u32(rOut, static_cast<uint32_t>(value));
+		put_u32(rOut, static_cast<uint32_t>(value >> 32));
+	}
+
+	static uint32_t get_u32(const uint8_t* pData)
+	{
+		return static_cast<uint32_t>(pData[0]) | (static_cast<uint32_t>(pData[1]) << 8) | (static_cast<uint32_t>(pData[2]) << 16) | (static_cast<uint32_t>(pData[3]) << 24);
+	}
+
+	static uint64_t get_u64(const uint8_t* pData)
+	{
+		return static_cast<uint64_t>(get_u32(pData)) | (static_cast<uint64_t>(get_u32(pData + 4)) << 32);
+	}
+
+	// The lookup table of crc32, built on first use.
+	struct Crc32Table
+	{
+		uint32_t entries[256];
+
+		Crc32Table()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+				}
+				entries[i] = c;
+			}
+		}
+	};
+
+	uint32_t crc32(const void* pData, size_t size, uint32_t previous)
+	{
+		// The game, audio and worker threads all compute checksums, local statics are initialised exactly once.
+		static const Crc32Table s_table;
+
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+		uint32_t crc = ~previous;
+		for (size_t i = 0; i < size; ++i)
+		{
+			crc = s_table.entries[(crc ^ pBytes[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	JournalWriter::~JournalWriter()
+	{
+		if (is_open())
+		{
+			close();
+		}
+	}
+
+	bool JournalWriter::open(const std::string& journalPath, FileBackend backend, uint32_t blockSize)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_journal.is_open())
+		{
+			return false;
+		}
+
+		m_journal.open(journalPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!m_journal.good())
+		{
+			return false;
+		}
+		m_journalPath = journalPath;
+		m_backend = backend;
+		m_blockSize = blockSize > 0 ? blockSize : kDefaultBlockSize;
+		m_commitSequence = 0;
+		m_isCommitQueued = false;
+		m_isCommitting = false;
+		m_heldRecords.clear();
+		m_streams.clear();
+
+		std::vector<uint8_t> header;
+		put_u32(header, kJournalMagic);
+		put_u32(header, kJournalVersion);
+		m_journal.write(reinterpret_cast<const char*>(header.data()), header.size());
+		m_journal.flush();
+		if (!m_journal.good())
+		{
+			return false;
+		}
+
+		m_stopWorker = false;
+		m_workerThread = std::thread(&JournalWriter::run_worker, this);
+		return true;
+	}
+
+	JournalWriter::stream_id_t JournalWriter::add_stream(StreamKind kind, const std::string& filePath, bool compressed)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_journal.is_open())
+		{
+			return kInvalidStream;
+		}
+
+		std::unique_ptr<Stream> pStream(new Stream());
+		pStream->kind = kind;
+		pStream->path = filePath;
+		pStream->compressed = compressed;
+		pStream->file = create_output_file(m_backend, filePath);
+		if (!pStream->file)
+		{
+			return kInvalidStream;
+		}
+
+		const stream_id_t streamId = static_cast<stream_id_t>(m_streams.size());
+		std::vector<uint8_t> payload;
+		put_u32(payload, streamId);
+		put_u32(payload, static_cast<uint32_t>(kind));
+		put_u32(payload, compressed ? static_cast<uint32_t>(kStreamCompressed) : 0u);
+		put_u32(payload, static_cast<uint32_t>(filePath.size()));
+		payload.insert(payload.end(), filePath.begin(), filePath.end());
+		write_record(RecordType::kStream, payload);
+
+		// Declarations are flushed right away, so the file can always be found again.
+		m_journal.flush();
+		m_streams.push_back(std::move(pStream));
+		return streamId;
+	}
+
+	void JournalWriter::append(stream_id_t stream, const void* pData, size_t size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (stream >= m_streams.size())
+		{
+			return;
+		}
+
+		Stream& rStream = *m_streams[stream];
+		if (!rStream.file || rStream.isClosing)
+		{
+			return;
+		}
+		append_data(stream, rStream, static_cast<const uint8_t*>(pData), size);
+	}
+
+	void JournalWriter::set_frame_index(stream_id_t stream, stream_id_t indexStream)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (stream < m_streams.size() && indexStream < m_streams.size())
+		{
+			m_streams[stream]->frameIndex = indexStream;
+		}
+	}
+
+	void JournalWriter::commit()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_journal.is_open())
+		{
+			return;
+		}
+
+		// Partial raw blocks are compressed as well, so a crash loses at most one commit interval.
+		// They are queued before the commit, which therefore covers their frames.
+		for (stream_id_t i = 0; i < m_streams.size(); ++i)
+		{
+			if (m_streams[i]->compressed)
+			{
+				queue_raw_block(i, *m_streams[i]);
+			}
+		}
+
+		// A commit that did not start yet seals everything up to its start, so a second one would not cover more.
+		if (!m_isCommitQueued)
+		{
+			m_isCommitQueued = true;
+			queue_job({ JobType::kCommit, kInvalidStream, std::vector<uint8_t>() });
+		}
+	}
+
+	void JournalWriter::close_stream(stream_id_t stream, std::vector<uint8_t> finalHeader)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_journal.is_open() || stream >= m_streams.size() || !m_streams[stream]->file || m_streams[stream]->isClosing)
+		{
+			return;
+		}
+
+		// The raw data that is left is compressed before the stream is closed, as jobs are performed in order.
+		Stream& rStream = *m_streams[stream];
+		if (rStream.compressed)
+		{
+			queue_raw_block(stream, rStream);
+		}
+		rStream.isClosing = true;
+		queue_job({ JobType::kCloseStream, stream, std::move(finalHeader) });
+	}
+
+	void JournalWriter::close()
+	{
+		if (!is_open())
+		{
+			return;
+		}
+		commit();
+
+		// The worker thread performs all queued jobs, including the commit, before it stops.
+		if (m_workerThread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> queueLock(m_queueMutex);
+				m_stopWorker = true;
+			}
+			m_queueSignal.notify_all();
+			m_workerThread.join();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& pStream : m_streams)
+		{
+			if (!pStream->file)
+			{
+				continue;
+			}
+			pStream->file->close();
+			if (pStream->kind == StreamKind::kWave && !pStream->compressed)
+			{
+				AudioFile::WaveStream::finalise(pStream->path);
+			}
+			else if (pStream->kind == StreamKind::kFlac && !pStream->compressed)
+			{
+				AudioFile::FlacStream::finalise(pStream->path);
+			}
+		}
+		m_streams.clear();
+
+		write_record(RecordType::kClose, std::vector<uint8_t>());
+		m_journal.close();
+
+		// A completed session doesn't need its journal anymore.
+		std::remove(m_journalPath.c_str());
+	}
+
+	bool JournalWriter::is_open() const
+	{
+		return m_journal.is_open();
+	}
+
+	void JournalWriter::append_data(stream_id_t streamId, Stream& rStream, const uint8_t* pData, size_t size)
+	{
+		if (!rStream.compressed)
+		{
+			write_stream_data(streamId, rStream, pData, size);
+			return;
+		}
+
+		// Collect raw data until a whole block can be compressed.
+		rStream.rawBlock.insert(rStream.rawBlock.end(), pData, pData + size);
+		if (rStream.rawBlock.size() >= m_blockSize)
+		{
+			queue_raw_block(streamId, rStream);
+		}
+	}
+
+	void JournalWriter::write_stream_data(stream_id_t streamId, Stream& rStream, const uint8_t* pData, size_t size)
+	{
+		rStream.file->write(pData, size);
+		rStream.blockCrc = crc32(pData, size, rStream.blockCrc);
+		rStream.blockSize += static_cast<uint32_t>(size);
+		rStream.offset += size;
+
+		if (rStream.blockSize >= m_blockSize)
+		{
+			seal_block(streamId, rStream);
+		}
+	}
+
+	void JournalWriter::seal_block(stream_id_t streamId, Stream& rStream)
+	{
+		if (rStream.blockSize == 0)
+		{
+			return;
+		}
+
+		std::vector<uint8_t> payload;
+		put_u32(payload, streamId);
+		put_u64(payload, rStream.blockOffset);
+		put_u32(payload, rStream.blockSize);
+		put_u32(payload, rStream.blockCrc);
+		write_record(RecordType::kBlock, payload);
+
+		rStream.blockOffset = rStream.offset;
+		rStream.blockSize = 0;
+		rStream.blockCrc = 0;
+	}
+
+	void JournalWriter::queue_raw_block(stream_id_t streamId, Stream& rStream)
+	{
+		if (rStream.rawBlock.empty())
+		{
+			return;
+		}
+
+		Job job;
+		job.type = JobType::kCompress;
+		job.stream = streamId;
+		job.data.swap(rStream.rawBlock);
+		rStream.rawBlock.reserve(m_blockSize);
+		queue_job(std::move(job));
+	}
+
+	void JournalWriter::queue_job(Job&& rJob)
+	{
+		{
+			std::lock_guard<std::mutex> queueLock(m_queueMutex);
+			m_jobQueue.push_back(std::move(rJob));
+		}
+		m_queueSignal.notify_one();
+	}
+
+	void JournalWriter::run_worker()
+	{
+		std::vector<uint8_t> frame;
+		std::vector<uint8_t> frameEntry;
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> queueLock(m_queueMutex);
+				m_queueSignal.wait(queueLock, [this]() { return !m_jobQueue.empty() || m_stopWorker; });
+				if (m_jobQueue.empty())
+				{
+					break;
+				}
+				job = std::move(m_jobQueue.front());
+				m_jobQueue.pop_front();
+			}
+
+			if (job.type == JobType::kCommit)
+			{
+				perform_commit();
+			}
+			else if (job.type == JobType::kCloseStream)
+			{
+				perform_close_stream(job.stream, job.data);
+			}
+			else
+			{
+				// Compress without holding any lock, only writing the frame needs the streams.
+				frame.clear();
+				encode_frame(job.data.data(), job.data.size(), frame);
+				std::lock_guard<std::mutex> lock(m_mutex);
+				Stream& rStream = *m_streams[job.stream];
+				const uint64_t frameOffset = rStream.offset;
+				write_stream_data(job.stream, rStream, frame.data(), frame.size());
+				// Each frame is described by exactly one block, which keeps recovery at frame boundaries.
+				seal_block(job.stream, rStream);
+
+				if (rStream.frameIndex != kInvalidStream && m_streams[rStream.frameIndex]->file && !m_streams[rStream.frameIndex]->isClosing)
+				{
+					frameEntry.clear();
+					SessionIndexWriter::add_frame(frameEntry, rStream.rawOffset, job.data.size(), frameOffset);
+					append_data(rStream.frameIndex, *m_streams[rStream.frameIndex], frameEntry.data(), frameEntry.size());
+				}
+				rStream.rawOffset += job.data.size();
+			}
+		}
+	}
+
+	void JournalWriter::perform_commit()
+	{
+		// The syncs are submitted while the lock is held, so they cover exactly the sealed blocks.
+		std::vector<OutputFile*> files;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isCommitQueued = false;
+			for (stream_id_t i = 0; i < m_streams.size(); ++i)
+			{
+				if (m_streams[i]->file)
+				{
+					seal_block(i, *m_streams[i]);
+					m_streams[i]->file->submit_sync();
+					files.push_back(m_streams[i]->file.get());
+				}
+			}
+			m_isCommitting = true;
+		}
+
+		// Streams are only closed by jobs or after all of them were performed, so the files stay open while waiting without the lock.
+		bool isDurable = true;
+		for (OutputFile* pFile : files)
+		{
+			isDurable = pFile->wait_for_sync() && isDurable;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isCommitting = false;
+		// The marker may only reach the journal after all data it covers reached the disk.
+		// [NOTE] If any sync failed, no marker is written and recovery checks the blocks against their checksums instead.
+		if (isDurable)
+		{
+			std::vector<uint8_t> payload;
+			put_u32(payload, ++m_commitSequence);
+			write_record(RecordType::kCommit, payload);
+		}
+		m_journal.write(reinterpret_cast<const char*>(m_heldRecords.data()), m_heldRecords.size());
+		m_heldRecords.clear();
+		m_journal.flush();
+	}
+
+	void JournalWriter::perform_close_stream(stream_id_t streamId, const std::vector<uint8_t>& finalHeader)
+	{
+		// Nothing is appended to a closing stream anymore, and everything else that touches its file is a job as well.
+		OutputFile* pFile;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			Stream& rStream = *m_streams[streamId];
+			seal_block(streamId, rStream);
+			rStream.file->submit_sync();
+			pFile = rStream.file.get();
+		}
+		pFile->wait_for_sync();
+		pFile->close();
+
+		StreamKind kind;
+		std::string path;
+		bool compressed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			Stream& rStream = *m_streams[streamId];
+			rStream.file.reset();
+
+			// The record acts as a commit of this stream, its data was synchronised before.
+			// It is written before the header is patched, as recovery finalises closed streams again instead of checking their blocks.
+			std::vector<uint8_t> payload;
+			put_u32(payload, streamId);
+			put_u64(payload, rStream.offset);
+			write_record(RecordType::kStreamClosed, payload);
+			m_journal.flush();
+
+			kind = rStream.kind;
+			path = rStream.path;
+			compressed = rStream.compressed;
+		}
+
+		if (compressed)
+		{
+			return;
+		}
+		if (!finalHeader.empty())
+		{
+			std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+			file.write(reinterpret_cast<const char*>(finalHeader.data()), finalHeader.size());
+		}
+		else if (kind == StreamKind::kWave)
+		{
+			AudioFile::WaveStream::finalise(path);
+		}
+		else if (kind == StreamKind::kFlac)
+		{
+			AudioFile::FlacStream::finalise(path);
+		}
+	}
+
+	void JournalWriter::write_record(RecordType type, const std::vector<uint8_t>& payload)
+	{
+		std::vector<uint8_t> header;
+		put_u32(header, static_cast<uint32_t>(type));
+		put_u32(header, static_cast<uint32_t>(payload.size()));
+		put_u32(header, crc32(payload.data(), payload.size()));
+		if (m_isCommitting && type != RecordType::kStream)
+		{
+			// The blocks sealed while a commit waits for the disk are not covered by it, so they have to follow its marker.
+			m_heldRecords.insert(m_heldRecords.end(), header.begin(), header.end());
+			m_heldRecords.insert(m_heldRecords.end(), payload.begin(), payload.end());
+			return;
+		}
+		m_journal.write(reinterpret_cast<const char*>(header.data()), header.size());
+		m_journal.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+	}
+
+	bool recover_journal(const std::string& journalPath, const char* abortMarker, std::vector<RecoveredStream>* pRecovered)
+	{
+		std::ifstream journal(journalPath, std::ios::in | std::ios::binary);
+		if (!journal.is_open())
+		{
+			return false;
+		}
+
+		struct BlockRecord
+		{
+			uint64_t offset;
+			uint32_t size;
+			uint32_t crc;
+		};
+		struct StreamState
+		{
+			StreamKind kind;
+			std::string path;
+			bool compressed = false;
+			bool closed = false;
+			uint64_t committedLength = 0;
+			std::vector<BlockRecord> pendingBlocks;
+		};
+		std::vector<StreamState> streams;
+		bool completed = false;
+
+		uint8_t header[12];
+		journal.read(reinterpret_cast<char*>(header), 8);
+		if (journal.gcount() == 8 && get_u32(header) == kJournalMagic && get_u32(header + 4) >= kMinJournalVersion && get_u32(header + 4) <= kJournalVersion)
+		{
+			// Read records until the end of the journal or the first damaged record.
+			std::vector<uint8_t> payload;
+			while (true)
+			{
+				journal.read(reinterpret_cast<char*>(header), sizeof(header));
+				if (journal.gcount() != sizeof(header))
+				{
+					break;
+				}
+				const RecordType type = static_cast<RecordType>(get_u32(header));
+				payload.resize(get_u32(header + 4));
+				journal.read(reinterpret_cast<char*>(payload.data()), payload.size());
+				if (static_cast<size_t>(journal.gcount()) != payload.size() || crc32(payload.data(), payload.size()) != get_u32(header + 8))
+				{
+					break;
+				}
+
+				if (type == RecordType::kStream && payload.size() >= 16)
+				{
+					const uint32_t pathLength = get_u32(payload.data() + 12);
+					if (get_u32(payload.data()) != streams.size() || payload.size() < 16 + pathLength)
+					{
+						break;
+					}
+					StreamState state;
+					state.kind = static_cast<StreamKind>(get_u32(payload.data() + 4));
+					state.compressed = (get_u32(payload.data() + 8) & kStreamCompressed) != 0;
+					state.path.assign(reinterpret_cast<const char*>(payload.data() + 16), pathLength);
+					streams.push_back(state);
+				}
+				else if (type == RecordType::kBlock && payload.size() >= 20)
+				{
+					const uint32_t streamId = get_u32(payload.data());
+					if (streamId >= streams.size())
+					{
+						break;
+					}
+					streams[streamId].pendingBlocks.push_back({ get_u64(payload.data() + 4), get_u32(payload.data() + 12), get_u32(payload.data() + 16) });
+				}
+				else if (type == RecordType::kCommit)
+				{
+					// All blocks up to here were handed to the operating system before the marker was written.
+					for (auto& rState : streams)
+					{
+						if (!rState.pendingBlocks.empty())
+						{
+							const BlockRecord& rLast = rState.pendingBlocks.back();
+							rState.committedLength = rLast.offset + rLast.size;
+							rState.pendingBlocks.clear();
+						}
+					}
+				}
+				else if (type == RecordType::kStreamClosed && payload.size() >= 12)
+				{
+					const uint32_t streamId = get_u32(payload.data());
+					if (streamId >= streams.size())
+					{
+						break;
+					}
+					// The stream is complete, whatever was described of it is final.
+					streams[streamId].closed = true;
+					streams[streamId].committedLength = get_u64(payload.data() + 4);
+					streams[streamId].pendingBlocks.clear();
+				}
+				else if (type == RecordType::kClose)
+				{
+					completed = true;
+				}
+			}
+		}
+		journal.close();
+
+		for (auto& rState : streams)
+		{
+			uint64_t length = rState.committedLength;
+			if (!completed && !rState.closed)
+			{
+				// Blocks after the last commit are only kept as long as their data is intact.
+				std::ifstream data(rState.path, std::ios::in | std::ios::binary);
+				std::vector<uint8_t> buffer;
+				for (const BlockRecord& rBlock : rState.pendingBlocks)
+				{
+					if (!data.is_open() || rBlock.offset != length)
+					{
+						break;
+					}
+					buffer.resize(rBlock.size);
+					data.seekg(static_cast<std::streamoff>(rBlock.offset), std::ios::beg);
+					data.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+					if (static_cast<size_t>(data.gcount()) != buffer.size() || crc32(buffer.data(), buffer.size()) != rBlock.crc)
+					{
+						break;
+					}
+					length += rBlock.size;
+				}
+				data.close();
+
+				truncate_file(rState.path, length);
+				if ((rState.kind == StreamKind::kText && abortMarker) || rState.kind == StreamKind::kBinaryLog)
+				{
+					// Compressed streams get the marker as a frame of its own, so they stay decodable.
+					std::vector<uint8_t> marker(rState.kind == StreamKind::kBinaryLog ? BinaryLogWriter::create_abort_record() : std::vector<uint8_t>(abortMarker, abortMarker + std::strlen(abortMarker)));
+					if (rState.compressed)
+					{
+						std::vector<uint8_t> frame;
+						encode_frame(marker.data(), marker.size(), frame);
+						marker.swap(frame);
+					}
+					std::ofstream text(rState.path, std::ios::out | std::ios::binary | std::ios::app);
+					text.write(reinterpret_cast<const char*>(marker.data()), marker.size());
+					length += marker.size();
+				}
+			}
+			// Closed streams are finalised again, as the application may have crashed while they were.
+			if (rState.kind == StreamKind::kWave && !rState.compressed)
+			{
+				AudioFile::WaveStream::finalise(rState.path);
+			}
+			else if (rState.kind == StreamKind::kFlac && !rState.compressed)
+			{
+				AudioFile::FlacStream::finalise(rState.path);
+			}
+
+			if (pRecovered)
+			{
+				pRecovered->push_back({ rState.kind, rState.path, length, rState.compressed });
+			}
+		}
+
+		std::remove(journalPath.c_str());
+		return true;
+	}
+
+} // namespace SessionLog
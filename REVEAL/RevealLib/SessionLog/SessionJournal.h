@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OutputFile.h"
+
+namespace SessionLog
+{
+
+	// Computes the CRC-32 (IEEE 802.3) of the given data.
+	// Pass the result of a previous call to continue the checksum over several pieces of data.
+	uint32_t crc32(const void* pData, size_t size, uint32_t previous = 0);
+
+	// The kinds of output streams a session consists of.
+	// The kind defines how a stream is finalised after a crash.
+	enum class StreamKind : uint32_t
+	{
+		// Text streams get the abort marker appended to their last valid line.
+		kText = 0,
+		// Wave streams get the size fields of their header patched.
+		kWave = 1,
+		// Binary log streams get an abort record appended, see BinaryLog.h.
+		kBinaryLog = 2,
+		// Session index streams are only cut off, see SessionIndex.h.
+		// Their entries may point past the end of a recovered output file, which readers have to check.
+		kIndex = 3,
+		// FLAC streams get the number of samples and the frame sizes of their STREAMINFO block filled in, see AudioFile::FlacStream.
+		// Their data has to be appended in whole frames.
+		kFlac = 4
+	};
+
+	// Record types of the journal file.
+	// Each record consists of its type, payload size and payload checksum followed by the payload.
+	enum class RecordType : uint32_t
+	{
+		// Declares a new stream: kind, flags, path.
+		kStream = 1,
+		// Describes a block of stream data: stream, offset, size, checksum.
+		kBlock = 2,
+		// Marks all previously described blocks as durable: sequence number.
+		kCommit = 3,
+		// Marks the session as completed, no recovery is necessary.
+		kClose = 4,
+		// Marks a single stream as completed before the session ends: stream, length.
+		kStreamClosed = 5
+	};
+
+	static constexpr uint32_t kJournalMagic = 0x314A5652; // "RVJ1"
+	static constexpr uint32_t kJournalVersion = 3;
+	// Journals of older versions without closed streams are still recovered.
+	static constexpr uint32_t kMinJournalVersion = 2;
+
+	// Flags of the stream declaration records.
+	enum StreamFlags : uint32_t
+	{
+		// The stream's file consists of compressed frames, see BlockCodec.h.
+		kStreamCompressed = 1 << 0
+	};
+
+	// Writes the output streams of one session while keeping an append-only journal next to them.
+	// The journal describes every block of stream data with its offset, size and checksum.
+	// Commit markers are written periodically after all stream data described before them reached the disk.
+	// If the application crashes, recover_journal can restore every stream to its last valid block.
+	// Streams may be appended to from several threads, e.g. the game and the audio thread.
+	// A worker thread performs everything that waits: it compresses the blocks of compressed streams, which are written as independent frames,
+	// it waits for the disk during commits and it closes streams, so appending, committing and closing a stream never do.
+	class JournalWriter
+	{
+	public:
+
+		using stream_id_t = uint32_t;
+		static constexpr stream_id_t kInvalidStream = 0xFFFFffff;
+		static constexpr uint32_t kDefaultBlockSize = 64 * 1024;
+
+		~JournalWriter();
+
+		// Creates the journal file. Blocks are sealed once they reach the given size.
+		// The output files of all streams are written with the given backend, the journal itself is always a plain stream.
+		bool open(const std::string& journalPath, FileBackend backend = FileBackend::kStream, uint32_t blockSize = kDefaultBlockSize);
+
+		// Creates the output file of a new stream and declares it in the journal.
+		// If requested, the stream is compressed block by block. Compressed wave and FLAC streams are only finalised when decompressed.
+		// Returns kInvalidStream if the file could not be created.
+		stream_id_t add_stream(StreamKind kind, const std::string& filePath, bool compressed = false);
+
+		// Appends data to the given stream.
+		// Blocks are only sealed between appends, so appending whole lines or records keeps them intact after recovery.
+		// Nothing is flushed here, the data only becomes durable with the next commit.
+		void append(stream_id_t stream, const void* pData, size_t size);
+
+		// Describes every frame of a compressed stream with an entry in the given session index stream, see SessionIndex.h.
+		// The entries map offsets of the decoded data to frames, so readers only have to decode the frames they need.
+		void set_frame_index(stream_id_t stream, stream_id_t indexStream);
+
+		// Seals all blocks and queues a commit, which returns right away.
+		// The worker thread submits the synchronisation of all stream data and writes the commit marker once that completed.
+		// Blocks sealed meanwhile are only described in the journal after the marker.
+		void commit();
+
+		// Completes a single stream while the session goes on, e.g. one segment of a recording, and returns right away.
+		// The worker thread synchronises its data, closes its file and finalises wave and FLAC streams.
+		// If a final header is given, it is written over the start of the file instead, which saves reading the whole file,
+		// e.g. the STREAMINFO block FlacEncoder::createHeader completes after flush(). Compressed streams ignore it.
+		// Nothing may be appended to the stream afterwards, recovery leaves it untouched.
+		void close_stream(stream_id_t stream, std::vector<uint8_t> finalHeader = std::vector<uint8_t>());
+
+		// Commits, marks the session as completed and closes all streams.
+		// Wave and FLAC streams that are still open are finalised and the journal file is deleted afterwards.
+		void close();
+
+		// Returns true if the journal is currently open.
+		bool is_open() const;
+
+	private:
+
+		struct Stream
+		{
+			StreamKind kind;
+			std::string path;
+			// Streams closed before the session ends have no file anymore.
+			std::unique_ptr<OutputFile> file;
+			// Set once the stream is to be closed, while its file is still being completed.
+			bool isClosing = false;
+			uint64_t offset = 0;
+			uint64_t blockOffset = 0;
+			uint32_t blockSize = 0;
+			uint32_t blockCrc = 0;
+			bool compressed = false;
+			// Raw data of compressed streams that is waiting to fill a block.
+			std::vector<uint8_t> rawBlock;
+			// The amount of raw data that was compressed into frames so far.
+			uint64_t rawOffset = 0;
+			// The session index stream that describes the frames of a compressed stream, if any.
+			stream_id_t frameIndex = kInvalidStream;
+		};
+
+		enum class JobType
+		{
+			// Compresses the raw data of a stream and writes it as one frame.
+			kCompress,
+			// Seals all blocks, waits until they reached the disk and writes a commit marker.
+			kCommit,
+			// Completes a stream that is closed before the session ends, the data is its final header.
+			kCloseStream
+		};
+
+		struct Job
+		{
+			JobType type;
+			stream_id_t stream;
+			std::vector<uint8_t> data;
+		};
+
+		// Appends data to an open stream, the lock has to be held.
+		void append_data(stream_id_t streamId, Stream& rStream, const uint8_t* pData, size_t size);
+
+		// Writes data to the file of the given stream and accounts for it in the stream's current block.
+		void write_stream_data(stream_id_t streamId, Stream& rStream, const uint8_t* pData, size_t size);
+
+		// Describes the current block of the given stream in the journal and starts a new one.
+		void seal_block(stream_id_t streamId, Stream& rStream);
+
+		// Hands the raw block of a compressed stream to the worker thread.
+		void queue_raw_block(stream_id_t streamId, Stream& rStream);
+
+		// Hands a job to the worker thread.
+		void queue_job(Job&& rJob);
+
+		// The worker thread: performs queued jobs in order.
+		void run_worker();
+
+		// Performs a commit on the worker thread. The lock is only held to seal the blocks and to write the marker.
+		void perform_commit();
+
+		// Closes a stream on the worker thread and finalises its file, the lock is only held to seal and to describe it.
+		void perform_close_stream(stream_id_t streamId, const std::vector<uint8_t>& finalHeader);
+
+		// Appends a record with the given payload to the journal.
+		// While a commit waits for the disk, all records but stream declarations are held back until its marker was written.
+		void write_record(RecordType type, const std::vector<uint8_t>& payload);
+
+		std::ofstream m_journal;
+		std::string m_journalPath;
+		std::vector<std::unique_ptr<Stream>> m_streams;
+		std::mutex m_mutex;
+		FileBackend m_backend = FileBackend::kStream;
+		uint32_t m_blockSize = kDefaultBlockSize;
+		uint32_t m_commitSequence = 0;
+		bool m_isCommitQueued = false;
+		bool m_isCommitting = false;
+		std::vector<uint8_t> m_heldRecords;
+
+		std::thread m_workerThread;
+		std::mutex m_queueMutex;
+		std::condition_variable m_queueSignal;
+		std::deque<Job> m_jobQueue;
+		bool m_stopWorker = false;
+	};
+
+	// The state of a stream after a journal was recovered.
+	struct RecoveredStream
+	{
+		StreamKind kind;
+		std::string path;
+		uint64_t length;
+		bool compressed;
+	};
+
+	// Restores all streams of a session that did not complete, if there is a journal at the given path.
+	// Blocks up to the last commit marker are trusted, later blocks are only kept if their checksum matches.
+	// Everything after the last valid block is truncated, text and binary log streams get their abort marker appended
+	// and uncompressed wave and FLAC streams get their headers patched. Streams that were closed are kept as they are.
+	// The journal is deleted afterwards.
+	// Returns true if a journal was found and processed.
+	bool recover_journal(const std::string& journalPath, const char* abortMarker, std::vector<RecoveredStream>* pRecovered = nullptr);
+
+} // namespace SessionLog
@@ -1,12 +1,24 @@
 #include "ExperimentManager.h"
 
 #include <ctime>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <Phyre.h>
 #include <Framework/PhyreFramework.h>
 #include <fstream>
+#include <limits>
+#include <utility>
 #include <audioin.h>
 #include <user_service.h>
 #include <AudioFile/AudioFile.cpp>
+#include <SessionLog/AsyncOutputFile.cpp>
+#include <SessionLog/BinaryLog.cpp>
+#include <SessionLog/BlockCodec.cpp>
+#include <SessionLog/OutputFile.cpp>
+#include <SessionLog/OutputSink.cpp>
+#include <SessionLog/SessionIndex.cpp>
+#include <SessionLog/SessionJournal.cpp>
 
 #include "rv/GamePlay/RevealEvents.h"
 #include "rv/GamePlay/GameStates/GameStatesReveal.h"
@@ -22,19 +34,7 @@
 
 #ifdef ENABLE_EXPERIMENT
 
-// The plug-in register has to be included in this implementation file!
-// Right after the initialisation of the static plug-in register.
-namespace rv
-{
-namespace Experiment
-{
-
-	ExperimentManager::PluginRegister ExperimentManager::m_sAvailablePlugins;
-
-}
-}
-// Create plug-in globals. The define will be undefined automatically.
-#define CreatePluginGlobals
+// The table of plug-in factories has to be included in this implementation file!
 #include "ExperimentPlugins.h"
 
 #undef GetObject
@@ -45,21 +45,45 @@ namespace rv
 namespace Experiment
 {
 
-	std::ostream& operator <<(std::ostream& s, const ConditionValue& v)
+	// Formats a condition value as text.
+	static void append_condition_value(SessionLog::OutputSink& rSink, const ConditionValue& v)
 	{
 		switch (v.type)
 		{
 		case ConditionValue::kInteger:
-			s << v.integer;
+			rSink.append_integer(v.integer);
 			break;
 		case ConditionValue::kString:
-			s << v.stringHash.get_message();
+			rSink.append(v.stringHash.get_message());
 			break;
 		default:
-			s << "NA";
+			rSink.append("NA");
 			break;
 		}
-		return s;
+	}
+
+	// Returns the time of the steady clock in seconds, which the session clock is based on.
+	static double get_steady_seconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Returns whether two condition values are of the same type and equal.
+	static bool is_same_condition_value(const ConditionValue& a, const ConditionValue& b)
+	{
+		if (a.type != b.type)
+		{
+			return false;
+		}
+		switch (a.type)
+		{
+		case ConditionValue::kInteger:
+			return a.integer == b.integer;
+		case ConditionValue::kString:
+			return a.stringHash == b.stringHash;
+		default:
+			return true;
+		}
 	}
 
 	namespace JsonFieldName
@@ -81,14 +105,83 @@ namespace Experiment
 		// This is an optional array that contains activated plug-ins and their configuration.
 		static constexpr const char* kExperimentPlugins = "plugins";
 		static constexpr const char* kExperimentPluginName = "name";
+		// This is an optional value of plug-in configuration objects that names the output stream their data fields are written to.
+		// Each stream is a separate file with its own columns, all plug-ins without a stream write to the main one.
+		static constexpr const char* kExperimentPluginOutputStream = "outputStream";
+		static constexpr const char* kExperimentPluginOutputStreamMain = "main";
 		// This is an optional value that indicates whether audio recordings should be possible.
 		// [NOTE] Audio commands will not work if this value is not explicitly configured to be true!
 		static constexpr const char* kExperimentAudioRecording = "enableAudioRecording";
+		// This is an optional value that defines a second sample rate the audio recording is resampled to while recording.
+		// The resampled recording is written to its own file next to the native one, e.g. at 16000 Hz for speech analysis.
+		static constexpr const char* kExperimentAudioResampleRate = "audioResampleRate";
+		// This is an optional value that defines the format of the audio recordings, either "wave" or "flac".
+		// FLAC recordings are compressed losslessly to about half the size while recording and can be read by most audio tools.
+		static constexpr const char* kExperimentAudioFormat = "audioFormat";
+		static constexpr const char* kExperimentAudioFormatWave = "wave";
+		static constexpr const char* kExperimentAudioFormatFlac = "flac";
+		// This is an optional value that defines whether the audio recording is split into several files.
+		// With "recording", each start of the recording creates a new file, with "marker", each activity marker does as well.
+		static constexpr const char* kExperimentAudioSegments = "audioSegments";
+		static constexpr const char* kExperimentAudioSegmentsNone = "none";
+		static constexpr const char* kExperimentAudioSegmentsRecording = "recording";
+		static constexpr const char* kExperimentAudioSegmentsMarker = "marker";
+		// This is an optional value that defines how many seconds may pass between two commits of the session journal.
+		// Shorter intervals lose less data after a crash, longer intervals write to the disk less often.
+		static constexpr const char* kExperimentJournalCommitInterval = "journalCommitInterval";
+		// This is an optional value that defines how output files are written, either "mapped", "stream" or "async".
+		// Mapped files are preallocated in large extents and filled without system calls, streams are plain buffered files.
+		// Async files are written on dedicated threads, through io_uring on Linux.
+		static constexpr const char* kExperimentOutputBackend = "outputBackend";
+		static constexpr const char* kExperimentOutputBackendMapped = "mapped";
+		static constexpr const char* kExperimentOutputBackendStream = "stream";
+		static constexpr const char* kExperimentOutputBackendAsync = "async";
+		// This is an optional value that indicates whether output files should be compressed block by block.
+		// Compressed files get the extension .rvz and have to be decoded with REVEAL/Tools/SessionLogTool.
+		static constexpr const char* kExperimentCompressOutput = "compressOutput";
+		// This is an optional value that defines the format of the main output file, either "text", "binary" or "long".
+		// Binary logs dictionary encode names and flags and have to be decoded with REVEAL/Tools/SessionLogTool.
+		// Long logs are binary logs that only contain the values that changed, plus a periodic keyframe.
+		static constexpr const char* kExperimentOutputFormat = "outputFormat";
+		static constexpr const char* kExperimentOutputFormatText = "text";
+		static constexpr const char* kExperimentOutputFormatBinary = "binary";
+		static constexpr const char* kExperimentOutputFormatLong = "long";
+		// This is an optional value that defines how many seconds may pass between two keyframes of long logs.
+		static constexpr const char* kExperimentKeyframeInterval = "keyframeInterval";
+		// This is an optional value that defines for how many seconds changes are collected before a line is written.
+		// All changes within this window are merged into one line with the time of the first change.
+		// Plug-in configuration objects may override it for their data fields with the same name.
+		static constexpr const char* kExperimentCoalesceWindow = "coalesceWindow";
+		// This is an optional array that overrides the coalescing window for single columns, e.g. to keep samples exact.
+		static constexpr const char* kExperimentCoalesceColumns = "coalesceColumns";
+		static constexpr const char* kExperimentCoalesceColumnsName = "name";
+		static constexpr const char* kExperimentCoalesceColumnsWindow = "window";
+		// This is an optional value that indicates whether a session index (.rvi) is written next to each output file.
+		// The index maps times, activity markers and condition changes to offsets, see REVEAL/RevealLib/SessionLog/SessionIndex.h.
+		static constexpr const char* kExperimentWriteIndex = "writeIndex";
+		// These are optional values that define after how many seconds or rows a regular index entry is written.
+		static constexpr const char* kExperimentIndexInterval = "indexInterval";
+		static constexpr const char* kExperimentIndexRowInterval = "indexRowInterval";
 	};
 
+#if defined(RV_PLATFORM_ORBIS) && defined(RV_PACKAGE)
+	// [NOTE] All experiment data is written to a USB drive!
+	static constexpr const char* kOutputDirectory = "/usb0/";
+#else
+	static constexpr const char* kOutputDirectory = RV_PATH_LITERAL("Media/Config/");
+#endif
+	// The size of the buffers output file paths are formatted into.
+	static constexpr size_t kOutputPathSize = 160;
+	// The rate of the audio port, which is opened with SCE_AUDIO_IN_FREQ_DEFAULT.
+	static constexpr u32 kAudioCaptureRate = 16000;
+	// The journal of the running session always has the same name, so it can be found again after a crash.
+	static constexpr const char* kJournalFileName = "experiment_session.journal";
+	// The line that marks the output of an aborted session.
+	// This should be enough to make statistics software notice a problem during file import...
+	static constexpr const char* kAbortMarker = "ABORTED!\n";
+
 	CI_set_experiment_condition g_CI_set_experiment_condition;
 	CI_increment_experiment_condition g_CI_increment_experiment_condition;
-	std::vector<ExperimentArgs> g_CI_experiment_args_bank;
 	CI_experiment_trigger g_CI_experiment_trigger;
 	CI_start_experiment g_CI_start_experiment;
 	CI_end_experiment g_CI_end_experiment;
@@ -99,7 +192,6 @@ namespace Experiment
 
 	ExperimentManager::ExperimentManager()
 	{
-		m_sAvailablePlugins.reserve(m_sAvailablePlugins.size());
 	}
 
 	void ExperimentManager::register_interpreters(Events::CommandBlockManager& rCBManager)
@@ -114,9 +206,10 @@ namespace Experiment
 		rCBManager.register_command_interpreter(Utilities::Name("stop_audio_recording"), &g_CI_stop_audio_recording);
 		rCBManager.register_command_interpreter(Utilities::Name("start_controller_check"), &g_CI_start_controller_check);
 		// Also give all available plug-ins the opportunity to register their own commands.
-		for (auto plugin : m_sAvailablePlugins)
+		// This does not require any plug-in to be constructed.
+		for (auto& factory : kPluginFactories)
 		{
-			plugin.second->register_interpreters(rCBManager);
+			factory.register_interpreters(rCBManager);
 		}
 	}
 
@@ -129,6 +222,17 @@ namespace Experiment
 		Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kGameplayChannel, this);
 		Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kExperimentChannel, this);
 
+		// Restore the output files of a session that did not complete, e.g. because the application crashed.
+		// Everything after the last intact block is cut off and the files are marked as aborted.
+		std::vector<SessionLog::RecoveredStream> recoveredStreams;
+		if (SessionLog::recover_journal(std::string(kOutputDirectory) + kJournalFileName, kAbortMarker, &recoveredStreams))
+		{
+			for (auto& stream : recoveredStreams)
+			{
+				RV_DEBUG_PRINTF("[ExperimentManager] Recovered %s with %llu bytes from an interrupted session.", stream.path.c_str(), static_cast<unsigned long long>(stream.length));
+			}
+		}
+
 		// Reset the experiment manager.
 		reset();
 	}
@@ -161,8 +265,10 @@ namespace Experiment
 			// https://www.rdocumentation.org/packages/base/versions/3.5.0/topics/NA
 			m_undefinedValue = "NA";
 		}
-		// Clear the condition value map.
+		// Clear the condition arrays.
+		m_conditionNames.clear();
 		m_conditionDefaults.clear();
+		update_condition_slots();
 		if (jsonData.HasMember(JsonFieldName::kExperimentConditions))
 		{
 			// [OPTIONAL] Names of all experiment conditions to consider.
@@ -185,8 +291,10 @@ namespace Experiment
 				add_experiment_condition(name, defaultValue);
 			}
 		}
-		// Clear the map of triggers.
+		// Clear the trigger arrays.
+		m_triggerNames.clear();
 		m_triggers.clear();
+		update_trigger_slots();
 		if (jsonData.HasMember(JsonFieldName::kExperimentTriggers))
 		{
 			// [OPTIONAL] Triggers that the experiment manager can execute when requested.
@@ -208,17 +316,17 @@ namespace Experiment
 				add_experiment_trigger(name, currentTrigger);
 			}
 		}
-		// Disable all active plug-ins.
-		auto& act(m_activePlugins);
-		std::vector<Utilities::Name> dis(act.size());
-		std::for_each(act.cbegin(), act.cend(), [&dis](const ExperimentPlugin* p) { dis.push_back(Utilities::Name(p->get_name())); });
-		for (auto it : dis)
+		// Disable and destroy all active plug-ins.
+		while (!m_activePlugins.empty())
 		{
-			disable_plugin(it);
+			disable_plugin(m_activePlugins.back()->get_name());
 		}
+		m_pluginCoalesceWindows.clear();
+		m_pluginOutputStreams.clear();
 		if (jsonData.HasMember(JsonFieldName::kExperimentPlugins))
 		{
 			// [OPTIONAL] Configuration objects for all experiment plug-ins that should be active.
+			// Plug-ins are constructed here in the order of this array.
 			auto plugins = jsonData[JsonFieldName::kExperimentPlugins].GetArray();
 			for (Json::Value::ConstValueIterator it = plugins.Begin(); it != plugins.End(); ++it)
 			{
@@ -228,6 +336,16 @@ namespace Experiment
 				{
 					// If the plug-in is available and successfully loaded, configure it.
 					pPlugin->configure_from_json(*it);
+					if (it->HasMember(JsonFieldName::kExperimentCoalesceWindow))
+					{
+						// [OPTIONAL] The coalescing window for all data fields of this plug-in.
+						m_pluginCoalesceWindows[pluginName] = (*it)[JsonFieldName::kExperimentCoalesceWindow].GetFloat();
+					}
+					if (it->HasMember(JsonFieldName::kExperimentPluginOutputStream))
+					{
+						// [OPTIONAL] The output stream for all data fields of this plug-in.
+						m_pluginOutputStreams[pluginName] = Utilities::Name((*it)[JsonFieldName::kExperimentPluginOutputStream].GetString());
+					}
 				}
 			}
 		}
@@ -241,6 +359,147 @@ namespace Experiment
 			// For privacy reasons, audio recording is disabled by default.
 			m_enableAudioRecording = false;
 		}
+		// [OPTIONAL] The rate of the resampled audio recording, no resampled recording is written by default.
+		m_audioResampleRate = jsonData.HasMember(JsonFieldName::kExperimentAudioResampleRate) ? jsonData[JsonFieldName::kExperimentAudioResampleRate].GetUint() : 0;
+		m_audioFormat = AudioFormat::kWave;
+		if (jsonData.HasMember(JsonFieldName::kExperimentAudioFormat))
+		{
+			// [OPTIONAL] The format of the audio recordings.
+			const char* format = jsonData[JsonFieldName::kExperimentAudioFormat].GetString();
+			if (strcmp(format, JsonFieldName::kExperimentAudioFormatFlac) == 0)
+			{
+				m_audioFormat = AudioFormat::kFlac;
+			}
+			else if (strcmp(format, JsonFieldName::kExperimentAudioFormatWave) != 0)
+			{
+				RV_DEBUG_PRINTF("[ExperimentManager] Unknown audio format %s, wave files will be written.", format);
+			}
+		}
+		m_audioSegments = AudioSegments::kNone;
+		if (jsonData.HasMember(JsonFieldName::kExperimentAudioSegments))
+		{
+			// [OPTIONAL] How the audio recording is split into files.
+			const char* segments = jsonData[JsonFieldName::kExperimentAudioSegments].GetString();
+			if (strcmp(segments, JsonFieldName::kExperimentAudioSegmentsRecording) == 0)
+			{
+				m_audioSegments = AudioSegments::kRecording;
+			}
+			else if (strcmp(segments, JsonFieldName::kExperimentAudioSegmentsMarker) == 0)
+			{
+				m_audioSegments = AudioSegments::kMarker;
+			}
+			else if (strcmp(segments, JsonFieldName::kExperimentAudioSegmentsNone) != 0)
+			{
+				RV_DEBUG_PRINTF("[ExperimentManager] Unknown audio segments %s, the recording will not be split.", segments);
+			}
+		}
+		if (jsonData.HasMember(JsonFieldName::kExperimentJournalCommitInterval))
+		{
+			// [OPTIONAL] The maximum time in seconds between two commits of the session journal.
+			m_journalCommitInterval = jsonData[JsonFieldName::kExperimentJournalCommitInterval].GetFloat();
+		}
+		else
+		{
+			// At most one second of data is lost after a crash by default.
+			m_journalCommitInterval = 1.0f;
+		}
+		if (jsonData.HasMember(JsonFieldName::kExperimentCompressOutput))
+		{
+			// [OPTIONAL] Whether to compress all output files.
+			m_compressOutput = jsonData[JsonFieldName::kExperimentCompressOutput].GetBool();
+		}
+		else
+		{
+			// Uncompressed files can be opened right away, which is what most people expect.
+			m_compressOutput = false;
+		}
+		m_outputFormat = OutputFormat::kText;
+		if (jsonData.HasMember(JsonFieldName::kExperimentOutputFormat))
+		{
+			// [OPTIONAL] The format of the main output file.
+			const char* format = jsonData[JsonFieldName::kExperimentOutputFormat].GetString();
+			if (strcmp(format, JsonFieldName::kExperimentOutputFormatBinary) == 0)
+			{
+				m_outputFormat = OutputFormat::kBinary;
+			}
+			else if (strcmp(format, JsonFieldName::kExperimentOutputFormatLong) == 0)
+			{
+				m_outputFormat = OutputFormat::kLong;
+			}
+			else if (strcmp(format, JsonFieldName::kExperimentOutputFormatText) != 0)
+			{
+				RV_DEBUG_PRINTF("[ExperimentManager] Unknown output format %s, text will be written.", format);
+			}
+		}
+		if (jsonData.HasMember(JsonFieldName::kExperimentKeyframeInterval))
+		{
+			// [OPTIONAL] The maximum time in seconds between two keyframes of long logs.
+			m_keyframeInterval = jsonData[JsonFieldName::kExperimentKeyframeInterval].GetFloat();
+		}
+		else
+		{
+			m_keyframeInterval = 10.0f;
+		}
+		if (jsonData.HasMember(JsonFieldName::kExperimentCoalesceWindow))
+		{
+			// [OPTIONAL] The time in seconds during which changes are merged into one line.
+			m_coalesceWindow = jsonData[JsonFieldName::kExperimentCoalesceWindow].GetFloat();
+		}
+		else
+		{
+			// Every frame with changes writes its own line by default.
+			m_coalesceWindow = 0.0f;
+		}
+		if (jsonData.HasMember(JsonFieldName::kExperimentWriteIndex))
+		{
+			// [OPTIONAL] Whether to write a session index for each output file.
+			m_writeIndex = jsonData[JsonFieldName::kExperimentWriteIndex].GetBool();
+		}
+		else
+		{
+			// The index is tiny compared to the output, so it is always written by default.
+			m_writeIndex = true;
+		}
+		// [OPTIONAL] The maximum number of seconds and rows between two regular index entries.
+		m_indexInterval = jsonData.HasMember(JsonFieldName::kExperimentIndexInterval) ? jsonData[JsonFieldName::kExperimentIndexInterval].GetFloat() : 10.0f;
+		m_indexRowInterval = jsonData.HasMember(JsonFieldName::kExperimentIndexRowInterval) ? jsonData[JsonFieldName::kExperimentIndexRowInterval].GetUint() : 1000;
+		m_columnCoalesceWindows.clear();
+		if (jsonData.HasMember(JsonFieldName::kExperimentCoalesceColumns))
+		{
+			// [OPTIONAL] Coalescing windows for single columns, which take precedence over those of their plug-ins.
+			auto columns = jsonData[JsonFieldName::kExperimentCoalesceColumns].GetArray();
+			for (Json::Value::ConstValueIterator it = columns.Begin(); it != columns.End(); ++it)
+			{
+				auto column = it->GetObject();
+				Utilities::Name columnName(column[JsonFieldName::kExperimentCoalesceColumnsName].GetString());
+				m_columnCoalesceWindows[columnName] = column[JsonFieldName::kExperimentCoalesceColumnsWindow].GetFloat();
+			}
+		}
+		// Output files are mapped by default, the stream backend is used whenever mapping a file fails.
+		m_outputBackend = SessionLog::FileBackend::kMapped;
+		if (jsonData.HasMember(JsonFieldName::kExperimentOutputBackend))
+		{
+			// [OPTIONAL] The backend used to write all output files.
+			const char* backend = jsonData[JsonFieldName::kExperimentOutputBackend].GetString();
+			if (strcmp(backend, JsonFieldName::kExperimentOutputBackendStream) == 0)
+			{
+				m_outputBackend = SessionLog::FileBackend::kStream;
+			}
+			else if (strcmp(backend, JsonFieldName::kExperimentOutputBackendAsync) == 0)
+			{
+				m_outputBackend = SessionLog::FileBackend::kAsync;
+			}
+			else if (strcmp(backend, JsonFieldName::kExperimentOutputBackendMapped) != 0)
+			{
+				RV_DEBUG_PRINTF("[ExperimentManager] Unknown output backend %s, files will be mapped.", backend);
+			}
+		}
+		// Resolve all command blocks now, so missing ones are reported right after loading the configuration.
+		// Blocks loaded later are found when the experiment starts, which fails if any are still missing then.
+		if (!link_command_blocks(GamePlay::g_globalGameState.command_block_manager()))
+		{
+			RV_DEBUG_PRINTF("[ExperimentManager] Error: The configuration references command blocks that are not loaded (yet)!");
+		}
 	}
 
 	void ExperimentManager::set_participant(const participant_number_t number)
@@ -254,8 +513,11 @@ namespace Experiment
 		RV_ASSERT(!m_isRunning);
 		// Make sure that this conditions does not already exist.
 		Utilities::Name condition(conditionName);
-		RV_ASSERT(m_conditionDefaults.find(condition) == m_conditionDefaults.end() && "Experiment conditions have to have unique names!");
-		m_conditionDefaults.insert(std::make_pair(condition, value));
+		RV_ASSERT(m_conditionSlots.find(condition) == m_conditionSlots.end() && "Experiment conditions have to have unique names!");
+		// The new condition is appended, so it gets the next slot.
+		m_conditionNames.push_back(condition);
+		m_conditionDefaults.push_back(value);
+		update_condition_slots();
 	}
 
 	void ExperimentManager::remove_experiment_condition(const char* conditionName)
@@ -263,8 +525,13 @@ namespace Experiment
 		RV_ASSERT(!m_isRunning);
 		// Make sure that this conditions does not already exist.
 		Utilities::Name condition(conditionName);
-		RV_ASSERT(m_conditionDefaults.find(condition) != m_conditionDefaults.end() && "The requested experiment condition was not found!");
-		m_conditionDefaults.erase(condition);
+		auto itSlot = m_conditionSlots.find(condition);
+		RV_ASSERT(itSlot != m_conditionSlots.end() && "The requested experiment condition was not found!");
+		// Close the gap in the slots, which moves all subsequent conditions.
+		u32 slot = itSlot->second;
+		m_conditionNames.erase(m_conditionNames.begin() + slot);
+		m_conditionDefaults.erase(m_conditionDefaults.begin() + slot);
+		update_condition_slots();
 	}
 
 	void ExperimentManager::add_experiment_trigger(const char* triggerName, const Trigger& trigger)
@@ -272,8 +539,11 @@ namespace Experiment
 		RV_ASSERT(!m_isRunning);
 		// Make sure that this trigger does not already exist.
 		Utilities::Name triggerHash(triggerName);
-		RV_ASSERT(m_triggers.find(triggerHash) == m_triggers.end() && "Experiment triggers have to have unique names!");
-		m_triggers.insert(std::make_pair(triggerHash, trigger));
+		RV_ASSERT(m_triggerSlots.find(triggerHash) == m_triggerSlots.end() && "Experiment triggers have to have unique names!");
+		// The new trigger is appended, so it gets the next slot.
+		m_triggerNames.push_back(triggerHash);
+		m_triggers.push_back(trigger);
+		update_trigger_slots();
 	}
 
 	void ExperimentManager::remove_experiment_trigger(const char* triggerName)
@@ -281,48 +551,70 @@ namespace Experiment
 		RV_ASSERT(!m_isRunning);
 		// Make sure that this conditions does not already exist.
 		Utilities::Name trigger(triggerName);
-		RV_ASSERT(m_triggers.find(trigger) != m_triggers.end() && "The requested experiment trigger was not found!");
-		m_triggers.erase(trigger);
+		auto itSlot = m_triggerSlots.find(trigger);
+		RV_ASSERT(itSlot != m_triggerSlots.end() && "The requested experiment trigger was not found!");
+		if (itSlot == m_triggerSlots.end())
+		{
+			return;
+		}
+		// Close the gap in the slots, which moves all subsequent triggers.
+		u32 slot = itSlot->second;
+		m_triggerNames.erase(m_triggerNames.begin() + slot);
+		m_triggers.erase(m_triggers.begin() + slot);
+		update_trigger_slots();
 	}
 
-	void ExperimentManager::register_plugin(Utilities::Name pluginName, ExperimentPlugin* pPlugin)
+	bool ExperimentManager::link_command_blocks(Events::CommandBlockManager& rCBManager)
 	{
-		// Check if another instance of this plug-in is already registered.
-		auto itPlugin = m_sAvailablePlugins.find(pluginName);
-		if (itPlugin == m_sAvailablePlugins.end())
+		RV_ASSERT(!m_isRunning);
+		bool allResolved = true;
+		for (u32 slot = 0; slot < m_triggers.size(); slot++)
 		{
-			// Insert the new plug-in into the static map.
-			m_sAvailablePlugins.insert(std::make_pair(pluginName, pPlugin));
+			auto& rTrigger(m_triggers[slot]);
+			rTrigger.commandIndices.clear();
+			for (auto& blockName : rTrigger.commands)
+			{
+				u32 blockIndex = rCBManager.find_command_block_index(blockName);
+				if (blockIndex == Events::CommandBlockManager::kInvalidCommandBlockIndex)
+				{
+					RV_DEBUG_PRINTF("[ExperimentManager] Error: Trigger \"%s\" references the unknown command block \"%s\"!", m_triggerNames[slot].get_message(), blockName.get_message());
+					allResolved = false;
+				}
+				rTrigger.commandIndices.push_back(blockIndex);
+			}
 		}
-		else
+		// Plug-ins might reference command blocks, too.
+		for (auto& plugin : m_activePlugins)
 		{
-			// Replace the pointer to the existing plug-in instance with the new one.
-			itPlugin->second = pPlugin;
+			allResolved &= plugin->link_command_blocks(rCBManager);
 		}
-		m_sAvailablePlugins.insert(std::make_pair(pluginName, pPlugin));
+		return allResolved;
 	}
 
 	ExperimentPlugin* ExperimentManager::enable_plugin(Utilities::Name pluginName)
 	{
 		RV_ASSERT(!m_isRunning);
-		auto itPlugin = m_sAvailablePlugins.find(pluginName);
+		auto pFactory = find_plugin_factory(pluginName);
 		// Check if a plug-in with this name is available.
-		if (itPlugin != m_sAvailablePlugins.end())
+		if (pFactory)
 		{
 			// Check that this plug-in is not already active.
-			if (std::find(m_activePlugins.begin(), m_activePlugins.end(), itPlugin->second) == m_activePlugins.end())
+			auto itActivePlugin = find_active_plugin(pluginName);
+			if (itActivePlugin == m_activePlugins.end())
 			{
+				// Only now construct the plug-in and add it to the vector of active plug-ins.
+				m_activePlugins.emplace_back(pFactory->create());
+				ExperimentPlugin* pPlugin = m_activePlugins.back().get();
 				// Register the plug-in as an event observer.
-				Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kGameplayChannel, itPlugin->second);
-				Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kExperimentChannel, itPlugin->second);
-				// Add the pointer to the plug-in to the vector of active plug-ins.
-				m_activePlugins.push_back(itPlugin->second);
+				Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kGameplayChannel, pPlugin);
+				Events::GEventSystem::instance().register_observer(Events::ERevealEventChannels::kExperimentChannel, pPlugin);
+				return pPlugin;
 			}
 			else
 			{
 				RV_DEBUG_PRINTF("[ExperimentManager] Warning: The plug-in with name \"%s\" was already active.", pluginName.get_message());
+				return itActivePlugin->get();
 			}
-			return itPlugin->second;
 		}
 		else
 		{
@@ -331,83 +623,150 @@ namespace Experiment
 		}
 	}
 
-	ExperimentPlugin* ExperimentManager::disable_plugin(Utilities::Name pluginName)
+	bool ExperimentManager::disable_plugin(Utilities::Name pluginName)
 	{
 		RV_ASSERT(!m_isRunning);
-		auto itPlugin = m_sAvailablePlugins.find(pluginName);
-		// Check if a plug-in with this name is available.
-		if (itPlugin != m_sAvailablePlugins.end())
+		// Check that this plug-in is currently active.
+		auto itActivePlugin = find_active_plugin(pluginName);
+		if (itActivePlugin != m_activePlugins.end())
 		{
-			// Check that this plug-in is currently active.
-			auto itActivePlugin = std::find(m_activePlugins.begin(), m_activePlugins.end(), itPlugin->second);
-			if (itActivePlugin != m_activePlugins.end())
-			{
-				// Remove the pointer to the plug-in from the vector of active plug-ins.
-				m_activePlugins.erase(itActivePlugin);
-				// Unregister the plug-in as an event observer.
-				Events::GEventSystem::instance().unregister_observer(Events::ERevealEventChannels::kGameplayChannel, itPlugin->second);
-				Events::GEventSystem::instance().unregister_observer(Events::ERevealEventChannels::kExperimentChannel, itPlugin->second);
-			}
-			else
-			{
-				RV_DEBUG_PRINTF("[ExperimentManager] Warning: The plug-in with name \"%s\" was not currently active.", pluginName.get_message());
-			}
-			return itPlugin->second;
+			// Unregister the plug-in as an event observer.
+			Events::GEventSystem::instance().unregister_observer(Events::ERevealEventChannels::kGameplayChannel, itActivePlugin->get());
+			Events::GEventSystem::instance().unregister_observer(Events::ERevealEventChannels::kExperimentChannel, itActivePlugin->get());
+			// Remove the plug-in from the vector of active plug-ins, which destroys it.
+			m_activePlugins.erase(itActivePlugin);
+			return true;
 		}
 		else
 		{
-			RV_DEBUG_PRINTF("[ExperimentManager] There is no registered plug-in with name \"%s\" available!", pluginName.get_message());
-			return nullptr;
+			RV_DEBUG_PRINTF("[ExperimentManager] Warning: The plug-in with name \"%s\" was not currently active.", pluginName.get_message());
+			return false;
+		}
+	}
+
+	const PluginFactory* ExperimentManager::find_plugin_factory(Utilities::Name pluginName)
+	{
+		for (auto& factory : kPluginFactories)
+		{
+			if (Utilities::Name(factory.name) == pluginName)
+			{
+				return &factory;
+			}
 		}
+		return nullptr;
 	}
 
-	void ExperimentManager::start()
+	ExperimentManager::PluginList::iterator ExperimentManager::find_active_plugin(Utilities::Name pluginName)
+	{
+		return std::find_if(m_activePlugins.begin(), m_activePlugins.end(), [pluginName](const std::unique_ptr<ExperimentPlugin>& pPlugin) { return pPlugin->get_name() == pluginName; });
+	}
+
+	bool ExperimentManager::start()
 	{
 		// Do not reset the experiment manager here, as it was already done during initialisation.
 		// This is because the participant number is set before the experiment is started.
 		RV_ASSERT(!m_isRunning);
 		RV_ASSERT(m_currentParticipant != kInvalidParticipantNumber);
 
-		// Open output file with the participant number and time in its name.
-		char outputPath[128];
+		// The command blocks are linked again for every experiment, as they might have been reloaded since the configuration.
+		// Indices resolved before could point to other blocks then, which an outdated link would play without notice.
+		// Missing blocks were reported while linking, an experiment that could not execute them is not started at all.
+		if (!link_command_blocks(GamePlay::g_globalGameState.command_block_manager()))
+		{
+			RV_DEBUG_PRINTF("[ExperimentManager] Error: The experiment was not started, as command blocks are missing!");
+			return false;
+		}
+
+		// Open the session journal and one output file per output stream with the participant number and time in its name.
+		char outputPath[kOutputPathSize];
 		time_t rawtime;
 		struct tm* timeinfo;
 		time(&rawtime);
 		timeinfo = localtime(&rawtime);
 		char dateString[32];
 		strftime(dateString, 32, "%A_%d-%m-%Y_%H-%M-%S", timeinfo);
-#if defined(RV_PLATFORM_ORBIS) && defined(RV_PACKAGE)
-		// [NOTE] All experiment data is written to a USB drive!
-		sprintf_s(outputPath, 128, "/usb0/participant_%02d_%s.csv", m_currentParticipant, dateString);
-#else
-		sprintf_s(outputPath, 128, RV_PATH_LITERAL("Media/Config/participant_%02d_%s.csv"), m_currentParticipant, dateString);
-#endif
-		m_outputWriter.open(outputPath, std::ios::app);
+		m_journal.open(std::string(kOutputDirectory) + kJournalFileName, m_outputBackend);
+		m_timeSinceJournalCommit = 0.0f;
 
-		// Initialise the condition value vector with the current default condition values.
-		m_conditionValues = m_conditionDefaults;
+		// Initialise the condition values with the current default condition values.
+		// The value array already has the right size, so this is just one copy.
+		RV_ASSERT(m_conditionValues.size() == m_conditionDefaults.size());
+		if (!m_conditionDefaults.empty())
+		{
+			std::memcpy(m_conditionValues.data(), m_conditionDefaults.data(), m_conditionDefaults.size() * sizeof(ConditionValue));
+		}
 
 		// Reset all active plug-ins.
-		for (auto plugin : m_activePlugins)
+		for (auto& plugin : m_activePlugins)
 		{
 			plugin->reset();
 		}
 
-		// Write the header line with all currently available conditions and plug-ins.
-		m_outputWriter << "participant" << m_separator << "elapsedTime";
-		for (auto& conditionPair : m_conditionValues)
+		// Assign all plug-ins to their output streams, the main stream with the conditions always comes first.
+		// Streams are numbered in the order their first plug-in was activated, plug-ins keep their order within a stream.
+		const Utilities::Name mainStreamName(JsonFieldName::kExperimentPluginOutputStreamMain);
+		m_outputStreams.clear();
+		m_outputStreams.emplace_back();
+		m_outputStreams.front().name = mainStreamName;
+		m_outputStreams.front().hasConditions = true;
+		m_pluginStreamIndices.clear();
+		for (auto& plugin : m_activePlugins)
 		{
-			m_outputWriter << m_separator << conditionPair.first.get_message();
+			auto itStreamName = m_pluginOutputStreams.find(plugin->get_name());
+			const Utilities::Name streamName = itStreamName != m_pluginOutputStreams.end() ? itStreamName->second : mainStreamName;
+			auto itStream = std::find_if(m_outputStreams.begin(), m_outputStreams.end(), [streamName](const OutputStream& stream) { return stream.name == streamName; });
+			if (itStream == m_outputStreams.end())
+			{
+				m_outputStreams.emplace_back();
+				m_outputStreams.back().name = streamName;
+				itStream = m_outputStreams.end() - 1;
+			}
+			itStream->plugins.push_back(plugin.get());
+			m_pluginStreamIndices.push_back(static_cast<u32>(itStream - m_outputStreams.begin()));
 		}
-		for (auto plugin : m_activePlugins)
+
+		const char* fileExtension = m_compressOutput ? SessionLog::kCompressedFileExtension : "";
+		const bool isBinary = m_outputFormat != OutputFormat::kText;
+		for (auto& stream : m_outputStreams)
 		{
-			for (auto& field : plugin->get_data())
+			// Only the files of additional streams carry the name of their stream.
+			std::string streamSuffix;
+			if (!stream.hasConditions)
+			{
+				streamSuffix = std::string("_") + stream.name.get_message();
+			}
+			sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s%s%s%s", kOutputDirectory, m_currentParticipant, dateString, streamSuffix.c_str(), isBinary ? SessionLog::kBinaryLogFileExtension : ".csv", fileExtension);
+			stream.journalStream = m_journal.add_stream(isBinary ? SessionLog::StreamKind::kBinaryLog : SessionLog::StreamKind::kText, outputPath, m_compressOutput);
+			if (m_writeIndex)
+			{
+				// The index is never compressed, it is read in small pieces and hardly compresses anyway.
+				stream.indexStream = m_journal.add_stream(SessionLog::StreamKind::kIndex, SessionLog::get_index_path(outputPath));
+				SessionLog::SessionIndexWriter::begin_index(m_indexRecords);
+				m_journal.append(stream.indexStream, m_indexRecords.data(), m_indexRecords.size());
+				m_indexRecords.clear();
+				// Compressed files get their frames indexed as well, so readers can decode just the frames around an entry.
+				if (m_compressOutput)
+				{
+					m_journal.set_frame_index(stream.journalStream, stream.indexStream);
+				}
+			}
+
+			// Look up for how long the changes of each data field may be held back to merge them with others.
+			// The pending row keeps a copy of every value, so its storage is allocated once here.
+			for (auto pPlugin : stream.plugins)
 			{
-				m_outputWriter << m_separator << field.first.get_message();
+				auto itPluginWindow = m_pluginCoalesceWindows.find(pPlugin->get_name());
+				const f32 pluginWindow = itPluginWindow != m_pluginCoalesceWindows.end() ? itPluginWindow->second : m_coalesceWindow;
+				for (auto& field : pPlugin->get_data())
+				{
+					auto itColumnWindow = m_columnCoalesceWindows.find(field.first);
+					stream.fieldWindows.push_back(itColumnWindow != m_columnCoalesceWindows.end() ? itColumnWindow->second : pluginWindow);
+				}
 			}
+			stream.row.fields.resize(stream.fieldWindows.size());
+
+			write_header(stream);
 		}
-		m_outputWriter << "\n";
-		m_outputWriter.flush();
 
 		// Open an audio port for voice recording if enabled in the configuration.
 		static SceUserServiceUserId userid;
@@ -416,55 +775,188 @@ namespace Experiment
 			m_audioPort = sceAudioInOpen(userid, SCE_AUDIO_IN_TYPE_VOICE, 0, SCE_AUDIO_IN_GRAIN_DEFAULT, SCE_AUDIO_IN_FREQ_DEFAULT, SCE_AUDIO_IN_PARAM_FORMAT_S16_MONO);
 			if (m_audioPort >= 0) {
 				// The audio port was opened, now open the output audio file..
-#if defined(RV_PLATFORM_ORBIS) && defined(RV_PACKAGE)
-				// [NOTE] All experiment data is written to a USB drive!
-				sprintf_s(outputPath, 128, "/usb0/participant_%02d_%s.wav", m_currentParticipant, dateString);
-#else
-				sprintf_s(outputPath, 128, RV_PATH_LITERAL("Media/Config/participant_%02d_%s.wav"), m_currentParticipant, dateString);
-#endif
-				m_audioFilePath = outputPath;
-				m_audioRecording = AudioFile::AudioFile<short>();
-				m_audioRecording.setNumChannels(1);
-				m_audioRecording.setSampleRate(16000);
+				// Samples are streamed into it while recording, its header sizes are patched when the journal is closed.
+				const char* audioExtension = m_audioFormat == AudioFormat::kFlac ? "flac" : "wav";
+				if (m_audioResampleRate > 0 && m_audioResampleRate != kAudioCaptureRate)
+				{
+					m_isAudioResampled = m_audioResampler.setup(kAudioCaptureRate, m_audioResampleRate, 1);
+					if (!m_isAudioResampled)
+					{
+						RV_DEBUG_PRINTF("[ExperimentManager] The audio recording can not be resampled to %u Hz!", m_audioResampleRate);
+					}
+				}
+				if (m_audioSegments == AudioSegments::kNone)
+				{
+					sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s.%s%s", kOutputDirectory, m_currentParticipant, dateString, audioExtension, fileExtension);
+					m_audioFilePath = outputPath;
+					m_audioStream = add_audio_stream(m_audioFilePath, kAudioCaptureRate, m_audioEncoder);
+					// The resampled recording is written alongside, block by block from the same samples.
+					if (m_isAudioResampled)
+					{
+						sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s_%uHz.%s%s", kOutputDirectory, m_currentParticipant, dateString, m_audioResampleRate, audioExtension, fileExtension);
+						m_resampledAudioStream = add_audio_stream(outputPath, m_audioResampleRate, m_resampledAudioEncoder);
+					}
+				}
+				else
+				{
+					// ..or only the list of segments, whose files are created whenever a segment starts.
+					sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s", kOutputDirectory, m_currentParticipant, dateString);
+					m_audioSegmentPrefix = outputPath;
+					sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s_audioSegments.csv%s", kOutputDirectory, m_currentParticipant, dateString, fileExtension);
+					m_audioSegmentListStream = m_journal.add_stream(SessionLog::StreamKind::kText, outputPath, m_compressOutput);
+					char segmentHeader[64];
+					const int segmentHeaderLength = sprintf_s(segmentHeader, sizeof(segmentHeader), "segment%sfirstSample\n", m_separator);
+					m_journal.append(m_audioSegmentListStream, segmentHeader, segmentHeaderLength);
+				}
+				// Each captured block is stamped with the session time, which relates samples to lines without guessing the drift between both clocks.
+				sprintf_s(outputPath, sizeof(outputPath), "%sparticipant_%02d_%s_audioTiming.csv%s", kOutputDirectory, m_currentParticipant, dateString, fileExtension);
+				m_audioTimingStream = m_journal.add_stream(SessionLog::StreamKind::kText, outputPath, m_compressOutput);
+				char timingHeader[64];
+				const int timingHeaderLength = std::snprintf(timingHeader, sizeof(timingHeader), "samplesCaptured%ssessionTime\n", m_separator);
+				m_journal.append(m_audioTimingStream, timingHeader, timingHeaderLength);
 			}
 			else
 			{
-				RV_DEBUG_PRINTF("[ExperimentManager] A new audio port could not be opened!", outputPath);
+				RV_DEBUG_PRINTF("[ExperimentManager] A new audio port could not be opened!");
 			}
 		}
 
 		// Set the experiment running and write one line just for the initial condition values.
+		m_sessionClockOffset.store(m_fTotalTime - get_steady_seconds(), std::memory_order_relaxed);
 		m_isRunning = true;
 		record_experiment_state();
+		return true;
+	}
+
+	void ExperimentManager::write_header(OutputStream& rStream)
+	{
+		// Conditions are only part of the main stream.
+		const size_t conditionCount = rStream.hasConditions ? m_conditionNames.size() : 0;
+		if (m_outputFormat != OutputFormat::kText)
+		{
+			// The participant number and the undefined value are only stored once in binary logs.
+			// Long logs additionally need to know which columns keep their value: conditions and "always up to date" fields.
+			std::vector<const char*> columnNames;
+			std::vector<uint8_t> persistentColumns;
+			for (size_t slot = 0; slot < conditionCount; slot++)
+			{
+				columnNames.push_back(m_conditionNames[slot].get_message());
+				persistentColumns.push_back(1);
+			}
+			for (auto pPlugin : rStream.plugins)
+			{
+				for (auto& field : pPlugin->get_data())
+				{
+					columnNames.push_back(field.first.get_message());
+					persistentColumns.push_back(field.second.is_always_up_to_date() ? 1 : 0);
+				}
+			}
+			rStream.binaryWriter.begin_session(m_currentParticipant, m_undefinedValue.c_str(), m_binaryRecords);
+			if (m_outputFormat == OutputFormat::kLong)
+			{
+				rStream.binaryWriter.write_columns(columnNames, persistentColumns, m_binaryRecords);
+				rStream.lastKeyframeTime = 0.0f;
+			}
+			else
+			{
+				rStream.binaryWriter.write_columns(columnNames, m_binaryRecords);
+			}
+			// Readers starting in the middle of the log read the definitions the index points at instead of everything before.
+			if (rStream.indexStream != SessionLog::JournalWriter::kInvalidStream)
+			{
+				SessionLog::SessionIndexWriter::add_entry(m_indexRecords, SessionLog::IndexEntryType::kDefinitions, 0.0f, rStream.get_data_offset(), m_binaryRecords.size(), rStream.get_data_offset());
+				m_journal.append(rStream.indexStream, m_indexRecords.data(), m_indexRecords.size());
+				m_indexRecords.clear();
+			}
+			write_binary_records(rStream);
+		}
+		else
+		{
+			SessionLog::OutputSink& rSink = rStream.sink;
+			rSink.append("participant");
+			rSink.append(m_separator);
+			rSink.append("elapsedTime");
+			for (size_t slot = 0; slot < conditionCount; slot++)
+			{
+				rSink.append(m_separator);
+				rSink.append(m_conditionNames[slot].get_message());
+			}
+			for (auto pPlugin : rStream.plugins)
+			{
+				for (auto& field : pPlugin->get_data())
+				{
+					rSink.append(m_separator);
+					rSink.append(field.first.get_message());
+				}
+			}
+			rSink.append('\n');
+			flush_output(rStream, false);
+		}
 	}
 
 	void ExperimentManager::update(const f32 fDeltaTime, Input::InputController& inputController)
 	{
 		if (m_isRunning)
 		{
-			// Update the experiment time.
+			// Update the experiment time and continue it on the steady clock until the next update.
 			m_fTotalTime += fDeltaTime;
+			m_sessionClockOffset.store(m_fTotalTime - get_steady_seconds(), std::memory_order_relaxed);
+
+			// Commit the session journal regularly, which makes everything written so far survive a crash.
+			// Committing only queues the work, the journal waits for the disk on its worker thread.
+			m_timeSinceJournalCommit += fDeltaTime;
+			if (m_timeSinceJournalCommit >= m_journalCommitInterval)
+			{
+				for (auto& stream : m_outputStreams)
+				{
+					flush_output(stream, true);
+				}
+				m_journal.commit();
+				m_timeSinceJournalCommit = 0.0f;
+			}
 
-			// Update all active plug-ins and write a new line when at least one requested its data to be written or a condition changed.
-			bool writeRequest = false;
-			for (auto plugin : m_activePlugins)
+			// Update all active plug-ins and write a new line to each output stream when at least one of its plug-ins requested its data to be written.
+			// Condition changes are written to the main stream.
+			for (size_t index = 0; index < m_activePlugins.size(); index++)
+			{
+				const bool writeRequest = m_activePlugins[index]->update(fDeltaTime);
+				m_outputStreams[m_pluginStreamIndices[index]].writeRequest |= writeRequest;
+			}
+			m_outputStreams.front().writeRequest |= m_conditionChanged;
+			for (auto& stream : m_outputStreams)
 			{
-				writeRequest |= plugin->update(fDeltaTime);
+				// Changes may be held back for the coalescing window, so a line is written once it has passed.
+				if (stream.writeRequest)
+				{
+					coalesce_experiment_state(stream);
+				}
+				else if (stream.row.isPending && m_fTotalTime >= stream.row.deadline)
+				{
+					flush_experiment_state(stream);
+				}
 			}
-			bool writeRequired = m_conditionChanged || writeRequest;
-			if (writeRequired)
+			m_conditionChanged = false;
+
+			// A marker may request a new audio segment while the previous one is still being taken over, its files are created once that happened.
+			if (m_audioSplitSample.load(std::memory_order_relaxed) != kInvalidAudioSampleIndex)
 			{
-				record_experiment_state();
-				m_conditionChanged = false;
+				prepare_audio_segment();
 			}
 
 			// Check if this was the last update:
 			if (m_lastHaltEvent != Events::ERevealEventTypes::kDummyEvent)
 			{
-				if (!writeRequired)
+				for (auto& stream : m_outputStreams)
 				{
-					// Although no write is necessary, write one last line.
-					record_experiment_state();
+					if (!stream.writeRequest)
+					{
+						// Although no write is necessary, write one last line.
+						record_experiment_state(stream);
+					}
+					else if (stream.row.isPending)
+					{
+						flush_experiment_state(stream);
+					}
 				}
 				// Proceed according to the halt event:
 				if (m_lastHaltEvent == Events::ERevealEventTypes::kExperiment_End)
@@ -476,131 +968,538 @@ namespace Experiment
 					abort();
 				}
 			}
+			for (auto& stream : m_outputStreams)
+			{
+				stream.writeRequest = false;
+			}
 		}
 	}
 
-	void ExperimentManager::set_experiment_condition(const char* conditionName, const ConditionValue& conditionValue)
+	ConditionHandle ExperimentManager::find_experiment_condition(Utilities::Name conditionName) const
 	{
-		Utilities::Name condition(conditionName);
+		ConditionHandle condition;
+		condition.name = conditionName;
+		resolve_condition(condition);
+		return condition;
+	}
 
+	void ExperimentManager::set_experiment_condition(ConditionHandle& condition, const ConditionValue& conditionValue)
+	{
 		// Only predefined conditions in Media/Config/experiment_config.json at "conditions" can be set.
-		RV_ASSERT(m_conditionValues.find(condition) != m_conditionValues.end() && "Only values of predefined conditions can be set!");
+		bool isRegistered = resolve_condition(condition);
+		RV_ASSERT(m_isRunning && "Condition values can only be set while the experiment is running!");
+		RV_ASSERT(isRegistered && "Only values of predefined conditions can be set!");
+		if (!isRegistered)
+		{
+			// Without assertions, log a warning instead of writing outside of the condition values.
+			RV_DEBUG_PRINTF("[ExperimentManager] Warning: Could not set the value of undefined condition %s.", condition.name.get_message());
+			return;
+		}
 		// [NOTE] The old Utilities::Name value could in many cases now be deleted from the cache.
 		// However, this could be dangerous if the old condition value was by coincidence also used to reference a system-relevant name!
-		m_conditionValues[condition] = conditionValue;
+		m_conditionValues[condition.slot] = conditionValue;
 
 		// Set the flag for condition changes, so the next opportunity to write a line is taken.
 		m_conditionChanged = true;
 	}
 
-	void ExperimentManager::increment_experiment_condition(const char* conditionName, s32 increment)
+	void ExperimentManager::set_experiment_condition(Utilities::Name conditionName, const ConditionValue& conditionValue)
+	{
+		ConditionHandle condition(find_experiment_condition(conditionName));
+		set_experiment_condition(condition, conditionValue);
+	}
+
+	void ExperimentManager::set_experiment_condition(const char* conditionName, const ConditionValue& conditionValue)
+	{
+		set_experiment_condition(Utilities::Name(conditionName), conditionValue);
+	}
+
+	void ExperimentManager::increment_experiment_condition(ConditionHandle& condition, s32 increment)
 	{
-		// Read out the current value string and try to parse it as an integer.
-		auto pCurrentValue = get_experiment_condition_value(conditionName);
-		if (pCurrentValue.type == ConditionValue::kInteger)
+		// Read out the current value and check that it is an integer.
+		auto currentValue = get_experiment_condition_value(condition);
+		if (currentValue.type == ConditionValue::kInteger)
 		{
-			pCurrentValue.integer += increment;
-			set_experiment_condition(conditionName, pCurrentValue);
+			currentValue.integer += increment;
+			set_experiment_condition(condition, currentValue);
 		}
 		else
 		{
-			RV_DEBUG_PRINTF("[ExperimentManager] Could not increment the value of condition %s!", conditionName);
+			RV_DEBUG_PRINTF("[ExperimentManager] Could not increment the value of condition %s!", condition.name.get_message());
 		}
 	}
 
-	void ExperimentManager::trigger(const char* triggerName)
+	void ExperimentManager::increment_experiment_condition(Utilities::Name conditionName, s32 increment)
 	{
-		Utilities::Name trigger(triggerName);
+		ConditionHandle condition(find_experiment_condition(conditionName));
+		increment_experiment_condition(condition, increment);
+	}
 
-		// Only predefined triggers in Media/Config/experiment_config.json at "triggers" can be executed.
-		RV_ASSERT(m_triggers.find(trigger) != m_triggers.end() && "Only predefined triggers can be executed!");
+	void ExperimentManager::increment_experiment_condition(const char* conditionName, s32 increment)
+	{
+		increment_experiment_condition(Utilities::Name(conditionName), increment);
+	}
 
-		// Find out which block should be triggered and execute the appropriate command block.
-		auto blockName = m_triggers[trigger].get_command_block(m_currentParticipant);
-		auto blockIndex = GamePlay::g_globalGameState.command_block_manager().find_command_block_index(blockName);
-		GamePlay::g_globalGameState.command_block_manager().play_block(blockIndex, Events::GEventSystem::instance(), GamePlay::g_globalGameState.callback_manager());
+	TriggerHandle ExperimentManager::find_experiment_trigger(Utilities::Name triggerName) const
+	{
+		TriggerHandle trigger;
+		trigger.name = triggerName;
+		resolve_trigger(trigger);
+		return trigger;
 	}
 
-	void ExperimentManager::record_experiment_state()
+	void ExperimentManager::trigger(TriggerHandle& trigger)
 	{
-		RV_ASSERT(m_isRunning);
-		m_outputWriter << m_currentParticipant << m_separator << std::fixed << std::setprecision(2) << m_fTotalTime;
-		for (auto& conditionPair : m_conditionValues)
+		// Only predefined triggers in Media/Config/experiment_config.json at "triggers" can be executed.
+		bool isConfigured = resolve_trigger(trigger);
+		RV_ASSERT(isConfigured && "Only predefined triggers can be executed!");
+		if (!isConfigured)
 		{
-			m_outputWriter << m_separator << conditionPair.second;
+			// Without assertions, log a warning instead of reading outside of the triggers.
+			RV_DEBUG_PRINTF("[ExperimentManager] Warning: Could not execute undefined trigger %s.", trigger.name.get_message());
+			return;
 		}
-		for (auto plugin : m_activePlugins)
+
+		// Find out which block should be triggered and execute the appropriate command block.
+		auto blockIndex = m_triggers[trigger.slot].get_command_block_index(m_currentParticipant);
+		RV_ASSERT(blockIndex != Events::CommandBlockManager::kInvalidCommandBlockIndex && "The trigger's command block was not found during linking!");
+		if (blockIndex == Events::CommandBlockManager::kInvalidCommandBlockIndex)
 		{
-			for (auto& field : plugin->get_data())
-			{
-				// Data fields are defined to have an age of zero during the entire frame they were modified in.
-				// Ignore any data with an age greater than zero if they are not marked as always up to date.
-				bool ignoreOld = !field.second.is_always_up_to_date() && field.second.older_than(0.0f);
-				auto& value = ignoreOld || field.second.is_undefined() ? m_undefinedValue : field.second.get();
-				m_outputWriter << m_separator << value;
-			}
+			RV_DEBUG_PRINTF("[ExperimentManager] Warning: Trigger %s has no linked command block for this participant.", trigger.name.get_message());
+			return;
 		}
-		m_outputWriter << "\n";
-		// [NOTE] It can be useful to always flush to avoid losing records after a crash.
-		// However, this might not be necessary for the final application!
-		m_outputWriter.flush();
+		GamePlay::g_globalGameState.command_block_manager().play_block(blockIndex, Events::GEventSystem::instance(), GamePlay::g_globalGameState.callback_manager());
 	}
 
-	void ExperimentManager::end()
+	void ExperimentManager::trigger(Utilities::Name triggerName)
 	{
-		if (m_isRunning)
-		{
-			// Reset the experiment manager for the next experiment.
-			reset();
-		}
+		TriggerHandle trigger(find_experiment_trigger(triggerName));
+		this->trigger(trigger);
 	}
 
-	void ExperimentManager::abort()
+	void ExperimentManager::trigger(const char* triggerName)
 	{
-		if (m_isRunning)
+		trigger(Utilities::Name(triggerName));
+	}
+
+	void ExperimentManager::record_experiment_state()
+	{
+		for (auto& stream : m_outputStreams)
 		{
-			// Write a line to the file that indicates that the experiment was aborted!
-			// This should be enough to make statistics software notice a problem during file import...
-			m_outputWriter << "ABORTED!" << "\n";
-			// Reset the experiment manager for the next experiment.
-			reset();
+			record_experiment_state(stream);
 		}
 	}
 
-	void ExperimentManager::reset()
+	void ExperimentManager::record_experiment_state(OutputStream& rStream)
 	{
-		// Close the output writer if necessary:
-		// [NOTE] Do that BEFORE requesting the next file handle, as in package mode, only one file handle can be used at a time.
-		// But naturally, neither the kernel nor SCE clearly state that in their logs. IT WOULDN'T BE PS4 DEVELOPMENT IF THEY JUST DID, RIGHT?!
-		if (m_outputWriter.is_open())
+		RV_ASSERT(m_isRunning);
+		// Changes that are still held back belong to an earlier line.
+		if (rStream.row.isPending)
 		{
-			m_outputWriter.close();
+			flush_experiment_state(rStream);
 		}
+		capture_experiment_state(rStream, true);
+		rStream.row.time = m_fTotalTime;
+		rStream.row.isPending = true;
+		flush_experiment_state(rStream);
+	}
 
-		// Stop and finalise the audio recording if necessary:
-		if (m_enableAudioRecording && m_audioPort >= 0)
+	void ExperimentManager::coalesce_experiment_state(OutputStream& rStream)
+	{
+		// Find out for how long the changes of this frame may be held back and whether one of them would replace a pending change.
+		const bool conditionChanged = rStream.hasConditions && m_conditionChanged;
+		f32 window = conditionChanged ? m_coalesceWindow : std::numeric_limits<f32>::max();
+		bool collides = conditionChanged && rStream.row.hasConditionChange;
+		u32 index = 0;
+		for (auto pPlugin : rStream.plugins)
 		{
-			// Join the recording thread if it is active...
-			if (m_isAudioRecording)
+			for (auto& field : pPlugin->get_data())
 			{
-				m_isAudioRecording = false;
-				m_audioThread.join();
+				if (!field.second.is_undefined_or_old())
+				{
+					window = std::min(window, rStream.fieldWindows[index]);
+					collides |= !rStream.row.fields[index].is_undefined_or_old();
+				}
+				index++;
+			}
+		}
+
+		// Merging must neither lose a value nor move a change further away from its time than its window allows.
+		if (rStream.row.isPending && (collides || rStream.row.time + window < m_fTotalTime))
+		{
+			flush_experiment_state(rStream);
+		}
+		if (rStream.row.isPending)
+		{
+			capture_experiment_state(rStream, false);
+			rStream.row.deadline = std::min(rStream.row.deadline, rStream.row.time + window);
+		}
+		else
+		{
+			capture_experiment_state(rStream, true);
+			rStream.row.time = m_fTotalTime;
+			rStream.row.deadline = m_fTotalTime + window;
+			rStream.row.isPending = true;
+		}
+		rStream.row.hasConditionChange |= conditionChanged;
+
+		// Without a window, this writes the line right away.
+		if (m_fTotalTime >= rStream.row.deadline)
+		{
+			flush_experiment_state(rStream);
+		}
+	}
+
+	void ExperimentManager::capture_experiment_state(OutputStream& rStream, bool captureAll)
+	{
+		if (rStream.hasConditions && (captureAll || m_conditionChanged))
+		{
+			rStream.row.conditions = m_conditionValues;
+		}
+		// Copying a data field also copies its age, which stays the same while the row is pending.
+		u32 index = 0;
+		for (auto pPlugin : rStream.plugins)
+		{
+			for (auto& field : pPlugin->get_data())
+			{
+				auto& pendingField = rStream.row.fields[index++];
+				// Fields reset during this frame must not replace a pending change.
+				if (captureAll || (!field.second.older_than(0.0f) && (!field.second.is_undefined() || pendingField.is_undefined_or_old())))
+				{
+					pendingField = field.second;
+				}
+			}
+		}
+	}
+
+	void ExperimentManager::flush_experiment_state(OutputStream& rStream)
+	{
+		RV_ASSERT(m_isRunning && rStream.row.isPending);
+		// Rows of the long format can only be decoded from the last keyframe on, which the row itself might write.
+		const u64 rowOffset = rStream.get_data_offset();
+		const u64 resumeOffset = m_outputFormat == OutputFormat::kLong ? rStream.resumeOffset : rowOffset;
+		switch (m_outputFormat)
+		{
+		case OutputFormat::kBinary:
+			record_binary_state(rStream);
+			break;
+		case OutputFormat::kLong:
+			record_long_state(rStream);
+			break;
+		default:
+			record_text_state(rStream);
+			break;
+		}
+		if (rStream.indexStream != SessionLog::JournalWriter::kInvalidStream)
+		{
+			index_row(rStream, rowOffset, resumeOffset);
+		}
+		rStream.row.isPending = false;
+		rStream.row.hasConditionChange = false;
+	}
+
+	void ExperimentManager::record_text_state(OutputStream& rStream)
+	{
+		// Numbers are converted right into the sink, the time with two decimals just like "%.2f".
+		SessionLog::OutputSink& rSink = rStream.sink;
+		rSink.append_unsigned(m_currentParticipant);
+		rSink.append(m_separator);
+		rSink.append_fixed(rStream.row.time, 2);
+		for (auto& conditionValue : rStream.row.conditions)
+		{
+			rSink.append(m_separator);
+			append_condition_value(rSink, conditionValue);
+		}
+		for (auto& field : rStream.row.fields)
+		{
+			// Data fields are defined to have an age of zero during the entire frame they were modified in.
+			// Ignore any data with an age greater than zero if they are not marked as always up to date.
+			bool ignoreOld = !field.is_always_up_to_date() && field.older_than(0.0f);
+			rSink.append(m_separator);
+			if (ignoreOld || field.is_undefined())
+			{
+				rSink.append(m_undefinedValue);
+			}
+			else if (field.is_name())
+			{
+				rSink.append(field.get_name().get_message());
+			}
+			else
+			{
+				rSink.append(field.get());
+			}
+		}
+		rSink.append('\n');
+		// [NOTE] Lines are not flushed individually, the sink is handed to the journal before each of its commits.
+		flush_output(rStream, false);
+	}
+
+	void ExperimentManager::record_binary_state(OutputStream& rStream)
+	{
+		rStream.binaryWriter.begin_row(rStream.row.time);
+		for (auto& conditionValue : rStream.row.conditions)
+		{
+			switch (conditionValue.type)
+			{
+			case ConditionValue::kInteger:
+				rStream.binaryWriter.add_integer(conditionValue.integer);
+				break;
+			case ConditionValue::kString:
+				rStream.binaryWriter.add_name(conditionValue.stringHash.get_hash(), conditionValue.stringHash.get_message());
+				break;
+			default:
+				rStream.binaryWriter.add_undefined();
+				break;
+			}
+		}
+		for (auto& field : rStream.row.fields)
+		{
+			// The same rules as for text output apply.
+			bool ignoreOld = !field.is_always_up_to_date() && field.older_than(0.0f);
+			if (ignoreOld || field.is_undefined())
+			{
+				rStream.binaryWriter.add_undefined();
+			}
+			else if (field.is_name())
+			{
+				// Only the first occurrence of a name writes its string, afterwards only its id is stored.
+				rStream.binaryWriter.add_name(field.get_name().get_hash(), field.get_name().get_message());
+			}
+			else
+			{
+				rStream.binaryWriter.add_text(field.get().data(), field.get().size());
+			}
+		}
+		rStream.binaryWriter.end_row(m_binaryRecords);
+		write_binary_records(rStream);
+	}
+
+	void ExperimentManager::record_long_state(OutputStream& rStream)
+	{
+		rStream.binaryWriter.begin_changes(rStream.row.time);
+		u32 column = 0;
+		for (auto& conditionValue : rStream.row.conditions)
+		{
+			// Conditions only produce a change when their value actually changed.
+			switch (conditionValue.type)
+			{
+			case ConditionValue::kInteger:
+				rStream.binaryWriter.change_integer(column, conditionValue.integer, false);
+				break;
+			case ConditionValue::kString:
+				rStream.binaryWriter.change_name(column, conditionValue.stringHash.get_hash(), conditionValue.stringHash.get_message(), false);
+				break;
+			default:
+				rStream.binaryWriter.change_undefined(column);
+				break;
+			}
+			column++;
+		}
+		for (auto& field : rStream.row.fields)
+		{
+			// "Always up to date" fields are compared with their last value, all others are written whenever they were set for this row.
+			// Values that would be undefined in the wide table are simply left out.
+			const bool isPersistent = field.is_always_up_to_date();
+			if (field.is_undefined())
+			{
+				rStream.binaryWriter.change_undefined(column);
+			}
+			else if (isPersistent || !field.older_than(0.0f))
+			{
+				if (field.is_name())
+				{
+					rStream.binaryWriter.change_name(column, field.get_name().get_hash(), field.get_name().get_message(), !isPersistent);
+				}
+				else
+				{
+					rStream.binaryWriter.change_text(column, field.get().data(), field.get().size(), !isPersistent);
+				}
+			}
+			column++;
+		}
+		rStream.binaryWriter.end_changes(m_binaryRecords);
+
+		// Repeat all persistent values once in a while, so readers do not have to start at the beginning of the log.
+		if (rStream.row.time - rStream.lastKeyframeTime >= m_keyframeInterval)
+		{
+			rStream.resumeOffset = rStream.get_data_offset() + m_binaryRecords.size();
+			rStream.binaryWriter.write_keyframe(rStream.row.time, m_binaryRecords);
+			rStream.lastKeyframeTime = rStream.row.time;
+		}
+		write_binary_records(rStream);
+	}
+
+	void ExperimentManager::flush_output(OutputStream& rStream, bool force)
+	{
+		if (rStream.sink.is_full() || (force && !rStream.sink.empty()))
+		{
+			m_journal.append(rStream.journalStream, rStream.sink.data(), rStream.sink.size());
+			rStream.flushedBytes += rStream.sink.size();
+			rStream.sink.clear();
+		}
+	}
+
+	void ExperimentManager::write_binary_records(OutputStream& rStream)
+	{
+		rStream.sink.append(m_binaryRecords.data(), m_binaryRecords.size());
+		m_binaryRecords.clear();
+		flush_output(rStream, false);
+	}
+
+	void ExperimentManager::index_row(OutputStream& rStream, u64 rowOffset, u64 resumeOffset)
+	{
+		const u64 rowSize = rStream.get_data_offset() - rowOffset;
+		const f32 rowTime = rStream.row.time;
+
+		// Dictionary entries of new names are written right before the row, later rows may depend on them.
+		const size_t dictionarySize = m_outputFormat != OutputFormat::kText ? rStream.binaryWriter.get_last_dictionary_size() : 0;
+		if (dictionarySize > 0)
+		{
+			SessionLog::SessionIndexWriter::add_entry(m_indexRecords, SessionLog::IndexEntryType::kDefinitions, rowTime, rowOffset, dictionarySize, rowOffset);
+		}
+
+		// Every condition that changed since the last row gets an entry named by the condition.
+		if (rStream.hasConditions)
+		{
+			for (size_t slot = 0; slot < rStream.indexedConditions.size() && slot < rStream.row.conditions.size(); slot++)
+			{
+				if (!is_same_condition_value(rStream.indexedConditions[slot], rStream.row.conditions[slot]))
+				{
+					const char* conditionName = m_conditionNames[slot].get_message();
+					SessionLog::SessionIndexWriter::add_entry(m_indexRecords, SessionLog::IndexEntryType::kCondition, rowTime, rowOffset, rowSize, resumeOffset, conditionName, strlen(conditionName));
+				}
+			}
+			rStream.indexedConditions = rStream.row.conditions;
+		}
+
+		// Indexed data fields that were set for this row get an entry named by their value.
+		for (auto& field : rStream.row.fields)
+		{
+			if (field.is_indexed() && !field.is_undefined_or_old())
+			{
+				const char* value = field.is_name() ? field.get_name().get_message() : field.get().c_str();
+				SessionLog::SessionIndexWriter::add_entry(m_indexRecords, SessionLog::IndexEntryType::kMarker, rowTime, rowOffset, rowSize, resumeOffset, value, strlen(value));
+			}
+		}
+
+		// Regular entries make sure that any time can be found without decoding too many rows.
+		rStream.rowsSinceIndexEntry++;
+		if (rStream.rowsSinceIndexEntry >= m_indexRowInterval || rowTime - rStream.lastIndexTime >= m_indexInterval)
+		{
+			SessionLog::SessionIndexWriter::add_entry(m_indexRecords, SessionLog::IndexEntryType::kTime, rowTime, rowOffset, rowSize, resumeOffset);
+			rStream.rowsSinceIndexEntry = 0;
+			rStream.lastIndexTime = rowTime;
+		}
+
+		if (!m_indexRecords.empty())
+		{
+			m_journal.append(rStream.indexStream, m_indexRecords.data(), m_indexRecords.size());
+			m_indexRecords.clear();
+		}
+	}
+
+	void ExperimentManager::end()
+	{
+		if (m_isRunning)
+		{
+			// Write the changes that are still held back.
+			for (auto& stream : m_outputStreams)
+			{
+				if (stream.row.isPending)
+				{
+					flush_experiment_state(stream);
+				}
+			}
+			// Reset the experiment manager for the next experiment.
+			reset();
+		}
+	}
+
+	void ExperimentManager::abort()
+	{
+		if (m_isRunning)
+		{
+			for (auto& stream : m_outputStreams)
+			{
+				if (stream.row.isPending)
+				{
+					flush_experiment_state(stream);
+				}
+				// Write a line to each file that indicates that the experiment was aborted!
+				if (m_outputFormat != OutputFormat::kText)
+				{
+					m_binaryRecords = SessionLog::BinaryLogWriter::create_abort_record();
+					write_binary_records(stream);
+				}
+				else
+				{
+					stream.sink.append(kAbortMarker);
+				}
+				flush_output(stream, true);
+			}
+			// Reset the experiment manager for the next experiment.
+			reset();
+		}
+	}
+
+	void ExperimentManager::reset()
+	{
+		// Stop the audio recording if necessary:
+		if (m_enableAudioRecording && m_audioPort >= 0)
+		{
+			// Join the recording thread if it is active, as it appends to the journal...
+			m_isAudioRecording = false;
+			if (m_audioThread.joinable())
+			{
+				m_audioThread.join();
+			}
+			// ..and complete the recording, unless it was written in segments which the thread already completed.
+			close_audio_stream(m_audioStream, m_audioEncoder);
+			close_audio_stream(m_resampledAudioStream, m_resampledAudioEncoder);
+			// [NOTE] A segment prepared for a marker the recording did not reach anymore stays empty and is not listed.
+			if (m_isAudioSegmentPrepared.load(std::memory_order_acquire))
+			{
+				close_audio_stream(m_nextAudioStream, m_nextAudioEncoder);
+				close_audio_stream(m_nextResampledAudioStream, m_nextResampledAudioEncoder);
+				m_isAudioSegmentPrepared.store(false, std::memory_order_relaxed);
 			}
-			// Close the audio output file:
-			m_audioRecording.save(m_audioFilePath);
 			// End the SCE audio input and reset the port handle:
 			sceAudioInInput(m_audioPort, nullptr);
 			sceAudioInClose(m_audioPort);
 			m_audioPort = -1;
 		}
 
+		// Close the journal and with it all output files if necessary:
+		// [NOTE] Do that BEFORE requesting the next file handle, as in package mode, only one file handle can be used at a time.
+		// But naturally, neither the kernel nor SCE clearly state that in their logs. IT WOULDN'T BE PS4 DEVELOPMENT IF THEY JUST DID, RIGHT?!
+		if (m_journal.is_open())
+		{
+			for (auto& stream : m_outputStreams)
+			{
+				flush_output(stream, true);
+			}
+			m_journal.close();
+		}
+		m_outputStreams.clear();
+		m_audioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_resampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_audioTimingStream = SessionLog::JournalWriter::kInvalidStream;
+		m_audioSamplesCaptured = 0;
+		m_audioStopSample = kInvalidAudioSampleIndex;
+		m_isAudioResampled = false;
+		m_audioSegmentListStream = SessionLog::JournalWriter::kInvalidStream;
+		m_audioSegmentCount = 0;
+		m_audioSegmentStart = 0;
+		m_audioSplitSample.store(kInvalidAudioSampleIndex, std::memory_order_relaxed);
+		m_nextAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_nextResampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+
 		// Reset any helper variables, but not the configuration!
 		m_isRunning = false;
 		m_isAudioRecording = false;
 		m_lastHaltEvent = Events::ERevealEventTypes::kDummyEvent;
 		m_currentParticipant = kInvalidParticipantNumber;
 		m_fTotalTime = 0.0f;
-		m_conditionValues.clear();
 	}
 
 	bool ExperimentManager::is_running() const
@@ -618,28 +1517,117 @@ namespace Experiment
 		return m_fTotalTime;
 	}
 
-	ConditionValue ExperimentManager::get_experiment_condition_value(const char* conditionName) const
+	u64 ExperimentManager::get_audio_sample_index() const
+	{
+		if (!m_isAudioRecording)
+		{
+			return m_audioStopSample;
+		}
+		// Until the first block of a recording was captured, there is nothing to extrapolate from.
+		const double clockOffset = m_audioClockOffset.load(std::memory_order_relaxed);
+		if (std::isnan(clockOffset))
+		{
+			return m_audioStartSample;
+		}
+		const double sampleIndex = (get_session_time() - clockOffset) * kAudioCaptureRate;
+		return std::max(m_audioStartSample, static_cast<u64>(std::max(sampleIndex, 0.0)));
+	}
+
+	void ExperimentManager::split_audio_recording(u64 sampleIndex)
+	{
+		// A stopped recording starts a new segment anyway when it is resumed.
+		if (m_audioSegments == AudioSegments::kMarker && m_isAudioRecording && sampleIndex != kInvalidAudioSampleIndex)
+		{
+			prepare_audio_segment();
+			m_audioSplitSample.store(sampleIndex, std::memory_order_relaxed);
+		}
+	}
+
+	double ExperimentManager::get_session_time() const
+	{
+		return get_steady_seconds() + m_sessionClockOffset.load(std::memory_order_relaxed);
+	}
+
+	ConditionValue ExperimentManager::get_experiment_condition_value(ConditionHandle& condition) const
 	{
 		// Allow to probe for existence without crashing the application.
-		auto itCondition = m_conditionValues.find(Utilities::Name(conditionName));
-		if (itCondition != m_conditionValues.end())
+		if (m_isRunning && resolve_condition(condition))
 		{
-			return itCondition->second;
+			return m_conditionValues[condition.slot];
 		}
 		else
 		{
 			// Log a warning and return an invalid value if the condition was not defined.
-			RV_DEBUG_PRINTF("[ExperimentManager] Warning: Could not find condition value with name %s.", conditionName);
+			RV_DEBUG_PRINTF("[ExperimentManager] Warning: Could not find condition value with name %s.", condition.name.get_message());
 			return ConditionValue();
 		}
 	}
 
+	ConditionValue ExperimentManager::get_experiment_condition_value(Utilities::Name conditionName) const
+	{
+		ConditionHandle condition(find_experiment_condition(conditionName));
+		return get_experiment_condition_value(condition);
+	}
+
+	ConditionValue ExperimentManager::get_experiment_condition_value(const char* conditionName) const
+	{
+		return get_experiment_condition_value(Utilities::Name(conditionName));
+	}
+
+	bool ExperimentManager::resolve_condition(ConditionHandle& condition) const
+	{
+		// Only look the slot up again if the conditions were reconfigured since the last resolve.
+		if (condition.generation != m_conditionGeneration)
+		{
+			auto itSlot = m_conditionSlots.find(condition.name);
+			condition.slot = itSlot != m_conditionSlots.end() ? itSlot->second : ConditionHandle::kInvalidSlot;
+			condition.generation = m_conditionGeneration;
+		}
+		return condition.slot != ConditionHandle::kInvalidSlot;
+	}
+
+	void ExperimentManager::update_condition_slots()
+	{
+		m_conditionSlots.clear();
+		for (u32 slot = 0; slot < m_conditionNames.size(); slot++)
+		{
+			m_conditionSlots.insert(std::make_pair(m_conditionNames[slot], slot));
+		}
+		// Allocate the value array right away, so starting an experiment does not need to.
+		m_conditionValues.resize(m_conditionNames.size());
+		// Invalidate all handles that were resolved before.
+		m_conditionGeneration++;
+	}
+
+	bool ExperimentManager::resolve_trigger(TriggerHandle& trigger) const
+	{
+		// Only look the slot up again if the triggers were reconfigured since the last resolve.
+		if (trigger.generation != m_triggerGeneration)
+		{
+			auto itSlot = m_triggerSlots.find(trigger.name);
+			trigger.slot = itSlot != m_triggerSlots.end() ? itSlot->second : TriggerHandle::kInvalidSlot;
+			trigger.generation = m_triggerGeneration;
+		}
+		return trigger.slot != TriggerHandle::kInvalidSlot;
+	}
+
+	void ExperimentManager::update_trigger_slots()
+	{
+		m_triggerSlots.clear();
+		for (u32 slot = 0; slot < m_triggerNames.size(); slot++)
+		{
+			m_triggerSlots.insert(std::make_pair(m_triggerNames[slot], slot));
+		}
+		// Invalidate all handles that were resolved before.
+		m_triggerGeneration++;
+	}
+
 	void ExperimentManager::on_event(const Events::Event& evt)
 	{
 		if (m_isRunning)
 		{
 			// Make sure we can write to the output file.
-			RV_ASSERT(m_outputWriter.good());
+			RV_ASSERT(m_journal.is_open() && !m_outputStreams.empty());
 
 			switch (evt.eventType)
 			{
@@ -660,21 +1648,25 @@ namespace Experiment
 			case Events::ERevealEventTypes::kExperiment_SetCondition:
 			{
 				// Set the new value for the specified experiment condition.
-				const ExperimentArgs& arg = g_CI_experiment_args_bank[evt.uUserArg];
-				set_experiment_condition(Utilities::Name(arg.conditionHash).get_message(), arg.newValue);
+				RV_ASSERT(evt.userPtr);
+				ExperimentArgs* pArgs(reinterpret_cast<ExperimentArgs*>(evt.userPtr));
+				set_experiment_condition(pArgs->condition, pArgs->newValue);
 				break;
 			}
 			case Events::ERevealEventTypes::kExperiment_IncrementCondition:
 			{
 				// Try to increment the specified experiment condition.
-				const ExperimentArgs& arg = g_CI_experiment_args_bank[evt.uUserArg];
-				increment_experiment_condition(Utilities::Name(arg.conditionHash).get_message(), arg.increment);
+				RV_ASSERT(evt.userPtr);
+				ExperimentArgs* pArgs(reinterpret_cast<ExperimentArgs*>(evt.userPtr));
+				increment_experiment_condition(pArgs->condition, pArgs->increment);
 				break;
 			}
 			case Events::ERevealEventTypes::kExperiment_Trigger:
 			{
 				// Execute the given experiment trigger.
-				trigger(Utilities::Name(evt.uUserArg).get_message());
+				RV_ASSERT(evt.userPtr);
+				ExperimentArgs* pArgs(reinterpret_cast<ExperimentArgs*>(evt.userPtr));
+				trigger(pArgs->trigger);
 				break;
 			}
 			case Events::ERevealEventTypes::kExperiment_StartAudioRecording:
@@ -687,6 +1679,16 @@ namespace Experiment
 						// The thread member variable was used before, make sure to join it!
 						m_audioThread.join();
 					}
+					// The new recording continues the samples of the previous one.
+					m_audioStartSample = m_audioSamplesCaptured;
+					// If the recording is split, this recording window gets files of its own.
+					if (m_audioSegments != AudioSegments::kNone)
+					{
+						m_audioSplitSample.store(kInvalidAudioSampleIndex, std::memory_order_relaxed);
+						prepare_audio_segment();
+						begin_audio_segment(m_audioStartSample);
+					}
+					m_audioClockOffset.store(std::numeric_limits<double>::quiet_NaN(), std::memory_order_relaxed);
 					m_isAudioRecording = true;
 					m_audioThread = std::thread(&ExperimentManager::record_audio, this);
 				}
@@ -696,6 +1698,10 @@ namespace Experiment
 			{
 				// Stop recording the participant's voice.
 				// The audio recording thread will automatically exit when the flag changes.
+				if (m_isAudioRecording)
+				{
+					m_audioStopSample = get_audio_sample_index();
+				}
 				m_isAudioRecording = false;
 				break;
 			}
@@ -710,33 +1716,230 @@ namespace Experiment
 
 	void ExperimentManager::record_audio()
 	{
+		static const int kSamplesPerBlock = 256;
+		// The buffers of the resampled recording are allocated once, the resampler keeps its state between blocks.
+		const bool resample = m_isAudioResampled;
+		std::vector<float> samplesIn(resample ? kSamplesPerBlock : 0);
+		std::vector<float> samplesOut(resample ? m_audioResampler.getMaxOutputFrames(kSamplesPerBlock) : 0);
+		std::vector<uint8_t> pcmOut(samplesOut.size() * sizeof(short));
+		const double blockDuration = static_cast<double>(kSamplesPerBlock) / kAudioCaptureRate;
+		// Timing lines are collected here and appended together, so the journal is only locked about once per second.
+		// [NOTE] Lines are cut to fit kMaxTimingLineLength, so the buffer is appended before it could overflow.
+		static const int kMaxTimingLineLength = 64;
+		char timingLines[2048];
+		int timingLinesLength = 0;
+		// Plug-ins analyse each recording on its own, so they start from scratch before its first block.
+		for (auto& pPlugin : m_activePlugins)
+		{
+			pPlugin->begin_audio(kAudioCaptureRate);
+		}
+		// Stores samples in the current segment, a block is stored in two parts if a segment starts within it.
+		auto storeSamples = [&](const short* pSamples, u32 numSamples)
+		{
+			if (numSamples == 0)
+			{
+				return;
+			}
+			append_audio(m_audioStream, m_audioEncoder, pSamples, numSamples);
+			if (resample)
+			{
+				float* pIn = samplesIn.data();
+				float* pOut = samplesOut.data();
+				AudioFile::PcmConversion::decode(reinterpret_cast<const uint8_t*>(pSamples), AudioFile::AudioFileFormat::Wave, 16, 1, numSamples, &pIn);
+				size_t numFrames = m_audioResampler.process(&pIn, numSamples, &pOut);
+				AudioFile::PcmConversion::encode(&pOut, 1, numFrames, AudioFile::AudioFileFormat::Wave, 16, pcmOut.data());
+				append_audio(m_resampledAudioStream, m_resampledAudioEncoder, pcmOut.data(), numFrames);
+			}
+		};
 		while (m_isAudioRecording)
 		{
-			static const int kSamplesPerBlock = 256;
-			static short pcmBuf[2][kSamplesPerBlock] = { { 0 } };
-			static int iSide = 0;
-			auto samples = sceAudioInInput(m_audioPort, pcmBuf[iSide]);
-			iSide ^= 1;
-			auto* arrayStart = &pcmBuf[iSide][0];
-			auto& rChannel(m_audioRecording.samples[0]);
-			rChannel.insert(rChannel.end(), arrayStart, arrayStart + kSamplesPerBlock);
+			// The input call returns as soon as the block was captured, so the block is stamped with the session time right away.
+			// [NOTE] Each block is stored before the next call, so no stale block from an earlier recording ends up in the file.
+			static short pcmBuf[kSamplesPerBlock] = { 0 };
+			sceAudioInInput(m_audioPort, pcmBuf);
+			const double captureTime = get_session_time();
+			const u64 blockStart = m_audioSamplesCaptured;
+			m_audioSamplesCaptured += kSamplesPerBlock;
+			m_audioClockOffset.store(captureTime - static_cast<double>(m_audioSamplesCaptured) / kAudioCaptureRate, std::memory_order_relaxed);
+			const int timingLength = std::snprintf(timingLines + timingLinesLength, kMaxTimingLineLength, "%llu%s%.6f\n", static_cast<unsigned long long>(m_audioSamplesCaptured), m_separator, captureTime);
+			timingLinesLength += std::min(timingLength, kMaxTimingLineLength - 1);
+			if (timingLinesLength > static_cast<int>(sizeof(timingLines)) - kMaxTimingLineLength)
+			{
+				m_journal.append(m_audioTimingStream, timingLines, timingLinesLength);
+				timingLinesLength = 0;
+			}
+
+			// Switch to a new segment if a marker requested one within this block and its files were prepared.
+			// [NOTE] A marker issued while the request is taken over is only handled with the next block.
+			u64 splitSample = m_audioSplitSample.load(std::memory_order_relaxed);
+			if (splitSample < m_audioSamplesCaptured && m_isAudioSegmentPrepared.load(std::memory_order_acquire) &&
+				m_audioSplitSample.compare_exchange_strong(splitSample, kInvalidAudioSampleIndex, std::memory_order_relaxed))
+			{
+				const u32 numSamplesBefore = static_cast<u32>(std::max(splitSample, blockStart) - blockStart);
+				storeSamples(pcmBuf, numSamplesBefore);
+				// Several markers at the same sample only start one segment.
+				if (blockStart + numSamplesBefore > m_audioSegmentStart)
+				{
+					finish_audio_segment();
+					begin_audio_segment(blockStart + numSamplesBefore);
+				}
+				storeSamples(pcmBuf + numSamplesBefore, kSamplesPerBlock - numSamplesBefore);
+			}
+			else
+			{
+				storeSamples(pcmBuf, kSamplesPerBlock);
+			}
+			// Plug-ins analyse the block after it was stored, the next one keeps being captured meanwhile.
+			// Active plug-ins can not change while the experiment is running, so they are passed every block without locking.
+			const f32 blockTime = static_cast<f32>(captureTime - blockDuration);
+			for (auto& pPlugin : m_activePlugins)
+			{
+				pPlugin->process_audio(pcmBuf, kSamplesPerBlock, kAudioCaptureRate, blockTime);
+			}
+		}
+
+		// The remaining timing lines are appended before the journal can be closed, which waits for this thread.
+		if (timingLinesLength > 0)
+		{
+			m_journal.append(m_audioTimingStream, timingLines, timingLinesLength);
+		}
+
+		// The segment of this recording window ends with it.
+		if (m_audioSegments != AudioSegments::kNone)
+		{
+			finish_audio_segment();
 		}
 	}
 
-	rv::result_t CI_set_experiment_condition::interpret_json(const Json::Value& rCommandJson, Events::Command& rCmdOut, Memory::MemAllocator& rAllocator) const
+	void ExperimentManager::prepare_audio_segment()
 	{
-		RV_UNUSED(rAllocator);
+		if (m_isAudioSegmentPrepared.load(std::memory_order_acquire))
+		{
+			return;
+		}
+		// Segments are numbered in the order they were recorded, the list relates their numbers to the samples of the whole session.
+		const char* audioExtension = m_audioFormat == AudioFormat::kFlac ? "flac" : "wav";
+		const char* fileExtension = m_compressOutput ? SessionLog::kCompressedFileExtension : "";
+		// The prefix was formatted into a buffer of the same size, the suffix is a segment number, a rate and extensions.
+		char outputPath[kOutputPathSize + 48];
+		m_audioSegmentCount++;
+		sprintf_s(outputPath, sizeof(outputPath), "%s_%03u.%s%s", m_audioSegmentPrefix.c_str(), m_audioSegmentCount, audioExtension, fileExtension);
+		m_nextAudioStream = add_audio_stream(outputPath, kAudioCaptureRate, m_nextAudioEncoder);
+		if (m_isAudioResampled)
+		{
+			sprintf_s(outputPath, sizeof(outputPath), "%s_%03u_%uHz.%s%s", m_audioSegmentPrefix.c_str(), m_audioSegmentCount, m_audioResampleRate, audioExtension, fileExtension);
+			m_nextResampledAudioStream = add_audio_stream(outputPath, m_audioResampleRate, m_nextResampledAudioEncoder);
+		}
+		m_isAudioSegmentPrepared.store(true, std::memory_order_release);
+	}
 
+	void ExperimentManager::begin_audio_segment(u64 firstSample)
+	{
+		RV_ASSERT(m_isAudioSegmentPrepared.load(std::memory_order_acquire));
+		// Taking over the prepared files and encoders neither allocates nor touches the disk.
+		m_audioStream = m_nextAudioStream;
+		m_resampledAudioStream = m_nextResampledAudioStream;
+		std::swap(m_audioEncoder, m_nextAudioEncoder);
+		std::swap(m_resampledAudioEncoder, m_nextResampledAudioEncoder);
+		m_nextAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_nextResampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_audioSegmentStart = firstSample;
+		// The filter history of the previous segment must not carry into the first samples of this one.
+		if (m_isAudioResampled)
+		{
+			m_audioResampler.reset();
+		}
+		char segmentLine[64];
+		const int segmentLineLength = std::snprintf(segmentLine, sizeof(segmentLine), "%u%s%llu\n", m_audioSegmentCount, m_separator, static_cast<unsigned long long>(firstSample));
+		m_journal.append(m_audioSegmentListStream, segmentLine, segmentLineLength);
+		m_isAudioSegmentPrepared.store(false, std::memory_order_release);
+	}
+
+	void ExperimentManager::finish_audio_segment()
+	{
+		// Closing only queues the files in the journal, so the recording thread never waits for the disk here.
+		close_audio_stream(m_audioStream, m_audioEncoder);
+		close_audio_stream(m_resampledAudioStream, m_resampledAudioEncoder);
+		m_audioStream = SessionLog::JournalWriter::kInvalidStream;
+		m_resampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+	}
+
+	SessionLog::JournalWriter::stream_id_t ExperimentManager::add_audio_stream(const std::string& filePath, u32 sampleRate, AudioFile::FlacEncoder& rEncoder)
+	{
+		std::vector<uint8_t> header;
+		SessionLog::JournalWriter::stream_id_t stream;
+		if (m_audioFormat == AudioFormat::kFlac)
+		{
+			// The STREAMINFO block is completed by close_audio_stream, the sizes of wave headers when the journal closes the stream.
+			stream = m_journal.add_stream(SessionLog::StreamKind::kFlac, filePath, m_compressOutput);
+			rEncoder.setup(1, sampleRate, 16);
+			rEncoder.createHeader(header);
+		}
+		else
+		{
+			stream = m_journal.add_stream(SessionLog::StreamKind::kWave, filePath, m_compressOutput);
+			AudioFile::WaveStream::createHeader(header, 1, sampleRate, 16);
+		}
+		m_journal.append(stream, header.data(), header.size());
+		return stream;
+	}
+
+	void ExperimentManager::append_audio(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder, const void* pSamples, size_t numSamples)
+	{
+		if (m_audioFormat == AudioFormat::kWave)
+		{
+			m_journal.append(stream, pSamples, numSamples * sizeof(short));
+			return;
+		}
+
+		// Samples are encoded on the recording thread and only whole frames are appended,
+		// so recovering the journal after a crash never cuts a frame in half.
+		m_encodedAudio.clear();
+		if (rEncoder.process(static_cast<const uint8_t*>(pSamples), numSamples, m_encodedAudio) > 0)
+		{
+			m_journal.append(stream, m_encodedAudio.data(), m_encodedAudio.size());
+		}
+	}
+
+	void ExperimentManager::flush_audio(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder)
+	{
+		m_encodedAudio.clear();
+		if (stream != SessionLog::JournalWriter::kInvalidStream && rEncoder.flush(m_encodedAudio) > 0)
+		{
+			m_journal.append(stream, m_encodedAudio.data(), m_encodedAudio.size());
+		}
+	}
+
+	void ExperimentManager::close_audio_stream(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder)
+	{
+		if (stream == SessionLog::JournalWriter::kInvalidStream)
+		{
+			return;
+		}
+		if (m_audioFormat == AudioFormat::kWave)
+		{
+			m_journal.close_stream(stream);
+			return;
+		}
+
+		// After the last frame, the encoder knows the number of samples and the frame sizes of the STREAMINFO block.
+		flush_audio(stream, rEncoder);
+		std::vector<uint8_t> header;
+		rEncoder.createHeader(header);
+		m_journal.close_stream(stream, std::move(header));
+	}
+
+	rv::result_t CI_set_experiment_condition::interpret_json(const Json::Value& rCommandJson, Events::Command& rCmdOut, Memory::MemAllocator& rAllocator) const
+	{
 		if (rCommandJson.HasMember("condition") && rCommandJson.HasMember("value"))
 		{
 			rCmdOut.m_event.eventType = Events::ERevealEventTypes::kExperiment_SetCondition;
 			rCmdOut.m_event.eventChannel = Events::ERevealEventChannels::kExperimentChannel;
-			// Set the next available index of the experiment argument bank and append it to the bank!
-			rCmdOut.m_event.uUserArg = g_CI_experiment_args_bank.size();
-			ExperimentArgs newArg = {};
-			newArg.conditionHash = Utilities::Name(rCommandJson["condition"].GetString()).get_hash();
-			newArg.newValue = ConditionValue(rCommandJson["value"]);
-			g_CI_experiment_args_bank.push_back(newArg);
+			// Place the arguments in the command block's memory and reference them directly.
+			ExperimentArgs* pArgs = allocate_command_args<ExperimentArgs>(rAllocator);
+			pArgs->condition = GExperimentManager::instance().find_experiment_condition(Utilities::Name(rCommandJson["condition"].GetString()));
+			pArgs->newValue = ConditionValue(rCommandJson["value"]);
+			rCmdOut.m_event.userPtr = pArgs;
 		}
 		else
 		{
@@ -765,8 +1968,6 @@ namespace Experiment
 
 	rv::result_t CI_increment_experiment_condition::interpret_json(const Json::Value& rCommandJson, Events::Command& rCmdOut, Memory::MemAllocator& rAllocator) const
 	{
-		RV_UNUSED(rAllocator);
-
 		if (rCommandJson.HasMember("condition"))
 		{
 			s32 increment = 1;
@@ -776,12 +1977,11 @@ namespace Experiment
 			}
 			rCmdOut.m_event.eventType = Events::ERevealEventTypes::kExperiment_IncrementCondition;
 			rCmdOut.m_event.eventChannel = Events::ERevealEventChannels::kExperimentChannel;
-			// Set the next available index of the experiment argument bank and append it to the bank!
-			rCmdOut.m_event.uUserArg = g_CI_experiment_args_bank.size();
-			ExperimentArgs newArg = {};
-			newArg.conditionHash = Utilities::Name(rCommandJson["condition"].GetString()).get_hash();
-			newArg.increment = increment;
-			g_CI_experiment_args_bank.push_back(newArg);
+			// Place the arguments in the command block's memory and reference them directly.
+			ExperimentArgs* pArgs = allocate_command_args<ExperimentArgs>(rAllocator);
+			pArgs->condition = GExperimentManager::instance().find_experiment_condition(Utilities::Name(rCommandJson["condition"].GetString()));
+			pArgs->increment = increment;
+			rCmdOut.m_event.userPtr = pArgs;
 		}
 		else
 		{
@@ -810,13 +2010,14 @@ namespace Experiment
 
 	rv::result_t CI_experiment_trigger::interpret_json(const Json::Value& rCommandJson, Events::Command& rCmdOut, Memory::MemAllocator& rAllocator) const
 	{
-		RV_UNUSED(rAllocator);
-
 		if (rCommandJson.HasMember("trigger"))
 		{
 			rCmdOut.m_event.eventType = Events::ERevealEventTypes::kExperiment_Trigger;
 			rCmdOut.m_event.eventChannel = Events::ERevealEventChannels::kExperimentChannel;
-			rCmdOut.m_event.uUserArg = Utilities::Name(rCommandJson["trigger"].GetString()).get_hash();
+			// Place the handle in the command block's memory, so executing the trigger indexes it directly.
+			ExperimentArgs* pArgs = allocate_command_args<ExperimentArgs>(rAllocator);
+			pArgs->trigger = GExperimentManager::instance().find_experiment_trigger(Utilities::Name(rCommandJson["trigger"].GetString()));
+			rCmdOut.m_event.userPtr = pArgs;
 		}
 		else
 		{
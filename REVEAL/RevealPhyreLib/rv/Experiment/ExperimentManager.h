@@ -1,15 +1,28 @@
 #pragma once
 
 #include <ios>
+#include <new>
+#include <cstring>
+#include <type_traits>
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <fstream>
+#include <sstream>
 #include <utility>
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <AudioFile/AudioFile.h>
+#include <SessionLog/BinaryLog.h>
+#include <SessionLog/BlockCodec.h>
+#include <SessionLog/OutputSink.h>
+#include <SessionLog/SessionIndex.h>
+#include <SessionLog/SessionJournal.h>
 
 #include "rv/RevealConfig.h"
 #include "rv/Events/Events.h"
@@ -72,12 +85,45 @@ namespace Experiment
 		}
 	};
 
+	// Condition values are reset and copied in bulk, so they have to stay plain data.
+	static_assert(std::is_trivially_copyable<ConditionValue>::value, "Condition values have to be trivially copyable!");
+
+	// A condition handle caches the dense slot of a registered condition for string-free access.
+	// Handles are resolved by name once and silently re-resolved whenever the conditions were reconfigured.
+	struct ConditionHandle
+	{
+		enum : u32
+		{
+			kInvalidSlot = 0xFFFFffff
+		};
+
+		Utilities::Name name;
+		u32 slot = kInvalidSlot;
+		u32 generation = 0;
+	};
+
+	// A trigger handle caches the dense slot of a configured trigger, just like a condition handle.
+	// Executing a trigger through its handle indexes the linked triggers directly.
+	struct TriggerHandle
+	{
+		enum : u32
+		{
+			kInvalidSlot = 0xFFFFffff
+		};
+
+		Utilities::Name name;
+		u32 slot = kInvalidSlot;
+		u32 generation = 0;
+	};
+
 	// This defines what information is needed for an experiment trigger.
 	// Alongside the list of possible command blocks, a rotation value greater zero is required.
 	// The rotation value defines after how many participants the command blocks are rotated.
+	// Command block indices are resolved once during linking, so executing a trigger does not involve any lookups.
 	struct Trigger
 	{
 		std::vector<Utilities::Name> commands;
+		std::vector<u32> commandIndices;
 
 		// The default constructor provides an empty trigger.
 		Trigger()
@@ -95,6 +141,13 @@ namespace Experiment
 			return commands.size() > 0 ? commands[(participant / participantRotateInterval) % commands.size()] : Utilities::Name::kInvalidHash;
 		}
 
+		// Returns the linked index of the command block for the given participant.
+		// The trigger has to have been linked before, see ExperimentManager::link_command_blocks.
+		u32 get_command_block_index(u32 participant) const
+		{
+			return commandIndices.size() > 0 ? commandIndices[(participant / participantRotateInterval) % commandIndices.size()] : Events::CommandBlockManager::kInvalidCommandBlockIndex;
+		}
+
 	private:
 
 		u32 participantRotateInterval;
@@ -113,6 +166,9 @@ namespace Experiment
 			kInvalidParticipantNumber = 0xFFFFffff
 		};
 
+		// Audio sample indices count the samples of the session's recording, which pauses while audio recording is stopped.
+		static constexpr u64 kInvalidAudioSampleIndex = 0xFFFFffffFFFFffff;
+
 		ExperimentManager();
 
 		// Registers special command interpreters for experiment commands.
@@ -148,45 +204,64 @@ namespace Experiment
 		// Removes the given experiment trigger from the configuration.
 		void remove_experiment_trigger(const char* triggerName);
 
-		// This static function should be called once for each plug-in that should be registered.
-		// The experimenter can then activate these plug-ins by providing their configuration.
-		// This can be done in Media/Config/experiment_config.json at the "plugins" array.
-		// Note that a plug-in with the same name as an already registered one will be ignored!
-		static void register_plugin(Utilities::Name pluginName, ExperimentPlugin* pPlugin);
+		// Resolves the names of all command blocks referenced by triggers and active plug-ins to indices.
+		// This is done automatically after configuration and whenever an experiment starts.
+		// Unresolved names are reported as errors.
+		// Returns true if every referenced command block was found.
+		bool link_command_blocks(Events::CommandBlockManager& rCBManager);
 
-		// Sets the specified plug-in active and keeps it in the loop from now on.
+		// Constructs the specified plug-in, sets it active and keeps it in the loop from now on.
+		// Available plug-ins are listed in the factory table in ExperimentPlugins.h.
+		// The experimenter activates them in Media/Config/experiment_config.json at the "plugins" array.
+		// Returns the active plug-in or nullptr if no plug-in with this name is available.
 		ExperimentPlugin* enable_plugin(Utilities::Name pluginName);
 
-		// Sets the specified plug-in inactive.
-		ExperimentPlugin* disable_plugin(Utilities::Name pluginName);
+		// Sets the specified plug-in inactive and destroys it.
+		// Returns true if the plug-in was active before.
+		bool disable_plugin(Utilities::Name pluginName);
 
 		// Starts the experiment with the current participant number.
 		// This involves opening the output file and configuring the world.
 		// The filename will contain the current time and the participant number.
-		void start();
+		// Returns false without starting if any command block of a trigger or plug-in could not be linked.
+		bool start();
 
 		// This has to be called every frame to update timings.
 		// TODO: A good place for an experiment plugin system that can record special data when triggered?
 		void update(const f32 fDeltaTime, Input::InputController& inputController);
 
+		// Returns a handle to the given condition that allows accessing it without any name lookups.
+		// If the condition has not been registered (yet), the handle's slot is invalid.
+		ConditionHandle find_experiment_condition(Utilities::Name conditionName) const;
+
 		// Sets the value of the given condition which has to have been registered before.
 		// This can be done in Media/Config/experiment_config.json at the "conditions" array.
 		// Objects with "name" and (optional) "value" fields define names and default values.
 		// Make sure to not call this function with too many different values and names:
-		// It internally uses an unordered map of registered Utilities::Name pairs!
+		// String values are stored as Utilities::Name hashes!
 		// [NOTE] The Name class globally stores all occurances without reference counters.
+		void set_experiment_condition(ConditionHandle& condition, const ConditionValue& conditionValue);
+		void set_experiment_condition(Utilities::Name conditionName, const ConditionValue& conditionValue);
 		void set_experiment_condition(const char* conditionName, const ConditionValue& conditionValue);
 
 		// Increments the value of the given condition which has to have been registered before.
 		// For more information, see the comments on ExperimentManager::set_experiment_condition.
 		// The value has to represent a signed integer (up to 32 bits) in order to be incremented.
+		void increment_experiment_condition(ConditionHandle& condition, s32 increment = 1);
+		void increment_experiment_condition(Utilities::Name conditionName, s32 increment = 1);
 		void increment_experiment_condition(const char* conditionName, s32 increment = 1);
 
+		// Returns a handle to the given trigger that allows executing it without any name lookups.
+		// If the trigger has not been configured, the handle's slot is invalid.
+		TriggerHandle find_experiment_trigger(Utilities::Name triggerName) const;
+
 		// Executes the given trigger which in turn will execute one of its command blocks.
 		// Which one this is depends in the number of the current participant.
+		void trigger(TriggerHandle& trigger);
+		void trigger(Utilities::Name triggerName);
 		void trigger(const char* triggerName);
 
-		// Appends another line according to the current experiment state to the output file.
+		// Appends another line according to the current experiment state to the files of all output streams.
 		void record_experiment_state();
 
 		// Ends the experiment, closes the output file and resets the experiment manager.
@@ -210,9 +285,21 @@ namespace Experiment
 		// Returns the time the experiment has been running in seconds.
 		f32 get_elapsed_time() const;
 
+		// Returns the index of the audio sample that is being captured right now, which allows relating lines to the recording.
+		// It is extrapolated from the time stamp of the latest captured block, or exactly the first sample of a recording that was just started.
+		// While the recording is stopped, this is the index at which it was stopped. Before the first recording, kInvalidAudioSampleIndex is returned.
+		u64 get_audio_sample_index() const;
+
+		// Starts a new segment of the audio recording at the given sample, if the recording is split at activity markers.
+		// The recording thread switches files exactly at this sample, or at the start of its next block if that sample was already stored.
+		// The files of the new segment are created right here, so this has to be called on the game thread.
+		void split_audio_recording(u64 sampleIndex);
+
 		// Returns the current value of the given condition which has to have been registered before.
 		// For more information, see the comments on ExperimentManager::set_experiment_condition.
 		// If the requested condition has not been registered, an invalid value is returned.
+		ConditionValue get_experiment_condition_value(ConditionHandle& condition) const;
+		ConditionValue get_experiment_condition_value(Utilities::Name conditionName) const;
 		ConditionValue get_experiment_condition_value(const char* conditionName) const;
 
 	protected:
@@ -220,14 +307,142 @@ namespace Experiment
 		// Handles game events that are relevant to the experiment manager.
 		virtual void on_event(const Events::Event& evt) override;
 
+		// Creates the output file of an audio recording with the given rate and appends its header.
+		// FLAC files are encoded with the given encoder, which is set up for the recording here.
+		SessionLog::JournalWriter::stream_id_t add_audio_stream(const std::string& filePath, u32 sampleRate, AudioFile::FlacEncoder& rEncoder);
+
+		// Appends 16 bit samples to an audio recording, in the configured format.
+		void append_audio(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder, const void* pSamples, size_t numSamples);
+
+		// Appends the samples of a FLAC recording that did not fill a whole frame yet.
+		void flush_audio(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder);
+
+		// Completes an audio recording and closes it in the journal, which finalises it on its worker thread.
+		// FLAC recordings are flushed and get the complete header of their encoder, so their files are not read again.
+		void close_audio_stream(SessionLog::JournalWriter::stream_id_t stream, AudioFile::FlacEncoder& rEncoder);
+
+		// Returns the session time in seconds, which is the experiment time continued on the steady clock.
+		// Unlike the experiment time, it can be read on any thread and between updates.
+		double get_session_time() const;
+
+		// Creates the files of the next audio segment on the game thread, unless they were created already.
+		// The recording thread only switches to them, so it never creates files or competes for the journal while doing so.
+		void prepare_audio_segment();
+
+		// Switches the recording to the prepared segment starting at the given sample and lists it next to the recordings.
+		void begin_audio_segment(u64 firstSample);
+
+		// Completes the files of the current audio segment and closes them in the journal.
+		void finish_audio_segment();
+
 		// This function records audio and will be run in a separate thread.
-		// Start and stop commands just resume and pause the recording.
+		// Start and stop commands just resume and pause the recording, unless each recording window is written to its own segment.
 		void record_audio();
 
 	private:
 
-		// This is used for static registration of plug-ins.
-		using PluginRegister = std::unordered_map<Utilities::Name, ExperimentPlugin*>;
+		// Active plug-ins are owned by the experiment manager.
+		using PluginList = std::vector<std::unique_ptr<ExperimentPlugin>>;
+
+		// Returns the factory of the plug-in with the given name or nullptr if there is none.
+		static const PluginFactory* find_plugin_factory(Utilities::Name pluginName);
+
+		// Returns the position of the given plug-in in the list of active plug-ins.
+		PluginList::iterator find_active_plugin(Utilities::Name pluginName);
+
+		// Re-resolves the slot of the given handle if the condition configuration changed since.
+		// Returns true if the handle now refers to a registered condition.
+		bool resolve_condition(ConditionHandle& condition) const;
+
+		// Assigns dense slots to all configured conditions in the order they were added.
+		void update_condition_slots();
+
+		// Re-resolves the slot of the given handle if the trigger configuration changed since.
+		// Returns true if the handle now refers to a configured trigger.
+		bool resolve_trigger(TriggerHandle& trigger) const;
+
+		// Assigns dense slots to all configured triggers in the order they were added.
+		void update_trigger_slots();
+
+		// Changes within the coalescing window are merged into one pending row, stamped with the time of the first change.
+		// The row holds a copy of all values, as data fields keep aging and changing until it is written.
+		struct PendingRow
+		{
+			f32 time = 0.0f;
+			f32 deadline = 0.0f;
+			bool isPending = false;
+			bool hasConditionChange = false;
+			std::vector<ConditionValue> conditions;
+			std::vector<ExperimentPlugin::DataField> fields;
+		};
+
+		// Plug-ins can write their data fields to a separate output stream, e.g. to keep high-rate samples out of the main file.
+		// Each stream is its own file with the participant number, the session time and only the columns of its plug-ins.
+		// Conditions are only written to the main stream, which is always the first one.
+		// Coalescing windows are looked up per data field when the experiment starts: column overrides first, then plug-in overrides.
+		struct OutputStream
+		{
+			Utilities::Name name;
+			SessionLog::JournalWriter::stream_id_t journalStream = SessionLog::JournalWriter::kInvalidStream;
+			std::vector<ExperimentPlugin*> plugins;
+			std::vector<f32> fieldWindows;
+			PendingRow row;
+			SessionLog::BinaryLogWriter binaryWriter;
+			f32 lastKeyframeTime = 0.0f;
+			// Lines and records are collected in the sink and only handed to the journal when it is full or the journal commits.
+			SessionLog::OutputSink sink;
+			u64 flushedBytes = 0;
+			// The session index maps rows to offsets in the stream's file, which counts all bytes written to it.
+			// Readers can start decoding at the resume offset, which is the last keyframe in the long format.
+			SessionLog::JournalWriter::stream_id_t indexStream = SessionLog::JournalWriter::kInvalidStream;
+			u64 resumeOffset = 0;
+			u32 rowsSinceIndexEntry = 0;
+			f32 lastIndexTime = -std::numeric_limits<f32>::infinity();
+			std::vector<ConditionValue> indexedConditions;
+			bool hasConditions = false;
+			bool writeRequest = false;
+
+			// Returns the offset in the stream's file at which the next line or record will be written.
+			u64 get_data_offset() const
+			{
+				return flushedBytes + sink.size();
+			}
+		};
+
+		// Writes the column header of the given output stream.
+		void write_header(OutputStream& rStream);
+
+		// Appends another line according to the current experiment state to the file of the given output stream.
+		void record_experiment_state(OutputStream& rStream);
+
+		// Merges the changes of this frame into the pending row and writes it once its coalescing window has passed.
+		// A pending row is written early if a change would overwrite one of its values or exceed its own window.
+		void coalesce_experiment_state(OutputStream& rStream);
+
+		// Copies the current experiment state into the pending row.
+		// Unless all values are requested, only conditions and data fields that changed during this frame are copied.
+		void capture_experiment_state(OutputStream& rStream, bool captureAll);
+
+		// Writes the pending row in the configured output format.
+		void flush_experiment_state(OutputStream& rStream);
+
+		// Formats the pending row as a line of text.
+		void record_text_state(OutputStream& rStream);
+
+		// Hands the contents of the stream's sink to the session journal once it is full, or right away if forced.
+		void flush_output(OutputStream& rStream, bool force);
+
+		// Records the pending row as a row of the binary log.
+		void record_binary_state(OutputStream& rStream);
+
+		// Records the values of the pending row that changed since the last call as a change record of the long log.
+		void record_long_state(OutputStream& rStream);
+
+		// Moves the encoded binary log records into the stream's sink.
+		void write_binary_records(OutputStream& rStream);
+
+		// Writes the session index entries for the row that was just written at the given offset.
+		void index_row(OutputStream& rStream, u64 rowOffset, u64 resumeOffset);
 
 		bool m_isRunning = false;
 		bool m_isAudioRecording = false;
@@ -235,21 +450,103 @@ namespace Experiment
 		participant_number_t m_currentParticipant = kInvalidParticipantNumber;
 		f32 m_fTotalTime = 0.0f;
 
-		std::unordered_map<Utilities::Name, ConditionValue> m_conditionDefaults;
-		std::unordered_map<Utilities::Name, ConditionValue> m_conditionValues;
-		std::unordered_map<Utilities::Name, Trigger> m_triggers;
-		static PluginRegister m_sAvailablePlugins;
-		std::vector<ExperimentPlugin*> m_activePlugins;
+		// Conditions are stored in contiguous arrays indexed by the slot assigned at configuration time.
+		// The name to slot map is only needed for setting up handles, never while recording lines.
+		// The generation changes whenever slots are reassigned, which invalidates all handles.
+		std::vector<Utilities::Name> m_conditionNames;
+		std::vector<ConditionValue> m_conditionDefaults;
+		std::vector<ConditionValue> m_conditionValues;
+		std::unordered_map<Utilities::Name, u32> m_conditionSlots;
+		u32 m_conditionGeneration = 1;
+		// Triggers are stored the same way, linking resolves the command block indices of each slot in place.
+		std::vector<Utilities::Name> m_triggerNames;
+		std::vector<Trigger> m_triggers;
+		std::unordered_map<Utilities::Name, u32> m_triggerSlots;
+		u32 m_triggerGeneration = 1;
+		PluginList m_activePlugins;
 		bool m_conditionChanged = false;
 
-		std::ofstream m_outputWriter;
+		// Coalescing windows and output streams as configured for plug-ins and single columns.
+		f32 m_coalesceWindow = 0.0f;
+		std::unordered_map<Utilities::Name, f32> m_pluginCoalesceWindows;
+		std::unordered_map<Utilities::Name, f32> m_columnCoalesceWindows;
+		std::unordered_map<Utilities::Name, Utilities::Name> m_pluginOutputStreams;
+		// The output streams of the running session and the stream index of each active plug-in.
+		std::vector<OutputStream> m_outputStreams;
+		std::vector<u32> m_pluginStreamIndices;
+
+		// All output files of a session are written through the journal, so they can be recovered after a crash.
+		// Lines are formatted directly into the sink of their output stream, which is appended to the journal in large blocks.
+		SessionLog::JournalWriter m_journal;
+		SessionLog::JournalWriter::stream_id_t m_audioStream = SessionLog::JournalWriter::kInvalidStream;
+		SessionLog::JournalWriter::stream_id_t m_resampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		SessionLog::FileBackend m_outputBackend = SessionLog::FileBackend::kMapped;
+		bool m_compressOutput = false;
+		// Binary logs are encoded record by record into a reused buffer.
+		enum class OutputFormat
+		{
+			kText,
+			kBinary,
+			kLong
+		} m_outputFormat = OutputFormat::kText;
+		f32 m_keyframeInterval = 10.0f;
+		std::vector<uint8_t> m_binaryRecords;
+		bool m_writeIndex = true;
+		f32 m_indexInterval = 10.0f;
+		u32 m_indexRowInterval = 1000;
+		std::vector<uint8_t> m_indexRecords;
+		f32 m_journalCommitInterval = 1.0f;
+		f32 m_timeSinceJournalCommit = 0.0f;
 		const char* m_separator = "\t";
 		std::string m_undefinedValue;
 		bool m_enableAudioRecording;
 		s32 m_audioPort;
-		AudioFile::AudioFile<short> m_audioRecording;
 		std::string m_audioFilePath;
 		std::thread m_audioThread;
+		// The difference between the experiment time and the steady clock, which is published with every update.
+		std::atomic<double> m_sessionClockOffset{ 0.0 };
+		// The number of samples captured so far, the first sample of the current recording and the sample at which it was stopped.
+		// The recording thread publishes the difference between the session time and the sample clock with each block, it is NaN until the first block.
+		u64 m_audioSamplesCaptured = 0;
+		u64 m_audioStartSample = 0;
+		u64 m_audioStopSample = kInvalidAudioSampleIndex;
+		std::atomic<double> m_audioClockOffset{ 0.0 };
+		// Each captured block is listed with the session time it was completed at in a small text file next to the recording.
+		SessionLog::JournalWriter::stream_id_t m_audioTimingStream = SessionLog::JournalWriter::kInvalidStream;
+		// The recording is resampled to this rate into a second file, unless it is 0.
+		u32 m_audioResampleRate = 0;
+		AudioFile::Resampler m_audioResampler;
+		bool m_isAudioResampled = false;
+		// Recordings are written as wave files or encoded losslessly into FLAC frames on the recording thread.
+		enum class AudioFormat
+		{
+			kWave,
+			kFlac
+		} m_audioFormat = AudioFormat::kWave;
+		AudioFile::FlacEncoder m_audioEncoder;
+		AudioFile::FlacEncoder m_resampledAudioEncoder;
+		std::vector<uint8_t> m_encodedAudio;
+		// Recordings can be split into one file per recording window, or additionally at every activity marker.
+		// Each segment is closed in the journal as soon as it ends, so it is finalised while the session goes on.
+		enum class AudioSegments
+		{
+			kNone,
+			kRecording,
+			kMarker
+		} m_audioSegments = AudioSegments::kNone;
+		std::string m_audioSegmentPrefix;
+		u32 m_audioSegmentCount = 0;
+		u64 m_audioSegmentStart = 0;
+		SessionLog::JournalWriter::stream_id_t m_audioSegmentListStream = SessionLog::JournalWriter::kInvalidStream;
+		// The sample the recording thread starts the next segment at, kInvalidAudioSampleIndex unless a marker requested one.
+		std::atomic<u64> m_audioSplitSample{ kInvalidAudioSampleIndex };
+		// The files of the next segment and their encoders, which the game thread prepares and the recording thread takes over.
+		// The flag hands them over in both directions: the game thread only touches them while it is false, the recording thread while it is true.
+		SessionLog::JournalWriter::stream_id_t m_nextAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		SessionLog::JournalWriter::stream_id_t m_nextResampledAudioStream = SessionLog::JournalWriter::kInvalidStream;
+		AudioFile::FlacEncoder m_nextAudioEncoder;
+		AudioFile::FlacEncoder m_nextResampledAudioEncoder;
+		std::atomic<bool> m_isAudioSegmentPrepared{ false };
 	};
 
 	// Singleton experiment manager.
@@ -282,16 +579,30 @@ namespace Experiment
 	};
 
 	// This struct is needed to store the parameters for all possible experiment commands in a unified way.
+	// Instances live in the memory of the command block they were parsed for and are referenced by the event's user pointer.
 	struct ExperimentArgs
 	{
 		// For set_experiment_condition and increment_experiment_condition:
-		Utilities::hash_t conditionHash;
+		// The handle is resolved during parsing, so dispatch usually does not need any lookup.
+		ConditionHandle condition;
 		// For set_experiment_condition:
 		ConditionValue newValue;
 		// For increment_experiment_condition:
-		s32 increment;
+		s32 increment = 0;
+		// For experiment_trigger:
+		TriggerHandle trigger;
 	};
 
+	// Constructs command arguments in the allocator that the command block manager provides during parsing.
+	// Their lifetime is therefore tied to the command block, so they must not own any other resources.
+	template <typename TArgs>
+	TArgs* allocate_command_args(Memory::MemAllocator& rAllocator)
+	{
+		void* pMemory = rAllocator.allocate(sizeof(TArgs), alignof(TArgs));
+		RV_ASSERT(pMemory && "Could not allocate the command arguments in the command block memory!");
+		return new (pMemory) TArgs();
+	}
+
 	//! Experiment command interpreter for the "experiment_trigger" command. @ref CommandList "Commands."
 	//! This command executes the given trigger, which will then play an appropriate command block depending on the participant number.
 	//! The trigger has to have been registered in Media/Config/experiment_config.json at "triggers" with its exact name.
@@ -340,6 +651,7 @@ namespace Experiment
 	//! Experiment command interpreter for the "start_audio_recording" command. @ref CommandList "Commands."
 	//! This command starts recording to the audio output file if audio recording was enabled in the experiment configuration.
 	//! For each experiment, only one audio output file will be written. Starting and stopping merely resumes or pauses recording.
+	//! If "audioSegments" is configured, each start creates a new audio file instead.
 	//! @ingroup CommandBlockSystem
 	class CI_start_audio_recording : public Events::CommandInterpreter
 	{
@@ -352,6 +664,7 @@ namespace Experiment
 	//! Experiment command interpreter for the "stop_audio_recording" command. @ref CommandList "Commands."
 	//! This command stops recording to the audio output file if audio is currently being recorded.
 	//! For each experiment, only one audio output file will be written. Starting and stopping merely resumes or pauses recording.
+	//! If "audioSegments" is configured, each stop completes the current audio file instead.
 	//! @ingroup CommandBlockSystem
 	class CI_stop_audio_recording : public Events::CommandInterpreter
 	{
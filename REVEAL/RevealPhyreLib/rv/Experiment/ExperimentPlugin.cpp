@@ -13,7 +13,7 @@ namespace Experiment
 	{
 	}
 
-	void ExperimentPlugin::register_interpreters(Events::CommandBlockManager& rCBManager) const
+	void ExperimentPlugin::register_interpreters(Events::CommandBlockManager& rCBManager)
 	{
 	}
 
@@ -21,6 +21,11 @@ namespace Experiment
 	{
 	}
 
+	bool ExperimentPlugin::link_command_blocks(Events::CommandBlockManager& rCBManager)
+	{
+		return true;
+	}
+
 	bool ExperimentPlugin::update(const f32 fDeltaTime)
 	{
 		// Update the age of all data fields.
@@ -61,6 +66,14 @@ namespace Experiment
 		return m_data;
 	}
 
+	void ExperimentPlugin::process_audio(const short* pSamples, u32 numSamples, u32 sampleRate, f32 fTime)
+	{
+	}
+
+	void ExperimentPlugin::begin_audio(u32 sampleRate)
+	{
+	}
+
 	void ExperimentPlugin::on_event(const Events::Event& evt)
 	{
 		// Queue up any events during an event dispatch.
@@ -72,12 +85,6 @@ namespace Experiment
 		}
 	}
 
-	void ExperimentPlugin::initialise()
-	{
-		// Automatically register this plugin with the experiment manager.
-		ExperimentManager::register_plugin(get_name(), this);
-	}
-
 	void ExperimentPlugin::add_data_field(const char* headerName, const DataField& initialValue)
 	{
 		Utilities::Name headerNameHash(headerName);
@@ -32,12 +32,18 @@ namespace Experiment
 		virtual ~ExperimentPlugin();
 
 		// Registers special command interpreters for this experiment plug-in.
-		// This function may be overridden by subclasses that define their own commands.
-		virtual void register_interpreters(Events::CommandBlockManager& rCBManager) const;
+		// This static function may be hidden by subclasses that define their own commands.
+		// It is called through the plug-in factory, so commands are available without an instance.
+		static void register_interpreters(Events::CommandBlockManager& rCBManager);
 
 		// Configure the plug-in from a JSON object.
 		virtual void configure_from_json(const Json::Value& jsonData);
 
+		// Resolves the names of all command blocks this plug-in executes to indices.
+		// This is called after configuration, so no lookups are necessary during the experiment.
+		// Return false and report an error if any of the names could not be resolved.
+		virtual bool link_command_blocks(Events::CommandBlockManager& rCBManager);
+
 		// Updates this plug-in and indicates if new data is available.
 		// The resulting boolean will be stored for later queries.
 		bool update(const f32 fDeltaTime);
@@ -52,6 +58,15 @@ namespace Experiment
 		// Returns a constant reference to read the plug-in's current data map.
 		const DataMap& get_data() const;
 
+		// Analyses the next block of the participant's voice while it is being recorded.
+		// The mono block was captured at the given rate, starting at the given experiment time.
+		// [NOTE] This is called on the audio recording thread! Results may only be handed over to the update without locks.
+		virtual void process_audio(const short* pSamples, u32 numSamples, u32 sampleRate, f32 fTime);
+
+		// Prepares the analysis of a new recording with the given rate, before its first block is passed to process_audio.
+		// [NOTE] This is called on the audio recording thread as well, every time the recording is started.
+		virtual void begin_audio(u32 sampleRate);
+
 	protected:
 
 		// Handles game events that are relevant to this plug-in.
@@ -70,10 +85,6 @@ namespace Experiment
 		// The reason for this is the way the data field ages are managed.
 		virtual void handle_event(const Events::Event& evt) = 0;
 
-		// All subclasses should initialise the base class at construction time.
-		// Solves the problem explained here: https://stackoverflow.com/a/8630215
-		void initialise();
-
 		// Subclasses shall use this function to add another field (column) to future output.
 		// If a field with this header name already exists, its value is replaced with the given default value.
 		void add_data_field(const char* headerName, const DataField& initialValue = DataField());
@@ -113,6 +124,30 @@ namespace Experiment
 
 	};
 
+	// A plug-in factory describes a plug-in that can be activated by its name in the configuration.
+	// The factories of all available plug-ins form a compile-time table, see ExperimentPlugins.h.
+	// Plug-ins are only constructed once the configuration activates them.
+	struct PluginFactory
+	{
+		const char* name;
+		ExperimentPlugin* (*create)();
+		void (*register_interpreters)(Events::CommandBlockManager& rCBManager);
+	};
+
+	// Creates a new instance of the given plug-in class for its factory.
+	template <class TPlugin>
+	ExperimentPlugin* create_plugin()
+	{
+		return new TPlugin();
+	}
+
+	// Describes the given plug-in class through its name and static functions.
+	template <class TPlugin>
+	constexpr PluginFactory make_plugin_factory()
+	{
+		return PluginFactory{ TPlugin::kPluginName, &create_plugin<TPlugin>, &TPlugin::register_interpreters };
+	}
+
 } // namespace Experiment
 } // namespace rv
 
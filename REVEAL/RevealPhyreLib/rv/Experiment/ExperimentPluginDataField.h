@@ -11,18 +11,22 @@ namespace Experiment
 
 	// A string data field that allows to keep track of its age in seconds.
 	// Whenever a new value is set or it is refreshed, its age is set back to zero.
+	// Values from a small set of repeating strings, like names and flags, can be stored as a Utilities::Name instead.
+	// These are dictionary encoded in binary logs and never have to be copied or formatted.
 	class ExperimentPluginDataField
 	{
 	public:
 
 		static constexpr const char* kUndefinedValue = "";
+		static constexpr const char* kTrueValue = "TRUE";
+		static constexpr const char* kFalseValue = "FALSE";
 
 		// The default contructor initialises an undefined data field.
 		// If a data field is "always up to date", its value is allowed to be passively written.
 		// While changes will still actively cause it to be written, it will later be considered up to date, too.
 		// With this flag enabled, please make sure to reset this data field when it is no longer up to date!
 		ExperimentPluginDataField(bool alwaysUpToDate = false)
-			: data(kUndefinedValue), fAge(0.0f), bAlwaysUpToDate(alwaysUpToDate)
+			: data(kUndefinedValue), nameData(Utilities::Name::kInvalidHash), fAge(0.0f), bAlwaysUpToDate(alwaysUpToDate), bIsName(false), bIndexed(false)
 		{
 		}
 
@@ -31,7 +35,7 @@ namespace Experiment
 		// While changes will still actively cause it to be written, it will later be considered up to date, too.
 		// With this flag enabled, please make sure to reset this data field when it is no longer up to date!
 		ExperimentPluginDataField(const std::string& initialData, bool alwaysUpToDate = false)
-			: data(initialData), fAge(0.0f), bAlwaysUpToDate(alwaysUpToDate)
+			: data(initialData), nameData(Utilities::Name::kInvalidHash), fAge(0.0f), bAlwaysUpToDate(alwaysUpToDate), bIsName(false), bIndexed(false)
 		{
 		}
 
@@ -39,9 +43,32 @@ namespace Experiment
 		inline void set(const std::string& newData)
 		{
 			data = newData;
+			bIsName = false;
 			fAge = 0.0f;
 		}
 
+		// Sets a new data value from a C string and reverts the age to zero.
+		// Without this overload, C strings would be converted to bool and picked up by set(bool).
+		inline void set(const char* newData)
+		{
+			set(std::string(newData));
+		}
+
+		// Sets a new name value and reverts the age to zero.
+		inline void set(Utilities::Name newName)
+		{
+			data.clear();
+			nameData = newName;
+			bIsName = true;
+			fAge = 0.0f;
+		}
+
+		// Sets a flag value, which is stored as the name TRUE or FALSE.
+		inline void set(bool flag)
+		{
+			set(Utilities::Name(flag ? kTrueValue : kFalseValue));
+		}
+
 		// Resets the data value to be undefined.
 		inline void reset()
 		{
@@ -61,11 +88,23 @@ namespace Experiment
 			fAge = 0.0f;
 		}
 
+		// Returns the string value. This is empty for name values, use get_name() for those.
 		inline const std::string& get() const
 		{
 			return data;
 		}
 
+		// Returns whether the current value is a name.
+		inline bool is_name() const
+		{
+			return bIsName;
+		}
+
+		inline Utilities::Name get_name() const
+		{
+			return nameData;
+		}
+
 		// Returns the data field's current age.
 		// This is zero after setting a value until the next update.
 		inline f32 get_age() const
@@ -82,7 +121,7 @@ namespace Experiment
 		// Returns whether the data value is undefined.
 		inline bool is_undefined() const
 		{
-			return data == kUndefinedValue;
+			return bIsName ? nameData == Utilities::Name::kInvalidHash : data == kUndefinedValue;
 		}
 
 		// A helper function for a common check on data fields.
@@ -100,6 +139,19 @@ namespace Experiment
 			return bAlwaysUpToDate;
 		}
 
+		// Marks this data field as an index key: every new value gets an entry in the session index, named by the value.
+		// This is meant for rare values that name parts of the session, like activity markers.
+		inline void set_indexed(bool indexed)
+		{
+			bIndexed = indexed;
+		}
+
+		// Returns whether new values of this data field are written to the session index.
+		inline bool is_indexed() const
+		{
+			return bIndexed;
+		}
+
 		// This operator allows directly assigning the data field strings!
 		inline ExperimentPluginDataField& operator =(const std::string& newData)
 		{
@@ -114,14 +166,31 @@ namespace Experiment
 			return *this;
 		}
 
+		// This operator allows directly assigning names!
+		inline ExperimentPluginDataField& operator =(Utilities::Name newName)
+		{
+			set(newName);
+			return *this;
+		}
+
+		// This operator allows directly assigning flags!
+		inline ExperimentPluginDataField& operator =(bool flag)
+		{
+			set(flag);
+			return *this;
+		}
+
 		// Keep the default copy-assignment operator alive...
 		ExperimentPluginDataField& operator =(const ExperimentPluginDataField& other) = default;
 
 	private:
 
 		std::string data;
+		Utilities::Name nameData;
 		f32 fAge;
 		bool bAlwaysUpToDate;
+		bool bIsName;
+		bool bIndexed;
 
 	};
 
@@ -8,33 +8,34 @@
 #include "PluginLocomotion.h"
 #include "PluginActivity.h"
 #include "PluginVoice.h"
+#include "PluginVoiceActivity.h"
 #include "PluginHands.h"
 #include "PluginCollectionCounter.h"
 
-// It can be useful in implementation files to create globals.
-// This way, all plug-ins register themselves automatically.
-
-// Only create plug-in instances with the experiment enabled!
+// Only describe plug-ins with the experiment enabled!
 #ifdef ENABLE_EXPERIMENT
 
-#ifdef CreatePluginGlobals
 namespace rv
 {
 namespace Experiment
 {
 
-	// For each header file, also create a default global instance.
-	PluginController g_ExperimentPluginController;
-	PluginHMD g_ExperimentPluginHMD;
-	PluginLocomotion g_ExperimentPluginLocomotion;
-	PluginActivity g_ExperimentPluginActivity;
-	PluginVoice g_ExperimentPluginVoice;
-	PluginHands g_ExperimentPluginHands;
-	PluginCollectionCounter g_ExperimentPluginCollectionCounter;
+	// For each header file, also add a factory to this table.
+	// The experiment manager constructs plug-ins from it when the configuration activates them.
+	// [NOTE] The table is constant-initialised, so it does not depend on any static initialisation order.
+	static constexpr PluginFactory kPluginFactories[] =
+	{
+		make_plugin_factory<PluginController>(),
+		make_plugin_factory<PluginHMD>(),
+		make_plugin_factory<PluginLocomotion>(),
+		make_plugin_factory<PluginActivity>(),
+		make_plugin_factory<PluginVoice>(),
+		make_plugin_factory<PluginVoiceActivity>(),
+		make_plugin_factory<PluginHands>(),
+		make_plugin_factory<PluginCollectionCounter>()
+	};
 
 }
 }
-#endif
-#undef CreatePluginGlobals
 
 #endif // ENABLE_EXPERIMENT
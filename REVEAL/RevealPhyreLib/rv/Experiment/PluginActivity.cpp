@@ -1,5 +1,7 @@
 #include "PluginActivity.h"
 
+#include "ExperimentManager.h"
+
 #include <limits>
 
 #ifdef ENABLE_EXPERIMENT
@@ -13,6 +15,7 @@ namespace Experiment
 	static constexpr const char* kHeaderActivityPositionTravelled = "activityPosition";
 	static constexpr const char* kHeaderActivityRotationTravelled = "activityRotation";
 	static constexpr const char* kHeaderActivityBaseTurns = "activityBaseTurns";
+	static constexpr const char* kHeaderActivityAudioSample = "activityAudioSample";
 
 	namespace JsonFieldName
 	{
@@ -28,20 +31,21 @@ namespace Experiment
 		m_autoMarkerInterval(std::numeric_limits<float>::infinity())
 	{
 		// Add all static data fields to the data map.
-		add_data_field(kHeaderActivityMarker);
+		// Markers are indexed, so single activities can be found without reading the output from the start.
+		DataField markerField;
+		markerField.set_indexed(true);
+		add_data_field(kHeaderActivityMarker, markerField);
 		add_data_field(kHeaderActivityPositionTravelled);
 		add_data_field(kHeaderActivityRotationTravelled);
 		add_data_field(kHeaderActivityBaseTurns);
+		add_data_field(kHeaderActivityAudioSample);
 
 		// Reset the auto marker system and helper variables.
 		reset_helpers();
 		reset_auto_markers();
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
-	void PluginActivity::register_interpreters(Events::CommandBlockManager& rCBManager) const
+	void PluginActivity::register_interpreters(Events::CommandBlockManager& rCBManager)
 	{
 		rCBManager.register_command_interpreter(Utilities::Name("issue_activity_marker"), &g_CI_issue_activity_marker);
 	}
@@ -67,6 +71,7 @@ namespace Experiment
 		data(kHeaderActivityPositionTravelled).reset();
 		data(kHeaderActivityRotationTravelled).reset();
 		data(kHeaderActivityBaseTurns).reset();
+		data(kHeaderActivityAudioSample).reset();
 		// Reset everything including the last HMD matrix and the monitoring state.
 		reset_helpers();
 		reset_auto_markers();
@@ -76,7 +81,7 @@ namespace Experiment
 
 	Utilities::Name PluginActivity::get_name() const
 	{
-		return Utilities::Name("activity");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginActivity::handle_event(const Events::Event& evt)
@@ -139,10 +144,19 @@ namespace Experiment
 			if (m_nextMarkerName != Utilities::Name::kInvalidHash)
 			{
 				// Write the data accumulated until now since the last marker.
-				data(kHeaderActivityMarker) = m_nextMarkerName.get_message();
+				data(kHeaderActivityMarker) = m_nextMarkerName;
 				data(kHeaderActivityPositionTravelled) = std::to_string(m_positionTravelled);
 				data(kHeaderActivityRotationTravelled) = std::to_string(m_rotationTravelled);
 				data(kHeaderActivityBaseTurns) = std::to_string(m_numberBaseTurns);
+				// Markers also point into the audio recording, so clips of single activities can be cut from it.
+				// If configured, the recording is even split into one file per activity at exactly this sample.
+				ExperimentManager& rManager = GExperimentManager::instance();
+				const u64 audioSampleIndex = rManager.get_audio_sample_index();
+				if (audioSampleIndex != ExperimentManager::kInvalidAudioSampleIndex)
+				{
+					data(kHeaderActivityAudioSample) = std::to_string(audioSampleIndex);
+					rManager.split_audio_recording(audioSampleIndex);
+				}
 
 				// Reset the next marker variable and all activity variables.
 				reset_helpers();
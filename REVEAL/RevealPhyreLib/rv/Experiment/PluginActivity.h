@@ -31,11 +31,14 @@ namespace Experiment
 	{
 	public:
 
+		// The unique name used to activate this plug-in in the configuration.
+		static constexpr const char* kPluginName = "activity";
+
 		PluginActivity();
 
 		// Registers special command interpreters for this experiment plug-in.
 		// These allow control over when markers are issued an which name they get.
-		virtual void register_interpreters(Events::CommandBlockManager& rCBManager) const override;
+		static void register_interpreters(Events::CommandBlockManager& rCBManager);
 
 		// Configure the plug-in from a JSON object.
 		virtual void configure_from_json(const Json::Value& jsonData) override;
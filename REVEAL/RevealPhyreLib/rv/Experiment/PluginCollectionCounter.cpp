@@ -28,15 +28,13 @@ namespace Experiment
 	{
 		// Add all static data fields to the data map.
 		add_data_field(kHeaderCollectionCounterItems, DataField("0", true));
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
 	void PluginCollectionCounter::configure_from_json(const Json::Value& jsonData)
 	{
 		// Clear the list of available command blocks:
 		m_commandBlocks.clear();
+		m_commandBlockIndices.clear();
 		if (jsonData.HasMember(JsonFieldName::kPluginCollectionCounterCommandBlocks))
 		{
 			// [OPTIONAL] An array containing the names of command blocks available for collection events.
@@ -51,6 +49,25 @@ namespace Experiment
 		m_onlyInventory = jsonData[JsonFieldName::kPluginCollectionCounterOnlyInventory].GetBool();
 	}
 
+	bool PluginCollectionCounter::link_command_blocks(Events::CommandBlockManager& rCBManager)
+	{
+		bool allResolved = true;
+		m_commandBlockIndices.clear();
+		for (auto& blockName : m_commandBlocks)
+		{
+			u32 blockIndex = rCBManager.find_command_block_index(blockName);
+			if (blockIndex == Events::CommandBlockManager::kInvalidCommandBlockIndex)
+			{
+				RV_DEBUG_PRINTF("[PluginCollectionCounter] Error: The command block \"%s\" does not exist!", blockName.get_message());
+				allResolved = false;
+				continue;
+			}
+			// Only resolved blocks are kept, so handle_event never plays an invalid index.
+			m_commandBlockIndices.push_back(blockIndex);
+		}
+		return allResolved;
+	}
+
 	void PluginCollectionCounter::reset()
 	{
 		// Reset all data fields.
@@ -61,7 +78,7 @@ namespace Experiment
 
 	Utilities::Name PluginCollectionCounter::get_name() const
 	{
-		return Utilities::Name("collectionCounter");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginCollectionCounter::handle_event(const Events::Event& evt)
@@ -75,10 +92,10 @@ namespace Experiment
 			auto* artifact = static_cast<GamePlay::ArtifactNode*>(rWG.get_node_value(rWG.find_node_by_id(evt.uUserArg)));
 			if (!m_onlyInventory || artifact->is_inventory_item())
 			{
-				if (m_commandBlocks.size() > 0)
+				if (m_commandBlockIndices.size() > 0)
 				{
 					// There is at least one command block, execute the one associated with the "previous" count...
-					auto blockIndex = GamePlay::g_globalGameState.command_block_manager().find_command_block_index(m_commandBlocks[m_currentItems % m_commandBlocks.size()]);
+					auto blockIndex = m_commandBlockIndices[m_currentItems % m_commandBlockIndices.size()];
 					GamePlay::g_globalGameState.command_block_manager().play_block(blockIndex, Events::GEventSystem::instance(), GamePlay::g_globalGameState.callback_manager());
 				}
 				// Increase the collected item count and update the data field:
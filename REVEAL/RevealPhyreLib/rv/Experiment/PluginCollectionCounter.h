@@ -26,11 +26,17 @@ namespace Experiment
 	{
 	public:
 
+		// The unique name used to activate this plug-in in the configuration.
+		static constexpr const char* kPluginName = "collectionCounter";
+
 		PluginCollectionCounter();
 
 		// Configure the plug-in from a JSON object.
 		virtual void configure_from_json(const Json::Value& jsonData) override;
 
+		// Resolves the configured command blocks to indices.
+		virtual bool link_command_blocks(Events::CommandBlockManager& rCBManager) override;
+
 		// Resets the plug-in's data fields and internal variables.
 		// The data fields are set back to their initial values.
 		virtual void reset() override;
@@ -49,6 +55,7 @@ namespace Experiment
 	private:
 
 		std::vector<Utilities::Name> m_commandBlocks;
+		std::vector<u32> m_commandBlockIndices;
 		bool m_onlyInventory;
 
 		u32 m_currentItems;
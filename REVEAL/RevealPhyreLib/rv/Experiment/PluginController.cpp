@@ -23,9 +23,6 @@ namespace Experiment
 	{
 		// Add all static data fields to the data map.
 		add_data_field(kHeaderController, DataField(true));
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
 	void PluginController::configure_from_json(const Json::Value& jsonData)
@@ -58,7 +55,7 @@ namespace Experiment
 
 	Utilities::Name PluginController::get_name() const
 	{
-		return Utilities::Name("controller");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginController::handle_event(const Events::Event& evt)
@@ -71,7 +68,7 @@ namespace Experiment
 			// This will result in one new line in the output file for each controller switch.
 
 			// [NOTE] Determine the new controller's name. (Specific to your implementation...)
-			data(kHeaderController) = "ControllerName";
+			data(kHeaderController) = Utilities::Name("ControllerName");
 
 			auto& movementFlagData = data(kHeaderControllerMovement);
 			if (movementFlagData.get_age() > 0.0f)
@@ -85,7 +82,7 @@ namespace Experiment
 		{
 			if (exists_data_field(kHeaderControllerMovement))
 			{
-				data(kHeaderControllerMovement) = static_cast<bool>(evt.uUserArg) ? "TRUE" : "FALSE";
+				data(kHeaderControllerMovement) = static_cast<bool>(evt.uUserArg);
 			}
 			break;
 		}
@@ -20,6 +20,9 @@ namespace Experiment
 	{
 	public:
 
+		// The unique name used to activate this plug-in in the configuration.
+		static constexpr const char* kPluginName = "controller";
+
 		PluginController();
 
 		// Configure the plug-in from a JSON object.
@@ -46,12 +46,9 @@ namespace Experiment
 
 		// Reset the helper variables.
 		reset_helpers();
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
-	void PluginHMD::register_interpreters(Events::CommandBlockManager& rCBManager) const
+	void PluginHMD::register_interpreters(Events::CommandBlockManager& rCBManager)
 	{
 		rCBManager.register_command_interpreter(Utilities::Name("start_hmd_recording"), &g_CI_start_hmd_recording);
 		rCBManager.register_command_interpreter(Utilities::Name("stop_hmd_recording"), &g_CI_stop_hmd_recording);
@@ -87,7 +84,7 @@ namespace Experiment
 
 	Utilities::Name PluginHMD::get_name() const
 	{
-		return Utilities::Name("HMD");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginHMD::handle_event(const Events::Event& evt)
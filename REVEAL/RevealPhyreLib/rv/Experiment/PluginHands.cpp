@@ -46,12 +46,9 @@ namespace Experiment
 
 		// Reset the helper variables.
 		reset_helpers();
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
-	void PluginHands::register_interpreters(Events::CommandBlockManager& rCBManager) const
+	void PluginHands::register_interpreters(Events::CommandBlockManager& rCBManager)
 	{
 		rCBManager.register_command_interpreter(Utilities::Name("start_hands_recording"), &g_CI_start_hands_recording);
 		rCBManager.register_command_interpreter(Utilities::Name("stop_hands_recording"), &g_CI_stop_hands_recording);
@@ -87,7 +84,7 @@ namespace Experiment
 
 	Utilities::Name PluginHands::get_name() const
 	{
-		return Utilities::Name("hands");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginHands::handle_event(const Events::Event& evt)
@@ -20,9 +20,6 @@ namespace Experiment
 		// Add all static data fields to the data map.
 		add_data_field(kHeaderLocomotionNode, DataField(true));
 		add_data_field(kHeaderLocomotionDistance);
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
 	void PluginLocomotion::configure_from_json(const Json::Value& jsonData)
@@ -38,7 +35,7 @@ namespace Experiment
 
 	Utilities::Name PluginLocomotion::get_name() const
 	{
-		return Utilities::Name("locomotion");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginLocomotion::handle_event(const Events::Event& evt)
@@ -51,7 +48,7 @@ namespace Experiment
 			// The new node will be recorded with an undefined travelled distance.
 			// This is technically not correct, but useful for the analysis.
 			// (The beeline would probably not be very helpful anyway!)
-			data(kHeaderLocomotionNode) = Utilities::Name(evt.uUserArg).get_message();
+			data(kHeaderLocomotionNode) = Utilities::Name(evt.uUserArg);
 			break;
 		}
 		case Events::ERevealEventTypes::kAnalytics_NodeReached:
@@ -60,7 +57,7 @@ namespace Experiment
 			// Record the name of the new node and the distance that was travelled.
 			RV_ASSERT(evt.userPtr);
 			const Events::NodeReachedArgs* pArgs(reinterpret_cast<const Events::NodeReachedArgs*>(evt.userPtr));
-			data(kHeaderLocomotionNode) = pArgs->nodeName.get_message();
+			data(kHeaderLocomotionNode) = pArgs->nodeName;
 			data(kHeaderLocomotionDistance) = std::to_string(pArgs->distance);
 			break;
 		}
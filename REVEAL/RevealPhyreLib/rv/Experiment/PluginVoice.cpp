@@ -1,5 +1,7 @@
 #include "PluginVoice.h"
 
+#include "ExperimentManager.h"
+
 #ifdef ENABLE_EXPERIMENT
 
 namespace rv
@@ -8,30 +10,30 @@ namespace Experiment
 {
 
 	static constexpr const char* kHeaderVoiceRecording = "voiceRecording";
+	static constexpr const char* kHeaderVoiceRecordingSample = "voiceRecordingSample";
 
 	PluginVoice::PluginVoice()
 	{
 		// Add all static data fields to the data map.
 		add_data_field(kHeaderVoiceRecording, DataField(true));
+		add_data_field(kHeaderVoiceRecordingSample);
 
 		// Reset the plug-in:
 		reset();
-
-		// Initialise the base class to register this plug-in!
-		initialise();
 	}
 
 	void PluginVoice::reset()
 	{
 		// Reset all data fields.
-		data(kHeaderVoiceRecording) = "FALSE";
+		data(kHeaderVoiceRecording) = false;
+		data(kHeaderVoiceRecordingSample).reset();
 		// Reset the recording flag.
 		m_bRecording = false;
 	}
 
 	Utilities::Name PluginVoice::get_name() const
 	{
-		return Utilities::Name("voice");
+		return Utilities::Name(kPluginName);
 	}
 
 	void PluginVoice::handle_event(const Events::Event& evt)
@@ -44,7 +46,8 @@ namespace Experiment
 			// Only update the data field if its value will change!
 			if (!m_bRecording)
 			{
-				data(kHeaderVoiceRecording) = "TRUE";
+				data(kHeaderVoiceRecording) = true;
+				write_sample_index();
 				m_bRecording = true;
 			}
 			break;
@@ -56,7 +59,8 @@ namespace Experiment
 			// Only update the data field if its value will change!
 			if (m_bRecording)
 			{
-				data(kHeaderVoiceRecording) = "FALSE";
+				data(kHeaderVoiceRecording) = false;
+				write_sample_index();
 				m_bRecording = false;
 			}
 			break;
@@ -68,6 +72,16 @@ namespace Experiment
 	{
 	}
 
+	void PluginVoice::write_sample_index()
+	{
+		// The audio sample at which the recording started or stopped, unless it has actually been prevented.
+		const u64 sampleIndex = GExperimentManager::instance().get_audio_sample_index();
+		if (sampleIndex != ExperimentManager::kInvalidAudioSampleIndex)
+		{
+			data(kHeaderVoiceRecordingSample) = std::to_string(sampleIndex);
+		}
+	}
+
 } // namespace Experiment
 } // namespace rv
 
@@ -16,10 +16,14 @@ namespace Experiment
 	//! This plug-in records when recordings of the participant's voice are made.
 	//! Note that recordings are indicated even if they have actually been prevented!
 	//! Reason: The plug-in analyses the event bus and not the experiment manager.
+	//! Recordings that did happen also get the index of the audio sample they started or stopped at.
 	class PluginVoice : public ExperimentPlugin
 	{
 	public:
 
+		// The unique name used to activate this plug-in in the configuration.
+		static constexpr const char* kPluginName = "voice";
+
 		PluginVoice();
 
 		// Resets the plug-in's data fields and internal variables.
@@ -37,6 +41,11 @@ namespace Experiment
 		// Updates any plug-in data that is dependent on certain events.
 		virtual void handle_event(const Events::Event& evt) override;
 
+	private:
+
+		// Writes the index of the audio sample that is being captured, if audio is actually recorded.
+		void write_sample_index();
+
 	private:
 
 		bool m_bRecording;
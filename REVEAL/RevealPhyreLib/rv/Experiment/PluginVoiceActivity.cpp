@@ -0,0 +1,210 @@
+#include "PluginVoiceActivity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#ifdef ENABLE_EXPERIMENT
+
+namespace rv
+{
+namespace Experiment
+{
+
+	static constexpr const char* kHeaderVoiceActive = "voiceActive";
+	static constexpr const char* kHeaderVoiceActivityTime = "voiceActivityTime";
+	static constexpr const char* kHeaderVoiceLevel = "voiceLevel";
+
+	namespace JsonFieldName
+	{
+		// This is an optional value that defines the time in seconds between records of the voice level.
+		// The loudest level since the last record is written, a value of zero disables the voice level.
+		static constexpr const char* kPluginVoiceActivityLevelInterval = "levelIntervalSeconds";
+		// These are optional values that define how far above the noise floor the voice has to be to start and to continue.
+		static constexpr const char* kPluginVoiceActivityOnset = "onsetDecibels";
+		static constexpr const char* kPluginVoiceActivityRelease = "releaseDecibels";
+		// This is an optional value that defines the level below which nothing counts as voice, in dB relative to full scale.
+		static constexpr const char* kPluginVoiceActivityMinLevel = "minLevelDecibels";
+		// This is an optional value that defines for how many seconds the voice has to be quiet before it counts as ended.
+		static constexpr const char* kPluginVoiceActivityHangover = "hangoverSeconds";
+	};
+
+	PluginVoiceActivity::PluginVoiceActivity()
+		: m_queueWrite(0), m_queueRead(0), m_droppedFrames(0), m_sampleRate(0), m_numSamples(0), m_levelInterval(0.1f)
+	{
+		// Add all static data fields to the data map.
+		add_data_field(kHeaderVoiceActive, DataField(true));
+		add_data_field(kHeaderVoiceActivityTime);
+		add_data_field(kHeaderVoiceLevel);
+
+		// The audio recording thread must not allocate while passing frames on.
+		m_frames.reserve(64);
+
+		// Reset the plug-in:
+		reset();
+	}
+
+	void PluginVoiceActivity::configure_from_json(const Json::Value& jsonData)
+	{
+		// [OPTIONAL] All values default to the settings of the detector, which suit speech recorded with a headset.
+		if (jsonData.HasMember(JsonFieldName::kPluginVoiceActivityLevelInterval))
+		{
+			m_levelInterval = jsonData[JsonFieldName::kPluginVoiceActivityLevelInterval].GetFloat();
+		}
+		if (jsonData.HasMember(JsonFieldName::kPluginVoiceActivityOnset))
+		{
+			m_settings.onsetDecibels = jsonData[JsonFieldName::kPluginVoiceActivityOnset].GetFloat();
+		}
+		if (jsonData.HasMember(JsonFieldName::kPluginVoiceActivityRelease))
+		{
+			m_settings.releaseDecibels = jsonData[JsonFieldName::kPluginVoiceActivityRelease].GetFloat();
+		}
+		if (jsonData.HasMember(JsonFieldName::kPluginVoiceActivityMinLevel))
+		{
+			m_settings.minLevelDecibels = jsonData[JsonFieldName::kPluginVoiceActivityMinLevel].GetFloat();
+		}
+		if (jsonData.HasMember(JsonFieldName::kPluginVoiceActivityHangover))
+		{
+			const f32 hangover = jsonData[JsonFieldName::kPluginVoiceActivityHangover].GetFloat();
+			m_settings.hangoverFrames = std::max(1, static_cast<int>(std::lround(hangover / m_settings.frameSeconds)));
+		}
+	}
+
+	void PluginVoiceActivity::reset()
+	{
+		// Reset all data fields.
+		data(kHeaderVoiceActive) = false;
+		data(kHeaderVoiceActivityTime).reset();
+		data(kHeaderVoiceLevel).reset();
+		// Reset all helper variables.
+		// [NOTE] This is only called while the audio recording thread is not running.
+		m_queueWrite = 0;
+		m_queueRead = 0;
+		m_droppedFrames = 0;
+		m_sampleRate = 0;
+		m_numSamples = 0;
+		m_timeSinceLevel = 0.0f;
+		m_maxLevel = -std::numeric_limits<f32>::infinity();
+		m_hasLevel = false;
+		m_recording = false;
+		m_voiceActive = false;
+	}
+
+	Utilities::Name PluginVoiceActivity::get_name() const
+	{
+		return Utilities::Name(kPluginName);
+	}
+
+	void PluginVoiceActivity::begin_audio(u32 sampleRate)
+	{
+		// Only the experiment manager knows the rate of the recording, so the detector is set up here instead of during configuration.
+		m_sampleRate = m_detector.setup(sampleRate, m_settings) ? sampleRate : 0;
+		m_numSamples = 0;
+	}
+
+	void PluginVoiceActivity::process_audio(const short* pSamples, u32 numSamples, u32 sampleRate, f32 fTime)
+	{
+		if (m_sampleRate == 0 || sampleRate != m_sampleRate)
+		{
+			return;
+		}
+
+		// Frames may start in an earlier block, so they are timed relative to the start of this one.
+		const u64 blockStart = m_numSamples;
+		m_numSamples += numSamples;
+		m_frames.clear();
+		m_detector.process(pSamples, numSamples, m_frames);
+		for (const auto& frame : m_frames)
+		{
+			const u32 write = m_queueWrite.load(std::memory_order_relaxed);
+			if (write - m_queueRead.load(std::memory_order_acquire) == kQueueSize)
+			{
+				m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			VoiceFrame& rOut = m_queue[write % kQueueSize];
+			rOut.levelDecibels = frame.levelDecibels;
+			rOut.changeTime = fTime + static_cast<f32>((static_cast<double>(frame.changeSampleIndex) - static_cast<double>(blockStart)) / m_sampleRate);
+			rOut.voiceActive = frame.voiceActive;
+			rOut.changed = frame.changed;
+			m_queueWrite.store(write + 1, std::memory_order_release);
+		}
+	}
+
+	void PluginVoiceActivity::handle_event(const Events::Event& evt)
+	{
+		switch (evt.eventType)
+		{
+		case Events::ERevealEventTypes::kExperiment_StartAudioRecording:
+		{
+			m_recording = true;
+			break;
+		}
+		case Events::ERevealEventTypes::kExperiment_StopAudioRecording:
+		case Events::ERevealEventTypes::kExperiment_End:
+		{
+			// Nobody is heard anymore, the detector is set up again when the next recording starts.
+			if (m_voiceActive)
+			{
+				data(kHeaderVoiceActive) = false;
+				m_voiceActive = false;
+			}
+			m_recording = false;
+			break;
+		}
+		}
+	}
+
+	void PluginVoiceActivity::update_internal(const f32 fDeltaTime)
+	{
+		// Take over the frames analysed since the last update.
+		// Only one change can be written per line, so a second one waits for the next update.
+		u32 read = m_queueRead.load(std::memory_order_relaxed);
+		const u32 write = m_queueWrite.load(std::memory_order_acquire);
+		bool changed = false;
+		while (read != write)
+		{
+			const VoiceFrame& rFrame = m_queue[read % kQueueSize];
+			// Frames that were still analysed after the recording stopped are skipped.
+			if (m_recording)
+			{
+				if (rFrame.changed)
+				{
+					if (changed)
+					{
+						break;
+					}
+					data(kHeaderVoiceActive) = rFrame.voiceActive;
+					data(kHeaderVoiceActivityTime) = std::to_string(rFrame.changeTime);
+					m_voiceActive = rFrame.voiceActive;
+					changed = true;
+				}
+				m_maxLevel = std::max(m_maxLevel, rFrame.levelDecibels);
+				m_hasLevel = true;
+			}
+			++read;
+		}
+		m_queueRead.store(read, std::memory_order_release);
+
+		const u32 droppedFrames = m_droppedFrames.exchange(0, std::memory_order_relaxed);
+		if (droppedFrames > 0)
+		{
+			RV_DEBUG_PRINTF("[PluginVoiceActivity] The update fell behind, %u frames of the recording were not analysed!", droppedFrames);
+		}
+
+		// The loudest level since the last record is written in the configured interval and with each change.
+		m_timeSinceLevel += fDeltaTime;
+		if (m_levelInterval > 0.0f && m_hasLevel && (changed || m_timeSinceLevel >= m_levelInterval))
+		{
+			data(kHeaderVoiceLevel) = std::to_string(m_maxLevel);
+			m_maxLevel = -std::numeric_limits<f32>::infinity();
+			m_hasLevel = false;
+			m_timeSinceLevel = 0.0f;
+		}
+	}
+
+} // namespace Experiment
+} // namespace rv
+
+#endif // ENABLE_EXPERIMENT
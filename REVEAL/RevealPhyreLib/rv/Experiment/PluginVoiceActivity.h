@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <AudioFile/AudioFile.h>
+
+#include "rv/RevealConfig.h"
+#include "rv/Events/Events.h"
+#include "rv/GamePlay/RevealEvents.h"
+#include "rv/Json/JsonDecl.h"
+#include "rv/Json/JsonHelpers.h"
+
+#include "ExperimentPlugin.h"
+
+#ifdef ENABLE_EXPERIMENT
+
+namespace rv
+{
+namespace Experiment
+{
+
+	//! This plug-in records whether the participant is actually speaking while their voice is recorded.
+	//! The recording is analysed on the audio recording thread, see AudioFile::VoiceActivityDetector.
+	//! The results are handed over to the update through a lock-free queue, so neither thread ever waits for the other.
+	//! Changes are written together with the experiment time at which the voice started or ended,
+	//! which is more precise than the time of the line they are written in.
+	class PluginVoiceActivity : public ExperimentPlugin
+	{
+	public:
+
+		// The unique name used to activate this plug-in in the configuration.
+		static constexpr const char* kPluginName = "voiceActivity";
+
+		PluginVoiceActivity();
+
+		// Configure the plug-in from a JSON object.
+		virtual void configure_from_json(const Json::Value& jsonData) override;
+
+		// Resets the plug-in's data fields and internal variables.
+		// The data fields are set back to their initial values.
+		virtual void reset() override;
+
+		// Return the unique name of the plug-in used as an identifier.
+		virtual Utilities::Name get_name() const override;
+
+		// Analyses the next block of the recording and queues the results for the update.
+		// This is called on the audio recording thread.
+		virtual void process_audio(const short* pSamples, u32 numSamples, u32 sampleRate, f32 fTime) override;
+
+		// Sets the detector up from scratch, so a recording does not start with the noise floor of the previous one.
+		// This is called on the audio recording thread.
+		virtual void begin_audio(u32 sampleRate) override;
+
+	protected:
+
+		// Updates the specific plug-in logic and any plug-in data dependent on it.
+		virtual void update_internal(const f32 fDeltaTime) override;
+
+		// Updates any plug-in data that is dependent on certain events.
+		virtual void handle_event(const Events::Event& evt) override;
+
+	private:
+
+		// The analysis of one frame of the recording, timed in experiment time.
+		struct VoiceFrame
+		{
+			f32 levelDecibels;
+			f32 changeTime;
+			bool voiceActive;
+			bool changed;
+		};
+
+		// A single-producer single-consumer ring of analysed frames, which holds about five seconds.
+		// Each thread only writes its own index, frames are dropped if the update falls that far behind.
+		static constexpr u32 kQueueSize = 512;
+		VoiceFrame m_queue[kQueueSize];
+		std::atomic<u32> m_queueWrite;
+		std::atomic<u32> m_queueRead;
+		std::atomic<u32> m_droppedFrames;
+
+		// These are only used on the audio recording thread.
+		AudioFile::VoiceActivityDetector m_detector;
+		AudioFile::VoiceActivityDetector::Settings m_settings;
+		std::vector<AudioFile::VoiceActivityDetector::Frame> m_frames;
+		u32 m_sampleRate;
+		u64 m_numSamples;
+
+		// These are only used in the update.
+		f32 m_levelInterval;
+		f32 m_timeSinceLevel;
+		f32 m_maxLevel;
+		bool m_hasLevel;
+		bool m_recording;
+		bool m_voiceActive;
+
+	};
+
+} // namespace Experiment
+} // namespace rv
+
+#endif // ENABLE_EXPERIMENT
@@ -0,0 +1,1065 @@
+// Command line tool for working with experiment session output files on a desktop machine.
+// It only depends on RevealLib and is built as a single translation unit with RevealLib in the include path, e.g.:
+//   cl /EHsc /O2 /I ..\..\RevealLib SessionLogTool.cpp
+//   g++ -std=c++14 -O2 -pthread -I ../../RevealLib SessionLogTool.cpp -o SessionLogTool
+//
+// Commands:
+//   decompress <input.rvz> [output]
+//     Decodes a compressed output file frame by frame. Decoding stops at the first damaged frame,
+//     everything before it is still written. Wave files get their header sizes patched afterwards.
+//   decode <input.rvl[.rvz]> [output]
+//     Converts a binary log, which may also be compressed, into the tab separated text the experiment would have written.
+//     Logs in the long format are widened again, rows after a damaged or incomplete record are skipped.
+//   tidy <input.rvl[.rvz]> [output]
+//     Writes the values of a binary log in the tidy long format: one line per set value with participant, time, column and value.
+//   index <output file>
+//     Lists the entries of the session index (.rvi) that belongs to an output file.
+//   seek <output file> <seconds|marker> [durationSeconds]
+//     Prints the rows of an output file starting at the given time (for ten seconds by default),
+//     or the rows of the activity named by the given marker. Only the part of the file the index points at is decoded.
+//   bench <file> [blockSizeKiB]
+//     Compresses any file in blocks of the given size (64 KiB by default) and reports the compression ratio
+//     as well as the time needed to compress and decompress one block.
+//   pcmbench <seconds> [channels]
+//     Converts the given length of synthetic 48 kHz audio between 8, 16 and 24 bit wave data and float samples,
+//     once with the bulk conversion of AudioFile and once sample by sample like AudioFile used to, and compares the throughput.
+//   resample <input.wav|aiff> <sampleRate> [output]
+//     Resamples an audio recording to the given rate and writes it as a 16 bit wave file, e.g. for speech analysis.
+//     The delay of the filter is compensated to the nearest output frame, so the output starts at the same time as the input.
+//   flac <input.wav|flac> [output]
+//     Encodes a wave file losslessly as FLAC, or decodes a FLAC file back into the wave file it was made from,
+//     e.g. for recordings of older sessions or tools that do not read FLAC.
+//   clip <input.wav> <startSeconds> <endSeconds> [output]
+//     Copies the samples that start within [startSeconds, endSeconds) into a new wave file, e.g. the activity between two markers.
+//     The clip is taken straight from the mapped input, so the rest of a long recording is never read.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <AudioFile/AudioFile.cpp>
+#include <SessionLog/AsyncOutputFile.cpp>
+#include <SessionLog/BinaryLog.cpp>
+#include <SessionLog/BlockCodec.cpp>
+#include <SessionLog/OutputFile.cpp>
+#include <SessionLog/SessionIndex.cpp>
+#include <SessionLog/SessionJournal.cpp>
+
+namespace
+{
+
+	int print_usage()
+	{
+		std::printf("Usage:\n");
+		std::printf("  SessionLogTool decompress <input.rvz> [output]\n");
+		std::printf("  SessionLogTool decode <input.rvl[.rvz]> [output]\n");
+		std::printf("  SessionLogTool tidy <input.rvl[.rvz]> [output]\n");
+		std::printf("  SessionLogTool index <output file>\n");
+		std::printf("  SessionLogTool seek <output file> <seconds|marker> [durationSeconds]\n");
+		std::printf("  SessionLogTool bench <file> [blockSizeKiB]\n");
+		std::printf("  SessionLogTool pcmbench <seconds> [channels]\n");
+		std::printf("  SessionLogTool resample <input.wav|aiff> <sampleRate> [output]\n");
+		std::printf("  SessionLogTool flac <input.wav|flac> [output]\n");
+		std::printf("  SessionLogTool clip <input.wav> <startSeconds> <endSeconds> [output]\n");
+		return 1;
+	}
+
+	bool read_file(const char* pPath, std::vector<uint8_t>& rData)
+	{
+		std::ifstream file(pPath, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+		{
+			std::printf("Could not open %s!\n", pPath);
+			return false;
+		}
+		file.seekg(0, std::ios::end);
+		rData.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0, std::ios::beg);
+		file.read(reinterpret_cast<char*>(rData.data()), rData.size());
+		return true;
+	}
+
+	// Replaces the given extension of a path, or appends the replacement if the path does not end with it.
+	std::string replace_extension(const char* pPath, const char* pExtension, const char* pReplacement)
+	{
+		std::string path(pPath);
+		const std::string extension(pExtension);
+		if (path.size() > extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+		{
+			path.resize(path.size() - extension.size());
+		}
+		return path + pReplacement;
+	}
+
+	// Reads a whole file and decodes it if it consists of compressed frames.
+	bool load_log(const char* pPath, std::vector<uint8_t>& rData)
+	{
+		if (!read_file(pPath, rData))
+		{
+			return false;
+		}
+		if (rData.size() >= 4 && rData[0] == 'R' && rData[1] == 'V' && rData[2] == 'Z' && rData[3] == 'B')
+		{
+			std::istringstream input(std::string(rData.begin(), rData.end()));
+			std::vector<uint8_t> decoded;
+			while (SessionLog::decode_frame(input, decoded))
+			{
+			}
+			rData.swap(decoded);
+		}
+		return true;
+	}
+
+	int decompress(const char* pInputPath, std::string outputPath)
+	{
+		if (outputPath.empty())
+		{
+			// Strip the extension of compressed files by default.
+			outputPath = replace_extension(pInputPath, SessionLog::kCompressedFileExtension, "");
+			if (outputPath == pInputPath)
+			{
+				outputPath += ".out";
+			}
+		}
+
+		std::ifstream input(pInputPath, std::ios::in | std::ios::binary);
+		if (!input.is_open())
+		{
+			std::printf("Could not open %s!\n", pInputPath);
+			return 1;
+		}
+		std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open())
+		{
+			std::printf("Could not create %s!\n", outputPath.c_str());
+			return 1;
+		}
+
+		std::vector<uint8_t> block;
+		size_t frameCount = 0;
+		uint64_t rawSize = 0;
+		bool isWave = false;
+		bool isFlac = false;
+		while (SessionLog::decode_frame(input, block))
+		{
+			if (frameCount == 0)
+			{
+				isWave = block.size() >= 4 && std::memcmp(block.data(), "RIFF", 4) == 0;
+				isFlac = block.size() >= 4 && std::memcmp(block.data(), "fLaC", 4) == 0;
+			}
+			output.write(reinterpret_cast<const char*>(block.data()), block.size());
+			rawSize += block.size();
+			block.clear();
+			++frameCount;
+		}
+		const bool isComplete = input.peek() == std::char_traits<char>::eof();
+		output.close();
+
+		if (isWave)
+		{
+			AudioFile::WaveStream::finalise(outputPath);
+		}
+		else if (isFlac)
+		{
+			AudioFile::FlacStream::finalise(outputPath);
+		}
+		std::printf("Decoded %zu frames (%llu bytes) into %s.\n", frameCount, static_cast<unsigned long long>(rawSize), outputPath.c_str());
+		if (!isComplete)
+		{
+			std::printf("Warning: Decoding stopped at a damaged or truncated frame, the rest of the input was skipped!\n");
+			return 2;
+		}
+		return 0;
+	}
+
+	// Opens a binary log for reading and the text file it is converted into.
+	bool open_conversion(const char* pInputPath, std::string& rOutputPath, const char* pOutputExtension, std::vector<uint8_t>& rData, std::ofstream& rOutput)
+	{
+		if (rOutputPath.empty())
+		{
+			rOutputPath = replace_extension(replace_extension(pInputPath, SessionLog::kCompressedFileExtension, "").c_str(), SessionLog::kBinaryLogFileExtension, pOutputExtension);
+		}
+		if (!load_log(pInputPath, rData))
+		{
+			return false;
+		}
+		if (!SessionLog::BinaryLogReader(rData.data(), rData.size()).read_header())
+		{
+			std::printf("%s is no binary log!\n", pInputPath);
+			return false;
+		}
+		rOutput.open(rOutputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!rOutput.is_open())
+		{
+			std::printf("Could not create %s!\n", rOutputPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	int finish_conversion(const SessionLog::BinaryLogReader& reader, size_t lineCount, const std::string& outputPath)
+	{
+		std::printf("Wrote %zu lines into %s.\n", lineCount, outputPath.c_str());
+		if (reader.is_truncated())
+		{
+			std::printf("Warning: Decoding stopped at a damaged or incomplete record, the rest of the input was skipped!\n");
+			return 2;
+		}
+		return 0;
+	}
+
+	int decode(const char* pInputPath, std::string outputPath)
+	{
+		std::vector<uint8_t> data;
+		std::ofstream output;
+		if (!open_conversion(pInputPath, outputPath, ".csv", data, output))
+		{
+			return 1;
+		}
+		SessionLog::BinaryLogReader reader(data.data(), data.size());
+		reader.read_header();
+
+		// The output matches the text format of the experiment manager.
+		const char* pSeparator = "\t";
+		size_t rowCount = 0;
+		std::string buffer;
+		char timeString[32];
+		while (reader.next_row())
+		{
+			if (rowCount == 0)
+			{
+				output << "participant" << pSeparator << "elapsedTime";
+				for (auto& column : reader.get_columns())
+				{
+					output << pSeparator << column;
+				}
+				output << "\n";
+			}
+			std::snprintf(timeString, sizeof(timeString), "%.2f", reader.get_row_time());
+			output << reader.get_participant() << pSeparator << timeString;
+			for (auto& cell : reader.get_row())
+			{
+				output << pSeparator << reader.get_cell_string(cell, buffer);
+			}
+			output << "\n";
+			++rowCount;
+		}
+		if (reader.is_aborted())
+		{
+			output << "ABORTED!\n";
+		}
+		return finish_conversion(reader, rowCount, outputPath);
+	}
+
+	int tidy(const char* pInputPath, std::string outputPath)
+	{
+		std::vector<uint8_t> data;
+		std::ofstream output;
+		if (!open_conversion(pInputPath, outputPath, ".tidy.csv", data, output))
+		{
+			return 1;
+		}
+		SessionLog::BinaryLogReader reader(data.data(), data.size());
+		reader.read_header();
+
+		const char* pSeparator = "\t";
+		size_t lineCount = 0;
+		std::string buffer;
+		char timeString[32];
+		output << "participant" << pSeparator << "elapsedTime" << pSeparator << "column" << pSeparator << "value\n";
+		while (reader.next_row())
+		{
+			std::snprintf(timeString, sizeof(timeString), "%.2f", reader.get_row_time());
+			for (auto& change : reader.get_changes())
+			{
+				output << reader.get_participant() << pSeparator << timeString << pSeparator << reader.get_columns()[change.first] << pSeparator << reader.get_cell_string(change.second, buffer) << "\n";
+				++lineCount;
+			}
+		}
+		return finish_conversion(reader, lineCount, outputPath);
+	}
+
+	bool load_index(const char* pInputPath, SessionLog::SessionIndex& rIndex)
+	{
+		const std::string indexPath(SessionLog::get_index_path(pInputPath));
+		if (!rIndex.load_file(indexPath))
+		{
+			std::printf("Could not read the session index %s!\n", indexPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	int list_index(const char* pInputPath)
+	{
+		SessionLog::SessionIndex index;
+		if (!load_index(pInputPath, index))
+		{
+			return 1;
+		}
+		static const char* kEntryTypeNames[] = { "unknown", "time", "marker", "condition" };
+		std::printf("time\ttype\toffset\tsize\tresume\tname\n");
+		for (auto& entry : index.get_entries())
+		{
+			const size_t type = static_cast<size_t>(entry.type) < 4 ? static_cast<size_t>(entry.type) : 0;
+			std::printf("%.2f\t%s\t%llu\t%llu\t%llu\t%s\n", entry.time, kEntryTypeNames[type], static_cast<unsigned long long>(entry.offset),
+				static_cast<unsigned long long>(entry.size), static_cast<unsigned long long>(entry.resumeOffset), entry.name.c_str());
+		}
+		std::printf("%zu entries.\n", index.get_entries().size());
+		// Definitions and frames are only needed for seeking, so they are just counted.
+		std::printf("%zu definitions, %zu frames.\n", index.get_definitions().size(), index.get_frames().size());
+		return 0;
+	}
+
+	// Reads parts of an output file by the offsets of its decoded data, which are the offsets of a session index.
+	// Compressed files are decoded from the frame the index maps an offset to, so only the frames around a part are read.
+	// Indices of older versions have no frame entries, their compressed files are decoded as a whole once instead.
+	class OutputFileReader
+	{
+	public:
+
+		bool open(const char* pPath, SessionLog::SessionIndex& rIndex)
+		{
+			m_file.open(pPath, std::ios::in | std::ios::binary);
+			if (!m_file.is_open())
+			{
+				std::printf("Could not open %s!\n", pPath);
+				return false;
+			}
+			m_file.seekg(0, std::ios::end);
+			const uint64_t fileLength = static_cast<uint64_t>(m_file.tellg());
+			m_file.seekg(0, std::ios::beg);
+			char magic[4] = {};
+			m_file.read(magic, sizeof(magic));
+			m_file.clear();
+			m_isCompressed = fileLength >= 4 && std::memcmp(magic, "RVZB", 4) == 0;
+			m_pIndex = &rIndex;
+			if (!m_isCompressed)
+			{
+				m_length = fileLength;
+				return true;
+			}
+
+			// Files that were cut off by anything but the recovery might end inside a frame, which is dropped then.
+			m_length = rIndex.limit_frames(fileLength);
+			while (!rIndex.get_frames().empty())
+			{
+				const SessionLog::IndexFrame& lastFrame = rIndex.get_frames().back();
+				m_cache.clear();
+				m_cacheOffset = lastFrame.offset;
+				m_file.clear();
+				m_file.seekg(static_cast<std::streamoff>(lastFrame.fileOffset), std::ios::beg);
+				while (m_cache.size() < lastFrame.size && SessionLog::decode_frame(m_file, m_cache))
+				{
+				}
+				if (m_cache.size() >= lastFrame.size)
+				{
+					break;
+				}
+				m_length = rIndex.limit_frames(lastFrame.fileOffset);
+			}
+			if (rIndex.get_frames().empty() || rIndex.get_frames().front().offset != 0)
+			{
+				m_cache.clear();
+				m_cacheOffset = 0;
+				m_file.clear();
+				m_file.seekg(0, std::ios::beg);
+				while (SessionLog::decode_frame(m_file, m_cache))
+				{
+				}
+				m_length = m_cache.size();
+				m_isCacheWhole = true;
+			}
+			return true;
+		}
+
+		// Returns the length of the decoded data.
+		uint64_t get_length() const { return m_length; }
+
+		// Reads the decoded data in [offset, offset + size), which is cut off at the end of the data.
+		// Returns false if the data could not be read or decoded.
+		bool read(uint64_t offset, uint64_t size, std::vector<uint8_t>& rData)
+		{
+			rData.clear();
+			offset = std::min(offset, m_length);
+			size = std::min(size, m_length - offset);
+			if (size == 0)
+			{
+				return true;
+			}
+			if (!m_isCompressed)
+			{
+				rData.resize(static_cast<size_t>(size));
+				m_file.clear();
+				m_file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+				m_file.read(reinterpret_cast<char*>(rData.data()), rData.size());
+				return static_cast<uint64_t>(m_file.gcount()) == size;
+			}
+
+			// Definitions of a binary log are often read from the same frames, so the frames decoded last are kept.
+			if (!m_isCacheWhole && (offset < m_cacheOffset || offset + size > m_cacheOffset + m_cache.size()))
+			{
+				const SessionLog::IndexFrame* pFrame = m_pIndex->find_frame(offset);
+				if (!pFrame)
+				{
+					return false;
+				}
+				m_cache.clear();
+				m_cacheOffset = pFrame->offset;
+				m_file.clear();
+				m_file.seekg(static_cast<std::streamoff>(pFrame->fileOffset), std::ios::beg);
+				while (m_cacheOffset + m_cache.size() < offset + size && SessionLog::decode_frame(m_file, m_cache))
+				{
+				}
+				if (m_cacheOffset + m_cache.size() < offset + size)
+				{
+					return false;
+				}
+			}
+			const auto itBegin = m_cache.begin() + static_cast<ptrdiff_t>(offset - m_cacheOffset);
+			rData.assign(itBegin, itBegin + static_cast<ptrdiff_t>(size));
+			return true;
+		}
+
+	private:
+
+		std::ifstream m_file;
+		const SessionLog::SessionIndex* m_pIndex = nullptr;
+		bool m_isCompressed = false;
+		uint64_t m_length = 0;
+		std::vector<uint8_t> m_cache;
+		uint64_t m_cacheOffset = 0;
+		bool m_isCacheWhole = false;
+	};
+
+	int seek(const char* pInputPath, const char* pTarget, float duration)
+	{
+		SessionLog::SessionIndex index;
+		OutputFileReader file;
+		if (!load_index(pInputPath, index) || !file.open(pInputPath, index))
+		{
+			return 1;
+		}
+		// The output file might have been cut off by a crash, while its index was not.
+		index.limit(file.get_length());
+
+		// Find the byte range to print, either starting at a time or as the activity named by a marker.
+		char* pNumberEnd;
+		const float startTime = std::strtof(pTarget, &pNumberEnd);
+		const bool isTime = pNumberEnd != pTarget && *pNumberEnd == '\0';
+		float endTime = std::numeric_limits<float>::infinity();
+		uint64_t begin, end, resume;
+		if (isTime)
+		{
+			const SessionLog::IndexEntry* pEntry = index.find_time(startTime);
+			if (!pEntry)
+			{
+				std::printf("The session index is empty!\n");
+				return 1;
+			}
+			begin = pEntry->offset;
+			resume = pEntry->resumeOffset;
+			endTime = startTime + duration;
+			// The first entry after the end time ends the range, rows after it are not needed.
+			const SessionLog::IndexEntry* pEndEntry = index.find_time(endTime);
+			const auto& entries = index.get_entries();
+			const size_t endIndex = static_cast<size_t>(pEndEntry - entries.data()) + 1;
+			end = endIndex < entries.size() ? entries[endIndex].offset + entries[endIndex].size : file.get_length();
+		}
+		else
+		{
+			const SessionLog::IndexEntry* pMarker = index.find_marker(pTarget);
+			if (!pMarker)
+			{
+				std::printf("There is no marker named %s!\n", pTarget);
+				return 1;
+			}
+			index.get_marker_segment(*pMarker, begin, end, resume);
+		}
+
+		const char* pSeparator = "\t";
+		size_t rowCount = 0;
+		std::vector<uint8_t> data;
+		file.read(0, 4, data);
+		const bool isBinary = data.size() >= 4 && data[0] == 'R' && data[1] == 'V' && data[2] == '1' && data[3] == 'L';
+		if (isBinary)
+		{
+			// Binary logs are decoded from the resume offset on, rows before the range only restore persistent values.
+			// The definitions before it are read from where the index points, older indices need everything before the resume offset.
+			SessionLog::BinaryLogReader reader(nullptr, 0);
+			bool isValid = true;
+			if (index.has_definitions())
+			{
+				for (auto& definition : index.get_definitions())
+				{
+					if (definition.offset >= resume)
+					{
+						break;
+					}
+					isValid = isValid && file.read(definition.offset, definition.size, data) && reader.read_definitions(data.data(), data.size());
+				}
+				isValid = isValid && file.read(resume, end - resume, data);
+				reader.resume(data.data(), data.size(), static_cast<size_t>(resume));
+			}
+			else
+			{
+				isValid = file.read(0, end, data);
+				reader.resume(data.data(), data.size(), 0);
+				isValid = isValid && reader.read_header() && reader.seek(static_cast<size_t>(resume));
+			}
+			if (!isValid)
+			{
+				std::printf("Could not seek to offset %llu!\n", static_cast<unsigned long long>(resume));
+				return 1;
+			}
+			std::string buffer;
+			while (reader.next_row() && reader.get_row_offset() < end && reader.get_row_time() < endTime)
+			{
+				if (reader.get_row_offset() < begin || reader.get_row_time() < (isTime ? startTime : 0.0f))
+				{
+					continue;
+				}
+				if (rowCount == 0)
+				{
+					// The columns might only be known after reading the first records.
+					std::printf("participant%selapsedTime", pSeparator);
+					for (auto& column : reader.get_columns())
+					{
+						std::printf("%s%s", pSeparator, column.c_str());
+					}
+					std::printf("\n");
+				}
+				std::printf("%u%s%.2f", reader.get_participant(), pSeparator, reader.get_row_time());
+				for (auto& cell : reader.get_row())
+				{
+					std::printf("%s%s", pSeparator, reader.get_cell_string(cell, buffer).c_str());
+				}
+				std::printf("\n");
+				++rowCount;
+			}
+		}
+		else
+		{
+			// Text rows stand on their own, only the header line is needed in addition.
+			// It is read in growing parts, as its length is not known.
+			const char* pHeaderEnd = nullptr;
+			for (uint64_t headerSize = 4096; !pHeaderEnd; headerSize *= 2)
+			{
+				file.read(0, headerSize, data);
+				pHeaderEnd = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+				if (!pHeaderEnd && data.size() < headerSize)
+				{
+					std::printf("%s has no header line!\n", pInputPath);
+					return 1;
+				}
+			}
+			const uint64_t headerLength = static_cast<uint64_t>(pHeaderEnd - reinterpret_cast<const char*>(data.data())) + 1;
+			std::fwrite(data.data(), 1, static_cast<size_t>(headerLength), stdout);
+
+			begin = std::max(begin, headerLength);
+			if (begin < end && !file.read(begin, end - begin, data))
+			{
+				std::printf("Could not read offset %llu!\n", static_cast<unsigned long long>(begin));
+				return 1;
+			}
+			const char* pLine = reinterpret_cast<const char*>(data.data());
+			const char* pEnd = pLine + (begin < end ? data.size() : 0);
+			while (pLine < pEnd)
+			{
+				const char* pLineEnd = static_cast<const char*>(std::memchr(pLine, '\n', pEnd - pLine));
+				pLineEnd = pLineEnd ? pLineEnd + 1 : pEnd;
+				// The elapsed time is the second column.
+				const char* pTime = static_cast<const char*>(std::memchr(pLine, '\t', pLineEnd - pLine));
+				const float rowTime = pTime ? std::strtof(pTime + 1, nullptr) : endTime;
+				if (rowTime >= endTime)
+				{
+					break;
+				}
+				if (!isTime || rowTime >= startTime)
+				{
+					std::fwrite(pLine, 1, pLineEnd - pLine, stdout);
+					++rowCount;
+				}
+				pLine = pLineEnd;
+			}
+		}
+		std::printf("%zu rows.\n", rowCount);
+		return 0;
+	}
+
+	int bench(const char* pInputPath, size_t blockSize)
+	{
+		std::vector<uint8_t> data;
+		if (!read_file(pInputPath, data))
+		{
+			return 1;
+		}
+		if (data.empty() || blockSize == 0)
+		{
+			std::printf("Nothing to compress.\n");
+			return 1;
+		}
+
+		using Clock = std::chrono::high_resolution_clock;
+		std::vector<uint8_t> compressed(SessionLog::compress_bound(blockSize));
+		std::vector<uint8_t> decompressed(blockSize);
+		size_t blockCount = 0;
+		uint64_t compressedSize = 0;
+		double compressSeconds = 0.0;
+		double decompressSeconds = 0.0;
+		for (size_t offset = 0; offset < data.size(); offset += blockSize)
+		{
+			const size_t size = std::min(blockSize, data.size() - offset);
+
+			auto start = Clock::now();
+			size_t storedSize = SessionLog::compress_block(data.data() + offset, size, compressed.data(), compressed.size());
+			compressSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+			start = Clock::now();
+			const bool isValid = SessionLog::decompress_block(compressed.data(), storedSize, decompressed.data(), size);
+			decompressSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+			if (!isValid || std::memcmp(decompressed.data(), data.data() + offset, size) != 0)
+			{
+				std::printf("Error: Block %zu did not survive the round trip!\n", blockCount);
+				return 1;
+			}
+
+			// Frames store incompressible blocks as they are, so the same is done here.
+			compressedSize += SessionLog::kFrameHeaderSize + std::min(storedSize, size);
+			++blockCount;
+		}
+
+		const double megabytes = data.size() / (1024.0 * 1024.0);
+		std::printf("Input:        %s (%zu bytes, %zu blocks of %zu bytes)\n", pInputPath, data.size(), blockCount, blockSize);
+		std::printf("Output:       %llu bytes including frame headers\n", static_cast<unsigned long long>(compressedSize));
+		std::printf("Ratio:        %.2f : 1\n", static_cast<double>(data.size()) / compressedSize);
+		std::printf("Compress:     %.1f us per block, %.1f MiB/s\n", compressSeconds * 1e6 / blockCount, megabytes / compressSeconds);
+		std::printf("Decompress:   %.1f us per block, %.1f MiB/s\n", decompressSeconds * 1e6 / blockCount, megabytes / decompressSeconds);
+		return 0;
+	}
+
+	// Decodes wave data the way AudioFile did before it converted in bulk: one branch and one push_back per sample.
+	void decode_per_sample(const std::vector<uint8_t>& data, int bitDepth, int numChannels, std::vector<std::vector<float>>& rSamples)
+	{
+		const int numBytesPerSample = bitDepth / 8;
+		const size_t numFrames = data.size() / (numBytesPerSample * numChannels);
+		rSamples.assign(numChannels, std::vector<float>());
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				const size_t sampleIndex = (i * numChannels + channel) * numBytesPerSample;
+				if (bitDepth == 8)
+				{
+					rSamples[channel].push_back(static_cast<float>(static_cast<int32_t>(data[sampleIndex]) - 128) / 128.f);
+				}
+				else if (bitDepth == 16)
+				{
+					const int16_t sampleAsInt = static_cast<int16_t>((data[sampleIndex + 1] << 8) | data[sampleIndex]);
+					rSamples[channel].push_back(static_cast<float>(sampleAsInt) / 32768.f);
+				}
+				else
+				{
+					int32_t sampleAsInt = (data[sampleIndex + 2] << 16) | (data[sampleIndex + 1] << 8) | data[sampleIndex];
+					if (sampleAsInt & 0x800000)
+					{
+						sampleAsInt = sampleAsInt | ~0xFFFFFF;
+					}
+					rSamples[channel].push_back(static_cast<float>(sampleAsInt) / 8388608.f);
+				}
+			}
+		}
+	}
+
+	// Encodes wave data the way AudioFile did before it converted in bulk.
+	void encode_per_sample(const std::vector<std::vector<float>>& samples, int bitDepth, std::vector<uint8_t>& rData)
+	{
+		rData.clear();
+		const size_t numFrames = samples[0].size();
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			for (size_t channel = 0; channel < samples.size(); channel++)
+			{
+				const float sample = samples[channel][i];
+				if (bitDepth == 8)
+				{
+					rData.push_back(static_cast<uint8_t>(static_cast<int32_t>((sample * 128.f) + 128.)));
+				}
+				else if (bitDepth == 16)
+				{
+					const int16_t sampleAsInt = static_cast<int16_t>(sample * 32768.f);
+					rData.push_back(static_cast<uint8_t>(sampleAsInt & 0xFF));
+					rData.push_back(static_cast<uint8_t>((sampleAsInt >> 8) & 0xFF));
+				}
+				else
+				{
+					const int32_t sampleAsInt = static_cast<int32_t>(sample * 8388608.f);
+					rData.push_back(static_cast<uint8_t>(sampleAsInt & 0xFF));
+					rData.push_back(static_cast<uint8_t>((sampleAsInt >> 8) & 0xFF));
+					rData.push_back(static_cast<uint8_t>((sampleAsInt >> 16) & 0xFF));
+				}
+			}
+		}
+	}
+
+	int pcm_bench(double seconds, int numChannels)
+	{
+		if (seconds <= 0.0 || numChannels < 1 || numChannels > 8)
+		{
+			std::printf("Please use a positive length and one to eight channels.\n");
+			return 1;
+		}
+
+		// A few overlapping tones with some noise, kept within [-1, 1) where both conversions are defined to be equal.
+		const size_t numFrames = static_cast<size_t>(seconds * 48000.0);
+		std::vector<std::vector<float>> input(numChannels, std::vector<float>(numFrames));
+		uint32_t noise = 12345;
+		for (int channel = 0; channel < numChannels; channel++)
+		{
+			for (size_t i = 0; i < numFrames; i++)
+			{
+				noise = noise * 1664525u + 1013904223u;
+				const float tone = 0.5f * std::sin(i * 0.0131f * (channel + 1)) + 0.3f * std::sin(i * 0.00173f);
+				input[channel][i] = tone + static_cast<float>(noise >> 8) / 16777216.0f * 0.3f - 0.15f;
+			}
+		}
+
+		using Clock = std::chrono::high_resolution_clock;
+		std::printf("%.0f seconds of %d channel audio, %zu frames\n", seconds, numChannels, numFrames);
+		std::printf("Bits  Direction  Per sample (MiB/s)  Bulk (MiB/s)  Speed-up\n");
+		bool allEqual = true;
+		for (int bitDepth : { 8, 16, 24 })
+		{
+			const size_t dataSize = numFrames * numChannels * (bitDepth / 8);
+			const double megabytes = dataSize / (1024.0 * 1024.0);
+
+			// Encoding
+			std::vector<uint8_t> referenceData;
+			auto start = Clock::now();
+			encode_per_sample(input, bitDepth, referenceData);
+			const double referenceEncodeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			std::vector<const float*> inputChannels;
+			for (auto& channel : input)
+			{
+				inputChannels.push_back(channel.data());
+			}
+			start = Clock::now();
+			std::vector<uint8_t> data(dataSize);
+			AudioFile::PcmConversion::encode(inputChannels.data(), numChannels, numFrames, AudioFile::AudioFileFormat::Wave, bitDepth, data.data());
+			const double bulkEncodeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+			const bool encodedEqual = data == referenceData;
+
+			// Decoding
+			std::vector<std::vector<float>> referenceSamples;
+			start = Clock::now();
+			decode_per_sample(data, bitDepth, numChannels, referenceSamples);
+			const double referenceDecodeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			start = Clock::now();
+			std::vector<std::vector<float>> samples(numChannels, std::vector<float>(numFrames));
+			std::vector<float*> outputChannels;
+			for (auto& channel : samples)
+			{
+				outputChannels.push_back(channel.data());
+			}
+			AudioFile::PcmConversion::decode(data.data(), AudioFile::AudioFileFormat::Wave, bitDepth, numChannels, numFrames, outputChannels.data());
+			const double bulkDecodeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+			const bool decodedEqual = samples == referenceSamples;
+
+			std::printf("%4d  encode     %18.1f  %12.1f  %7.1fx%s\n", bitDepth, megabytes / referenceEncodeSeconds, megabytes / bulkEncodeSeconds, referenceEncodeSeconds / bulkEncodeSeconds, encodedEqual ? "" : "  (results differ!)");
+			std::printf("%4d  decode     %18.1f  %12.1f  %7.1fx%s\n", bitDepth, megabytes / referenceDecodeSeconds, megabytes / bulkDecodeSeconds, referenceDecodeSeconds / bulkDecodeSeconds, decodedEqual ? "" : "  (results differ!)");
+			allEqual &= encodedEqual && decodedEqual;
+		}
+		return allEqual ? 0 : 1;
+	}
+
+	int resample(const char* pInputPath, uint32_t sampleRate, std::string outputPath)
+	{
+		AudioFile::AudioFileReader reader;
+		if (!reader.open(pInputPath))
+		{
+			std::printf("Could not open %s as an audio file!\n", pInputPath);
+			return 1;
+		}
+		const int numChannels = reader.getNumChannels();
+		AudioFile::Resampler resampler;
+		if (!resampler.setup(reader.getSampleRate(), sampleRate, numChannels))
+		{
+			std::printf("%u Hz can not be resampled to %u Hz!\n", reader.getSampleRate(), sampleRate);
+			return 1;
+		}
+		if (outputPath.empty())
+		{
+			outputPath = replace_extension(pInputPath, ".wav", "") + "_" + std::to_string(sampleRate) + "Hz.wav";
+		}
+		std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open())
+		{
+			std::printf("Could not open %s!\n", outputPath.c_str());
+			return 1;
+		}
+		std::vector<uint8_t> data;
+		AudioFile::WaveStream::createHeader(data, numChannels, sampleRate, 16);
+		output.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+		// The input is padded with silence until the delayed end of the recording came out of the filter.
+		static const size_t kBlockFrames = 4096;
+		const uint64_t numOutputFrames = reader.getNumSamplesPerChannel() * sampleRate / reader.getSampleRate();
+		uint64_t framesToSkip = static_cast<uint64_t>(resampler.getLatency() + 0.5);
+		uint64_t framesWritten = 0;
+		std::vector<std::vector<float>> input(numChannels, std::vector<float>(kBlockFrames));
+		std::vector<std::vector<float>> resampled(numChannels, std::vector<float>(resampler.getMaxOutputFrames(kBlockFrames)));
+		std::vector<float*> inputChannels;
+		std::vector<float*> resampledChannels;
+		for (int channel = 0; channel < numChannels; channel++)
+		{
+			inputChannels.push_back(input[channel].data());
+			resampledChannels.push_back(resampled[channel].data());
+		}
+		while (framesWritten < numOutputFrames)
+		{
+			const size_t framesRead = reader.read(inputChannels.data(), kBlockFrames);
+			for (auto& channel : input)
+			{
+				std::fill(channel.begin() + framesRead, channel.end(), 0.0f);
+			}
+			const size_t framesOut = resampler.process(inputChannels.data(), kBlockFrames, resampledChannels.data());
+			const size_t skipped = static_cast<size_t>(std::min<uint64_t>(framesToSkip, framesOut));
+			const size_t framesKept = static_cast<size_t>(std::min<uint64_t>(framesOut - skipped, numOutputFrames - framesWritten));
+			framesToSkip -= skipped;
+			std::vector<const float*> keptChannels;
+			for (auto& channel : resampled)
+			{
+				keptChannels.push_back(channel.data() + skipped);
+			}
+			data.resize(framesKept * numChannels * sizeof(int16_t));
+			AudioFile::PcmConversion::encode(keptChannels.data(), numChannels, framesKept, AudioFile::AudioFileFormat::Wave, 16, data.data());
+			output.write(reinterpret_cast<const char*>(data.data()), data.size());
+			framesWritten += framesKept;
+		}
+		output.close();
+		AudioFile::WaveStream::finalise(outputPath);
+		std::printf("Resampled %llu frames at %u Hz to %llu frames at %u Hz in %s\n", static_cast<unsigned long long>(reader.getNumSamplesPerChannel()), reader.getSampleRate(),
+			static_cast<unsigned long long>(framesWritten), sampleRate, outputPath.c_str());
+		return 0;
+	}
+
+	int encode_flac(const char* pInputPath, std::string outputPath)
+	{
+		AudioFile::AudioFileView view;
+		if (!view.open(pInputPath))
+		{
+			std::printf("Could not open %s as a wave file!\n", pInputPath);
+			return 1;
+		}
+		AudioFile::FlacEncoder encoder;
+		if (!encoder.setup(view.getNumChannels(), view.getSampleRate(), view.getBitDepth()))
+		{
+			std::printf("%d channels of %d bit samples can not be encoded as FLAC!\n", view.getNumChannels(), view.getBitDepth());
+			return 1;
+		}
+		if (outputPath.empty())
+		{
+			outputPath = replace_extension(pInputPath, ".wav", ".flac");
+		}
+
+		using Clock = std::chrono::high_resolution_clock;
+		const auto start = Clock::now();
+		std::vector<uint8_t> frames;
+		encoder.process(view.getData().data, static_cast<size_t>(view.getNumSamplesPerChannel()), frames);
+		encoder.flush(frames);
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		// The header is created after all frames, so it is complete and the file does not need to be finalised.
+		std::vector<uint8_t> header;
+		encoder.createHeader(header);
+		std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open())
+		{
+			std::printf("Could not open %s!\n", outputPath.c_str());
+			return 1;
+		}
+		output.write(reinterpret_cast<const char*>(header.data()), header.size());
+		output.write(reinterpret_cast<const char*>(frames.data()), frames.size());
+		output.close();
+
+		const size_t inputSize = view.getData().size;
+		const size_t outputSize = header.size() + frames.size();
+		std::printf("Encoded %.1f seconds of audio in %.3f seconds (%.0fx realtime) into %s.\n", view.getLengthInSeconds(), seconds, view.getLengthInSeconds() / seconds, outputPath.c_str());
+		std::printf("%zu bytes of samples -> %zu bytes (%.1f%%)\n", inputSize, outputSize, inputSize > 0 ? 100.0 * outputSize / inputSize : 0.0);
+		return 0;
+	}
+
+	int decode_flac(const std::vector<uint8_t>& data, const char* pInputPath, std::string outputPath)
+	{
+		AudioFile::FlacDecoder decoder;
+		if (!decoder.open(data.data(), data.size()))
+		{
+			std::printf("%s is not a supported FLAC file!\n", pInputPath);
+			return 1;
+		}
+		if (outputPath.empty())
+		{
+			outputPath = replace_extension(pInputPath, ".flac", ".wav");
+		}
+		std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open())
+		{
+			std::printf("Could not open %s!\n", outputPath.c_str());
+			return 1;
+		}
+		const int numChannels = decoder.getNumChannels();
+		const int bitDepth = decoder.getBitDepth();
+		const int bytesPerSample = bitDepth / 8;
+		std::vector<uint8_t> pcm;
+		AudioFile::WaveStream::createHeader(pcm, numChannels, decoder.getSampleRate(), bitDepth);
+		output.write(reinterpret_cast<const char*>(pcm.data()), pcm.size());
+
+		// Frames are interleaved into the sample format of wave files, 8 bit samples are stored unsigned there.
+		uint64_t numFrames = 0;
+		while (const int numSamples = decoder.readFrame())
+		{
+			pcm.resize(static_cast<size_t>(numSamples) * numChannels * bytesPerSample);
+			uint8_t* pOut = pcm.data();
+			for (int i = 0; i < numSamples; i++)
+			{
+				for (int channel = 0; channel < numChannels; channel++)
+				{
+					const int32_t sample = decoder.getFrameSamples(channel)[i] + (bitDepth == 8 ? 128 : 0);
+					for (int b = 0; b < bytesPerSample; b++)
+					{
+						*pOut++ = static_cast<uint8_t>(sample >> (8 * b));
+					}
+				}
+			}
+			output.write(reinterpret_cast<const char*>(pcm.data()), pcm.size());
+			numFrames += numSamples;
+		}
+		output.close();
+		AudioFile::WaveStream::finalise(outputPath);
+
+		std::printf("Decoded %llu frames into %s.\n", static_cast<unsigned long long>(numFrames), outputPath.c_str());
+		if (decoder.getPosition() < data.size())
+		{
+			std::printf("The file is damaged after byte %zu, the rest was skipped.\n", decoder.getPosition());
+			return 1;
+		}
+		return 0;
+	}
+
+	int flac(const char* pInputPath, std::string outputPath)
+	{
+		std::vector<uint8_t> data(4);
+		{
+			std::ifstream input(pInputPath, std::ios::in | std::ios::binary);
+			input.read(reinterpret_cast<char*>(data.data()), data.size());
+		}
+		if (std::memcmp(data.data(), "fLaC", 4) != 0)
+		{
+			return encode_flac(pInputPath, outputPath);
+		}
+		if (!read_file(pInputPath, data))
+		{
+			return 1;
+		}
+		return decode_flac(data, pInputPath, outputPath);
+	}
+
+	int clip(const char* pInputPath, double startSeconds, double endSeconds, std::string outputPath)
+	{
+		AudioFile::AudioFileView view;
+		if (!view.open(pInputPath))
+		{
+			std::printf("Could not open %s as a wave file!\n", pInputPath);
+			return 1;
+		}
+		if (outputPath.empty())
+		{
+			char suffix[64];
+			std::snprintf(suffix, sizeof(suffix), "_%.3f-%.3f.wav", startSeconds, endSeconds);
+			outputPath = replace_extension(pInputPath, ".wav", suffix);
+		}
+
+		// The clip is copied straight out of the mapped file, nothing before or after it is read.
+		const AudioFile::SampleSpan<uint8_t> samples = view.getSlice(startSeconds, endSeconds);
+		const uint64_t firstSample = view.getSampleIndex(startSeconds);
+		std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open())
+		{
+			std::printf("Could not open %s!\n", outputPath.c_str());
+			return 1;
+		}
+		std::vector<uint8_t> header;
+		AudioFile::WaveStream::createHeader(header, view.getNumChannels(), view.getSampleRate(), view.getBitDepth());
+		output.write(reinterpret_cast<const char*>(header.data()), header.size());
+		output.write(reinterpret_cast<const char*>(samples.data), samples.size);
+		output.close();
+		AudioFile::WaveStream::finalise(outputPath);
+
+		const uint64_t numSamples = samples.size / (view.getNumChannels() * (view.getBitDepth() / 8));
+		std::printf("Wrote samples %llu to %llu (%.3f seconds) into %s.\n", static_cast<unsigned long long>(firstSample),
+			static_cast<unsigned long long>(firstSample + numSamples), static_cast<double>(numSamples) / view.getSampleRate(), outputPath.c_str());
+		return 0;
+	}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		return print_usage();
+	}
+	const std::string command(argv[1]);
+	if (command == "decompress")
+	{
+		return decompress(argv[2], argc > 3 ? argv[3] : "");
+	}
+	if (command == "decode")
+	{
+		return decode(argv[2], argc > 3 ? argv[3] : "");
+	}
+	if (command == "tidy")
+	{
+		return tidy(argv[2], argc > 3 ? argv[3] : "");
+	}
+	if (command == "index")
+	{
+		return list_index(argv[2]);
+	}
+	if (command == "seek" && argc > 3)
+	{
+		return seek(argv[2], argv[3], argc > 4 ? std::strtof(argv[4], nullptr) : 10.0f);
+	}
+	if (command == "bench")
+	{
+		const size_t blockSizeKiB = argc > 3 ? static_cast<size_t>(std::strtoul(argv[3], nullptr, 10)) : SessionLog::JournalWriter::kDefaultBlockSize / 1024;
+		return bench(argv[2], blockSizeKiB * 1024);
+	}
+	if (command == "pcmbench")
+	{
+		return pcm_bench(std::strtod(argv[2], nullptr), argc > 3 ? std::atoi(argv[3]) : 1);
+	}
+	if (command == "resample" && argc > 3)
+	{
+		return resample(argv[2], static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)), argc > 4 ? argv[4] : "");
+	}
+	if (command == "flac")
+	{
+		return flac(argv[2], argc > 3 ? argv[3] : "");
+	}
+	if (command == "clip" && argc > 4)
+	{
+		return clip(argv[2], std::strtod(argv[3], nullptr), std::strtod(argv[4], nullptr), argc > 5 ? argv[5] : "");
+	}
+	return print_usage();
+}